@@ -0,0 +1,218 @@
+/*
+ * 파일명 : gen_sicxe.c
+ * 설  명 : 벤치마크용 SIC/XE 소스를 합성하는 생성기이다.
+ *          라인 수, CSECT 수, 심볼/리터럴 밀도, EXTREF fan-out, 4형식 비율을
+ *          지정하여 my_assembler가 그대로 어셈블할 수 있는 프로그램을 만든다.
+ *
+ * 사용법 : gen_sicxe [--lines N] [--csects N] [--symbol-density P]
+ *                    [--literal-density P] [--extref N] [--format4 P] [--seed N]
+ *          결과는 표준 출력으로 나간다.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_CSECTS 9        // 어셈블러의 섹션 번호 한도(MAX_SECTIONS - 1)
+#define REF_WINDOW 200      // 3형식 PC relative 참조가 닿도록 참조 대상을 이 라인 범위 안에서 고른다
+#define LTORG_INTERVAL 128  // 리터럴이 pool과 2047바이트 안에 있도록 주기적으로 LTORG를 넣는다
+#define LITERAL_KINDS 64    // 서로 다른 리터럴 종류 수
+
+static long lines = 10000;
+static int csects = 3;
+static double symbol_density = 0.3;
+static double literal_density = 0.1;
+static int extref_fanout = 2;
+static double format4_ratio = 0.05;
+static unsigned long long rng_state = 20231241;
+
+static const char* mem_ops[] = { "LDA", "STA", "LDX", "STX", "LDT", "COMP", "ADD", "SUB", "STL", "LDCH", "STCH" };
+static const char* jump_ops[] = { "J", "JEQ", "JLT", "JGT" };
+static const char* fmt2_lines[] = { "CLEAR\tX", "CLEAR\tA", "COMPR\tA,S", "TIXR\tT" };
+
+#define COUNT(a) ((int)(sizeof(a) / sizeof((a)[0])))
+
+/* ----------------------------------------------------------------------------------
+ * 설명 : 실행 환경과 무관하게 같은 seed에서 같은 소스가 나오도록 xorshift64*를 사용한다.
+ * ----------------------------------------------------------------------------------
+ */
+static unsigned long long next_rand(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 2685821657736338717ULL;
+}
+
+static int rand_below(int n)
+{
+    return (int)(next_rand() % (unsigned long long)n);
+}
+
+static double rand_unit(void)
+{
+    return (next_rand() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* ----------------------------------------------------------------------------------
+ * 설명 : 한 섹션 안에서 line 근처(REF_WINDOW 이내)의 라벨이 붙은 라인을 골라
+ *        그 라벨 이름을 반환한다. 범위 안에 라벨이 없으면 섹션 첫 라벨을 쓴다.
+ * 매개 : 섹션 라벨 여부 배열, 섹션 라인 수, 섹션 첫 라인 번호, 현재 라인
+ * 반환 : 라벨이 붙은 라인의 전역 번호
+ * ----------------------------------------------------------------------------------
+ */
+static long pick_target(const char* labeled, long count, long base, long line)
+{
+    long lo = line - REF_WINDOW < 0 ? 0 : line - REF_WINDOW;
+    long hi = line + REF_WINDOW >= count ? count - 1 : line + REF_WINDOW;
+    long start = lo + rand_below((int)(hi - lo + 1));
+
+    for (long k = start; k <= hi; k++)
+        if (labeled[k])
+            return base + k;
+    for (long k = start - 1; k >= lo; k--)
+        if (labeled[k])
+            return base + k;
+    return base;
+}
+
+/* pool 번호 pool에서 리터럴 종류 k에 해당하는 리터럴 피연산자를 out에 만든다.
+   어셈블러는 이미 배치된 같은 리터럴을 PC relative 범위 밖에서도 다시 쓰므로 pool마다 다른 이름을 쓰고,
+   리터럴 이름은 9자까지 저장되므로 (pool, 종류)를 36진수 5자리 C 리터럴로 만든다 */
+static void make_literal(int k, long pool, char* out)
+{
+    static const char digits[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    long id = pool * LITERAL_KINDS + k;
+    char name[6];
+    for (int d = 4; d >= 0; d--, id /= 36)
+        name[d] = digits[id % 36];
+    name[5] = '\0';
+    sprintf(out, "=C'%s'", name);
+}
+
+/* ----------------------------------------------------------------------------------
+ * 설명 : 섹션 하나의 소스를 출력한다.
+ *        첫 섹션은 START, 나머지는 CSECT로 시작하고, 각 섹션은 BUFn을 EXTDEF로
+ *        내보내며 fan-out 만큼 다른 섹션의 이름과 BUFn을 EXTREF로 참조한다.
+ * 매개 : 섹션 번호, 섹션 라인 수, 전역 라벨 번호 시작값
+ * 반환 : 없음
+ * ----------------------------------------------------------------------------------
+ */
+static void emit_section(int sec, long count, long base)
+{
+    char* labeled = malloc(count);
+    if (!labeled) {
+        perror("malloc");
+        exit(1);
+    }
+    for (long k = 0; k < count; k++)
+        labeled[k] = k == 0 || rand_unit() < symbol_density;
+
+    int fanout = extref_fanout < csects - 1 ? extref_fanout : csects - 1;
+    int refs[MAX_CSECTS];
+    for (int k = 0; k < fanout; k++)
+        refs[k] = (sec + 1 + k) % csects;
+
+    if (sec == 0)
+        printf("SEC%d\tSTART\t0\tSYNTHETIC BENCHMARK PROGRAM\n", sec);
+    else
+        printf("SEC%d\tCSECT\n", sec);
+    printf("\tEXTDEF\tBUF%d\n", sec);
+    if (fanout > 0) {
+        printf("\tEXTREF\t");
+        for (int k = 0; k < fanout; k++)
+            printf("%sSEC%d,BUF%d", k ? "," : "", refs[k], refs[k]);
+        printf("\n");
+    }
+
+    char label[16], operand[32];
+    for (long k = 0; k < count; k++) {
+        if (labeled[k])
+            sprintf(label, "L%ld", base + k);
+        else
+            label[0] = '\0';
+
+        double r = rand_unit();
+        if (r < format4_ratio) {
+            if (fanout > 0 && rand_below(2))
+                printf("%s\t+JSUB\tSEC%d\n", label, refs[rand_below(fanout)]);
+            else if (fanout > 0 && rand_below(2))
+                printf("%s\t+LDA\tBUF%d\n", label, refs[rand_below(fanout)]);
+            else
+                printf("%s\t+%s\tL%ld\n", label, mem_ops[rand_below(COUNT(mem_ops))],
+                       pick_target(labeled, count, base, k));
+        }
+        else if (r < format4_ratio + literal_density) {
+            make_literal(rand_below(LITERAL_KINDS), sec * (lines / LTORG_INTERVAL + 1) + k / LTORG_INTERVAL,
+                         operand);
+            printf("%s\t%s\t%s\n", label, rand_below(2) ? "LDA" : "COMP", operand);
+        }
+        else {
+            int kind = rand_below(10);
+            if (kind < 4)
+                printf("%s\t%s\tL%ld\n", label, mem_ops[rand_below(COUNT(mem_ops))],
+                       pick_target(labeled, count, base, k));
+            else if (kind < 6)
+                printf("%s\t%s\tL%ld\n", label, jump_ops[rand_below(COUNT(jump_ops))],
+                       pick_target(labeled, count, base, k));
+            else if (kind < 7)
+                printf("%s\t%s\n", label, fmt2_lines[rand_below(COUNT(fmt2_lines))]);
+            else if (kind < 8)
+                printf("%s\tLDA\t#%d\n", label, rand_below(4096));
+            else {
+                // 토크나이저는 라벨 없는 첫 토큰 WORD/BYTE를 라벨로 읽으므로 데이터 라인엔 항상 라벨을 붙인다
+                if (!label[0])
+                    sprintf(label, "D%ld", base + k);
+                if (kind < 9)
+                    printf("%s\tWORD\t%d\n", label, rand_below(100000));
+                else
+                    printf("%s\tBYTE\tX'%02X'\n", label, rand_below(256));
+            }
+        }
+
+        if ((k + 1) % LTORG_INTERVAL == 0)
+            printf("\tLTORG\n");
+    }
+    printf("BUF%d\tRESB\t64\n", sec);
+    free(labeled);
+}
+
+int main(int args, char* arg[])
+{
+    for (int a = 1; a < args; a++) {
+        if (!strcmp(arg[a], "--lines") && a + 1 < args)
+            lines = atol(arg[++a]);
+        else if (!strcmp(arg[a], "--csects") && a + 1 < args)
+            csects = atoi(arg[++a]);
+        else if (!strcmp(arg[a], "--symbol-density") && a + 1 < args)
+            symbol_density = atof(arg[++a]);
+        else if (!strcmp(arg[a], "--literal-density") && a + 1 < args)
+            literal_density = atof(arg[++a]);
+        else if (!strcmp(arg[a], "--extref") && a + 1 < args)
+            extref_fanout = atoi(arg[++a]);
+        else if (!strcmp(arg[a], "--format4") && a + 1 < args)
+            format4_ratio = atof(arg[++a]);
+        else if (!strcmp(arg[a], "--seed") && a + 1 < args)
+            rng_state = strtoull(arg[++a], NULL, 10) * 2654435761ULL + 1;
+        else {
+            fprintf(stderr, "usage: %s [--lines N] [--csects N] [--symbol-density P] "
+                            "[--literal-density P] [--extref N] [--format4 P] [--seed N]\n", arg[0]);
+            return 1;
+        }
+    }
+    if (csects < 1 || csects > MAX_CSECTS) {
+        fprintf(stderr, "--csects must be between 1 and %d\n", MAX_CSECTS);
+        return 1;
+    }
+    if (lines < csects)
+        lines = csects;
+
+    long base = 0;
+    for (int sec = 0; sec < csects; sec++) {
+        long count = lines / csects + (sec < lines % csects);
+        emit_section(sec, count, base);
+        base += count;
+    }
+    printf("\tEND\tL0\n");
+    return 0;
+}
@@ -0,0 +1,40 @@
+#!/bin/sh
+# 벤치마크 실행 스크립트
+#   gen_sicxe로 규모별 합성 소스를 만들고 세 가지 모드(two-pass, stream, one-pass)로
+#   어셈블하면서 --bench-json 결과(JSON Lines)를 bench_output.txt에 모은다.
+#
+# 사용법 : bench/run_bench.sh [라인 수 ...]
+#   환경 변수 CSECTS, SYMBOL_DENSITY, LITERAL_DENSITY, EXTREF, FORMAT4, SEED,
+#   MAX_LINES, OUT 으로 생성 조건과 출력 경로를 바꿀 수 있다.
+#   어셈블에 실패한 모드가 있으면 FAILED로 표시하고 끝에 0이 아닌 상태로 끝난다.
+set -e
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+WORK=${WORK:-"$ROOT/bench/work"}
+OUT=${OUT:-"$ROOT/bench_output.txt"}
+MAX_LINES=${MAX_LINES:-1100000}
+SIZES=${*:-"1000 10000 100000"}
+
+mkdir -p "$WORK"
+cc -O2 -DMAX_LINES="$MAX_LINES" -DFIX_CHAIN_SIZE="$((MAX_LINES * 2))" -o "$WORK/asm" "$ROOT/my_assembler_20231241.c" -lpthread -lm
+cc -O2 -o "$WORK/gen_sicxe" "$ROOT/bench/gen_sicxe.c"
+cp "$ROOT/inst_table.txt" "$WORK/"
+
+cd "$WORK"
+failed=0
+for n in $SIZES; do
+    ./gen_sicxe --lines "$n" --csects "${CSECTS:-4}" \
+        --symbol-density "${SYMBOL_DENSITY:-0.3}" --literal-density "${LITERAL_DENSITY:-0.1}" \
+        --extref "${EXTREF:-2}" --format4 "${FORMAT4:-0.05}" --seed "${SEED:-1}" > bench.asm
+    for mode in "" --stream --one-pass; do
+        # 실패한 실행은 이전 모드의 total_ms를 보고하지 않도록 FAILED로 표시하고 나머지는 계속 돈다
+        if ./asm $mode -i bench.asm -o bench.obj --symtab bench.sym --littab bench.lit \
+            --listing bench.lst --bench-json "$OUT"; then
+            echo "lines=$n mode=${mode:---two-pass}: $(tail -n 1 "$OUT" | sed 's/.*"total_ms":\([0-9.]*\).*/\1 ms/')"
+        else
+            echo "lines=$n mode=${mode:---two-pass}: FAILED (exit $?)"
+            failed=1
+        fi
+    done
+done
+exit $failed
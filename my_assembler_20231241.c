@@ -17,13 +17,39 @@
 #include <fcntl.h>
 #include <ctype.h>
 #include <strings.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <time.h>
 
 // 파일명의 "00000000"은 자신의 학번으로 변경할 것.
 #include "my_assembler_20231241.h"
 
+#ifdef ASM_STATS
+/* ASM_STATS 빌드에서는 모든 할당을 세기 위해 할당 함수를 감싼다. */
+asm_stats stats;
+
+static void* stat_malloc(size_t n) { stats.allocs++; stats.alloc_bytes += n; return malloc(n); }
+static void* stat_calloc(size_t c, size_t n) { stats.allocs++; stats.alloc_bytes += c * n; return calloc(c, n); }
+static void* stat_realloc(void* p, size_t n) { stats.allocs++; stats.alloc_bytes += n; return realloc(p, n); }
+static char* stat_strdup(const char* s) { stats.allocs++; stats.alloc_bytes += strlen(s) + 1; return strdup(s); }
+
+#define malloc(n) stat_malloc(n)
+#define calloc(c, n) stat_calloc(c, n)
+#define realloc(p, n) stat_realloc(p, n)
+#define strdup(s) stat_strdup(s)
+#endif
+
 // 토큰 파싱 시 라벨, operator, operand 총 3개
 #define MAX_COLUMNS 3
-#define MAX_TEXT_RECORD_LENGTH 30   // Text record 최대 바이트 수
 #define MAX_EXTREF 100
 #define MAX_SECTIONS 10
 
@@ -39,80 +65,484 @@ int label_num = 0;
 token* token_table[MAX_LINES];
 int token_line = 0;
 symbol sym_table[MAX_LINES];
+static int sym_slots[SYM_SLOTS];    // 심볼 이름 해시 (sym_table 인덱스 + 1, 0: 빈 칸)
 symbol literal_table[MAX_LINES];
+static int lit_slots[SYM_SLOTS];    // 리터럴 이름 해시 (literal_table 인덱스 + 1, 0: 빈 칸)
 int locctr = 0;
 int locctr_table[MAX_LINES];
-char* input_file;
-char* output_file;
+char* input_file = "input-1.txt";             // 소스 파일 ("-": stdin)
+char* output_file = "output_objectcode.txt";  // 오브젝트 프로그램 ("-": stdout)
+char* symtab_file = "output_symtab.txt";      // 이하 NULL이면 출력하지 않음
+char* littab_file = "output_littab.txt";
+char* listing_file = "opcode_output.txt";
+char* full_listing_file = NULL;               // --full-listing 출력 (NULL이면 만들지 않음)
+char* symindex_file = NULL;  // --symindex 출력 (NULL이면 만들지 않음)
+char* size_profile_file = NULL;  // --size-profile 출력 (NULL이면 통계를 모으지 않음)
+char* line_map_file = NULL;      // --line-map: 주소 -> 소스 라인 맵 (NULL이면 만들지 않음)
+char* archive_file = NULL;       // --archive: 오브젝트 프로그램의 섹션들을 이 아카이브에 추가
+int async_output = 0;            // --async-output: 출력 파일을 백그라운드 writer 스레드가 쓴다
+static size_profile size_profiles[MAX_SECTIONS + 1];    // pass2 섹션 번호별 통계
+static int size_profile_count = 0;
+int text_record_max = MAX_TEXT_RECORD_LENGTH;   // --text-record-size: T 레코드 최대 바이트 수
+int auto_base = 0;          // --auto-base: BASE가 없는 구간의 BASE를 자동으로 고른다 (두 패스 모드)
+int auto_ltorg = 0;         // --auto-ltorg: 리터럴이 PC relative 범위를 벗어나기 전에 풀을 자동으로 넣는다
+int gc_sections = 0;        // --gc-sections: 진입점에서 닿지 않는 섹션은 패스2에서 버린다
+static char section_live[MAX_SECTIONS+1];   // 섹션 번호별 출력 여부 (mark_live_sections)
+static int last_live_section = 0;           // 출력되는 마지막 섹션 번호
+int binary_object = 0;  // --obj-format binary: 오브젝트 프로그램을 바이너리 형식으로 출력
+int echo_object = 1;    // 오브젝트 프로그램을 화면에도 출력할지 여부
 int literal_count = 0;  // 리터럴 테이블 항목 수
 int literalPoolStart = 0;   // 현재 섹션의 미처리 리터럴 시작 인덱스
+int literalFirstUse = -1;   // 아직 배치되지 않은 리터럴을 처음 참조한 명령어 주소 (-1 = 없음)
+int literalFirstBlock = 0;  // literalFirstUse가 속한 프로그램 블록
+program_block blocks[MAX_SECTIONS+1][MAX_BLOCKS];  // 섹션별 프로그램 블록 (USE)
+int block_count[MAX_SECTIONS+1];
+int current_block = 0;      // 현재 프로그램 블록 번호
+int blocks_used = 0;        // USE가 한 번이라도 나왔는지 (패스1 뒤 블록 배치 필요)
 int current_section = 1;    // 현재 섹션 번호 관리
 int section_length[MAX_SECTIONS];
 char extref_table[MAX_EXTREF][32];
 int extref_count = 0;
 int total_program_end = 0;  // 전제 길이 저장용 전역 변수
-int base = 0;
 int literalPoolStartSec[MAX_SECTIONS+1];    // 섹션마다 리터럴 시작 인덱스 저장
 int literalPoolEndSec[MAX_SECTIONS+1];
 int sectionStartAddr[MAX_SECTIONS+1];
+char section_name[MAX_SECTIONS+1][7];   // 섹션별 H 레코드 이름 (4형식 M 레코드용)
+equ_node equ_nodes[MAX_LINES];  // EQU 의존 그래프 노드
+int equ_count = 0;
+char* bench_file = NULL;    // --bench-json 출력 경로
+char* stats_file = NULL;    // --stats 출력 경로
+char* trace_file = NULL;    // --trace 출력 경로
+phase_record phases[MAX_PHASES];    // 단계별 측정 결과
+int phase_count = 0;
+long source_lines = 0;      // 읽은 소스 라인 수 (처리량 계산용)
+long source_bytes = 0;
+FILE* diag_fp = NULL;  // 진단 메시지 출력 대상 (NULL: stderr)
+char equ_pending[MAX_LINES];    // 심볼 인덱스별: 아직 값이 계산되지 않은 EQU 심볼이면 1
+char equ_absolute[MAX_LINES];   // 심볼 인덱스별: 값이 절대값인 EQU 심볼이면 1 (재배치하지 않는다)
+char* sec_extdef[MAX_SECTIONS+1];   // 스트리밍 모드: 섹션별 EXTDEF 목록
+char* sec_extref[MAX_SECTIONS+1];   // 스트리밍 모드: 섹션별 EXTREF 목록
 
 /* 함수 선언부 */
 int init_my_assembler(void);
 int init_inst_file(char* inst_file);
 int init_input_file(char* input_file_name);
+static int init_input_stream(FILE* fp);
+static void diag(const char* fmt, ...);
 char* trim(char* str);
 void to_upper(char* s);
 int token_parsing(char* str);
+static int tokenize_line(char *str, token* t);
 int search_opcode(char* str);
 int get_instruction_length(char* op);
 static int assem_pass1(void);
+static int layout_program(void);
+static void reset_layout(void);
+static int splice_include(const token* inc, int depth);
+static int add_source_token(token* t, int depth);
+static int find_macro(const char* name);
+static void reset_macros(void);
+static token* alloc_token(void);
+static void free_token(token* t);
+static void free_inst_table(void);
+static int pass1_token(token* t, int line);
+static int token_size(token* t);
+static int add_equ_node(int sym_idx, token* t);
+static void mark_equ_absolute(const equ_node* node);
+static int add_symbol(const char* name, int addr, int section, int block);
+static int find_symbol(const char* name, int section);
+static int sym_lookup(const char* name, int section);
+static unsigned int name_hash(const char* s, int len);
+static int assign_base_registers(int pick);
+static int check_displacements(void);
+static int check_displacement(token* t, int line);
+static int section_exports(int first, int end, const char* name);
+static int mark_live_sections(void);
+static void operand_symbol(const char* operand, char* out, int size);
+static int section_relative(token* t);
+static int resolve_equ_symbols(void);
 void make_symtab_output(char* file_name);
+static void write_symtab(FILE* fp);
 void make_literaltab_output(char* filename);
+static void write_littab(FILE* fp);
+void make_symindex_output(char* file_name);
+static int run_symlookup(const char* index_path, const char* name);
 void extract_literal(const char* literalStr, char* dest);
 void process_literal_pool(void);
+static int find_literal(const char* name, int section, int addr);
+static int auto_pool_point(token* t, int after, int at);
+static int deferred_pool_end(int at, int addr, int pool);
+static int insert_auto_ltorg(int at);
+static void begin_blocks(int section);
+static int use_block(const char* name);
+static void relocate_program_blocks(void);
 static int get_register_number(const char *r);
 int calc_disp(int target, int current, int format, int base, int e, int *b, int *p);
 void calc_nixbpe(token* t, int baseOpcode, int *finalOpcode, int *n, int *i,int *x, int *e, int *targetAddr);
-static int findTokenIndex(token *t);
 int isTextRecordable(token *t);
 char* generate_object_code(token* t);
+static void normalize_operand(token* t);
+static int format34_kind(token* t);
+static void format34_resolve(token* t, int baseOpcode, int format, fmt34_batch* b, int j);
+static void encode_format34(fmt34_batch* b);
+static char* format34_object(const fmt34_batch* b, int j);
+static int fmt34_alloc(fmt34_batch* b, int count);
+static void fmt34_free(fmt34_batch* b);
+static void batch_encode_section(int first, int end, char** objs);
 char** generate_modification_records(token* t, int* count);
 static int assem_pass2(void);
+static int write_object_program(FILE* fp, object_code* oc);
 void make_opcode_output(char* file_name);
+static void write_opcode_line(FILE* fp, token* t);
+void make_listing_output(char* file_name);
+static void profile_token(size_profile* p, token* t, int line, const char* obj);
+static void profile_mods(size_profile* p, const section_writer* w);
+static void free_size_profiles(void);
 void make_objectcode_output(char* file_name);
 int is_extref(const char* symbol);
+static void sw_begin(section_writer* w, FILE* fp, object_code* oc);
+static void sw_flush_text(section_writer* w);
+static void sw_append_text(section_writer* w, int addr, const char* obj);
+static void sw_add_mods(section_writer* w, token* t);
+static int literal_object(int j, char* out);
+static void sw_append_pool(section_writer* w, int sec, int addr);
+static void sw_end_section(section_writer* w, int isFirst, int isLast, int secStart);
+static int find_inst_index(const char* name);
+static int assem_stream(void);
+static int stream_pass1(FILE* src, FILE* imed);
+static int stream_pass2(FILE* imed, FILE* obj_fp, FILE* list_fp);
+static int assem_one_pass(void);
+static void reset_assembler(void);
+static void teardown_assembler(void);
+static int assemble_buffer(const char* src, size_t len, FILE* obj_fp, FILE* sym_fp,
+                           FILE* lit_fp, FILE* list_fp, FILE* diag_out);
+static int run_daemon(const char* sock_path, int workers);
+static int run_client(const char* sock_path);
+static int run_disasm(const char* obj_path, const char* out_path);
+static int dis_grow(void** items, int* cap, int need, size_t size);
+static int hex_value(const char* p, int digits);
+static void obj_init(object_code* oc);
+static void obj_free(object_code* oc);
+static int obj_add_section(object_code* oc, const char* name, int start, int length);
+static int obj_add_text(object_code* oc, int addr, const char* hex);
+static int obj_add_mod(object_code* oc, const char* record);
+static int obj_add_symbol(object_code* oc, int is_ref, const char* name, int addr);
+static int obj_write_binary(FILE* fp, const object_code* oc);
+static int run_convert(const char* in_path, const char* out_path);
+static int obj_read_text(FILE* fp, object_code* oc);
+static int obj_write_text(FILE* fp, const object_code* oc);
+static int obj_parse_binary(const unsigned char* image, size_t size, const char* path, object_code* oc);
+static int obj_read_binary(int fd, const char* path, object_code* oc);
+static int obj_read_file(const char* path, object_code* oc, int* is_binary);
+static int run_translate(const char* obj_path, const char* out_path);
+static int run_annotate(const char* map_path, const char* prof_path, const char* out_path,
+                        const char* flame_path);
+static int objb_range_ok(uint32_t offset, uint32_t count, uint32_t size, size_t file_size);
+static void copy_name(char* dst, const char* src);
+static int append_archive(const char* path, const char* text, size_t len);
+static int run_ar_create(const char* path, char** objs, int count);
+static int run_ar_pull(const char* path, const char* name, const char* out_path);
+static int assem_two_pass(void);
+static void phase_begin(void);
+static void phase_end(const char* name);
+static void write_bench_json(const char* path, const char* mode, int result);
+static void write_stats_json(const char* path, const char* mode, int result);
+static void write_trace_json(const char* path);
+static FILE* open_input(const char* path);
+static FILE* open_output(const char* path, const char* what);
+static void close_stream(FILE* fp);
+static void* writer_run(void* arg);
+static int writer_start(void);
+static int writer_active(void);
+static void writer_submit_make(void (*make)(char*), char* path);
+static void writer_submit_buffer(FILE* fp, char* buf, size_t len, int echo);
+static void writer_submit_close(FILE* fp);
+static void writer_drain(void);
+static int writer_stop(void);
+static void run_output(const char* phase, void (*make)(char*), char* path);
 
 /* ----------------------------------------------------------------------------------
  * 설명 : 사용자로 부터 어셈블리 파일을 받아서 명령어의 OPCODE를 찾아 출력한다.
- * 매개 : 실행 파일, 어셈블리 파일
+ * 매개 : 실행 파일, 옵션
+ *        -i, --input PATH    : 소스 파일 ("-"이면 stdin)
+ *        -o, --output PATH   : 오브젝트 프로그램 ("-"이면 stdout)
+ *        --symtab PATH, --littab PATH, --listing PATH : 해당 출력을 원할 때만 지정
+ *        --full-listing PATH : 주소/오브젝트 코드/nixbpe/교차 참조가 포함된 리스트 (두 패스 모드)
+ *        --size-profile PATH : 섹션별 코드 크기/주소 지정 방식/재배치 통계 (두 패스 모드)
+ *        --stream, --one-pass, --daemon SOCKET [--workers N], --client SOCKET
+ *        --disasm OBJFILE    : 오브젝트 프로그램을 역어셈블 (-o로 출력 경로 지정, 기본 stdout)
+ *        --obj-format text|binary : 오브젝트 프로그램 형식 (binary는 두 패스 모드에서만)
+ *        --text-record-size N : T 레코드 최대 바이트 수 (1 ~ 255, 기본 30)
+ *        --auto-base         : BASE가 없는 구간마다 먼 참조를 가장 많이 덮는 BASE를 골라
+ *                              LDB/BASE를 끼워 넣고 보고 (두 패스 모드)
+ *        --auto-ltorg        : 리터럴이 PC relative 범위를 벗어나기 전에 J/RSUB 뒤나
+ *                              RESW/RESB 앞에 리터럴 풀을 자동으로 넣는다
+ *        --gc-sections       : END의 진입점에서 EXTREF로 닿지 않는 섹션을 출력하지 않는다
+ *                              (두 패스 모드)
+ *        --convert OBJFILE   : 텍스트 <-> 바이너리 오브젝트 변환 (입력 형식은 자동 판별, -o로 출력)
+ *        --translate OBJFILE : 오브젝트 프로그램을 적재해 기본 블록 단위로 C 소스로 번역
+ *                              (-o, 기본 stdout. 장치 XX는 실행 디렉터리의 XX.dev 파일)
+ *        --line-map PATH     : 주소 -> 소스 라인 맵 (--annotate 입력, 두 패스 모드)
+ *        --annotate MAP PROFILE [--flame PATH] : -DSIC_PROFILE로 빌드한 번역 프로그램의
+ *                              프로파일을 소스 라인별 실행/분기/장치 대기 횟수 리스트로 (-o,
+ *                              기본 stdout), 호출 스택별 횟수를 flame graph용 folded 파일로 출력
+ *        --symindex PATH     : mmap해서 바로 찾을 수 있는 바이너리 심볼/리터럴 색인
+ *        --symlookup INDEX NAME : 색인 파일에서 NAME을 찾아 출력
+ *        --archive PATH      : 오브젝트 프로그램의 섹션들을 모듈 아카이브에 추가 (두 패스 모드)
+ *        --async-output      : 출력 파일을 백그라운드 스레드가 써서 pass2와 겹친다 (두 패스 모드)
+ *        --ar-create ARCHIVE OBJFILE... : 오브젝트 파일들로 모듈 아카이브를 새로 만든다
+ *        --ar-pull ARCHIVE NAME : NAME을 내보내는 모듈과 그 모듈이 R 레코드로 참조하는 모듈만
+ *                              끌어와 하나의 오브젝트 프로그램으로 출력 (-o, 기본 stdout)
+ *        --bench-json PATH   : 단계별 소요 시간/처리량/최대 RSS를 JSON으로 기록
+ *        --stats PATH, --trace PATH : 내부 카운터 보고서(JSON) / Chrome trace-event 파일
+ *                              (카운터는 -DASM_STATS 로 빌드했을 때만 수집된다)
  * 반환 : 성공 = 0, 실패 = < 0
- * 주의 : 현재 어셈블리 프로그램의 리스트 파일을 생성하는 루틴은 만들지 않았다.
- *           또한 중간파일을 생성하지 않는다.
+ * 주의 : 입출력 옵션을 하나도 주지 않으면 예전처럼 input-1.txt를 읽어 네 개의 출력 파일을
+ *        모두 만들고 오브젝트 프로그램을 화면에 출력한다. 입출력 옵션을 하나라도 주면
+ *        지정한 출력만 만들고, -o가 없으면 오브젝트 프로그램을 stdout으로 보낸다.
  * ----------------------------------------------------------------------------------
  */
 int main(int args, char *arg[])
+{
+    int stream_mode = 0;
+    int one_pass_mode = 0;
+    char* daemon_sock = NULL;
+    char* client_sock = NULL;
+    char* disasm_file = NULL;
+    char* convert_file = NULL;
+    char* translate_file = NULL;
+    char *annotate_map = NULL, *annotate_prof = NULL, *flame_file = NULL;
+    char* ar_pull_archive = NULL;
+    char* ar_pull_name = NULL;
+    int workers = 4;
+    int pipeline = 0;
+    char *opt_input = NULL, *opt_output = NULL;
+    char *opt_symtab = NULL, *opt_littab = NULL, *opt_listing = NULL;
+
+    for (int a = 1; a < args; a++) {
+        if (!strcmp(arg[a], "--stream"))
+            stream_mode = 1;
+        else if (!strcmp(arg[a], "--one-pass"))
+            one_pass_mode = 1;
+        else if (!strcmp(arg[a], "--disasm") && a + 1 < args)
+            disasm_file = arg[++a];
+        else if (!strcmp(arg[a], "--convert") && a + 1 < args)
+            convert_file = arg[++a];
+        else if (!strcmp(arg[a], "--translate") && a + 1 < args)
+            translate_file = arg[++a];
+        else if (!strcmp(arg[a], "--text-record-size") && a + 1 < args) {
+            char* end;
+            long size = strtol(arg[++a], &end, 10);
+            if (end == arg[a] || *end || size < 1 || size > MAX_TEXT_RECORD_LIMIT) {
+                fprintf(stderr, "--text-record-size는 1 ~ %d 사이여야 합니다: %s\n",
+                        MAX_TEXT_RECORD_LIMIT, arg[a]);
+                return -1;
+            }
+            text_record_max = (int)size;
+        }
+        else if (!strcmp(arg[a], "--auto-base"))
+            auto_base = 1;
+        else if (!strcmp(arg[a], "--auto-ltorg"))
+            auto_ltorg = 1;
+        else if (!strcmp(arg[a], "--gc-sections"))
+            gc_sections = 1;
+        else if (!strcmp(arg[a], "--symindex") && a + 1 < args)
+            symindex_file = arg[++a], pipeline = 1;
+        else if (!strcmp(arg[a], "--symlookup") && a + 2 < args)
+            return run_symlookup(arg[a + 1], arg[a + 2]);
+        else if (!strcmp(arg[a], "--ar-create") && a + 2 < args)
+            return run_ar_create(arg[a + 1], arg + a + 2, args - a - 2);
+        else if (!strcmp(arg[a], "--ar-pull") && a + 2 < args)
+            ar_pull_archive = arg[++a], ar_pull_name = arg[++a];
+        else if (!strcmp(arg[a], "--archive") && a + 1 < args)
+            archive_file = arg[++a];
+        else if (!strcmp(arg[a], "--async-output"))
+            async_output = 1;
+        else if (!strcmp(arg[a], "--obj-format") && a + 1 < args &&
+                 (!strcmp(arg[a + 1], "text") || !strcmp(arg[a + 1], "binary")))
+            binary_object = !strcmp(arg[++a], "binary");
+        else if (!strcmp(arg[a], "--daemon") && a + 1 < args)
+            daemon_sock = arg[++a];
+        else if (!strcmp(arg[a], "--client") && a + 1 < args)
+            client_sock = arg[++a];
+        else if (!strcmp(arg[a], "--workers") && a + 1 < args)
+            workers = atoi(arg[++a]);
+        else if ((!strcmp(arg[a], "-i") || !strcmp(arg[a], "--input")) && a + 1 < args)
+            opt_input = arg[++a], pipeline = 1;
+        else if ((!strcmp(arg[a], "-o") || !strcmp(arg[a], "--output")) && a + 1 < args)
+            opt_output = arg[++a], pipeline = 1;
+        else if (!strcmp(arg[a], "--symtab") && a + 1 < args)
+            opt_symtab = arg[++a], pipeline = 1;
+        else if (!strcmp(arg[a], "--littab") && a + 1 < args)
+            opt_littab = arg[++a], pipeline = 1;
+        else if (!strcmp(arg[a], "--listing") && a + 1 < args)
+            opt_listing = arg[++a], pipeline = 1;
+        else if (!strcmp(arg[a], "--full-listing") && a + 1 < args)
+            full_listing_file = arg[++a], pipeline = 1;
+        else if (!strcmp(arg[a], "--size-profile") && a + 1 < args)
+            size_profile_file = arg[++a], pipeline = 1;
+        else if (!strcmp(arg[a], "--line-map") && a + 1 < args)
+            line_map_file = arg[++a], pipeline = 1;
+        else if (!strcmp(arg[a], "--annotate") && a + 2 < args)
+            annotate_map = arg[++a], annotate_prof = arg[++a];
+        else if (!strcmp(arg[a], "--flame") && a + 1 < args)
+            flame_file = arg[++a];
+        else if (!strcmp(arg[a], "--bench-json") && a + 1 < args)
+            bench_file = arg[++a];
+        else if (!strcmp(arg[a], "--stats") && a + 1 < args)
+            stats_file = arg[++a];
+        else if (!strcmp(arg[a], "--trace") && a + 1 < args)
+            trace_file = arg[++a];
+        else {
+            fprintf(stderr, "알 수 없는 옵션입니다: %s\n", arg[a]);
+            return -1;
+        }
+    }
+
+    // 입출력 옵션이 있으면 지정한 출력만 만든다
+    if (pipeline) {
+        input_file   = opt_input ? opt_input : "input-1.txt";
+        output_file  = opt_output ? opt_output : "-";
+        symtab_file  = opt_symtab;
+        littab_file  = opt_littab;
+        listing_file = opt_listing;
+        echo_object  = 0;
+    }
+
+    int result;
+    if (daemon_sock || disasm_file || convert_file || ar_pull_archive || translate_file || annotate_map) {
+        if (daemon_sock)
+            result = run_daemon(daemon_sock, workers);
+        else if (disasm_file)
+            result = run_disasm(disasm_file, pipeline ? output_file : "-");
+        else if (ar_pull_archive)
+            result = run_ar_pull(ar_pull_archive, ar_pull_name, pipeline ? output_file : "-");
+        else if (translate_file)
+            result = run_translate(translate_file, pipeline ? output_file : "-");
+        else if (annotate_map)
+            result = run_annotate(annotate_map, annotate_prof, pipeline ? output_file : "-", flame_file);
+        else
+            result = run_convert(convert_file, pipeline ? output_file : "-");
+        teardown_assembler();
+        return result;
+    }
+    // 모드를 가리는 옵션은 지원하지 않는 모드와 함께 주면 무시하지 않고 실패한다
+    if (stream_mode + one_pass_mode + (client_sock != NULL) > 1) {
+        fprintf(stderr, "--stream, --one-pass, --client는 함께 쓸 수 없습니다.\n");
+        return -1;
+    }
+    if (auto_ltorg && client_sock) {
+        fprintf(stderr, "--auto-ltorg는 --client와 함께 쓸 수 없습니다.\n");
+        return -1;
+    }
+    if (stream_mode || one_pass_mode || client_sock) {
+        const char* msg = NULL;
+        if (binary_object)
+            msg = "--obj-format binary는 기본(두 패스) 모드에서만 지원합니다. --convert로 변환하세요.\n";
+        else if (full_listing_file)
+            msg = "--full-listing은 기본(두 패스) 모드에서만 지원합니다.\n";
+        else if (size_profile_file)
+            msg = "--size-profile은 기본(두 패스) 모드에서만 지원합니다.\n";
+        else if (auto_base)
+            msg = "--auto-base는 기본(두 패스) 모드에서만 지원합니다.\n";
+        else if (gc_sections)
+            msg = "--gc-sections는 기본(두 패스) 모드에서만 지원합니다.\n";
+        else if (archive_file)
+            msg = "--archive는 기본(두 패스) 모드에서만 지원합니다.\n";
+        else if (async_output)
+            msg = "--async-output은 기본(두 패스) 모드에서만 지원합니다.\n";
+        else if (line_map_file)
+            msg = "--line-map은 기본(두 패스) 모드에서만 지원합니다.\n";
+        if (msg) {
+            fputs(msg, stderr);
+            return -1;
+        }
+    }
+    if (binary_object)
+        echo_object = 0;    // 바이너리는 화면에 출력하지 않는다
+
+    const char* mode = "two-pass";
+    if (client_sock)
+        result = run_client(client_sock), mode = "client";
+    else if (stream_mode)
+        result = assem_stream(), mode = "stream";
+    else if (one_pass_mode)
+        result = assem_one_pass(), mode = "one-pass";
+    else
+        result = assem_two_pass();
+
+    if (bench_file)
+        write_bench_json(bench_file, mode, result);
+    if (stats_file)
+        write_stats_json(stats_file, mode, result);
+    if (trace_file)
+        write_trace_json(trace_file);
+    teardown_assembler();
+    return result;
+}
+
+/* ----------------------------------------------------------------------------------
+ * 설명 : 기본 모드. 소스 전체를 읽어 두 패스로 어셈블하고 지정된 출력 파일을 만든다.
+ * 매개 : 없음
+ * 반환 : 성공 = 0, 실패 = < 0
+ * 주의 : 각 단계의 소요 시간은 phase_begin()/phase_end()로 기록된다.
+ * ----------------------------------------------------------------------------------
+ */
+static int assem_two_pass(void)
 {
     if (init_my_assembler() < 0) {
-        printf("init_my_assembler: 프로그램 초기화에 실패 했습니다.\n");
+        fprintf(stderr, "init_my_assembler: 프로그램 초기화에 실패 했습니다.\n");
         return -1;
     }
 
+    phase_begin();
     if (assem_pass1() < 0) {
-        printf("assem_pass1: 패스1 과정에서 실패하였습니다.  \n");
+        fprintf(stderr, "assem_pass1: 패스1 과정에서 실패하였습니다.  \n");
         return -1;
     }
-
-    make_symtab_output("output_symtab.txt");
-    make_literaltab_output("output_littab.txt");
+    phase_end("assem_pass1");
+
+    // --async-output: 이후의 출력은 writer 스레드가 제출 순서대로 쓴다
+    if (async_output && writer_start() < 0)
+        fprintf(stderr, "--async-output: writer 스레드를 만들지 못해 순서대로 출력합니다.\n");
+
+    // 패스1 테이블은 패스2가 읽기만 하므로 패스2와 동시에 쓸 수 있다
+    if (symtab_file)
+        run_output("make_symtab_output", make_symtab_output, symtab_file);
+    if (littab_file)
+        run_output("make_literaltab_output", make_literaltab_output, littab_file);
+    if (symindex_file)
+        run_output("make_symindex_output", make_symindex_output, symindex_file);
     
+    phase_begin();
     if (assem_pass2() < 0) {
-        printf(" assem_pass2: 패스2 과정에서 실패하였습니다.  \n");
+        fprintf(stderr, " assem_pass2: 패스2 과정에서 실패하였습니다.  \n");
+        writer_stop();
         return -1;
     }
-
-    make_opcode_output("opcode_output.txt");
-    make_objectcode_output("output_objectcode.txt");
-    
+    phase_end("assem_pass2");
+
+    if (listing_file)
+        run_output("make_opcode_output", make_opcode_output, listing_file);
+    if (full_listing_file)
+        run_output("make_listing_output", make_listing_output, full_listing_file);
+    if (size_profile_file)
+        run_output("make_size_profile_output", make_size_profile_output, size_profile_file);
+    if (line_map_file)
+        run_output("make_line_map_output", make_line_map_output, line_map_file);
+    // writer가 있으면 오브젝트 프로그램은 섹션마다 화면에도 이미 출력했다
+    if (echo_object && !writer_active())
+        run_output("make_objectcode_output", make_objectcode_output, output_file);
+
+    if (writer_active()) {
+        phase_begin();
+        int result = writer_stop();
+        phase_end("writer_drain");
+        if (result < 0) {
+            fprintf(stderr, "--async-output: 출력 파일을 쓰지 못했습니다.\n");
+            return -1;
+        }
+    }
     return 0;
 }
 
@@ -129,10 +559,15 @@ int init_my_assembler(void)
 {
     int result;
 
+    reset_assembler();  // 같은 프로세스에서 두 번째 어셈블이어도 빈 테이블에서 시작한다
+    phase_begin();
     if ((result = init_inst_file("inst_table.txt")) < 0)
         return -1;
-    if ((result = init_input_file("input-1.txt")) < 0)
+    phase_end("init_inst_file");
+    phase_begin();
+    if ((result = init_input_file(input_file)) < 0)
         return -1;
+    phase_end("init_input_file");
     return result;
 }
 
@@ -161,7 +596,7 @@ int init_inst_file(char *inst_file)
     }
     
     char line[100];
-    inst_index = 0;
+    free_inst_table();  // 다시 읽을 때 예전 항목이 새지 않도록
     while(fgets(line, sizeof(line), fp) != NULL) {
         if (line[0] == '\n')
             continue;
@@ -195,21 +630,60 @@ int init_inst_file(char *inst_file)
  */
 int init_input_file(char *input_file_name)
 {
-    FILE* fp = fopen(input_file_name, "r");
-    if (!fp) {
-        perror("Error opening input file");
+    FILE* fp = open_input(input_file_name);
+    if (!fp)
         return -1;
-    }
-    char line[256];
+    int result = init_input_stream(fp);
+    close_stream(fp);
+    return result;
+}
+
+/* 소스 전체를 담는 버퍼. input_data[]는 이 버퍼 안의 각 줄을 가리키며,
+   reset_assembler()는 버퍼를 비우기만 하고 용량은 다음 어셈블을 위해 남겨둔다 */
+static char* source_buf = NULL;
+static size_t source_cap = 0;
+
+/* init_input_stream(): 이미 열린 스트림(파일, 메모리 버퍼 등)에서 소스코드 테이블을 만든다.
+   MAX_LINES줄보다 긴 소스는 잘라서 어셈블하지 않고 진단을 출력한 뒤 -1 */
+static int init_input_stream(FILE* fp)
+{
+    size_t len = 0;
     line_num = 0;
-    while (fgets(line, sizeof(line), fp) != NULL) {
-        line[strcspn(line, "\n")] = '\0';
-        input_data[line_num] = strdup(line);
-        line_num++;
-        if (line_num >= MAX_LINES)
+    for (;;) {
+        if (source_cap - len < 4096) {
+            size_t cap = source_cap ? source_cap * 2 : 65536;
+            char* grown = realloc(source_buf, cap);
+            if (!grown) {
+                perror("init_input_file");
+                return -1;
+            }
+            source_buf = grown;
+            source_cap = cap;
+        }
+        size_t n = fread(source_buf + len, 1, source_cap - len - 1, fp);
+        if (n == 0)
             break;
+        len += n;
+    }
+    source_buf[len] = '\0';
+    source_bytes += len;
+
+    // 줄 단위로 나누어 제자리에서 NUL로 끝낸다
+    char* p = source_buf;
+    while (p < source_buf + len) {
+        if (line_num >= MAX_LINES) {
+            diag("소스가 너무 깁니다. (MAX_LINES = %d줄까지)\n", MAX_LINES);
+            return -1;
+        }
+        char* nl = memchr(p, '\n', source_buf + len - p);
+        if (nl)
+            *nl = '\0';
+        input_data[line_num++] = p;
+        source_lines++;
+        if (!nl)
+            break;
+        p = nl + 1;
     }
-    fclose(fp);
     return 0;
 }
 
@@ -227,6 +701,16 @@ char* trim(char* str) {
     return str;
 }
 
+// diag 함수: 어셈블 중 발생한 진단 메시지 출력 (diag_fp가 지정되면 그쪽으로, 아니면 stderr)
+//            -o - 로 stdout에 쓰는 오브젝트 프로그램과 섞이지 않도록 stdout은 쓰지 않는다
+static void diag(const char* fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    vfprintf(diag_fp ? diag_fp : stderr, fmt, ap);
+    va_end(ap);
+}
+
 // to_upper 함수: 문자열을 모두 대문자로 변환
 void to_upper(char* s) {
     for (int i = 0; s[i] != '\0'; i++) {
@@ -246,6 +730,609 @@ void to_upper(char* s) {
  - 첫 토큰이 "END" 혹은 opcode라면 label 없이 operator에 저장
  - 그 외의 경우 첫 토큰은 label, 두 번째는 operator, 세 번째는 operand */
 int token_parsing(char *str)
+{
+    token* t = alloc_token();
+    if (!t) return -1;
+
+    int result = tokenize_line(str, t);
+    if (result <= 0) {
+        free_token(t);
+        return result;
+    }
+    return add_source_token(t, 0);
+}
+
+/* 해제된 토큰 구조체를 모아두는 풀. 다음 어셈블에서 다시 쓰고 teardown_assembler()에서만 해제한다 */
+static token** token_pool = NULL;
+static int token_pool_count = 0, token_pool_cap = 0;
+
+/* alloc_token(): 0으로 초기화된 토큰을 풀에서 꺼내거나 새로 할당 */
+static token* alloc_token(void)
+{
+    if (token_pool_count > 0)
+        return token_pool[--token_pool_count];
+    return calloc(1, sizeof(token));
+}
+
+/* free_token(): 토큰이 가진 문자열을 해제하고 구조체는 풀에 돌려준다 */
+static void free_token(token* t)
+{
+    if (!t)
+        return;
+    free(t->label);
+    free(t->operator);
+    for (int k = 0; k < MAX_OPERAND; k++)
+        free(t->operand[k]);
+    free(t->obj);
+    memset(t, 0, sizeof(token));
+    if (token_pool_count == token_pool_cap) {
+        int cap = token_pool_cap ? token_pool_cap * 2 : 1024;
+        token** grown = realloc(token_pool, sizeof(token*) * cap);
+        if (!grown) {
+            free(t);
+            return;
+        }
+        token_pool = grown;
+        token_pool_cap = cap;
+    }
+    token_pool[token_pool_count++] = t;
+}
+
+/* clone_token(): 캐시된 토큰을 토큰 테이블에 넣을 사본으로 만든다 (패스2가 토큰을 고치므로) */
+static token* clone_token(const token* src)
+{
+    token* t = alloc_token();
+    if (!t)
+        return NULL;
+    t->label = strdup(src->label);
+    t->operator = strdup(src->operator);
+    for (int k = 0; k < MAX_OPERAND; k++)
+        if (src->operand[k])
+            t->operand[k] = strdup(src->operand[k]);
+    memcpy(t->comment, src->comment, sizeof(t->comment));
+    return t;
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : INCLUDE 파일을 토큰 단위로 읽어 캐시에 보관하고 돌려주는 함수이다.
+*        캐시는 경로와 파일의 mtime/크기로 구분되며, 파일이 바뀌지 않았다면
+*        다시 읽거나 다시 토큰 분리하지 않는다.
+* 매개 : INCLUDE 파일 경로
+* 반환 : 캐시된 모듈, 실패 = NULL
+* 주의 : 캐시는 프로세스가 끝날 때까지 유지된다. (reset_assembler에서도 지우지 않는다)
+*        데몬에서는 assemble_lock 안에서만 불리므로 따로 잠그지 않는다.
+* -----------------------------------------------------------------------------------
+*/
+static include_module* include_cache = NULL;
+
+/* free_include(): 캐시에서 모듈 m을 빼고 토큰과 함께 해제한다 */
+static void free_include(include_module* m)
+{
+    for (include_module** p = &include_cache; *p; p = &(*p)->next)
+        if (*p == m) {
+            *p = m->next;
+            break;
+        }
+    for (int k = 0; k < m->count; k++)
+        free_token(m->tokens[k]);
+    free(m->tokens);
+    free(m->path);
+    free(m);
+}
+
+static include_module* load_include(const char* path)
+{
+    struct stat st;
+    if (stat(path, &st) < 0) {
+        diag("INCLUDE: %s 파일을 열 수 없습니다: %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    include_module* m;
+    for (m = include_cache; m; m = m->next)
+        if (!strcmp(m->path, path))
+            break;
+    if (m && m->mtime == st.st_mtime && m->size == (long)st.st_size) {
+        m->hits++;
+        return m;
+    }
+
+    FILE* fp = fopen(path, "r");
+    if (!fp) {
+        diag("INCLUDE: %s 파일을 열 수 없습니다: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    if (m) {
+        // 파일이 바뀌었으면 예전 토큰을 버리고 다시 읽는다
+        for (int k = 0; k < m->count; k++)
+            free_token(m->tokens[k]);
+        m->count = 0;
+    } else {
+        m = calloc(1, sizeof(include_module));
+        if (!m || !(m->path = strdup(path))) {
+            free(m);
+            fclose(fp);
+            return NULL;
+        }
+        m->next = include_cache;
+        include_cache = m;
+    }
+    m->mtime = st.st_mtime;
+    m->size = (long)st.st_size;
+
+    // 한 줄이라도 해석하지 못하면 모듈 일부만 캐시하지 않도록 캐시에서 지우고 실패한다
+    char line[256], text[256];
+    int line_no = 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        line_no++;
+        line[strcspn(line, "\n")] = '\0';
+        strcpy(text, line);
+        token* t = alloc_token();
+        int parsed = t ? tokenize_line(line, t) : -1;
+        if (parsed == 0) {
+            free_token(t);
+            continue;
+        }
+        if (parsed < 0) {
+            diag("INCLUDE: %s %d번째 줄을 해석할 수 없습니다: %s\n", path, line_no, text);
+            free_token(t);
+            fclose(fp);
+            free_include(m);
+            return NULL;
+        }
+        if (m->count == m->cap) {
+            int cap = m->cap ? m->cap * 2 : 64;
+            token** grown = realloc(m->tokens, sizeof(token*) * cap);
+            if (!grown) {
+                perror("INCLUDE");
+                free_token(t);
+                fclose(fp);
+                free_include(m);
+                return NULL;
+            }
+            m->tokens = grown;
+            m->cap = cap;
+        }
+        m->tokens[m->count++] = t;
+    }
+    fclose(fp);
+    return m;
+}
+
+/* splice_include(): INCLUDE 토큰 자리에 캐시된 모듈의 토큰 사본을 이어 붙인다 (중첩 INCLUDE 포함) */
+static int splice_include(const token* inc, int depth)
+{
+    char path[256];
+    const char* operand = inc->operand[0] ? inc->operand[0] : "";
+    size_t len = strlen(operand);
+    if (len >= 2 && operand[0] == '\'' && operand[len - 1] == '\'') {
+        operand++;
+        len -= 2;
+    }
+    if (len == 0 || len >= sizeof(path)) {
+        diag("INCLUDE: 파일 이름이 잘못되었습니다. (%s)\n", inc->operand[0] ? inc->operand[0] : "");
+        return -1;
+    }
+    memcpy(path, operand, len);
+    path[len] = '\0';
+    if (depth >= MAX_INCLUDE_DEPTH) {
+        diag("INCLUDE: 중첩이 너무 깊습니다. 순환 INCLUDE인지 확인하세요. (%s)\n", path);
+        return -1;
+    }
+
+    include_module* m = load_include(path);
+    if (!m)
+        return -1;
+    for (int k = 0; k < m->count; k++) {
+        const token* src = m->tokens[k];
+        token* t = clone_token(src);
+        if (!t || add_source_token(t, depth + 1) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+/* ------------------- 매크로 처리 (MACRO/MEND) ------------------- */
+macro_def macro_defs[MAX_MACROS];
+int macro_count = 0;
+macro_def* macro_defining = NULL;   // MACRO ~ MEND 사이를 읽는 중인 매크로
+static short macro_slots[MACRO_HASH_SIZE];  // 이름 해시 -> macro_defs 인덱스 + 1 (0: 빈 칸)
+static long macro_unique = 0;       // $ 라벨 고유 번호
+
+static unsigned int macro_hash(const char* name)
+{
+    unsigned int h = 0;
+    for (; *name; name++)
+        h = h * 31 + (unsigned char)toupper((unsigned char)*name);
+    return h & (MACRO_HASH_SIZE - 1);
+}
+
+/* find_macro(): 이름이 name인 매크로 인덱스, 없으면 -1 */
+static int find_macro(const char* name)
+{
+    if (macro_count == 0 || !name || !*name)
+        return -1;
+    for (unsigned int h = macro_hash(name); macro_slots[h]; h = (h + 1) & (MACRO_HASH_SIZE - 1))
+        if (!strcasecmp(macro_defs[macro_slots[h] - 1].name, name))
+            return macro_slots[h] - 1;
+    return -1;
+}
+
+/* free_macro_field(): 템플릿 필드의 조각들을 해제 */
+static void free_macro_field(macro_field* f)
+{
+    for (int k = 0; k < f->count; k++)
+        free(f->parts[k].text);
+    free(f->parts);
+    f->parts = NULL;
+    f->count = 0;
+}
+
+/* reset_macros(): 정의된 매크로를 모두 지운다 (소스 하나가 끝날 때마다) */
+static void reset_macros(void)
+{
+    for (int m = 0; m < macro_count; m++) {
+        macro_def* d = &macro_defs[m];
+        for (int k = 0; k < d->param_count; k++)
+            free(d->defaults[k]);
+        for (int l = 0; l < d->line_count; l++) {
+            free_macro_field(&d->lines[l].label);
+            free_macro_field(&d->lines[l].operator);
+            free_macro_field(&d->lines[l].operand);
+        }
+        free(d->lines);
+    }
+    memset(macro_defs, 0, sizeof(macro_defs));
+    memset(macro_slots, 0, sizeof(macro_slots));
+    macro_count = 0;
+    macro_defining = NULL;
+    macro_unique = 0;
+}
+
+/* add_macro_part(): 템플릿 필드에 조각 하나를 덧붙인다 */
+static int add_macro_part(macro_field* f, int kind, int param, const char* text, int len)
+{
+    macro_part* grown = realloc(f->parts, sizeof(macro_part) * (f->count + 1));
+    if (!grown)
+        return -1;
+    f->parts = grown;
+    macro_part* p = &f->parts[f->count++];
+    p->kind = kind;
+    p->param = param;
+    p->len = len;
+    p->text = NULL;
+    if (text) {
+        p->text = malloc(len + 1);
+        if (!p->text)
+            return -1;
+        memcpy(p->text, text, len);
+        p->text[len] = '\0';
+    }
+    return 0;
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : 매크로 본문의 필드 문자열 하나를 템플릿(문자열 조각 + 매개변수 칸)으로 미리 나누는 함수이다.
+*        &이름 은 가장 길게 일치하는 매개변수 칸이 되고, $로 시작하는 이름은 확장할 때마다
+*        고유 번호가 붙는 칸($AALOOP 처럼)이 된다.
+* 매개 : 매크로 정의, 필드 문자열, 결과 필드
+* 반환 : 정상종료 = 0, 에러 < 0
+* -----------------------------------------------------------------------------------
+*/
+static int compile_macro_field(const macro_def* d, const char* src, macro_field* f)
+{
+    const char* text = src;
+    const char* p = src;
+    while (*p) {
+        int param = -1, plen = 0;
+        if (*p == '&') {
+            for (int k = 0; k < d->param_count; k++) {
+                int n = strlen(d->params[k]);
+                if (n > plen && !strncasecmp(p, d->params[k], n)) {
+                    param = k;
+                    plen = n;
+                }
+            }
+        }
+        int is_unique = (*p == '$' && (p == src || !isalnum((unsigned char)p[-1])));
+        if (param < 0 && !is_unique) {
+            p++;
+            continue;
+        }
+        if (p > text && add_macro_part(f, MACRO_PART_TEXT, -1, text, p - text) < 0)
+            return -1;
+        if (param >= 0) {
+            if (add_macro_part(f, MACRO_PART_PARAM, param, NULL, 0) < 0)
+                return -1;
+            p += plen;
+            if (*p == '.')      // &PARAM. 은 뒤 문자열과 붙여 쓰기 위한 구분자
+                p++;
+        } else {
+            if (add_macro_part(f, MACRO_PART_UNIQUE, -1, NULL, 0) < 0)
+                return -1;
+            p++;
+        }
+        text = p;
+    }
+    if (p > text && add_macro_part(f, MACRO_PART_TEXT, -1, text, p - text) < 0)
+        return -1;
+    return 0;
+}
+
+/* split_macro_args(): 쉼표로 나눈다. 따옴표 안의 쉼표는 나누지 않는다. 반환: 항목 수 */
+static int split_macro_args(char* list, char** items, int max)
+{
+    int count = 0, quoted = 0;
+    if (!list || !*list)
+        return 0;
+    items[count++] = list;
+    for (char* p = list; *p; p++) {
+        if (*p == '\'')
+            quoted = !quoted;
+        else if (*p == ',' && !quoted) {
+            *p = '\0';
+            if (count == max)
+                return -1;
+            items[count++] = p + 1;
+        }
+    }
+    return count;
+}
+
+/* begin_macro(): MACRO 라인(이름 MACRO &A,&B=기본값,...)으로 새 매크로 정의를 시작한다 */
+static int begin_macro(token* t)
+{
+    if (!t->label[0]) {
+        diag("MACRO: 매크로 이름이 없습니다.\n");
+        return -1;
+    }
+    if (find_macro(t->label) >= 0) {
+        diag("MACRO %s: 이미 정의된 매크로입니다.\n", t->label);
+        return -1;
+    }
+    if (macro_count >= MAX_MACROS) {
+        diag("MACRO %s: 매크로가 너무 많습니다.\n", t->label);
+        return -1;
+    }
+    macro_def* d = &macro_defs[macro_count];
+    memset(d, 0, sizeof(*d));
+    strncpy(d->name, t->label, sizeof(d->name) - 1);
+
+    char list[256];
+    char* items[MAX_MACRO_PARAMS];
+    strncpy(list, t->operand[0] ? t->operand[0] : "", sizeof(list) - 1);
+    list[sizeof(list) - 1] = '\0';
+    int n = split_macro_args(list, items, MAX_MACRO_PARAMS);
+    if (n < 0) {
+        diag("MACRO %s: 매개변수가 너무 많습니다.\n", d->name);
+        return -1;
+    }
+    for (int k = 0; k < n; k++) {
+        char* eq = strchr(items[k], '=');
+        if (eq) {
+            *eq = '\0';
+            d->defaults[k] = strdup(eq + 1);
+        }
+        if (items[k][0] != '&' || strlen(items[k]) >= sizeof(d->params[0])) {
+            diag("MACRO %s: 매개변수 이름이 잘못되었습니다. (%s)\n", d->name, items[k]);
+            return -1;
+        }
+        strcpy(d->params[k], items[k]);
+        d->param_count++;
+    }
+
+    unsigned int h = macro_hash(d->name);
+    while (macro_slots[h])
+        h = (h + 1) & (MACRO_HASH_SIZE - 1);
+    macro_slots[h] = (short)(macro_count + 1);
+    macro_count++;
+    macro_defining = d;
+    return 0;
+}
+
+/* add_macro_line(): 정의 중인 매크로에 본문 한 줄을 템플릿으로 추가한다 (주석 라인은 버린다) */
+static int add_macro_line(token* t)
+{
+    macro_def* d = macro_defining;
+    if (t->comment[0] == '.')
+        return 0;
+    if (d->line_count == d->line_cap) {
+        int cap = d->line_cap ? d->line_cap * 2 : 8;
+        macro_line* grown = realloc(d->lines, sizeof(macro_line) * cap);
+        if (!grown)
+            return -1;
+        d->lines = grown;
+        d->line_cap = cap;
+    }
+    macro_line* l = &d->lines[d->line_count];
+    memset(l, 0, sizeof(*l));
+    if (compile_macro_field(d, t->label, &l->label) < 0 ||
+        compile_macro_field(d, t->operator, &l->operator) < 0 ||
+        compile_macro_field(d, t->operand[0] ? t->operand[0] : "", &l->operand) < 0)
+        return -1;
+    d->line_count++;
+    return 0;
+}
+
+/* expand_macro_field(): 템플릿 필드에 인자와 고유 번호를 채워 새 문자열을 만든다 */
+static char* expand_macro_field(const macro_field* f, char** args, const char* unique)
+{
+    char buf[256];
+    int len = 0;
+    for (int k = 0; k < f->count; k++) {
+        const macro_part* p = &f->parts[k];
+        const char* src = p->kind == MACRO_PART_TEXT ? p->text
+                        : p->kind == MACRO_PART_PARAM ? (args[p->param] ? args[p->param] : "")
+                        : unique;
+        int n = p->kind == MACRO_PART_TEXT ? p->len : (int)strlen(src);
+        if (len + n >= (int)sizeof(buf))
+            n = sizeof(buf) - 1 - len;
+        memcpy(buf + len, src, n);
+        len += n;
+    }
+    buf[len] = '\0';
+    return strdup(buf);
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : 매크로 호출 토큰을 본문 템플릿으로 확장하여 토큰 테이블에 곧바로 넣는 함수이다.
+*        인자는 위치 인자와 키워드 인자(&NAME=값 혹은 NAME=값)를 함께 쓸 수 있고,
+*        빠진 인자는 정의의 기본값을 쓴다. 호출 라인의 라벨은 첫 확장 라인에 붙고,
+*        첫 라인에 이미 라벨이 있으면 본문 앞에 "라벨 EQU *"로 정의된다.
+* 매개 : 매크로 인덱스, 호출 토큰, 중첩 깊이
+* 반환 : 정상종료 = 0, 에러 < 0
+* 주의 : 확장은 문자열 조각을 이어 붙일 뿐 다시 토큰 분리하지 않는다.
+*        $ 라벨은 "$" + 확장 번호(36진수 2자리부터) + 이름이 된다. (예: $LOOP -> $AALOOP)
+* -----------------------------------------------------------------------------------
+*/
+static int expand_macro(int m, token* call, int depth)
+{
+    macro_def* d = &macro_defs[m];
+    if (depth >= MAX_MACRO_DEPTH) {
+        diag("%s: 매크로 확장이 너무 깊습니다. 재귀 호출인지 확인하세요.\n", d->name);
+        return -1;
+    }
+
+    char list[256];
+    char* items[MAX_MACRO_PARAMS];
+    char* args[MAX_MACRO_PARAMS];
+    strncpy(list, call->operand[0] ? call->operand[0] : "", sizeof(list) - 1);
+    list[sizeof(list) - 1] = '\0';
+    int n = split_macro_args(list, items, MAX_MACRO_PARAMS);
+    if (n < 0 || n > d->param_count) {
+        diag("%s: 인자가 너무 많습니다. (%s)\n", d->name, call->operand[0]);
+        return -1;
+    }
+    for (int k = 0; k < d->param_count; k++)
+        args[k] = d->defaults[k];
+    for (int k = 0, pos = 0; k < n; k++) {
+        char* eq = strchr(items[k], '=');
+        if (eq && items[k][0] != '=') {     // '='로 시작하면 리터럴 인자
+            *eq = '\0';
+            int found = -1;
+            for (int j = 0; j < d->param_count; j++)
+                if (!strcasecmp(d->params[j], items[k]) || !strcasecmp(d->params[j] + 1, items[k]))
+                    found = j;
+            if (found < 0) {
+                diag("%s: 알 수 없는 키워드 인자입니다. (%s)\n", d->name, items[k]);
+                return -1;
+            }
+            args[found] = eq + 1;
+        } else {
+            if (items[k][0])
+                args[pos] = items[k];
+            pos++;
+        }
+    }
+
+    // 고유 번호: 36진수 2자리(AA..99), 넘치면 필요한 만큼 자리를 늘린다 (번호가 되풀이되지 않도록)
+    static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+    char unique[16];
+    long id = macro_unique++;
+    int width = 2;
+    for (long limit = 36 * 36; id >= limit; limit *= 36)
+        width++;
+    unique[0] = '$';
+    unique[width + 1] = '\0';
+    for (int k = width; k >= 1; k--, id /= 36)
+        unique[k] = digits[id % 36];
+
+    for (int l = 0; l < d->line_count; l++) {
+        const macro_line* ml = &d->lines[l];
+        token* t = alloc_token();
+        if (!t)
+            return -1;
+        t->label = expand_macro_field(&ml->label, args, unique);
+        t->operator = expand_macro_field(&ml->operator, args, unique);
+        t->operand[0] = expand_macro_field(&ml->operand, args, unique);
+        if (l == 0 && call->label[0] && !t->label[0]) {
+            free(t->label);
+            t->label = strdup(call->label);
+        } else if (l == 0 && call->label[0]) {
+            // 첫 라인에 이미 라벨이 있으면 호출 라인의 라벨은 "라벨 EQU *"로 따로 정의한다
+            token* eq = alloc_token();
+            if (!eq) {
+                free_token(t);
+                return -1;
+            }
+            eq->label = strdup(call->label);
+            eq->operator = strdup("EQU");
+            eq->operand[0] = strdup("*");
+            if (add_source_token(eq, depth + 1) < 0) {
+                free_token(t);
+                return -1;
+            }
+        }
+        if (strlen(t->label) >= sizeof(((symbol*)0)->symbol)) {
+            diag("%s: 확장된 라벨 %s이(가) 너무 깁니다.\n", d->name, t->label);
+            free_token(t);
+            return -1;
+        }
+        if (add_source_token(t, depth + 1) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : 토큰 하나를 토큰 테이블에 넣기 전에 전처리하는 함수이다.
+*        MACRO~MEND 정의는 템플릿으로 저장하고, 매크로 호출은 확장하고,
+*        INCLUDE는 캐시된 파일의 토큰으로 바꾸며, 나머지는 그대로 토큰 테이블에 넣는다.
+* 매개 : 토큰 (소유권을 넘겨받는다), 중첩 깊이
+* 반환 : 정상종료 = 0, 에러 < 0
+* -----------------------------------------------------------------------------------
+*/
+static int add_source_token(token* t, int depth)
+{
+    int result = 0;
+    int is_code = (t->comment[0] != '.');
+
+    // 매크로가 정의되기 전에 토큰 분리된 라인(INCLUDE 캐시)은 "이름 인자"가 라벨/operator로 읽혀 있다
+    if (is_code && !macro_defining && t->label[0] && find_macro(t->operator) < 0 &&
+        find_macro(t->label) >= 0 && search_opcode(t->operator) < 0) {
+        free(t->operand[0]);
+        t->operand[0] = t->operator;
+        t->operator = t->label;
+        t->label = strdup("");
+    }
+
+    if (macro_defining) {
+        if (is_code && !strcasecmp(t->operator, "MEND"))
+            macro_defining = NULL;
+        else if (is_code && !strcasecmp(t->operator, "MACRO")) {
+            diag("MACRO %s: 매크로 정의 안에서 다른 매크로를 정의할 수 없습니다.\n", macro_defining->name);
+            result = -1;
+        }
+        else
+            result = add_macro_line(t);
+    }
+    else if (is_code && !strcasecmp(t->operator, "MACRO"))
+        result = begin_macro(t);
+    else if (is_code && !strcasecmp(t->operator, "MEND")) {
+        diag("MEND: 대응하는 MACRO가 없습니다.\n");
+        result = -1;
+    }
+    else if (is_code && !strcasecmp(t->operator, "INCLUDE"))
+        result = splice_include(t, depth);
+    else if (is_code && find_macro(t->operator) >= 0)
+        result = expand_macro(find_macro(t->operator), t, depth);
+    else {
+        if (token_line >= MAX_LINES) {
+            diag("토큰 테이블이 가득 찼습니다. (MAX_LINES = %d)\n", MAX_LINES);
+            free_token(t);
+            return -1;
+        }
+        token_table[token_line++] = t;
+        return 0;
+    }
+    free_token(t);
+    return result;
+}
+
+/* tokenize_line 함수: 한 줄을 파싱하여 호출자가 준비한 토큰 t를 채운다.
+ - 반환: 토큰 생성 = 1, 빈 라인 = 0, 에러 < 0
+ - 토큰 테이블에 등록하지 않으므로 스트리밍 모드에서도 그대로 사용한다. */
+static int tokenize_line(char *str, token* t)
 {
     if (str == NULL) return -1;
 
@@ -257,19 +1344,14 @@ int token_parsing(char *str)
 
     // 3) 주석 라인
     if (str[0] == '.') {
-        token* t = calloc(1, sizeof(token));
-        if (!t) return -1;
         strncpy(t->comment, str, sizeof(t->comment)-1);
         t->label    = strdup("");
         t->operator = strdup("");
         t->operand[0] = strdup("");
-        token_table[token_line++] = t;
-        return 0;
+        return 1;
     }
 
     // 4) 일반 명령어/지시어 라인
-    token* t = calloc(1, sizeof(token));
-    if (!t) return -1;
     t->label      = strdup("");
     t->operator   = strdup("");
     t->operand[0] = strdup("");
@@ -285,6 +1367,12 @@ int token_parsing(char *str)
             // 첫 토큰: 지시어/명령어라면 operator, 아니면 label
             if (!strcasecmp(tok, "END")  ||
                 !strcasecmp(tok, "LTORG")||
+                !strcasecmp(tok, "BASE")||
+                !strcasecmp(tok, "NOBASE")||
+                !strcasecmp(tok, "USE")||
+                !strcasecmp(tok, "INCLUDE")||
+                !strcasecmp(tok, "MEND")||
+                find_macro(tok) >= 0 ||
                 !strcasecmp(tok, "EXTDEF")||
                 !strcasecmp(tok, "EXTREF")||
                 search_opcode(tok) >= 0 ||
@@ -328,12 +1416,10 @@ int token_parsing(char *str)
         free(t->label);
         free(t->operator);
         free(t->operand[0]);
-        free(t);
+        t->label = t->operator = t->operand[0] = NULL;
         return -1;
     }
-
-    token_table[token_line++] = t;
-    return 0;
+    return 1;
 }
 
 /* ----------------------------------------------------------------------------------
@@ -356,7 +1442,9 @@ int search_opcode(char *str)
         memmove(temp, temp+1, strlen(temp));
     }
     to_upper(temp);
+    STAT_LOOKUP(opcode);
     for (int i = 0; i < inst_index; i++) {
+        STAT_PROBE(opcode);
         if (strcasecmp(inst_table[i]->str, temp) == 0) {
             return inst_table[i]->op;
         }
@@ -374,7 +1462,9 @@ int get_instruction_length(char* op) {
         strncpy(temp, op+1, sizeof(temp)-1);
         temp[sizeof(temp)-1] = '\0';
         to_upper(temp);
+        STAT_LOOKUP(opcode);
         for (int i = 0; i < inst_index; i++) {
+            STAT_PROBE(opcode);
             if (strcasecmp(inst_table[i]-> str, temp) == 0) {
                 return 4;
             }
@@ -385,7 +1475,9 @@ int get_instruction_length(char* op) {
         strncpy(temp, op, sizeof(temp)-1);
         temp[sizeof(temp)-1] = '\0';
         to_upper(temp);
+        STAT_LOOKUP(opcode);
         for (int i = 0; i < inst_index; i++) {
+            STAT_PROBE(opcode);
             if (strcasecmp(inst_table[i]->str, temp) == 0) {
                 return inst_table[i]->format;
             }
@@ -420,11 +1512,51 @@ static int assem_pass1(void)
         }
         free(line_copy);
     }
+    if (macro_defining) {
+        diag("MACRO %s: MEND가 없습니다.\n", macro_defining->name);
+        return -1;
+    }
+
+    // 2) ~ 5) 주소 배정
+    if (layout_program() < 0)
+        return -1;
+
+    // 6) 라인마다 유효한 BASE 값 기록 (--auto-base면 여기서 골라 LDB/BASE를 끼워 넣는다)
+    int inserted = assign_base_registers(auto_base);
+    if (inserted < 0)
+        return -1;
+    if (inserted > 0) {
+        // 끼워 넣은 LDB만큼 뒤쪽 주소가 밀리므로 주소를 다시 배정한다. 이제 BASE 지시어가 구간을 덮는다
+        reset_layout();
+        if (layout_program() < 0 || assign_base_registers(0) < 0)
+            return -1;
+    }
 
+    // 7) PC relative와 BASE relative 어느 쪽으로도 닿지 않는 3형식 참조는 오류
+    if (check_displacements() < 0)
+        return -1;
+
+    // 8) 패스2에서 출력할 섹션 표시 (--gc-sections면 진입점에서 닿는 섹션만)
+    return mark_live_sections();
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : 토큰 테이블의 토큰마다 주소/섹션/블록을 배정하고 심볼/리터럴 테이블을 만든다.
+*        USE 블록 배치와 EQU 계산까지 마치면 모든 주소가 확정된다.
+* 매개 : 없음
+* 반환 : 정상 종료 = 0 , 에러 = < 0
+* 주의 : 다시 부르려면 먼저 reset_layout()으로 이전 결과를 비운다.
+* -----------------------------------------------------------------------------------
+*/
+static int layout_program(void)
+{
     // 2) 초기값 설정
     locctr = 0;
     literalPoolStart = 0;
+    literalFirstUse = -1;
     current_section = 1;
+    begin_blocks(current_section);
+    blocks_used = 0;
     literalPoolStartSec[current_section] = 0;   // 섹션 1은 0부터
     literalPoolEndSec[current_section] = 0;
     sectionStartAddr[current_section] = locctr;
@@ -432,179 +1564,526 @@ static int assem_pass1(void)
     // 3) 패스1 주요 루프: 각 토큰별로 주소 기록 및 locctr 증가
     for (int i = 0; i < token_line; i++) {
         token* t = token_table[i];
+        // --auto-ltorg: RESW/RESB 앞에 리터럴 풀을 먼저 넣는다
+        if (auto_pool_point(t, 0, i)) {
+            if (insert_auto_ltorg(i) < 0)
+                return -1;
+            t = token_table[i];
+        }
         // 3.1) 현재 locctr을 토큰의 주소로 저장
         t->addr = locctr;
         t->section = current_section;
+        t->block = current_block;
         locctr_table[i] = locctr;
 
-        // 3.2) 주석 라인
-        if (t->comment[0] == '.')
-            continue;
+        int result = pass1_token(t, i + 1);
+        if (result < 0)
+            return -1;
+        if (result > 0)
+            break;
+        // --auto-ltorg: 무조건 분기 뒤에 리터럴 풀을 넣는다
+        if (auto_pool_point(t, 1, i) && insert_auto_ltorg(i + 1) < 0)
+            return -1;
+    }
 
-        /// 3.3) START 지시어
-        if (!strcasecmp(t->operator, "START")) {
-            // 프로그램 시작 주소로 locctr 설정
-            locctr = (int)strtol(t->operand[0], NULL, 16);
-            sectionStartAddr[current_section] = locctr;
-
-            // ▶ START 다음에 label(COPY)이 있으면 symtab에 추가
-            if (strlen(t->label) > 0) {
-                strcpy(sym_table[label_num].symbol, t->label);
-                sym_table[label_num].addr    = locctr;
-                sym_table[label_num].section = current_section;
-                label_num++;
-            }
-            continue;
+    // 4) USE 블록을 섹션 안에서 차례로 배치해 블록 상대 주소를 섹션 주소로 바꾼다
+    if (blocks_used)
+        relocate_program_blocks();
+
+    // 5) 모든 주소가 확정된 뒤 EQU 심볼을 위상 정렬 순서로 계산
+    return resolve_equ_symbols();
+}
+
+/* reset_layout(): layout_program()이 만든 심볼/리터럴/EQU 테이블과 섹션별 주소 정보를 비운다 */
+static void reset_layout(void)
+{
+    memset(equ_pending, 0, sizeof(equ_pending));
+    memset(equ_absolute, 0, sizeof(equ_absolute));
+    memset(section_name, 0, sizeof(section_name));
+    memset(section_length, 0, sizeof(section_length));
+    memset(literalPoolStartSec, 0, sizeof(literalPoolStartSec));
+    memset(literalPoolEndSec, 0, sizeof(literalPoolEndSec));
+    memset(sectionStartAddr, 0, sizeof(sectionStartAddr));
+    memset(block_count, 0, sizeof(block_count));
+    label_num = 0;
+    memset(sym_slots, 0, sizeof(sym_slots));
+    memset(lit_slots, 0, sizeof(lit_slots));
+    literal_count = 0;
+    total_program_end = 0;
+    equ_count = 0;
+}
+
+/* add_symbol(): 심볼 테이블 끝에 심볼을 추가한다. 테이블이 가득 찼으면 진단을 출력하고 -1 */
+static int add_symbol(const char* name, int addr, int section, int block)
+{
+    if (label_num >= MAX_LINES) {
+        diag("심볼 테이블이 가득 찼습니다. (MAX_LINES = %d)\n", MAX_LINES);
+        return -1;
+    }
+    symbol* sym = &sym_table[label_num];
+    strcpy(sym->symbol, name);
+    sym->addr = addr;
+    sym->section = section;
+    sym->block = block;
+    unsigned int h = name_hash(sym->symbol, sizeof(sym->symbol)) % SYM_SLOTS;
+    while (sym_slots[h])
+        h = (h + 1) % SYM_SLOTS;
+    sym_slots[h] = label_num + 1;
+    return label_num++;
+}
+
+/* sym_lookup(): 이름으로 심볼을 찾는다. section > 0이면 그 섹션의 심볼만, 0이면 테이블 순서로 첫 번째 심볼.
+   같은 이름은 추가된 순서대로 탐사열에 놓이므로 선형 탐색과 같은 항목을 돌려준다. 못 찾으면 -1 */
+static int sym_lookup(const char* name, int section)
+{
+    STAT_LOOKUP(symbol);
+    for (unsigned int h = name_hash(name, strlen(name)) % SYM_SLOTS; sym_slots[h]; h = (h + 1) % SYM_SLOTS) {
+        STAT_PROBE(symbol);
+        int k = sym_slots[h] - 1;
+        if (!strcmp(sym_table[k].symbol, name) && (section <= 0 || sym_table[k].section == section))
+            return k;
+    }
+    return -1;
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : 패스1에서 토큰 하나를 처리하는 함수이다. 토큰의 주소/섹션은 호출자가 기록한다.
+*        심볼/리터럴 테이블 등록과 locctr 증가를 수행한다.
+* 매개 : 처리할 토큰, 진단 메시지에 쓸 라인 번호
+* 반환 : 계속 진행 = 0, END 도달 = 1, 에러 < 0
+* 주의 : 토큰 테이블을 참조하지 않으므로 스트리밍 모드에서도 그대로 사용한다.
+*        섹션 번호는 1부터 쓰므로 CSECT는 MAX_SECTIONS - 1개 섹션까지만 받는다.
+* -----------------------------------------------------------------------------------
+*/
+static int pass1_token(token* t, int line)
+{
+    // 3.2) 주석 라인
+    if (t->comment[0] == '.')
+        return 0;
+
+    /// 3.3) START 지시어
+    if (!strcasecmp(t->operator, "START")) {
+        // 프로그램 시작 주소로 locctr 설정
+        locctr = (int)strtol(t->operand[0], NULL, 16);
+        sectionStartAddr[current_section] = locctr;
+        strncpy(section_name[current_section], t->label, 6);
+
+        // ▶ START 다음에 label(COPY)이 있으면 symtab에 추가
+        if (strlen(t->label) > 0 && add_symbol(t->label, locctr, current_section, 0) < 0)
+            return -1;
+        return 0;
+    }
+
+    // 3.4) CSECT 지시어: 섹션 전환 및 리터럴 풀 처리
+    if (!strcasecmp(t->operator, "CSECT")) {
+        if (current_section + 1 >= MAX_SECTIONS) {
+            diag("%d행: CSECT %s: 섹션은 %d개까지만 쓸 수 있습니다. (MAX_SECTIONS = %d)\n",
+                 line, t->label, MAX_SECTIONS - 1, MAX_SECTIONS);
+            return -1;
         }
+        process_literal_pool();
+
+        // 이전 섹션의 리터럴 풀 종료 인덱스 기록
+        section_length[current_section] = locctr;
+        blocks[current_section][current_block].length = locctr;
+        literalPoolEndSec[current_section] = literal_count;
+
+        if (locctr > total_program_end)
+            total_program_end = locctr;
+
+        locctr = 0;
+        literalPoolStart = literal_count;
+        current_section++;
+        literalPoolStartSec[current_section] = literal_count;
+        sectionStartAddr[current_section] = 0;  // csect는 항상 0으로 리셋
+        strncpy(section_name[current_section], t->label, 6);
+        begin_blocks(current_section);
+
+        // ▶ CSECT 다음에 label(RDREC, WRREC)이 있으면 symtab에 추가
+        if (strlen(t->label) > 0 && add_symbol(t->label, locctr, current_section, 0) < 0)
+            return -1;
+
+        return 0;
+    }
 
-        // 3.4) CSECT 지시어: 섹션 전환 및 리터럴 풀 처리
-        if (!strcasecmp(t->operator, "CSECT")) {
-            process_literal_pool();
+    // LTORG 또는 END 시점에 리터럴 풀 처리
+    if (!strcasecmp(t->operator, "LTORG")) {
+        process_literal_pool();
+        literalPoolEndSec[current_section] = literal_count;
+        return 0;
+    }
+    if (!strcasecmp(t->operator, "END")) {
+        process_literal_pool();
+        literalPoolEndSec[current_section] = literal_count;
+        section_length[current_section] = locctr;
+        blocks[current_section][current_block].length = locctr;
+        return 1;
+    }
 
-            // 이전 섹션의 리터럴 풀 종료 인덱스 기록
-            section_length[current_section] = locctr;
-            literalPoolEndSec[current_section] = literal_count;
+    // USE 지시어: 프로그램 블록 전환 (블록마다 locctr를 따로 둔다)
+    if (!strcasecmp(t->operator, "USE"))
+        return use_block(t->operand[0]);
 
-            if (locctr > total_program_end)
-                total_program_end = locctr;
+    // 3.5) EQU, EXTDEF, EXTREF 등 기타 지시어 처리 및 심볼 테이블 등록
+    // EQU는 이 시점에 값을 계산하지 않고 의존 그래프 노드로만 기록한다.
+    // (뒤에서 정의되는 심볼을 참조할 수 있으므로 주소 패스가 끝난 뒤 resolve_equ_symbols()에서 계산)
+    if (!strcasecmp(t->operator, "EQU")) {
+        if (strlen(t->label) > 0) {
+            int k = add_symbol(t->label, 0, current_section, current_block);
+            if (k < 0 || add_equ_node(k, t) < 0)
+                return -1;
+        }
+        return 0;
+    }
+    if (!strcasecmp(t->operator, "EXTDEF") || !strcasecmp(t->operator, "EXTREF"))
+        return 0;
 
-            locctr = 0;
-            literalPoolStart = literal_count;
-            current_section++;
-            literalPoolStartSec[current_section] = literal_count;
-            sectionStartAddr[current_section] = 0;  // csect는 항상 0으로 리셋
+    // 3.6) 라벨이 있으면 심볼 테이블에 추가 (같은 섹션 내에서만 중복 체크)
+    if (strlen(t->label) > 0) {
+        int exists = sym_lookup(t->label, current_section) >= 0;
+        if (!exists && add_symbol(t->label, t->addr, current_section, current_block) < 0)
+            return -1;
+    }
 
-            // ▶ CSECT 다음에 label(RDREC, WRREC)이 있으면 symtab에 추가
-            if (strlen(t->label) > 0) {
-                strcpy(sym_table[label_num].symbol, t->label);
-                sym_table[label_num].addr    = locctr;
-                sym_table[label_num].section = current_section;
-                label_num++;
+    // 3.7) 리터럴 수집: operand가 '='로 시작하면 리터럴 테이블에 등록 (TD/WD는 수집 안함)
+    //      --auto-ltorg면 이미 배치된 같은 리터럴이 다른 섹션이거나 PC relative 범위 밖일 때 새로 만든다
+    if (t->operand[0] && t->operand[0][0] == '=') {
+        int j = find_literal(t->operand[0], current_section, t->addr);
+        if (j >= 0 && auto_ltorg && literal_table[j].addr != -1) {
+            int disp = literal_table[j].addr - (t->addr + 3);
+            if (literal_table[j].section != current_section || literal_table[j].block != current_block ||
+                disp < -2048 || disp > 2047)
+                j = -1;
+        }
+        if (j < 0) {
+            if (literal_count >= MAX_LINES) {
+                diag("리터럴 테이블이 가득 찼습니다. (MAX_LINES = %d)\n", MAX_LINES);
+                return -1;
             }
+            strcpy(literal_table[literal_count].symbol, t->operand[0]);
+            literal_table[literal_count].addr = -1;
+            literal_table[literal_count].section = 0;
+            unsigned int h = name_hash(t->operand[0], strlen(t->operand[0])) % SYM_SLOTS;
+            while (lit_slots[h])
+                h = (h + 1) % SYM_SLOTS;
+            lit_slots[h] = literal_count + 1;
+            j = literal_count++;
+        }
+        if (literal_table[j].addr == -1 && literalFirstUse < 0) {
+            literalFirstUse = t->addr;
+            literalFirstBlock = current_block;
+        }
+    }
 
-            continue;
+    // 3.x) BASE, NOBASE 지시어: 주소를 차지하지 않는다. 값은 주소가 모두 확정된 뒤 패스2 쪽에서 정한다
+    if (!strcasecmp(t->operator, "BASE") || !strcasecmp(t->operator, "NOBASE"))
+        return 0;
+
+    // 3.8) 지시어/명령어 길이만큼 locctr 증가
+    if (!strcasecmp(t->operator, "LTORG"))        process_literal_pool();
+    else if (!strcasecmp(t->operator, "END")) { 
+        process_literal_pool(); 
+        section_length[current_section] = locctr;
+        return 1;
+    }
+    else
+        locctr += token_size(t);
+    return 0;
+}
+
+/* token_size(): 지시어/명령어가 차지하는 바이트 수 (WORD, RESW, RESB, BYTE, 형식 1~4 명령어) */
+static int token_size(token* t)
+{
+    if (!strcasecmp(t->operator, "WORD"))              return 3;
+    else if (!strcasecmp(t->operator, "RESW"))         return 3 * atoi(t->operand[0]);
+    else if (!strcasecmp(t->operator, "RESB"))         return atoi(t->operand[0]);
+    else if (!strcasecmp(t->operator, "BYTE")) {
+        char *start = strchr(t->operand[0], '\'');
+        char *end   = strrchr(t->operand[0], '\'');
+        if (start && end && end>start) {
+            if (toupper((unsigned char)t->operand[0][0]) == 'C')
+                return end - start - 1;
+            else  // X
+                return (end - start - 1 + 1) / 2;
         }
+        return 0;
+    }
+    return get_instruction_length(t->operator);   // 형식 1~4 명령어
+}
 
-        // LTORG 또는 END 시점에 리터럴 풀 처리
-        if (!strcasecmp(t->operator, "LTORG")) {
-            process_literal_pool();
-            literalPoolEndSec[current_section] = literal_count;
+/* ----------------------------------------------------------------------------------
+* 설명 : EQU 정의 하나를 의존 그래프의 노드로 등록하는 함수이다.
+*        피연산자 식은 여기서 한 번만 항(term) 단위로 분해해 두고,
+*        실제 값 계산은 resolve_equ_symbols()에서 한 번만 수행한다.
+* 매개 : 심볼 테이블 인덱스, EQU 토큰
+* 반환 : 정상종료 = 0, 에러 < 0
+* 주의 : '*'는 EQU 라인의 주소로 바로 치환한다.
+* -----------------------------------------------------------------------------------
+*/
+static int add_equ_node(int sym_idx, token* t)
+{
+    equ_node* node = &equ_nodes[equ_count];
+    node->sym = sym_idx;
+    strncpy(node->expr, t->operand[0], sizeof(node->expr) - 1);
+    node->expr[sizeof(node->expr) - 1] = '\0';
+    node->term_count = 0;
+    node->resolved = 0;
+    equ_pending[sym_idx] = 1;
+
+    const char* p = t->operand[0];
+    int sign = 1;
+    while (*p) {
+        if (*p == '+' || *p == '-') {
+            sign = (*p == '-') ? -1 : 1;
+            p++;
             continue;
         }
-        if (!strcasecmp(t->operator, "END")) {
-            process_literal_pool();
-            literalPoolEndSec[current_section] = literal_count;
-            section_length[current_section] = locctr;
+        if (node->term_count >= MAX_EQU_TERMS) {
+            diag("EQU %s: 식의 항이 너무 많습니다. (%s)\n", t->label, t->operand[0]);
+            return -1;
+        }
+        equ_term* term = &node->terms[node->term_count];
+        term->sign = sign;
+        term->sym = -1;
+        term->name[0] = '\0';
+        term->value = 0;
+        term->block = -1;
+        if (*p == '*') {
+            // 현재 주소 (블록 배치 후 블록 시작 주소를 더한다)
+            term->value = t->addr;
+            term->block = current_block;
+            p++;
+        } else if (isdigit((unsigned char)*p)) {
+            // 상수(16진수)
+            char* end;
+            term->value = (int)strtol(p, &end, 16);
+            p = end;
+        } else {
+            // 심볼 이름: 이름만 저장해 두고 주소 패스 이후에 참조를 연결한다.
+            int len = strcspn(p, "+-");
+            if (len >= (int)sizeof(term->name))
+                len = sizeof(term->name) - 1;
+            strncpy(term->name, p, len);
+            term->name[len] = '\0';
+            p += strcspn(p, "+-");
+        }
+        node->term_count++;
+        sign = 1;
+    }
+    equ_count++;
+    return 0;
+}
+
+/* mark_equ_absolute(): 계산이 끝난 EQU의 재배치 여부를 기록한다.
+   '*'와 절대값이 아닌 심볼 항의 부호 합이 0이면(상수, BUFEND-BUFFER 등) 절대값이다 */
+static void mark_equ_absolute(const equ_node* node)
+{
+    int weight = 0;
+    for (int k = 0; k < node->term_count; k++) {
+        const equ_term* term = &node->terms[k];
+        if (term->sym >= 0)
+            weight += equ_absolute[term->sym] ? 0 : term->sign;
+        else if (term->block >= 0)
+            weight += term->sign;
+    }
+    equ_absolute[node->sym] = weight == 0;
+}
+
+/* begin_blocks(): 새 섹션을 기본 블록 하나로 시작한다 */
+static void begin_blocks(int section)
+{
+    memset(&blocks[section][0], 0, sizeof(program_block));
+    block_count[section] = 1;
+    current_block = 0;
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : USE 지시어로 현재 섹션의 프로그램 블록을 바꾼다. 지금 블록의 locctr를 저장하고
+*        name 블록(처음이면 새로 만든다)의 locctr에서 이어서 주소를 배정한다.
+* 매개 : 블록 이름 ("" = 기본 블록)
+* 반환 : 정상종료 = 0, 블록이 너무 많으면 < 0
+* -----------------------------------------------------------------------------------
+*/
+static int use_block(const char* name)
+{
+    program_block* list = blocks[current_section];
+    list[current_block].length = locctr;
+
+    int b;
+    for (b = 0; b < block_count[current_section]; b++)
+        if (!strcmp(list[b].name, name))
             break;
+    if (b == block_count[current_section]) {
+        if (b >= MAX_BLOCKS) {
+            diag("USE %s: 프로그램 블록이 너무 많습니다. (MAX_BLOCKS = %d)\n", name, MAX_BLOCKS);
+            return -1;
         }
+        memset(&list[b], 0, sizeof(program_block));
+        snprintf(list[b].name, sizeof(list[b].name), "%s", name);
+        block_count[current_section]++;
+    }
+    current_block = b;
+    locctr = list[b].length;
+    blocks_used = 1;
+    return 0;
+}
 
-        // 3.5) EQU, EXTDEF, EXTREF 등 기타 지시어 처리 및 심볼 테이블 등록
-        if (!strcasecmp(t->operator, "EQU")) {
-            int value = 0;
-            // 1) '*' 이면 현재 주소
-            if (strcmp(t->operand[0], "*") == 0) {
-                value = t->addr;
-            }
-            // 2) 'SYM1-SYM2' 형태이면 두 심볼의 차이
-            else if (strchr(t->operand[0], '-') != NULL) {
-                char left[32] = {0}, right[32] = {0};
-                sscanf(t->operand[0], "%[^-]-%s", left, right);
-                int leftVal = -1, rightVal = -1;
-                for (int k = 0; k < label_num; k++) {
-                    if (strcmp(sym_table[k].symbol, left) == 0)
-                        leftVal = sym_table[k].addr;
-                    if (strcmp(sym_table[k].symbol, right) == 0)
-                        rightVal = sym_table[k].addr;
-                }
-                if (leftVal != -1 && rightVal != -1)
-                    value = leftVal - rightVal;
-            }
-            // 3) 그 외는 상수(16진수)로 파싱
-            else {
-                value = (int)strtol(t->operand[0], NULL, 16);
-            }
+/* ----------------------------------------------------------------------------------
+* 설명 : 패스1이 끝난 뒤 섹션마다 블록을 처음 나온 순서대로 이어 붙이고,
+*        블록 상대 주소로 기록된 토큰/심볼/리터럴/EQU '*' 값을 섹션 주소로 바꾼다.
+*        섹션 길이는 블록 길이의 합이 된다.
+* 매개 : 없음
+* 반환 : 없음
+* 주의 : EQU 심볼은 resolve_equ_symbols()가 바뀐 주소로 다시 계산하므로 건너뛴다.
+* -----------------------------------------------------------------------------------
+*/
+static void relocate_program_blocks(void)
+{
+    blocks[current_section][current_block].length = locctr;   // END가 없어도 마지막 블록 길이를 남긴다
+    for (int sec = 1; sec <= current_section; sec++) {
+        int next = blocks[sec][0].length;
+        blocks[sec][0].start = 0;
+        for (int b = 1; b < block_count[sec]; b++) {
+            blocks[sec][b].start = next;
+            next += blocks[sec][b].length;
+        }
+        section_length[sec] = next;
+    }
 
-            if (strlen(t->label) > 0) {
-                strcpy(sym_table[label_num].symbol, t->label);
-                sym_table[label_num].addr    = value;
-                sym_table[label_num].section = current_section;
-                label_num++;
-            }
-            continue;
-        }        if (!strcasecmp(t->operator, "EXTDEF") || !strcasecmp(t->operator, "EXTREF"))
-            continue;
+    for (int i = 0; i < token_line; i++) {
+        token* t = token_table[i];
+        t->addr += blocks[t->section][t->block].start;
+        locctr_table[i] = t->addr;
+    }
+    for (int k = 0; k < label_num; k++)
+        if (!equ_pending[k])
+            sym_table[k].addr += blocks[sym_table[k].section][sym_table[k].block].start;
+    for (int j = 0; j < literal_count; j++)
+        if (literal_table[j].addr != -1)
+            literal_table[j].addr += blocks[literal_table[j].section][literal_table[j].block].start;
+    for (int n = 0; n < equ_count; n++) {
+        int sec = sym_table[equ_nodes[n].sym].section;
+        for (int k = 0; k < equ_nodes[n].term_count; k++) {
+            equ_term* term = &equ_nodes[n].terms[k];
+            if (term->block > 0)
+                term->value += blocks[sec][term->block].start;
+        }
+    }
+}
 
-        // 3.6) 라벨이 있으면 심볼 테이블에 추가 (같은 섹션 내에서만 중복 체크)
-        if (strlen(t->label) > 0) {
-            int exists = 0;
-            for (int s = 0; s < label_num; s++) {
-                if (!strcmp(sym_table[s].symbol, t->label) 
-                    && sym_table[s].section == current_section) {
-                    exists = 1;
-                    break;
-                }
-            }
-            if (!exists) {
-                strcpy(sym_table[label_num].symbol, t->label);
-                sym_table[label_num].addr    = t->addr;
-                sym_table[label_num].section = current_section;
-                label_num++;
-            }
+/* 같은 섹션의 심볼을 우선 찾고, 없으면 다른 섹션의 심볼을 찾는다. 못 찾으면 -1 */
+static int find_symbol(const char* name, int section)
+{
+    int k = sym_lookup(name, section);
+    return (k >= 0) ? k : sym_lookup(name, 0);
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : 주소 패스가 끝난 뒤 EQU 심볼들을 의존 관계에 맞춰 위상 정렬 순서로 계산하는 함수이다.
+*        각 식은 정확히 한 번만 계산되며, 결과는 sym_table의 해당 항목에 기록된다.
+* 매개 : 없음
+* 반환 : 정상종료 = 0, 정의되지 않은 심볼 혹은 순환 참조가 있으면 < 0
+* 주의 : 오류는 모두 보고한 뒤에 실패를 반환한다.
+* -----------------------------------------------------------------------------------
+*/
+static int resolve_equ_symbols(void)
+{
+    static int equ_of_sym[MAX_LINES];   // 심볼 인덱스 -> EQU 노드 번호 (-1: EQU 아님)
+    static int indegree[MAX_LINES];
+    static int order[MAX_LINES];
+    static int edge_start[MAX_LINES + 1];
+    static int edge_to[MAX_LINES * MAX_EQU_TERMS];
+    int errors = 0;
+
+    for (int k = 0; k < label_num; k++)
+        equ_of_sym[k] = -1;
+    int pending = 0;   // 아직 계산되지 않은 노드 수
+    for (int n = 0; n < equ_count; n++)
+        if (!equ_nodes[n].resolved) {
+            equ_of_sym[equ_nodes[n].sym] = n;
+            pending++;
         }
 
-        // 3.7) 리터럴 수집: operand가 '='로 시작하면 리터럴 테이블에 등록 (TD/WD는 수집 안함)
-        if (t->operand[0] && t->operand[0][0] == '=') {
-            int found = 0;
-            for (int j = 0; j < literal_count; j++)
-                if (!strcmp(literal_table[j].symbol, t->operand[0])) { found = 1; break; }
-            if (!found) {
-                strcpy(literal_table[literal_count].symbol, t->operand[0]);
-                literal_table[literal_count].addr = -1;
-                literal_count++;
+    // 1) 심볼 참조 연결 및 진입 차수 계산 (이미 계산된 노드는 값으로만 취급)
+    for (int n = 0; n < equ_count; n++) {
+        equ_node* node = &equ_nodes[n];
+        int section = sym_table[node->sym].section;
+        indegree[n] = 0;
+        if (node->resolved)
+            continue;
+        for (int k = 0; k < node->term_count; k++) {
+            equ_term* term = &node->terms[k];
+            if (term->name[0] == '\0')
+                continue;
+            term->sym = find_symbol(term->name, section);
+            if (term->sym < 0) {
+                diag("EQU %s: 정의되지 않은 심볼 '%s'을(를) 참조합니다.\n",
+                       sym_table[node->sym].symbol, term->name);
+                errors++;
+            } else if (equ_of_sym[term->sym] >= 0) {
+                indegree[n]++;
             }
         }
+    }
 
-        // 3.x) BASE, NOBASE 지시어 처리
-        if (!strcasecmp(t->operator, "BASE")) {
-            // sym_table에서 t->operand[0] 심볼의 addr 찾아서 base에 저장
-            for (int k = 0; k < label_num; k++) {
-                if (!strcmp(sym_table[k].symbol, t->operand[0])) {
-                    base = sym_table[k].addr;
-                    break;
-                }
-            }
-            continue;
+    // 간선 목록 구성: 참조되는 노드 -> 참조하는 노드
+    for (int n = 0; n <= equ_count; n++)
+        edge_start[n] = 0;
+    for (int n = 0; n < equ_count; n++)
+        for (int k = 0; k < equ_nodes[n].term_count && !equ_nodes[n].resolved; k++) {
+            int sym = equ_nodes[n].terms[k].sym;
+            if (sym >= 0 && equ_of_sym[sym] >= 0)
+                edge_start[equ_of_sym[sym] + 1]++;
         }
-        if (!strcasecmp(t->operator, "NOBASE")) {
-            base = 0;
-            continue;
+    for (int n = 0; n < equ_count; n++)
+        edge_start[n + 1] += edge_start[n];
+    for (int n = 0; n < equ_count; n++)
+        order[n] = edge_start[n];   // 채워 넣을 위치로 임시 사용
+    for (int n = 0; n < equ_count; n++)
+        for (int k = 0; k < equ_nodes[n].term_count && !equ_nodes[n].resolved; k++) {
+            int sym = equ_nodes[n].terms[k].sym;
+            if (sym >= 0 && equ_of_sym[sym] >= 0)
+                edge_to[order[equ_of_sym[sym]]++] = n;
         }
 
-        // 3.8) 지시어/명령어 길이만큼 locctr 증가
-        if (!strcasecmp(t->operator, "WORD"))              locctr += 3;
-        else if (!strcasecmp(t->operator, "RESW")) { int n=atoi(t->operand[0]); locctr += 3*n; }
-        else if (!strcasecmp(t->operator, "RESB")) { int n=atoi(t->operand[0]); locctr += n; }
-        else if (!strcasecmp(t->operator, "BYTE")) {
-            char *start = strchr(t->operand[0], '\'');
-            char *end   = strrchr(t->operand[0], '\'');
-            if (start && end && end>start) {
-                if (toupper((unsigned char)t->operand[0][0]) == 'C')
-                    locctr += end - start - 1;
-                else  // X
-                    locctr += (end - start - 1 + 1) / 2;
-            }
+    // 2) 진입 차수가 0인 노드부터 차례로 계산 (Kahn 알고리즘)
+    int head = 0, tail = 0;
+    for (int n = 0; n < equ_count; n++)
+        if (!equ_nodes[n].resolved && indegree[n] == 0)
+            order[tail++] = n;
+    while (head < tail) {
+        equ_node* node = &equ_nodes[order[head++]];
+        int value = 0;
+        for (int k = 0; k < node->term_count; k++) {
+            equ_term* term = &node->terms[k];
+            int v = (term->sym >= 0) ? sym_table[term->sym].addr : term->value;
+            value += term->sign * v;
         }
-        else if (!strcasecmp(t->operator, "LTORG"))        process_literal_pool();
-        else if (!strcasecmp(t->operator, "END")) { 
-            process_literal_pool(); 
-            section_length[current_section] = locctr;
-            break;
+        sym_table[node->sym].addr = value;
+        node->resolved = 1;
+        equ_pending[node->sym] = 0;
+        mark_equ_absolute(node);
+
+        // 이 노드를 참조하는 노드들의 진입 차수 감소
+        int from = equ_of_sym[node->sym];
+        for (int e = edge_start[from]; e < edge_start[from + 1]; e++) {
+            if (--indegree[edge_to[e]] == 0)
+                order[tail++] = edge_to[e];
         }
-        else {                                            // 형식 1~4 명령어
-            locctr += get_instruction_length(t->operator);
+    }
+
+    // 3) 남은 노드는 순환 참조에 속한다
+    if (tail < pending) {
+        for (int n = 0; n < equ_count; n++) {
+            if (indegree[n] > 0) {
+                diag("EQU %s: 순환 참조가 있어 값을 결정할 수 없습니다. (%s)\n",
+                       sym_table[equ_nodes[n].sym].symbol,
+                       equ_nodes[n].expr);
+            }
         }
+        errors++;
     }
-    return 0;
+    return (errors > 0) ? -1 : 0;
 }
 
 /* ----------------------------------------------------------------------------------
@@ -622,7 +2101,7 @@ static int assem_pass1(void)
 void make_opcode_output(char *file_name)
 {
     FILE* fp;
-    if (file_name == NULL)
+    if (file_name == NULL || !strcmp(file_name, "-"))
         fp = stdout;
     else {
         fp = fopen(file_name, "w");
@@ -632,30 +2111,354 @@ void make_opcode_output(char *file_name)
         }
     }
     
+    for (int i = 0; i < token_line; i++)
+        write_opcode_line(fp, token_table[i]);
+    if (fp != stdout)
+        fclose(fp);
+}
+
+/* write_opcode_line(): 토큰 한 줄을 label, operator, operand, opcode 순으로 출력 */
+static void write_opcode_line(FILE* fp, token* t)
+{
+    if (t->comment[0] == '.') {
+        fprintf(fp, "%s\n", t->comment);
+        return;
+    }
+    if (t->label && strlen(t->label) > 0)
+        fprintf(fp, "%-8s", t->label);
+    else
+        fprintf(fp, "\t");
+    if (t->operator && strlen(t->operator) > 0)
+        fprintf(fp, "%-8s", t->operator);
+    else fprintf(fp, "\t");
+    if (t->operand[0] && strlen(t->operand[0]) > 0)
+        fprintf(fp, "%-16s", t->operand[0]);
+    else
+        fprintf(fp, "\t");
+    int opcode = search_opcode(t->operator);
+    if (opcode >= 0)
+        fprintf(fp, "\t%02X", opcode);
+    fprintf(fp, "\n");
+}
+
+/* ------------------- 전체 리스트 (--full-listing) ------------------- */
+/* 교차 참조용 이름 해시. 심볼/리터럴 이름 -> 테이블 인덱스 (선형 탐사) */
+typedef struct _name_index {
+    int* slots;     // -1: 빈 칸
+    int mask;
+    symbol* table;
+} name_index;
+
+static unsigned int name_hash(const char* s, int len)
+{
+    unsigned int h = 2166136261u;
+    for (int k = 0; k < len && s[k]; k++)
+        h = (h ^ (unsigned char)s[k]) * 16777619u;
+    return h;
+}
+
+/* ni_build(): table[0..count)을 이름으로 색인한다. 같은 이름은 테이블 순서대로 탐사열에 놓인다 */
+static int ni_build(name_index* ni, symbol* table, int count)
+{
+    int size = 16;
+    while (size < count * 2)
+        size <<= 1;
+    ni->slots = malloc(sizeof(int) * size);
+    if (!ni->slots)
+        return -1;
+    memset(ni->slots, 0xFF, sizeof(int) * size);
+    ni->mask = size - 1;
+    ni->table = table;
+    for (int k = 0; k < count; k++) {
+        unsigned int h = name_hash(table[k].symbol, sizeof(table[k].symbol)) & ni->mask;
+        while (ni->slots[h] >= 0)
+            h = (h + 1) & ni->mask;
+        ni->slots[h] = k;
+    }
+    return 0;
+}
+
+/* ni_find(): 이름이 len 글자인 항목을 찾는다. section > 0이면 같은 섹션을 우선한다 (find_symbol과 같은 규칙) */
+static int ni_find(const name_index* ni, const char* name, int len, int section)
+{
+    int first = -1;
+    for (unsigned int h = name_hash(name, len) & ni->mask; ni->slots[h] >= 0; h = (h + 1) & ni->mask) {
+        const symbol* e = &ni->table[ni->slots[h]];
+        if (strncmp(e->symbol, name, len) || e->symbol[len] != '\0')
+            continue;
+        if (section <= 0 || e->section == section)
+            return ni->slots[h];
+        if (first < 0)
+            first = ni->slots[h];
+    }
+    return first;
+}
+
+/* 교차 참조 항목: 심볼(혹은 리터럴) 인덱스와 참조한 리스트 라인 번호 */
+typedef struct _xref {
+    int index;
+    int line;
+} xref;
+
+typedef struct _xref_list {
+    xref* items;
+    int count;
+    int cap;
+} xref_list;
+
+static void xref_add(xref_list* l, int index, int line)
+{
+    if (l->count == l->cap) {
+        int cap = l->cap ? l->cap * 2 : 256;
+        xref* grown = realloc(l->items, sizeof(xref) * cap);
+        if (!grown)
+            return;
+        l->items = grown;
+        l->cap = cap;
+    }
+    l->items[l->count].index = index;
+    l->items[l->count].line = line;
+    l->count++;
+}
+
+/* collect_refs(): 토큰 operand에서 심볼/리터럴 참조를 찾아 교차 참조 목록에 넣는다 */
+static void collect_refs(token* t, int line, const name_index* syms, const name_index* lits,
+                         xref_list* sym_refs, xref_list* lit_refs)
+{
+    const char* p = t->operand[0];
+    if (!p || !*p)
+        return;
+    if (p[0] == '=') {
+        int j = ni_find(lits, p, strlen(p), 0);
+        if (j >= 0)
+            xref_add(lit_refs, j, line);
+        return;
+    }
+    if ((toupper((unsigned char)p[0]) == 'C' || toupper((unsigned char)p[0]) == 'X') && p[1] == '\'')
+        return;     // BYTE 상수
+    while (*p) {
+        if (!isalpha((unsigned char)*p) && *p != '$') {     // $: 매크로 확장 라벨
+            p++;
+            continue;
+        }
+        int len = (*p == '$');
+        while (isalnum((unsigned char)p[len]) || p[len] == '_')
+            len++;
+        int k = ni_find(syms, p, len, t->section);
+        if (k >= 0)
+            xref_add(sym_refs, k, line);
+        p += len;
+    }
+}
+
+/* group_refs(): 참조 목록을 인덱스별로 묶는다 (계수 정렬). start[k]..start[k+1]가 k의 참조 */
+static int* group_refs(xref_list* l, int count, int** lines_out)
+{
+    int* start = calloc(count + 1, sizeof(int));
+    int* lines = malloc(sizeof(int) * (l->count + 1));
+    if (!start || !lines) {
+        free(start);
+        free(lines);
+        return NULL;
+    }
+    for (int r = 0; r < l->count; r++)
+        start[l->items[r].index + 1]++;
+    for (int k = 0; k < count; k++)
+        start[k + 1] += start[k];
+    int* fill = malloc(sizeof(int) * (count + 1));
+    if (!fill) {
+        free(start);
+        free(lines);
+        return NULL;
+    }
+    memcpy(fill, start, sizeof(int) * (count + 1));
+    for (int r = 0; r < l->count; r++)     // 라인 순서로 모았으므로 안정 정렬이 된다
+        lines[fill[l->items[r].index]++] = l->items[r].line;
+    free(fill);
+    *lines_out = lines;
+    return start;
+}
+
+/* write_ref_lines(): 참조 라인 번호를 한 줄에 10개씩 출력 */
+static void write_ref_lines(FILE* fp, const int* lines, int from, int to)
+{
+    for (int r = from; r < to; r++) {
+        if (r > from && (r - from) % 10 == 0)
+            fprintf(fp, "\n%33s", "");
+        fprintf(fp, " %6d", lines[r]);
+    }
+    fprintf(fp, "\n");
+}
+
+/* write_pool_lines(): LTORG/CSECT/END 토큰 t에 배치된 리터럴 풀을 리스트 라인으로 출력 */
+static void write_pool_lines(FILE* fp, token* t)
+{
+    for (int j = t->lit_start; j < t->lit_end; j++) {
+        char obj[130];
+        literal_object(j, obj);
+        fprintf(fp, "%5s  %04X  %-8s %-8s %-18s %s\n", "",
+                (literal_table[j].addr - sectionStartAddr[t->section]) & 0xFFFF,
+                "*", "", literal_table[j].symbol, obj);
+    }
+}
+
+/* nixbpe_string(): 6비트 nixbpe를 "110010" 형태로 만든다 */
+static void nixbpe_string(int bits, char* out)
+{
+    for (int k = 0; k < 6; k++)
+        out[k] = (bits >> (5 - k)) & 1 ? '1' : '0';
+    out[6] = '\0';
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : 패스2가 끝난 뒤 전체 리스트를 파일에 출력하는 함수이다.
+*        라인마다 라인 번호, 섹션 상대 주소, 소스, 최종 오브젝트 코드, nixbpe 플래그를 쓰고
+*        LTORG/END 위치에는 그곳에 배치된 리터럴을 덧붙이고, CSECT에서 배치된 리터럴은
+*        이전 섹션의 끝이므로 CSECT 라인 앞에 쓴다.
+*        끝에는 심볼과 리터럴의 교차 참조(정의 라인, 참조 라인)를 출력한다.
+* 매개 : 생성할 리스트 파일명 ("-" 혹은 NULL이면 stdout)
+* 반환 : 없음
+* 주의 : 오브젝트 코드와 nixbpe는 패스2가 토큰에 남긴 값(t->obj, t->nixbpe)을 그대로 쓴다.
+*        참조 검색은 이름 해시로 하므로 라인 수에 비례하는 시간이 걸린다.
+* -----------------------------------------------------------------------------------
+*/
+void make_listing_output(char* file_name)
+{
+    FILE* fp = open_output(file_name ? file_name : "-", "listing");
+    if (!fp)
+        return;
+    if (fp != stdout)
+        setvbuf(fp, NULL, _IOFBF, 1 << 20);
+
+    name_index syms, lits;
+    if (ni_build(&syms, sym_table, label_num) < 0 || ni_build(&lits, literal_table, literal_count) < 0) {
+        perror("Error building listing index");
+        close_stream(fp);
+        return;
+    }
+    int* def_line = malloc(sizeof(int) * (label_num + 1));
+    xref_list sym_refs = {0}, lit_refs = {0};
+    for (int k = 0; k < label_num; k++)
+        def_line[k] = 0;
+
+    fprintf(fp, "%5s  %-4s  %-8s %-8s %-18s %-8s  %s\n",
+            "LINE", "LOC", "LABEL", "OPERATOR", "OPERAND", "OBJECT", "NIXBPE");
     for (int i = 0; i < token_line; i++) {
         token* t = token_table[i];
+        int line = i + 1;
         if (t->comment[0] == '.') {
-            fprintf(fp, "%s\n", t->comment);
+            fprintf(fp, "%5d        %s\n", line, t->comment);
             continue;
         }
-        if (t->label && strlen(t->label) > 0)
-            fprintf(fp, "%-8s", t->label);
-        else
-            fprintf(fp, "\t");
-        if (t->operator && strlen(t->operator) > 0)
-            fprintf(fp, "%-8s", t->operator);
-        else fprintf(fp, "\t");
-        if (t->operand[0] && strlen(t->operand[0]) > 0)
-            fprintf(fp, "%-16s", t->operand[0]);
-        else
-            fprintf(fp, "\t");
-        int opcode = search_opcode(t->operator);
-        if (opcode >= 0)
-            fprintf(fp, "\t%02X", opcode);
-        fprintf(fp, "\n");
+
+        const char* op = t->operator ? t->operator : "";
+        int has_loc = op[0] && strcasecmp(op, "END") && strcasecmp(op, "EXTDEF") &&
+                      strcasecmp(op, "EXTREF") && strcasecmp(op, "BASE") &&
+                      strcasecmp(op, "NOBASE") && strcasecmp(op, "LTORG") && strcasecmp(op, "USE");
+        // CSECT 토큰에는 이전 섹션의 주소/번호가 기록되어 있으므로 새 섹션 기준으로 바꾼다
+        int is_csect = !strcasecmp(op, "CSECT");
+        int section = is_csect ? t->section + 1 : t->section;
+        char loc[8] = "";
+        if (has_loc)
+            snprintf(loc, sizeof(loc), "%04X", is_csect ? 0 : t->addr & 0xFFFF);
+        if (!strcasecmp(op, "EQU") && t->label[0]) {
+            int k = ni_find(&syms, t->label, strlen(t->label), t->section);
+            if (k >= 0)
+                snprintf(loc, sizeof(loc), "%04X", sym_table[k].addr & 0xFFFF);
+        }
+        char flags[8] = "";
+        if (t->obj && t->nixbpe)
+            nixbpe_string(t->nixbpe, flags);
+        // CSECT에 배치된 리터럴은 이전 섹션의 끝이므로 CSECT 라인 앞에 쓴다
+        if (is_csect)
+            write_pool_lines(fp, t);
+        fprintf(fp, "%5d  %-4s  %-8s %-8s %-18s %-8s  %s\n", line, loc, t->label, op,
+                t->operand[0] ? t->operand[0] : "", t->obj ? t->obj : "", flags);
+        if (!is_csect)
+            write_pool_lines(fp, t);
+
+        if (t->label[0] && strcasecmp(op, "EXTREF")) {
+            int k = ni_find(&syms, t->label, strlen(t->label), section);
+            if (k >= 0 && sym_table[k].section == section && !def_line[k])
+                def_line[k] = line;
+        }
+        collect_refs(t, line, &syms, &lits, &sym_refs, &lit_refs);
+    }
+
+    int *sym_lines = NULL, *lit_lines = NULL;
+    int* sym_start = group_refs(&sym_refs, label_num, &sym_lines);
+    int* lit_start = group_refs(&lit_refs, literal_count, &lit_lines);
+    if (sym_start && lit_start) {
+        fprintf(fp, "\nSYMBOL CROSS-REFERENCE\n%-8s  %3s  %-6s  %7s  %s\n",
+                "NAME", "SEC", "VALUE", "DEFINED", "REFERENCES");
+        for (int k = 0; k < label_num; k++) {
+            fprintf(fp, "%-8s  %3d  %06X  %7d ", sym_table[k].symbol, sym_table[k].section,
+                    sym_table[k].addr & 0xFFFFFF, def_line[k]);
+            write_ref_lines(fp, sym_lines, sym_start[k], sym_start[k + 1]);
+        }
+        fprintf(fp, "\nLITERAL CROSS-REFERENCE\n%-8s  %3s  %-6s  %7s  %s\n",
+                "NAME", "", "ADDR", "", "REFERENCES");
+        for (int j = 0; j < literal_count; j++) {
+            fprintf(fp, "%-8s  %3s  %06X  %7s ", literal_table[j].symbol, "",
+                    literal_table[j].addr & 0xFFFFFF, "");
+            write_ref_lines(fp, lit_lines, lit_start[j], lit_start[j + 1]);
+        }
     }
+
+    free(sym_start);
+    free(lit_start);
+    free(sym_lines);
+    free(lit_lines);
+    free(sym_refs.items);
+    free(lit_refs.items);
+    free(def_line);
+    free(syms.slots);
+    free(lits.slots);
+    close_stream(fp);
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : 오브젝트 프로그램의 주소를 소스 라인으로 되돌리는 맵을 출력한다 (--line-map).
+*        출력한 섹션마다 "S 이름 길이", 오브젝트 코드가 있는 라인마다
+*        "L 주소 길이 라인번호 LABEL OPERATOR OPERAND"를 탭으로 나눠 쓴다.
+*        주소는 locctr_table의 섹션 상대 주소이고 라인 번호는 --full-listing과 같다.
+* 매개 : 생성할 파일명 ("-"이면 stdout)
+* 반환 : 없음
+* 주의 : pass2가 끝난 뒤(t->obj가 채워진 뒤)에 불러야 한다. --gc-sections로 빠진 섹션은
+*        오브젝트 프로그램과 같이 쓰지 않으므로 섹션을 차례로 이어 붙이면 적재 주소가 된다.
+* -----------------------------------------------------------------------------------
+*/
+void make_line_map_output(char* file_name)
+{
+    FILE* fp = open_output(file_name ? file_name : "-", "line map");
+    if (!fp)
+        return;
     if (fp != stdout)
-        fclose(fp);
+        setvbuf(fp, NULL, _IOFBF, 1 << 20);
+
+    fprintf(fp, "SICMAP 1\n");
+    int i = 0, sec = 0;
+    while (i < token_line && strcasecmp(token_table[i]->operator, "END")) {
+        int e = i + 1;
+        while (e < token_line && strcasecmp(token_table[e]->operator, "CSECT") &&
+               strcasecmp(token_table[e]->operator, "END"))
+            e++;
+        sec++;
+        if (sec > MAX_SECTIONS || section_live[sec]) {
+            fprintf(fp, "S\t%.6s\t%06X\n", token_table[i]->label,
+                    section_length[sec < MAX_SECTIONS ? sec : 0]);
+            for (int k = i + 1; k < e; k++) {
+                token* t = token_table[k];
+                if (t->comment[0] == '.' || !t->obj || !t->obj[0])
+                    continue;
+                fprintf(fp, "L\t%06X\t%d\t%d\t%s\t%s\t%s\n", locctr_table[k] & 0xFFFFFF,
+                        (int)strlen(t->obj) / 2, k + 1, t->label, t->operator ? t->operator : "",
+                        t->operand[0] ? t->operand[0] : "");
+            }
+        }
+        i = e;
+    }
+    close_stream(fp);
 }
 
 /* ----------------------------------------------------------------------------------
@@ -671,7 +2474,7 @@ void make_opcode_output(char *file_name)
 void make_symtab_output(char *file_name)
 {
     FILE* fp;
-    if (file_name == NULL)
+    if (file_name == NULL || !strcmp(file_name, "-"))
         fp = stdout;
     else {
         fp = fopen(file_name, "w");
@@ -681,16 +2484,22 @@ void make_symtab_output(char *file_name)
         }
     }
     
-    for (int i = 0; i < label_num; i++) {
-        if (i > 0 && sym_table[i].section != sym_table[i-1].section)
-            fprintf(fp, "\n"); // 섹션 변경 시 개행
-        fprintf(fp, "%-8s\t%X\n", sym_table[i].symbol, sym_table[i].addr);
-    }
+    write_symtab(fp);
     
     if (fp != stdout)
         fclose(fp);
 }
 
+/* write_symtab(): 심볼 테이블을 섹션별로 구분하여 fp에 출력 */
+static void write_symtab(FILE* fp)
+{
+    for (int i = 0; i < label_num; i++) {
+        if (i > 0 && sym_table[i].section != sym_table[i-1].section)
+            fprintf(fp, "\n"); // 섹션 변경 시 개행
+        fprintf(fp, "%-8s\t%X\n", sym_table[i].symbol, sym_table[i].addr);
+    }
+}
+
 // literal의 내부 내용을 추출하는 함수
 void extract_literal(const char* literalStr, char* dest) {
     if (literalStr == NULL || dest == NULL)
@@ -711,29 +2520,150 @@ void extract_literal(const char* literalStr, char* dest) {
     strcpy(dest, literalStr);
 }
 
+/* literal_length(): 리터럴(=C'..' 혹은 =X'..')이 차지하는 바이트 수 */
+static int literal_length(const char* lit)
+{
+    char* start = strchr(lit, '\'');
+    char* end = strrchr(lit, '\'');
+    if (!start || !end || end <= start)
+        return 0;
+    if (lit[1]=='C' || lit[1]=='c')
+        return end - start - 1;
+    if (lit[1]=='X' || lit[1]=='x')
+        return ((end - start - 1) + 1) / 2;
+    return 0;
+}
+
 /* 현재 섹션의 미할당 리터럴에 대해 현재 locctr 값을 할당하고
    literal의 길이만큼 locctr를 증가시키며, literalPoolStart를 갱신 */
 void process_literal_pool(void) {
     for (int j = literalPoolStart; j < literal_count; j++) {
         if (literal_table[j].addr == -1) {
             literal_table[j].addr = locctr;
-            char* lit = literal_table[j].symbol;
-            int length = 0;
-            if (lit[1]=='C' || lit[1]=='c') {
-                char* start = strchr(lit, '\'');
-                char* end = strrchr(lit, '\'');
-                if (start && end && end > start)
-                    length = end - start - 1;
-            } else if (lit[1]=='X' || lit[1]=='x') {
-                char* start = strchr(lit, '\'');
-                char* end = strrchr(lit, '\'');
-                if (start && end && end > start)
-                    length = ((end - start - 1) + 1) / 2;
-            }
-            locctr += length;
+            literal_table[j].section = current_section;
+            literal_table[j].block = current_block;
+            locctr += literal_length(literal_table[j].symbol);
         }
     }
     literalPoolStart = literal_count;
+    literalFirstUse = -1;
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : 주소 addr의 명령어가 참조하는 리터럴 name의 인스턴스를 찾는다.
+*        --auto-ltorg로 같은 리터럴이 여러 풀에 있을 수 있으므로 아직 배치되지 않았거나
+*        같은 섹션의 PC relative 범위 안에 있는 첫 인스턴스를 고르고,
+*        없으면 이름이 같은 첫 인스턴스를 고른다.
+* 매개 : 리터럴 이름, 참조하는 명령어의 섹션과 주소
+* 반환 : literal_table 인덱스, 없으면 -1
+* 주의 : 리터럴마다 인스턴스가 하나뿐이면 예전처럼 이름으로 찾은 결과와 같다.
+*        이름 해시(lit_slots)의 탐사열에는 같은 이름이 추가된 순서대로 놓이므로
+*        테이블 순서로 훑은 것과 같은 인스턴스를 고른다.
+* -----------------------------------------------------------------------------------
+*/
+static int find_literal(const char* name, int section, int addr)
+{
+    int first = -1;
+    STAT_LOOKUP(literal);
+    for (unsigned int h = name_hash(name, strlen(name)) % SYM_SLOTS; lit_slots[h]; h = (h + 1) % SYM_SLOTS) {
+        STAT_PROBE(literal);
+        int j = lit_slots[h] - 1;
+        if (strcmp(literal_table[j].symbol, name))
+            continue;
+        if (first < 0)
+            first = j;
+        int disp = literal_table[j].addr - (addr + 3);
+        if (literal_table[j].addr == -1 ||
+            (literal_table[j].section == section && disp >= -2048 && disp <= 2047))
+            return j;
+    }
+    return first;
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : --auto-ltorg에서 토큰 t의 앞(RESW/RESB) 혹은 뒤(J, RSUB)에 리터럴 풀을 넣을지 정한다.
+*        실행 흐름이 지나가지 않는 곳에만 넣고, 아직 배치되지 않은 리터럴의 풀 끝이
+*        첫 참조의 PC relative 범위까지 AUTO_LTORG_MARGIN보다 가까워지면 넣는다.
+*        RESW/RESB 앞에서는 예약 영역 뒤로 미뤘을 때를 기준으로 본다.
+*        토큰 테이블 위치 at을 알면(두 패스 모드) 다음 후보 지점까지 미뤘을 때 풀 끝이
+*        범위를 벗어나는지도 미리 보고, 벗어나면 여기에 넣는다.
+* 매개 : 토큰, 토큰 뒤 여부 (0 = 토큰 처리 전, 1 = 토큰 처리 후), token_table에서 t의 위치 (-1 = 모름)
+* 반환 : 풀을 넣어야 하면 1, 아니면 0
+* 주의 : 호출자가 LTORG를 만들어 패스1과 패스2에서 명시한 LTORG와 똑같이 처리한다.
+*        스트리밍/단일 패스 모드는 뒤 라인을 볼 수 없으므로 AUTO_LTORG_MARGIN 기준만 쓴다.
+* -----------------------------------------------------------------------------------
+*/
+static int auto_pool_point(token* t, int after, int at)
+{
+    if (!auto_ltorg || literalFirstUse < 0 || literalFirstBlock != current_block || t->comment[0] == '.')
+        return 0;
+    const char* op = t->operator[0] == '+' ? t->operator + 1 : t->operator;
+    int reserve = 0;
+    if (after) {
+        if (strcasecmp(op, "J") && strcasecmp(op, "RSUB"))
+            return 0;
+    } else if (!strcasecmp(op, "RESW")) {
+        reserve = 3 * atoi(t->operand[0]);
+    } else if (!strcasecmp(op, "RESB")) {
+        reserve = atoi(t->operand[0]);
+    } else {
+        return 0;
+    }
+
+    int pool = 0;
+    for (int j = literalPoolStart; j < literal_count; j++)
+        if (literal_table[j].addr == -1)
+            pool += literal_length(literal_table[j].symbol);
+    int limit = literalFirstUse + 3 + 2047;
+    if (locctr + reserve + pool + AUTO_LTORG_MARGIN > limit)
+        return 1;
+    return at >= 0 && deferred_pool_end(at + 1, locctr + reserve, pool) > limit;
+}
+
+/* deferred_pool_end(): token_table[at]부터 다음 풀 후보 지점(J/RSUB 뒤, RESW/RESB 앞,
+   LTORG/CSECT/END/USE)까지 주소를 세어, 풀을 거기로 미뤘을 때 풀 끝 주소를 돌려준다.
+   그 사이에 새로 나오는 리터럴도 풀 크기에 더한다 (같은 리터럴이 여러 번 나오면 크게 잡는다) */
+static int deferred_pool_end(int at, int addr, int pool)
+{
+    for (int k = at; k < token_line; k++) {
+        token* u = token_table[k];
+        if (u->comment[0] == '.')
+            continue;
+        const char* op = u->operator[0] == '+' ? u->operator + 1 : u->operator;
+        if (!strcasecmp(op, "RESW") || !strcasecmp(op, "RESB") || !strcasecmp(op, "LTORG") ||
+            !strcasecmp(op, "CSECT") || !strcasecmp(op, "END") || !strcasecmp(op, "USE"))
+            break;
+        if (u->operand[0] && u->operand[0][0] == '=') {
+            int j = find_literal(u->operand[0], current_section, addr);
+            int disp = j >= 0 ? literal_table[j].addr - (addr + 3) : 0;
+            if (j < 0 || (literal_table[j].addr != -1 &&
+                          (literal_table[j].section != current_section || disp < -2048 || disp > 2047)))
+                pool += literal_length(u->operand[0]);
+        }
+        addr += token_size(u);
+        if (!strcasecmp(op, "J") || !strcasecmp(op, "RSUB"))
+            break;
+    }
+    return addr + pool;
+}
+
+/* insert_auto_ltorg(): token_table의 at 위치에 --auto-ltorg가 고른 LTORG 토큰을 끼워 넣는다 */
+static int insert_auto_ltorg(int at)
+{
+    if (token_line >= MAX_LINES) {
+        diag("토큰 테이블이 가득 찼습니다. (MAX_LINES = %d)\n", MAX_LINES);
+        return -1;
+    }
+    token* t = alloc_token();
+    if (!t)
+        return -1;
+    t->label = strdup("");
+    t->operator = strdup("LTORG");
+    t->operand[0] = strdup("");
+    memmove(&token_table[at + 1], &token_table[at], sizeof(token*) * (token_line - at));
+    token_table[at] = t;
+    token_line++;
+    return 0;
 }
 
 /* ----------------------------------------------------------------------------------
@@ -750,7 +2680,7 @@ void process_literal_pool(void) {
 void make_literaltab_output(char* file_name)
 {
     FILE* fp;
-    if (file_name == NULL)
+    if (file_name == NULL || !strcmp(file_name, "-"))
         fp = stdout;
     else {
         fp = fopen(file_name, "w");
@@ -760,13 +2690,216 @@ void make_literaltab_output(char* file_name)
         }
     }
     
+    write_littab(fp);
+    if (fp != stdout)
+        fclose(fp);
+}
+
+/* write_littab(): 리터럴 테이블을 fp에 출력 */
+static void write_littab(FILE* fp)
+{
     for (int i = 0; i < literal_count; i++) {
         char litValue[32] = {0};
         extract_literal(literal_table[i].symbol, litValue);
         fprintf(fp, "%-8s\t%X\n", litValue, literal_table[i].addr);
     }
-    if (fp != stdout)
-        fclose(fp);
+}
+
+/* 색인 항목을 정렬하기 위한 임시 항목 */
+typedef struct _symx_item {
+    const char* name;
+    int value;
+    int section;
+    int kind;
+} symx_item;
+
+static int symx_item_cmp(const void* a, const void* b)
+{
+    const symx_item* x = a;
+    const symx_item* y = b;
+    int c = strcmp(x->name, y->name);
+    return c ? c : x->section - y->section;
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : pass1이 만든 sym_table/literal_table로 바이너리 심볼/리터럴 색인(symx_*)을 만든다.
+*        항목을 (이름, 섹션) 순으로 정렬하고, 같은 이름은 문자열 풀에 한 번만 넣은 뒤
+*        항목 수의 두 배 이상인 2의 거듭제곱 크기의 해시 슬롯을 채운다.
+* 매개 : 생성할 색인 파일명 ("-"이면 stdout)
+* 반환 : 없음
+* 주의 : 필드는 호스트 바이트 순서로 기록한다 (리틀 엔디안 호스트 가정, 매직 넘버로 확인).
+* -----------------------------------------------------------------------------------
+*/
+void make_symindex_output(char* file_name)
+{
+    int count = label_num + literal_count;
+    symx_item* items = malloc(sizeof(symx_item) * (count ? count : 1));
+    if (!items) {
+        perror("symindex");
+        return;
+    }
+    int string_size = 0;
+    for (int i = 0; i < label_num; i++) {
+        items[i].name = sym_table[i].symbol;
+        items[i].value = sym_table[i].addr;
+        items[i].section = sym_table[i].section;
+        items[i].kind = SYMX_SYMBOL;
+    }
+    for (int i = 0; i < literal_count; i++) {
+        symx_item* it = &items[label_num + i];
+        it->name = literal_table[i].symbol;
+        it->value = literal_table[i].addr;
+        it->section = literal_table[i].addr == -1 ? 0 : literal_table[i].section;
+        it->kind = SYMX_LITERAL;
+    }
+    qsort(items, count, sizeof(symx_item), symx_item_cmp);
+    for (int i = 0; i < count; i++)
+        if (i == 0 || strcmp(items[i].name, items[i - 1].name))
+            string_size += strlen(items[i].name) + 1;
+
+    uint32_t hash_size = 16;
+    while (hash_size < (uint32_t)count * 2)
+        hash_size *= 2;
+
+    symx_header h;
+    memset(&h, 0, sizeof(h));
+    h.magic = SYMX_MAGIC;
+    h.version = SYMX_VERSION;
+    h.entry_count = count;
+    h.entry_offset = sizeof(symx_header);
+    h.hash_offset = h.entry_offset + sizeof(symx_entry) * count;
+    h.hash_size = hash_size;
+    h.string_offset = h.hash_offset + sizeof(uint32_t) * hash_size;
+    h.string_size = string_size;
+    h.file_size = (h.string_offset + string_size + 3u) & ~3u;
+
+    unsigned char* image = calloc(1, h.file_size);
+    if (!image) {
+        perror("symindex");
+        free(items);
+        return;
+    }
+    memcpy(image, &h, sizeof(h));
+    symx_entry* entries = (symx_entry*)(image + h.entry_offset);
+    uint32_t* slots = (uint32_t*)(image + h.hash_offset);
+    char* strings = (char*)image + h.string_offset;
+
+    uint32_t name_off = 0, next_off = 0;
+    for (int i = 0; i < count; i++) {
+        if (i == 0 || strcmp(items[i].name, items[i - 1].name)) {
+            name_off = next_off;
+            strcpy(strings + name_off, items[i].name);
+            next_off += strlen(items[i].name) + 1;
+        }
+        entries[i].name = name_off;
+        entries[i].value = items[i].value;
+        entries[i].section = items[i].section;
+        entries[i].kind = items[i].kind;
+
+        uint32_t k = name_hash(items[i].name, strlen(items[i].name)) & (hash_size - 1);
+        while (slots[k])
+            k = (k + 1) & (hash_size - 1);
+        slots[k] = i + 1;
+    }
+
+    FILE* fp = open_output(file_name, "symbol index");
+    if (fp) {
+        if (fwrite(image, 1, h.file_size, fp) != h.file_size)
+            perror("symindex");
+        close_stream(fp);
+    }
+    free(image);
+    free(items);
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : mmap한 색인 image에서 name의 항목을 해시 탐사로 찾는다.
+*        start가 0이면 첫 항목을, 이전 결과 + 1을 주면 같은 이름의 다음 항목(다른 섹션)을 찾는다.
+* 매개 : 검증된 색인 image, 찾을 이름, 탐사를 시작할 위치 (*pos, 처음엔 -1)
+* 반환 : 항목 인덱스, 없으면 -1
+* 주의 : 탐사는 빈 슬롯에서 끝나므로 찾는 비용은 항목 수와 무관하다.
+* -----------------------------------------------------------------------------------
+*/
+static int symx_lookup(const unsigned char* image, const char* name, long* pos)
+{
+    const symx_header* h = (const symx_header*)image;
+    const symx_entry* entries = (const symx_entry*)(image + h->entry_offset);
+    const uint32_t* slots = (const uint32_t*)(image + h->hash_offset);
+    const char* strings = (const char*)image + h->string_offset;
+    uint32_t mask = h->hash_size - 1;
+
+    uint32_t k = *pos < 0 ? name_hash(name, strlen(name)) & mask : ((uint32_t)*pos + 1) & mask;
+    for (uint32_t n = 0; n < h->hash_size && slots[k]; n++, k = (k + 1) & mask) {
+        const symx_entry* e = &entries[slots[k] - 1];
+        if (!strcmp(strings + e->name, name)) {
+            *pos = k;
+            return slots[k] - 1;
+        }
+    }
+    return -1;
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : 색인 파일을 mmap하여 헤더와 범위를 검사한 뒤 name의 모든 항목을 출력한다 (--symlookup).
+* 매개 : 색인 파일 경로, 찾을 이름
+* 반환 : 찾으면 0, 없거나 에러면 < 0
+* 주의 :
+* -----------------------------------------------------------------------------------
+*/
+static int run_symlookup(const char* index_path, const char* name)
+{
+    int fd = open(index_path, O_RDONLY);
+    if (fd < 0) {
+        perror("Error opening symbol index");
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(symx_header)) {
+        fprintf(stderr, "symlookup: %s: 색인 헤더가 없습니다.\n", index_path);
+        close(fd);
+        return -1;
+    }
+    size_t size = st.st_size;
+    unsigned char* image = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+
+    const symx_header* h = (const symx_header*)image;
+    const symx_entry* entries = (const symx_entry*)(image + h->entry_offset);
+    const uint32_t* slots = (const uint32_t*)(image + h->hash_offset);
+    int ok = h->magic == SYMX_MAGIC && h->version == SYMX_VERSION && h->file_size == size &&
+             h->entry_offset == sizeof(symx_header) &&
+             (uint64_t)h->entry_count * sizeof(symx_entry) <= size - h->entry_offset &&
+             h->hash_offset == h->entry_offset + h->entry_count * sizeof(symx_entry) &&
+             h->hash_size && !(h->hash_size & (h->hash_size - 1)) && h->hash_size > h->entry_count &&
+             (uint64_t)h->hash_size * sizeof(uint32_t) <= size - h->hash_offset &&
+             h->string_offset == h->hash_offset + h->hash_size * sizeof(uint32_t) &&
+             h->string_size <= size - h->string_offset &&
+             (h->string_size == 0 || image[h->string_offset + h->string_size - 1] == '\0');
+    for (uint32_t k = 0; ok && k < h->entry_count; k++)
+        ok = entries[k].name < h->string_size;
+    for (uint32_t k = 0; ok && k < h->hash_size; k++)
+        ok = slots[k] <= h->entry_count;
+    if (!ok) {
+        fprintf(stderr, "symlookup: %s: 색인 형식이 잘못되었습니다.\n", index_path);
+        munmap(image, size);
+        return -1;
+    }
+
+    int found = 0;
+    long pos = -1;
+    for (int e = symx_lookup(image, name, &pos); e >= 0; e = symx_lookup(image, name, &pos)) {
+        printf("%-8s\t%X\tsection %u\t%s\n", name, entries[e].value, entries[e].section,
+               entries[e].kind == SYMX_LITERAL ? "literal" : "symbol");
+        found++;
+    }
+    if (!found)
+        fprintf(stderr, "%s: 색인에 없는 이름입니다.\n", name);
+    munmap(image, size);
+    return found ? 0 : -1;
 }
 
 // get_register_number(): 레지스터 번호 매핑
@@ -807,9 +2940,9 @@ int calc_disp(int target, int current, int format, int base, int e, int *b, int
         return disp & 0xFFF;        // 하위 12비트로 자르기
     }
 
-    // Base-relative: 0 ≤ (target - base) ≤ 4095
+    // Base-relative: 0 ≤ (target - base) ≤ 4095 (base < 0이면 BASE가 없다)
     disp = target - base;
-    if (disp >= 0 && disp <= 4095) {
+    if (base >= 0 && disp >= 0 && disp <= 4095) {
         *b = 1;
         return disp & 0xFFF;
     }
@@ -823,6 +2956,315 @@ int calc_disp(int target, int current, int format, int base, int e, int *b, int
     return 0;  // format 4 의 disp 필드는 0
 }
 
+/* ------------------- BASE 레지스터 배정 ------------------- */
+/* base_operand_addr(): BASE 피연산자(심볼 혹은 16진 상수)의 확정 주소. 찾지 못하면 -1 */
+static int base_operand_addr(const char* name, int section)
+{
+    if (!name || !name[0])
+        return -1;
+    if (isdigit((unsigned char)name[0]))
+        return (int)strtol(name, NULL, 16);
+    int k = find_symbol(name, section);
+    if (k < 0) {
+        diag("BASE %s: 정의되지 않은 심볼입니다.\n", name);
+        return -1;
+    }
+    return sym_table[k].addr;
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : 토큰이 PC relative 범위를 벗어나는 같은 섹션 주소를 참조하는지 판별한다.
+*        3형식은 BASE 없이는 인코딩할 수 없는 참조이고, 4형식은 BASE가 덮으면
+*        '+' 없이 3형식으로 쓸 수 있는 참조이다.
+* 매개 : 토큰, 목표 주소를 돌려받을 포인터
+* 반환 : 3형식 = 3, 4형식 = 4, 대상이 아니면 0
+* 주의 : 외부 참조, 다른 섹션 심볼, 즉시/간접 상수는 BASE와 관계없으므로 제외한다.
+* -----------------------------------------------------------------------------------
+*/
+static int far_reference(token* t, int* target)
+{
+    if (t->comment[0] == '.' || !isTextRecordable(t) || !t->operand[0] || !t->operand[0][0])
+        return 0;
+    int format = get_instruction_length(t->operator);
+    if (format != 3 && format != 4)
+        return 0;
+    if (!strcasecmp(t->operator, "RSUB") || !strcasecmp(t->operator, "BYTE") ||
+        !strcasecmp(t->operator, "WORD"))
+        return 0;
+
+    char name[64];
+    operand_symbol(t->operand[0], name, sizeof(name));
+    if (name[0] == '=') {
+        if (t->operator[0] == '+')
+            return 0;
+        int j = find_literal(name, t->section, t->addr);
+        if (j < 0 || literal_table[j].addr < 0)
+            return 0;
+        *target = literal_table[j].addr;
+    } else {
+        if (!name[0] || isdigit((unsigned char)name[0]) || t->operand[0][0] == '#' || is_extref(name))
+            return 0;
+        int k = find_symbol(name, t->section);
+        if (k < 0 || sym_table[k].section != t->section)
+            return 0;
+        *target = sym_table[k].addr;
+    }
+
+    int disp = *target - (t->addr + 3);
+    if (disp >= -2048 && disp <= 2047)
+        return 0;
+    return t->operator[0] == '+' ? 4 : 3;
+}
+
+static int int_cmp(const void* a, const void* b)
+{
+    int x = *(const int*)a, y = *(const int*)b;
+    return (x > y) - (x < y);
+}
+
+/* window_count(): 오름차순 addrs[*lo..]에서 [from, from + 4095] 안의 개수. *lo는 다음 호출을 위해 전진한다 */
+static int window_count(const int* addrs, int count, int* lo, int* hi, int from)
+{
+    while (*lo < count && addrs[*lo] < from)
+        (*lo)++;
+    if (*hi < *lo)
+        *hi = *lo;
+    while (*hi < count && addrs[*hi] <= from + 4095)
+        (*hi)++;
+    return *hi - *lo;
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : BASE가 없는 구간 [first, last) 하나에서 BASE로 쓸 심볼을 고른다.
+*        PC relative 범위 밖의 3형식 참조를 가장 많이 덮는 같은 섹션 라벨을 고르고,
+*        같으면 '+' 없이 쓸 수 있게 되는 4형식 참조가 많은 쪽, 그다음 목표에 가까운(높은) 주소를 고른다.
+*        구간의 첫 명령어 앞에 "LDB #심볼"과 "BASE 심볼"을 끼워 넣고 보고한다.
+* 매개 : 구간 시작/끝 토큰 번호, 섹션 이름, 작업 버퍼 두 개(각각 토큰 수 이상)
+* 반환 : 끼워 넣은 토큰 수 (0 또는 2), 에러 < 0
+* 주의 : 고른 라벨이 LDB 위치에서 AUTO_BASE_MARGIN을 뺀 PC relative 범위 밖이면
+*        "+LDB #심볼"(4형식, M 레코드로 재배치)을 넣는다. 코드 뒤에 큰 데이터가 오는 경우가 이렇다.
+*        라벨은 원래 명령어에 그대로 두므로 그 라벨로 바로 들어오는 흐름은 LDB를 거치지 않는다.
+*        구간 중간의 라벨로 들어오는 흐름이나 다른 섹션을 호출해 B가 바뀌는 경우도 보장하지 않는다.
+* -----------------------------------------------------------------------------------
+*/
+static int auto_base_region(int first, int last, const char* sec_name, int* far3, int* far4)
+{
+    int n3 = 0, n4 = 0, target = 0;
+    for (int i = first; i < last; i++) {
+        int kind = far_reference(token_table[i], &target);
+        if (kind == 3)
+            far3[n3++] = target;
+        else if (kind == 4)
+            far4[n4++] = target;
+    }
+    if (n3 == 0 && n4 == 0)
+        return 0;
+    qsort(far3, n3, sizeof(int), int_cmp);
+    qsort(far4, n4, sizeof(int), int_cmp);
+
+    // LDB를 넣을 구간의 첫 명령어 (먼 참조가 있으므로 반드시 있다)
+    int at = first;
+    while (at < last && (token_table[at]->comment[0] == '.' ||
+                         get_instruction_length(token_table[at]->operator) <= 0))
+        at++;
+    int pc = token_table[at]->addr + 3;
+
+    // 후보: 이 섹션의 라벨 (주소 오름차순으로 보며 두 창을 함께 민다)
+    int section = token_table[first]->section;
+    int cand_count = 0;
+    int* cand = malloc(sizeof(int) * (label_num + 1));
+    if (!cand) {
+        perror("auto-base");
+        return -1;
+    }
+    for (int k = 0; k < label_num; k++)
+        if (sym_table[k].section == section && !equ_pending[k] && !equ_absolute[k])
+            cand[cand_count++] = sym_table[k].addr;
+    qsort(cand, cand_count, sizeof(int), int_cmp);
+
+    int best = -1, best3 = 0, best4 = 0;
+    int lo3 = 0, hi3 = 0, lo4 = 0, hi4 = 0;
+    for (int c = 0; c < cand_count; c++) {
+        if (c > 0 && cand[c] == cand[c - 1])
+            continue;
+        int c3 = window_count(far3, n3, &lo3, &hi3, cand[c]);
+        int c4 = window_count(far4, n4, &lo4, &hi4, cand[c]);
+        if (c3 + c4 > 0 && (c3 > best3 || (c3 == best3 && c4 >= best4))) {
+            best = cand[c];
+            best3 = c3;
+            best4 = c4;
+        }
+    }
+    free(cand);
+    if (best < 0) {
+        diag("auto-base: %s %d~%d행: PC relative 범위 밖 3형식 참조 %d개를 덮는 BASE 후보가 없습니다.\n",
+             sec_name, first + 1, last, n3);
+        return 0;
+    }
+
+    const char* name = "";
+    for (int k = 0; k < label_num; k++)
+        if (sym_table[k].section == section && sym_table[k].addr == best && !equ_pending[k] && !equ_absolute[k]) {
+            name = sym_table[k].symbol;
+            break;
+        }
+
+    if (token_line + 2 > MAX_LINES) {
+        diag("토큰 테이블이 가득 찼습니다. (MAX_LINES = %d)\n", MAX_LINES);
+        return -1;
+    }
+    token* ldb = alloc_token();
+    token* base = alloc_token();
+    if (!ldb || !base) {
+        if (ldb)
+            free_token(ldb);
+        return -1;
+    }
+    char operand[sizeof(((symbol*)0)->symbol) + 1];
+    sprintf(operand, "#%s", name);
+    int near = best - pc >= -2048 + AUTO_BASE_MARGIN && best - pc <= 2047 - AUTO_BASE_MARGIN;
+    const char* ldb_op = near ? "LDB" : "+LDB";
+    ldb->label = strdup("");
+    ldb->operator = strdup(ldb_op);
+    ldb->operand[0] = strdup(operand);
+    base->label = strdup("");
+    base->operator = strdup("BASE");
+    base->operand[0] = strdup(name);
+    memmove(&token_table[at + 2], &token_table[at], sizeof(token*) * (token_line - at));
+    token_table[at] = ldb;
+    token_table[at + 1] = base;
+    token_line += 2;
+
+    diag("auto-base: %s %d~%d행: BASE %s (%d행 앞에 %s #%s 삽입) - 3형식 %d/%d개, '+' 생략 가능 4형식 %d/%d개\n",
+         sec_name, first + 1, last, name, at + 1, ldb_op, name, best3, n3, best4, n4);
+    return 2;
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : 패스1이 끝난 뒤 토큰마다 그 위치에서 유효한 BASE 주소를 t->base에 기록한다.
+*        BASE는 지시어가 나온 지점부터 NOBASE 혹은 다음 섹션 전까지 유효하고,
+*        피연산자는 모든 주소가 확정된 뒤의 값으로 계산한다.
+*        pick이면 BASE가 없는 구간마다 auto_base_region()으로 BASE를 골라 LDB/BASE를 끼워 넣는다.
+* 매개 : BASE를 자동으로 고를지 여부 (--auto-base)
+* 반환 : 끼워 넣은 구간 수, 에러 < 0
+* 주의 : BASE가 없는 구간은 예전처럼 B 레지스터를 0으로 본다.
+*        프로그래머가 지정한 BASE 구간은 --auto-base에서도 그대로 둔다.
+*        끼워 넣었으면 주소가 바뀌었으므로 호출자가 주소를 다시 배정하고 pick 없이 다시 불러야 한다.
+* -----------------------------------------------------------------------------------
+*/
+static int assign_base_registers(int pick)
+{
+    int* far3 = NULL;
+    int* far4 = NULL;
+    int inserted = 0;
+    if (pick && token_line > 0) {
+        far3 = malloc(sizeof(int) * token_line);
+        far4 = malloc(sizeof(int) * token_line);
+        if (!far3 || !far4) {
+            perror("auto-base");
+            free(far3);
+            free(far4);
+            return -1;
+        }
+    }
+
+    int cur = 0, in_base = 0, first = -1;
+    const char* sec_name = "";
+    for (int i = 0; i <= token_line; i++) {
+        token* t = i < token_line ? token_table[i] : NULL;
+        const char* op = (t && t->comment[0] != '.') ? t->operator : "";
+        int is_section = !strcasecmp(op, "START") || !strcasecmp(op, "CSECT");
+        int boundary = !t || is_section || !strcasecmp(op, "BASE") ||
+                       !strcasecmp(op, "NOBASE") || !strcasecmp(op, "END");
+        if (boundary && first >= 0) {
+            int added = far3 ? auto_base_region(first, i, sec_name, far3, far4) : 0;
+            if (added < 0) {
+                inserted = -1;
+                break;
+            }
+            i += added;     // t는 같은 토큰을 가리킨다
+            inserted += added > 0;
+            first = -1;
+        }
+        if (!t)
+            break;
+
+        if (is_section || !strcasecmp(op, "NOBASE")) {
+            cur = 0;
+            in_base = 0;
+        } else if (!strcasecmp(op, "BASE")) {
+            cur = base_operand_addr(t->operand[0], t->section);
+            in_base = 1;
+        }
+        if (is_section)
+            sec_name = t->label;
+        t->base = cur;
+        if (!boundary && !in_base && first < 0)
+            first = i;
+    }
+    free(far3);
+    free(far4);
+    return inserted;
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : BASE 배정이 끝난 뒤 같은 섹션 심볼이나 리터럴을 참조하는 3형식 명령어가
+*        PC relative(-2048 ~ 2047) 혹은 BASE relative(0 ~ 4095)로 목표에 닿는지 검사한다.
+* 매개 : 없음
+* 반환 : 모두 닿으면 0, 닿지 않는 명령어가 있으면 < 0
+* 주의 : 닿지 않는 명령어를 변위 0으로 인코딩하지 않도록 패스2 전에 모두 보고한다.
+* -----------------------------------------------------------------------------------
+*/
+static int check_displacements(void)
+{
+    int errors = 0;
+    for (int i = 0; i < token_line; i++)
+        if (check_displacement(token_table[i], i + 1) < 0)
+            errors++;
+    return errors > 0 ? -1 : 0;
+}
+
+/* check_displacement(): 토큰 하나의 3형식 변위가 닿는지 검사하고, 닿지 않으면 line 번호로 보고하고 -1.
+   외부 참조, 다른 섹션 심볼, 숫자 상수와 따로 인코딩하는 TD/WD는 검사하지 않는다.
+   t->base는 그 라인에서 유효한 BASE 주소여야 한다 (스트리밍 패스2도 같은 검사를 쓴다) */
+static int check_displacement(token* t, int line)
+{
+    if (t->comment[0] == '.' || !isTextRecordable(t) || !t->operand[0] || !t->operand[0][0])
+        return 0;
+    if (t->operator[0] == '+' || get_instruction_length(t->operator) != 3)
+        return 0;
+    if (!strcasecmp(t->operator, "RSUB") || !strcasecmp(t->operator, "TD") ||
+        !strcasecmp(t->operator, "WD"))
+        return 0;
+
+    char name[64];
+    int target;
+    operand_symbol(t->operand[0], name, sizeof(name));
+    if (name[0] == '=') {
+        int j = find_literal(name, t->section, t->addr);
+        if (j < 0 || literal_table[j].addr < 0)
+            return 0;
+        target = literal_table[j].addr;
+    } else {
+        if (!name[0] || isdigit((unsigned char)name[0]) || is_extref(name))
+            return 0;
+        int k = find_symbol(name, t->section);
+        if (k < 0 || sym_table[k].section != t->section)
+            return 0;
+        target = sym_table[k].addr;
+    }
+
+    int disp = target - (t->addr + 3);
+    if (disp >= -2048 && disp <= 2047)
+        return 0;
+    if (t->base >= 0 && target - t->base >= 0 && target - t->base <= 4095)
+        return 0;
+    diag("%d행: %s %s: 목표 주소 %04X가 PC relative 범위 밖이고 BASE relative로도 닿지 않습니다. "
+         "(BASE를 지정하거나 4형식으로 쓰십시오)\n",
+         line, t->operator, t->operand[0], target);
+    return -1;
+}
+
 /* ------------------- 모듈화된 op와 nixbpe 계산 함수 ------------------- */
 /* calc_nixbpe()
    - t             : 현재 토큰 (token 구조체 포인터)
@@ -848,12 +3290,9 @@ void calc_nixbpe(token* t, int baseOpcode,
     if (t->operand[0] && t->operand[0][0] == '=') {
         *n = 1; *i = 1;
         // literal address 찾기
-        for (int j = 0; j < literal_count; j++) {
-            if (strcmp(literal_table[j].symbol, t->operand[0]) == 0) {
-                *targetAddr = literal_table[j].addr;
-                break;
-            }
-        }
+        int j = find_literal(t->operand[0], t->section, t->addr);
+        if (j >= 0)
+            *targetAddr = literal_table[j].addr;
         *finalOpcode = (baseOpcode & 0xFC) | 0x03;
         return;
     }
@@ -874,27 +3313,17 @@ void calc_nixbpe(token* t, int baseOpcode,
         else {
             // symbolic immediate (#LABEL 주소 검색)
             *n = 0;
-            char symcpy[64];
-            strcpy(symcpy, t->operand[0] + 1);
-            for (int j = 0; j < label_num; j++) {
-                if (strcmp(sym_table[j].symbol, symcpy) == 0) {
-                    *targetAddr = sym_table[j].addr;
-                    break;
-                }
-            }
+            int j = sym_lookup(t->operand[0] + 1, 0);
+            if (j >= 0)
+                *targetAddr = sym_table[j].addr;
         }
     }
     // 4) indirect addressing
     else if (t->operand[0] && t->operand[0][0] == '@') {
         *n = 1;  *i = 0;
-        char symcpy[64];
-        strcpy(symcpy, t->operand[0] + 1);
-        for (int j = 0; j < label_num; j++) {
-            if (strcmp(sym_table[j].symbol, symcpy) == 0) {
-                *targetAddr = sym_table[j].addr;
-                break;
-            }
-        }
+        int j = sym_lookup(t->operand[0] + 1, 0);
+        if (j >= 0)
+            *targetAddr = sym_table[j].addr;
     }
     // 5) symple(direct) addressing
     else {
@@ -908,44 +3337,19 @@ void calc_nixbpe(token* t, int baseOpcode,
             *comma = '\0';
         }
 
-        int found = 0;
-        // (1) 같은 섹션에 정의된 심볼 먼저 찾기
-        for (int j = 0; j < label_num; j++) {
-            if (!strcmp(sym_table[j].symbol, symcpy)
-             && sym_table[j].section == t->section) {
-                *targetAddr = sym_table[j].addr;
-                found = 1;
-                break;
-            }
-        }
-        // (2) 그래도 못 찾으면 외부 참조(EXTREF) 혹은 다른 섹션 심볼
-        if (!found) {
-            for (int j = 0; j < label_num; j++) {
-                if (!strcmp(sym_table[j].symbol, symcpy)) {
-                    *targetAddr = sym_table[j].addr;
-                    found = 1;
-                    break;
-                }
-            }
-        }
+        // (1) 같은 섹션에 정의된 심볼 먼저, (2) 없으면 외부 참조(EXTREF) 혹은 다른 섹션 심볼
+        int j = find_symbol(symcpy, t->section);
+        if (j >= 0)
+            *targetAddr = sym_table[j].addr;
         // (3) 여전히 못 찾으면 숫자 상수로 간주
-        if (!found) {
+        else
             *targetAddr = (int)strtol(symcpy, NULL, 16);
-        }
     }
 
     // 6) ni 비트를 최종 오피코드로 만들기
     *finalOpcode = (baseOpcode & 0xFC) | ((*n << 1) | *i);
 }
 
-/* 토큰 포인터->인덱스 변환 (locctr_table 사용을 위해) */
-static int findTokenIndex(token *t) {
-    for (int idx = 0; idx < token_line; idx++) {
-        if (token_table[idx] == t) return idx;
-    }
-    return -1;
-}
-
 // 토큰이 T 레코드에 들어갈 만한 instruction 혹은 BYTE/WORD/리터럴인가?
 int isTextRecordable(token *t) {
     if (t->comment[0] == '.')       return 0; // 주석
@@ -959,13 +3363,17 @@ int isTextRecordable(token *t) {
         !strcasecmp(t->operator,"EQU")   ||
         !strcasecmp(t->operator,"RESW")  ||
         !strcasecmp(t->operator,"RESB")  ||
+        !strcasecmp(t->operator,"BASE")  ||
+        !strcasecmp(t->operator,"NOBASE")||
+        !strcasecmp(t->operator,"USE")   ||
         !strcasecmp(t->operator,"LTORG")) 
         return 0;
     return 1;
 }
 
-/* generate_object_code(): locctr_table 기반으로 disp 계산 */
+/* generate_object_code(): 토큰에 기록된 주소(t->addr) 기반으로 disp 계산 */
 char* generate_object_code(token* t) {
+    STAT_INC(gen_obj_calls);
     // 0) 미리 opcode 뽑아두기
     int baseOpcode = search_opcode(t->operator);
     if (baseOpcode < 0) baseOpcode = 0;
@@ -975,6 +3383,7 @@ char* generate_object_code(token* t) {
         unsigned int opcode = search_opcode("RSUB");      // 0x4F
         unsigned int finalOpc = (opcode & 0xFC) | 0x03;   // n=1,i=1 → 0x4F|0x03 = 0x4F
         unsigned int instr = finalOpc << 16;              // format3 → 3바이트
+        t->nixbpe = 0x30;
         char *obj = malloc(7);
         sprintf(obj, "%06X", instr);
         return obj;
@@ -982,15 +3391,16 @@ char* generate_object_code(token* t) {
 
     // 0) I/O format‑3 명령어 처리 (TD, WD)
     if (!strcasecmp(t->operator, "TD") || !strcasecmp(t->operator, "WD")) {
-        int finalOpc, n, i, x, e, targetAddr;
+        int finalOpc, n, i, x, e, targetAddr = 0;
         calc_nixbpe(t, baseOpcode, &finalOpc, &n, &i, &x, &e, &targetAddr);
+        t->target = targetAddr;
 
-        int idx = findTokenIndex(t);
-        int currentAddr = locctr_table[idx];
+        int currentAddr = t->addr;
         int flag_b = 0, flag_p = 0;
-        int disp = calc_disp(targetAddr, currentAddr, 3, base, e, &flag_b, &flag_p);
+        int disp = calc_disp(targetAddr, currentAddr, 3, t->base, e, &flag_b, &flag_p);
         int flags = (x << 3) | (flag_b << 2) | (flag_p << 1) | e;
         unsigned int instr = (finalOpc << 16) | (flags << 12) | (disp & 0xFFF);
+        t->nixbpe = ((finalOpc & 0x03) << 4) | flags;
 
         char *obj = malloc(7);
         sprintf(obj, "%06X", instr);
@@ -1035,13 +3445,7 @@ char* generate_object_code(token* t) {
         return obj;
         }
 
-    if (t->operand[0]) {
-        trim(t->operand[0]);
-        // 쉼표만 남았을 때도 제거
-        size_t L = strlen(t->operand[0]);
-        if (L > 0 && t->operand[0][L-1] == ',')
-            t->operand[0][L-1] = '\0';
-    }
+    normalize_operand(t);
 
     int format = get_instruction_length(t->operator);   // 명령어 format 추출
 
@@ -1052,13 +3456,23 @@ char* generate_object_code(token* t) {
         isdigit((unsigned char)t->operand[0][1])) {
         // 숫자 파싱: '#3' -> 3
          int value = (int)strtol(t->operand[0] + 1, NULL, 0);
+        t->target = value;
 
-        // n = 0, i = 1, x=b=p=e=0
+        // n = 0, i = 1, x=b=p=0
         unsigned int opcode = (baseOpcode & 0xFC) | 0x01;
+        if (format == 4) {
+            // +LDT #4096: e=1, 20비트 값 (패스1이 4바이트를 잡았으므로 4바이트로 출력)
+            unsigned int instr = (opcode << 24) | (1 << 20) | (value & 0xFFFFF);
+            t->nixbpe = 0x11;
+            char *obj = malloc(9);
+            sprintf(obj, "%08X", instr);
+            return obj;
+        }
         unsigned int flags = 0;
 
         // format 3: 6자리 16진수 (3 바이트)
         unsigned int instr = (opcode << 16) | (flags << 12) | (value & 0xFFF);
+        t->nixbpe = 0x10;
         char *obj = malloc(7);
         sprintf(obj, "%06X", instr);
         return obj;
@@ -1088,57 +3502,230 @@ char* generate_object_code(token* t) {
         return obj;
     }
 
-    // Format 3/4 계산을 위해 각 플래그 및 OP 계산
-    int finalOpcode, n, i, x, e, targetAddr;
-    calc_nixbpe(t, baseOpcode, &finalOpcode, &n, &i, &x, &e, &targetAddr);  // opcode 리턴
-
-    // 현재 명령어의 주소를 locctr_table에서 얻음
-    int idx = findTokenIndex(t);
-    int currentAddr = locctr_table[idx];
-    
-    // disp 계산 전 플래그 초기화
-    int flag_b = 0, flag_p = 0;
-    int disp;
-
-    // 간접 주소(@)가 숫자 상수일 경우: 16진수로 파싱
-    if (t->operand[0][0] == '@' && isdigit((unsigned char)t->operand[0][1])) {
-        disp = (int)strtol(t->operand[0] + 1, NULL, 0);
-        flag_b = 0; flag_p = 0;
-    } else {
-        // format 4인 경우엔 disp=0, M 레코드로 처리
-        if (e) {
-            disp = 0;
-        } else {
-            disp = calc_disp(targetAddr, currentAddr, format, base, e, &flag_b, &flag_p);
-        }
-    }
-
-    // nixbpe 플래그를 6비트 플래그로 인코딩 (x 비트는 이미 calc_nixbpe에서 설정됨)
-    int flags = (x << 3) | (flag_b << 2) | (flag_p << 1) | e;
+    // Format 3/4: 피연산자를 해석한 뒤 섹션 단위 인코딩과 같은 커널로 한 개만 인코딩한다
+    int opcode, mode, target, addr, base, disp_in, nixbpe, index = 0;
+    uint32_t word;
+    fmt34_batch one = { 1, 1, &opcode, &mode, &target, &addr, &base, &disp_in, &word, &nixbpe, &index };
+    format34_resolve(t, baseOpcode, format, &one, 0);
+    encode_format34(&one);
+    t->nixbpe = nixbpe;     // 전체 리스트 출력용
+    return format34_object(&one, 0);
+}
 
-    // opcode 구성
-    unsigned int instr;
-    char *objStr;
-    if (format == 3) {
-        // 6자리 16진수
-        instr = (finalOpcode << 16) | (flags << 12) | (disp & 0xFFF);
-        objStr = malloc(7);
-        sprintf(objStr, "%06X", instr);
-    } else {
-        // format == 4: 8자리 16진수
-        instr = (finalOpcode << 24) | (flags << 20) | (disp & 0xFFFFF);
-        objStr = malloc(9);
-        sprintf(objStr, "%08X", instr);
+/* normalize_operand(): 피연산자 앞뒤 공백과 끝에 남은 쉼표를 제거 */
+static void normalize_operand(token* t)
+{
+    if (t->operand[0]) {
+        trim(t->operand[0]);
+        // 쉼표만 남았을 때도 제거
+        size_t L = strlen(t->operand[0]);
+        if (L > 0 && t->operand[0][L-1] == ',')
+            t->operand[0][L-1] = '\0';
     }
-    return objStr;
 }
 
-// format 4인 경우 M 레코드
-char** generate_modification_records(token* t, int* count) {
-    if (!t || !t->operand[0]) return NULL;
-
-    int mod_addr = t->addr + 1;            // 수정 시작 주소
-    char **mods = malloc(sizeof(char*) * MAX_OPERAND);
+/* ----------------------------------------------------------------------------------
+* 설명 : generate_object_code()가 토큰을 3/4형식 일반 경로로 인코딩하는지 판별한다.
+*        RSUB/TD/WD, BYTE/WORD, #상수, 2형식처럼 따로 처리하는 경우는 제외한다.
+* 매개 : 토큰
+* 반환 : 일반 경로면 get_instruction_length() 값 + 1 (0일 수 있으므로), 아니면 0
+* 주의 : 판별 조건은 generate_object_code()의 분기 순서와 같아야 한다.
+* -----------------------------------------------------------------------------------
+*/
+static int format34_kind(token* t)
+{
+    if (!isTextRecordable(t) || !t->operand[0])
+        return 0;
+    if (!strcasecmp(t->operator, "RSUB") || !strcasecmp(t->operator, "TD") ||
+        !strcasecmp(t->operator, "WD") || !strcasecmp(t->operator, "WORD"))
+        return 0;
+    if (!strcasecmp(t->operator, "BYTE") && (t->operand[0][0] == 'C' || t->operand[0][0] == 'X') &&
+        t->operand[0][1] == '\'')
+        return 0;
+    normalize_operand(t);
+    int format = get_instruction_length(t->operator);
+    if (format == 2 || (t->operand[0][0] == '#' && isdigit((unsigned char)t->operand[0][1])))
+        return 0;
+    return format + 1;
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : 3/4형식 명령어 하나의 피연산자를 해석하여 batch의 j번째 입력을 채운다.
+*        심볼/리터럴 검색과 주소 지정 방식 판별은 calc_nixbpe()가 하고,
+*        변위 계산과 비트 배치는 encode_format34()에 맡긴다.
+* 매개 : 토큰, 기본 오피코드, 명령어 형식, 채울 batch, 위치
+* 반환 : 없음
+* 주의 : t->target도 함께 기록한다.
+* -----------------------------------------------------------------------------------
+*/
+static void format34_resolve(token* t, int baseOpcode, int format, fmt34_batch* b, int j)
+{
+    int finalOpcode, n, i, x, e, targetAddr = 0;
+    calc_nixbpe(t, baseOpcode, &finalOpcode, &n, &i, &x, &e, &targetAddr);
+    t->target = targetAddr;
+
+    int mode = (x ? FMT34_X : 0) | (e ? FMT34_E : 0) | (format != 3 ? FMT34_WIDE : 0);
+    int disp_in = 0;
+    // 간접 주소(@)가 숫자 상수일 경우: 변위를 계산하지 않고 그대로 쓴다
+    if (t->operand[0][0] == '@' && isdigit((unsigned char)t->operand[0][1])) {
+        mode |= FMT34_DIRECT;
+        disp_in = (int)strtol(t->operand[0] + 1, NULL, 0);
+    }
+    // 같은 섹션 라벨을 가리키는 4형식: 섹션 기준 주소를 그대로 넣고 M 레코드로 재배치한다
+    else if (e && section_relative(t)) {
+        mode |= FMT34_DIRECT;
+        disp_in = targetAddr;
+    }
+    b->opcode[j] = finalOpcode;
+    b->mode[j] = mode;
+    b->target[j] = targetAddr;
+    b->addr[j] = t->addr;       // pass1에서 locctr_table과 함께 기록된 값
+    b->base[j] = t->base;
+    b->disp_in[j] = disp_in;
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : 해석이 끝난 3/4형식 명령어 배열을 한꺼번에 인코딩한다.
+*        PC relative(-2048 ~ 2047)를 먼저, 안 되면 BASE relative(0 ~ 4095)를 고르고
+*        둘 다 안 되면 변위 0으로 둔다. 4형식과 @상수는 변위를 계산하지 않는다.
+* 매개 : 입력 배열이 채워진 batch (word, nixbpe를 채운다)
+* 반환 : 없음
+* 주의 : 루프 안은 비교 결과를 0/1 마스크로 바꿔 조합하는 정수 연산뿐이라
+*        분기가 없고, 컴파일러가 SIMD로 벡터화할 수 있다. calc_disp()와 결과가 같아야 한다.
+* -----------------------------------------------------------------------------------
+*/
+static void encode_format34(fmt34_batch* b)
+{
+    const int* restrict opcode = b->opcode;
+    const int* restrict mode = b->mode;
+    const int* restrict target = b->target;
+    const int* restrict addr = b->addr;
+    const int* restrict base = b->base;
+    const int* restrict disp_in = b->disp_in;
+    uint32_t* restrict word = b->word;
+    int* restrict nixbpe = b->nixbpe;
+    int count = b->count;   // 결과 배열과 겹치지 않도록 미리 읽어 둔다
+
+    for (int j = 0; j < count; j++) {
+        uint32_t m = (uint32_t)mode[j];
+        uint32_t e = m & FMT34_E;
+        uint32_t x = (m & FMT34_X) >> 3;
+        uint32_t direct = (m & FMT34_DIRECT) >> 4;
+        uint32_t wide = (m & FMT34_WIDE) >> 5;
+
+        uint32_t pc_disp = (uint32_t)(target[j] - (addr[j] + 3));
+        uint32_t base_disp = (uint32_t)(target[j] - base[j]);
+        uint32_t calc = (direct | e) ^ 1;       // 변위를 계산해야 하는지
+        uint32_t p = calc & (pc_disp + 2048 < 4096);
+        uint32_t bb = calc & (p ^ 1) & (base[j] >= 0) & (base_disp < 4096);
+        uint32_t disp = (pc_disp & 0xFFF & -p) | (base_disp & 0xFFF & -bb) |
+                        ((uint32_t)disp_in[j] & -direct);
+
+        uint32_t flags = (x << 3) | (bb << 2) | (p << 1) | e;
+        uint32_t op = (uint32_t)opcode[j];
+        uint32_t w3 = (op << 16) | (flags << 12) | (disp & 0xFFF);
+        uint32_t w4 = (op << 24) | (flags << 20) | (disp & 0xFFFFF);
+        word[j] = (w3 & (wide - 1)) | (w4 & -wide);
+        nixbpe[j] = (int)(((op & 0x03) << 4) | flags);
+    }
+}
+
+/* format34_object(): batch의 j번째 결과를 6자리(3형식) 혹은 8자리(4형식) 16진 문자열로 */
+static char* format34_object(const fmt34_batch* b, int j)
+{
+    int wide = b->mode[j] & FMT34_WIDE;
+    char* obj = malloc(wide ? 9 : 7);
+    if (obj)
+        sprintf(obj, wide ? "%08X" : "%06X", b->word[j]);
+    return obj;
+}
+
+/* fmt34_alloc(): count개를 담을 SoA 배열 할당 (실패하면 < 0) */
+static int fmt34_alloc(fmt34_batch* b, int count)
+{
+    int n = count ? count : 1;
+    b->count = 0;
+    b->cap = count;
+    b->opcode = malloc(sizeof(int) * n);
+    b->mode = malloc(sizeof(int) * n);
+    b->target = malloc(sizeof(int) * n);
+    b->addr = malloc(sizeof(int) * n);
+    b->base = malloc(sizeof(int) * n);
+    b->disp_in = malloc(sizeof(int) * n);
+    b->word = malloc(sizeof(uint32_t) * n);
+    b->nixbpe = malloc(sizeof(int) * n);
+    b->token = malloc(sizeof(int) * n);
+    if (!b->opcode || !b->mode || !b->target || !b->addr || !b->base || !b->disp_in ||
+        !b->word || !b->nixbpe || !b->token) {
+        fmt34_free(b);
+        return -1;
+    }
+    return 0;
+}
+
+static void fmt34_free(fmt34_batch* b)
+{
+    free(b->opcode);
+    free(b->mode);
+    free(b->target);
+    free(b->addr);
+    free(b->base);
+    free(b->disp_in);
+    free(b->word);
+    free(b->nixbpe);
+    free(b->token);
+    memset(b, 0, sizeof(*b));
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : 섹션 [first, end)의 3/4형식 명령어를 모아 한 번에 인코딩한다.
+*        1) 토큰마다 피연산자를 해석해 SoA 배열을 채우고 (format34_resolve)
+*        2) encode_format34()로 섹션 전체를 분기 없이 인코딩한 뒤
+*        3) objs[k - first]에 토큰 k의 오브젝트 코드를 둔다.
+* 매개 : 섹션 범위, 결과를 받을 배열 (end - first개, NULL로 초기화된 상태)
+* 반환 : 없음
+* 주의 : 여기서 인코딩하지 않은 토큰(다른 형식, 메모리 부족)은 objs가 NULL로 남으므로
+*        호출자는 generate_object_code()로 처리하면 된다.
+* -----------------------------------------------------------------------------------
+*/
+static void batch_encode_section(int first, int end, char** objs)
+{
+    int count = 0;
+    for (int k = first; k < end; k++)
+        if (format34_kind(token_table[k]))
+            count++;
+    fmt34_batch b;
+    if (count == 0 || fmt34_alloc(&b, count) < 0)
+        return;
+
+    for (int k = first; k < end; k++) {
+        token* t = token_table[k];
+        int kind = format34_kind(t);
+        if (!kind)
+            continue;
+        STAT_INC(gen_obj_calls);
+        int baseOpcode = search_opcode(t->operator);
+        if (baseOpcode < 0) baseOpcode = 0;
+        format34_resolve(t, baseOpcode, kind - 1, &b, b.count);
+        b.token[b.count++] = k;
+    }
+
+    encode_format34(&b);
+
+    for (int j = 0; j < b.count; j++) {
+        token* t = token_table[b.token[j]];
+        t->nixbpe = b.nixbpe[j];
+        objs[b.token[j] - first] = format34_object(&b, j);
+    }
+    fmt34_free(&b);
+}
+
+// format 4인 경우 M 레코드
+char** generate_modification_records(token* t, int* count) {
+    if (!t || !t->operand[0]) return NULL;
+
+    int mod_addr = t->addr + 1;            // 수정 시작 주소
+    char **mods = malloc(sizeof(char*) * MAX_OPERAND);
     *count = 0;
 
     // WORD 지시어의 relative expression 처리
@@ -1174,6 +3761,15 @@ char** generate_modification_records(token* t, int* count) {
     }
 
     // format 4 명령어 (+) 또는 일반 명령어의 operand 내 심볼 처리
+    if (t->operator[0] == '+' && section_relative(t)) {
+        // 같은 섹션 라벨: 섹션 시작 주소만큼 재배치 (이름 없는 섹션은 로더가 찾을 수 없어 생략)
+        if (section_name[t->section][0]) {
+            char buf[64];
+            sprintf(buf, "M%06X05+%s", mod_addr, section_name[t->section]);
+            mods[(*count)++] = strdup(buf);
+        }
+        return mods;
+    }
     if (t->operator[0] == '+') {
         // format 4 → 5 half-bytes
         char expr[64];
@@ -1207,6 +3803,261 @@ char** generate_modification_records(token* t, int* count) {
     return mods;
 }
 
+/* ------------------- 섹션 단위 T/M/E 레코드 출력 함수 ------------------- */
+/* sw_begin(): 섹션 하나의 레코드 출력 상태 초기화 */
+static void sw_begin(section_writer* w, FILE* fp, object_code* oc)
+{
+    w->fp = fp;
+    w->oc = oc;
+    w->literal_bytes = 0;
+    w->tRecStart = -1;
+    w->tRecLen = 0;
+    w->tRecord[0] = '\0';
+    w->modCount = 0;
+}
+
+/* sw_flush_text(): 모아둔 T 레코드가 있으면 출력 */
+static void sw_flush_text(section_writer* w)
+{
+    if (w->tRecLen > 0) {
+        if (w->oc)
+            obj_add_text(w->oc, w->tRecStart, w->tRecord);
+        else
+            STAT_RECORD('T', fprintf(w->fp, "T%06X%02X%s\n", w->tRecStart, w->tRecLen, w->tRecord));
+        w->tRecLen = 0;
+        w->tRecord[0] = '\0';
+    }
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : 오브젝트 코드(16진 문자열)를 addr 위치의 바이트로 현재 T 레코드에 덧붙인다.
+*        레코드가 addr에서 끝나지 않으면(RESW/RESB 등으로 주소가 끊겼으면) 새 레코드를 시작하고,
+*        text_record_max 바이트를 넘으면 명령어 경계에서 끊는다.
+* 매개 : section_writer, 섹션 상대 주소, 오브젝트 코드
+* 반환 : 없음
+* 주의 : 레코드 하나보다 긴 항목(긴 BYTE 상수 등)만 여러 레코드에 나누어 담는다.
+* -----------------------------------------------------------------------------------
+*/
+static void sw_append_text(section_writer* w, int addr, const char* obj)
+{
+    int objBytes = strlen(obj) / 2;
+    if (w->tRecLen > 0 &&
+        (addr != w->tRecStart + w->tRecLen ||
+         (objBytes <= text_record_max && w->tRecLen + objBytes > text_record_max)))
+        sw_flush_text(w);
+
+    while (objBytes > 0) {
+        if (w->tRecLen == text_record_max)
+            sw_flush_text(w);
+        if (w->tRecLen == 0)
+            w->tRecStart = addr;
+        int n = text_record_max - w->tRecLen;
+        if (n > objBytes)
+            n = objBytes;
+        memcpy(w->tRecord + w->tRecLen * 2, obj, n * 2);
+        w->tRecLen += n;
+        w->tRecord[w->tRecLen * 2] = '\0';
+        obj += n * 2;
+        addr += n;
+        objBytes -= n;
+    }
+}
+
+/* sw_add_mods(): format 4 명령어거나 WORD 디렉티브면 M 레코드를 모아둔다 */
+static void sw_add_mods(section_writer* w, token* t)
+{
+    if (t->operator[0] != '+' && strcasecmp(t->operator, "WORD"))
+        return;
+    int mcount = 0;
+    char **mods = generate_modification_records(t, &mcount);
+    for (int m = 0; m < mcount && w->modCount < MAX_MOD_RECORDS; m++) {
+        strncpy(w->modRecords[w->modCount], mods[m], sizeof(w->modRecords[0]) - 1);
+        w->modRecords[w->modCount][sizeof(w->modRecords[0]) - 1] = '\0';
+        w->modCount++;
+    }
+    for (int m = 0; m < mcount; m++)
+        free(mods[m]);
+    free(mods);
+}
+
+/* literal_object(): 리터럴 j의 오브젝트 코드를 16진 문자열로 만들고 바이트 수를 리턴 */
+static int literal_object(int j, char* out)
+{
+    char litValue[64];
+    extract_literal(literal_table[j].symbol, litValue);
+    if (toupper((unsigned char)literal_table[j].symbol[1]) == 'C') {
+        int litBytes = strlen(litValue);
+        for (int x = 0; x < litBytes; x++)
+            sprintf(out + x * 2, "%02X", (unsigned char)litValue[x]);
+        out[litBytes * 2] = '\0';
+        return litBytes;
+    }
+    strcpy(out, litValue);
+    return strlen(litValue) / 2;
+}
+
+/* sw_append_pool(): LTORG 위치 addr에 배치된 리터럴을 T 레코드에 이어 붙인다. addr < 0(섹션 끝)이면
+   남은 리터럴을 모두 붙인다. 한 풀의 리터럴은 인덱스와 주소가 모두 이어져 있으므로
+   addr에서 시작해 주소가 끊기는 곳까지가 이 LTORG의 풀이다. */
+static void sw_append_pool(section_writer* w, int sec, int addr)
+{
+    int j = literalPoolStartSec[sec];
+    for (; j < literalPoolEndSec[sec]; j++) {
+        if (addr >= 0 && literal_table[j].addr != addr)
+            break;
+        int relAddr = literal_table[j].addr - sectionStartAddr[sec];
+        char obj[130];
+        int litBytes = literal_object(j, obj);
+        w->literal_bytes += litBytes;
+        sw_append_text(w, relAddr, obj);
+        if (addr >= 0)
+            addr += litBytes;
+    }
+    // 출력 완료 표시
+    literalPoolStartSec[sec] = j;
+}
+
+/* sw_end_section(): 마지막 T 레코드 flush 후 모아둔 M 레코드와 E 레코드 출력 */
+static void sw_end_section(section_writer* w, int isFirst, int isLast, int secStart)
+{
+    sw_flush_text(w);
+
+    if (w->oc) {
+        for (int m = 0; m < w->modCount; m++)
+            obj_add_mod(w->oc, w->modRecords[m]);
+        w->oc->sections[w->oc->section_count - 1].entry = isFirst ? secStart : -1;
+        return;
+    }
+
+    // 모아놓은 모든 M 레코드 순서대로 출력
+    for (int m = 0; m < w->modCount; m++)
+        STAT_RECORD('M', fprintf(w->fp, "%s\n", w->modRecords[m]));
+
+    if (isFirst) {
+        // 첫 섹션은 E레코드 뒤에 빈 줄 하나
+        STAT_RECORD('E', fprintf(w->fp, "E%06X\n\n", secStart));
+    } else if (isLast) {
+        // 마지막 섹션이면 개행 하나만
+        STAT_RECORD('E', fprintf(w->fp, "E\n"));
+    } else {
+        // 중간 섹션은 빈 줄 하나
+        STAT_RECORD('E', fprintf(w->fp, "E\n\n"));
+    }
+}
+
+/* section_exports(): [first, end) 섹션이 name을 섹션 이름이나 EXTDEF로 내보내는지 검사 */
+static int section_exports(int first, int end, const char* name)
+{
+    if (!strcmp(token_table[first]->label, name))
+        return 1;
+    for (int k = first + 1; k < end; k++) {
+        token* t = token_table[k];
+        if (t->comment[0] == '.' || strcasecmp(t->operator, "EXTDEF"))
+            continue;
+        char* operand_copy = strdup(t->operand[0]);
+        char* save;
+        int found = 0;
+        for (char* sym = strtok_r(operand_copy, ",", &save); sym && !found; sym = strtok_r(NULL, ",", &save))
+            found = !strcmp(sym, name);
+        free(operand_copy);
+        if (found)
+            return 1;
+    }
+    return 0;
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : 패스2에서 출력할 섹션을 section_live[]에 표시하는 함수이다.
+*        --gc-sections면 섹션 사이의 참조 그래프를 만들어 END가 가리키는 진입점의
+*        섹션에서 닿는 섹션만 남긴다. 섹션 s의 EXTREF 이름을 다른 섹션 t가
+*        섹션 이름이나 EXTDEF로 내보내면 s에서 t로 가는 간선이 된다.
+* 매개 : 없음
+* 반환 : 정상종료 = 0, 섹션이 MAX_SECTIONS - 1개를 넘으면 < 0
+* 주의 : END에 피연산자가 없거나 심볼을 찾지 못하면 첫 섹션을 진입점으로 본다.
+*        버려지는 섹션은 diag로 알린다. 섹션 안에서 EXTREF 목록을 도는 동안
+*        section_exports()가 EXTDEF 목록을 나누므로 둘 다 strtok_r를 쓴다.
+* -----------------------------------------------------------------------------------
+*/
+static int mark_live_sections(void)
+{
+    int first[MAX_SECTIONS], end[MAX_SECTIONS];
+    int count = 0, end_idx = -1;
+
+    // 섹션 경계: write_object_program()과 같이 START/CSECT부터 다음 CSECT/END 전까지
+    int i = 0;
+    while (i < token_line && strcasecmp(token_table[i]->operator, "END")) {
+        int e = i + 1;
+        while (e < token_line && strcasecmp(token_table[e]->operator, "CSECT") &&
+               strcasecmp(token_table[e]->operator, "END"))
+            e++;
+        if (count + 1 >= MAX_SECTIONS) {
+            diag("%d행: 섹션은 %d개까지만 쓸 수 있습니다. (MAX_SECTIONS = %d)\n",
+                 i + 1, MAX_SECTIONS - 1, MAX_SECTIONS);
+            return -1;
+        }
+        count++;
+        first[count] = i;
+        end[count] = e;
+        i = e;
+    }
+    if (i < token_line)
+        end_idx = i;
+
+    memset(section_live, 1, sizeof(section_live));
+    last_live_section = count;
+    if (!gc_sections || count == 0)
+        return 0;
+
+    int entry = 1;
+    if (end_idx >= 0 && token_table[end_idx]->operand[0] && token_table[end_idx]->operand[0][0]) {
+        for (int s = 1; s <= count; s++) {
+            if (section_exports(first[s], end[s], token_table[end_idx]->operand[0])) {
+                entry = s;
+                break;
+            }
+        }
+        int k = find_symbol(token_table[end_idx]->operand[0], entry);
+        if (k >= 0 && sym_table[k].section >= 1 && sym_table[k].section <= count)
+            entry = sym_table[k].section;
+    }
+
+    // 진입점 섹션에서 EXTREF 간선을 따라 너비 우선 탐색
+    int queue[MAX_SECTIONS];
+    int head = 0, tail = 0;
+    memset(section_live, 0, sizeof(section_live));
+    section_live[entry] = 1;
+    queue[tail++] = entry;
+    while (head < tail) {
+        int s = queue[head++];
+        for (int k = first[s] + 1; k < end[s]; k++) {
+            token* t = token_table[k];
+            if (t->comment[0] == '.' || strcasecmp(t->operator, "EXTREF"))
+                continue;
+            char* operand_copy = strdup(t->operand[0]);
+            char* save;
+            for (char* sym = strtok_r(operand_copy, ",", &save); sym; sym = strtok_r(NULL, ",", &save)) {
+                for (int d = 1; d <= count; d++) {
+                    if (d == s || section_live[d] || !section_exports(first[d], end[d], sym))
+                        continue;
+                    section_live[d] = 1;
+                    queue[tail++] = d;
+                }
+            }
+            free(operand_copy);
+        }
+    }
+
+    last_live_section = 0;
+    for (int s = 1; s <= count; s++) {
+        if (section_live[s])
+            last_live_section = s;
+        else
+            diag("gc-sections: %s 섹션은 진입점에서 참조되지 않아 출력하지 않습니다.\n",
+                 token_table[first[s]]->label[0] ? token_table[first[s]]->label : "(이름 없음)");
+    }
+    return 0;
+}
+
 /* ----------------------------------------------------------------------------------
 * 설명 : 어셈블리 코드를 기계어 코드로 바꾸기 위한 패스2 과정을 수행하는 함수이다.
 *           패스 2에서는 프로그램을 기계어로 바꾸는 작업은 라인 단위로 수행된다.
@@ -1220,21 +4071,68 @@ char** generate_modification_records(token* t, int* count) {
 // Pass 2: Object Code 생성 및 H/D/R/T/M/E 레코드 출력
 static int assem_pass2(void)
 {
-    // H, T, M, E 레코드 생성
-    // token_table, sym_table, literal_table을 바탕으로 각 섹션별로 Object Code를 생성하여 파일에 출력
-    FILE *fp;
-    fp = fopen("output_objectcode.txt", "w");
-    if (!fp) {
-        perror("Error opening object code output file");
+    FILE *fp = open_output(output_file, "object code");
+    if (!fp)
         return -1;
+    int result;
+    if (binary_object) {
+        // 같은 pass2 결과를 object_code에 모은 뒤 바이너리로 쓴다
+        object_code oc;
+        obj_init(&oc);
+        result = write_object_program(NULL, &oc);
+        if (result == 0)
+            result = obj_write_binary(fp, &oc);
+        // 아카이브 모듈은 텍스트 형식으로 넣는다
+        if (result == 0 && archive_file) {
+            char* text = NULL;
+            size_t len = 0;
+            FILE* mem = open_memstream(&text, &len);
+            result = mem ? obj_write_text(mem, &oc) : -1;
+            if (mem)
+                fclose(mem);
+            if (result == 0)
+                result = append_archive(archive_file, text, len);
+            free(text);
+        }
+        obj_free(&oc);
+    } else if (archive_file) {
+        // --archive: 메모리에 한 번 만든 오브젝트 프로그램을 출력과 아카이브에 함께 쓴다
+        char* text = NULL;
+        size_t len = 0;
+        FILE* mem = open_memstream(&text, &len);
+        result = mem ? write_object_program(mem, NULL) : -1;
+        if (mem) {
+            writer_drain();     // writer가 섹션 버퍼를 mem에 다 쓴 뒤에 닫는다
+            fclose(mem);
+        }
+        if (result == 0 && fwrite(text, 1, len, fp) != len)
+            result = -1;
+        if (result == 0)
+            result = append_archive(archive_file, text, len);
+        free(text);
+    } else {
+        result = write_object_program(fp, NULL);
     }
+    if (writer_active())
+        writer_submit_close(fp);    // 앞서 제출한 섹션 버퍼를 다 쓴 뒤에 닫힌다
+    else
+        close_stream(fp);
+    return result;
+}
 
+/* write_object_program(): pass2 본체. 열린 스트림 fp에 H/D/R/T/M/E 레코드를 출력한다.
+   oc가 NULL이 아니면 레코드를 출력하는 대신 oc에 섹션/세그먼트/M/D/R 항목으로 모은다 */
+static int write_object_program(FILE* fp, object_code* oc)
+{
+    // H, T, M, E 레코드 생성
+    // token_table, sym_table, literal_table을 바탕으로 각 섹션별로 Object Code를 생성하여 파일에 출력
     int sectionCount = 0;
 
     // 각 control section 별로 object code를 생성함.
     // token_table의 순서대로 섹션이 연속된다고 가정하고 처리
     int i = 0;
     int sec = 1;
+    int firstEmitted = 0;   // E 레코드에 시작 주소를 쓰는 첫 출력 섹션인지
     while (i < token_line) {
         token *sectToken = token_table[i];
 
@@ -1258,8 +4156,24 @@ static int assem_pass2(void)
             endIdx++;
         }
 
+        // --gc-sections: 진입점에서 닿지 않는 섹션은 레코드를 하나도 만들지 않는다
+        if (sec <= MAX_SECTIONS && !section_live[sec]) {
+            i = endIdx;
+            sec++;
+            continue;
+        }
+
+        // --async-output: 섹션 레코드를 메모리에 모았다가 섹션이 끝나면 writer에 넘긴다
+        FILE* out = fp;
+        char* secBuf = NULL;
+        size_t secLen = 0;
+        if (fp && writer_active()) {
+            out = open_memstream(&secBuf, &secLen);
+            if (!out)
+                out = fp;
+        }
+
         int secStart = 0;   // 섹션이 시작하면 항상 주소 초기화
-        int secLength = 0;
 
         char progName[7] = {0}; 
         if (strlen(sectToken->label) > 0) {
@@ -1267,32 +4181,14 @@ static int assem_pass2(void)
             strncpy(progName, sectToken->label, 6);
         }
 
-        // H Rec
-        for (int k = sectStartIdx + 1; k < endIdx; k++) {
-            token *t = token_table[k];
-            if (t->comment[0] == '.') continue;
-            if (!t->operator[0] ||
-                !strcasecmp(t->operator, "START") ||
-                !strcasecmp(t->operator, "CSECT") ||
-                !strcasecmp(t->operator, "END")   ||
-                !strcasecmp(t->operator, "EQU")   ||
-                !strcasecmp(t->operator, "EXTDEF")||
-                !strcasecmp(t->operator, "EXTREF")||
-                !strcasecmp(t->operator, "LTORG"))
-                continue;
-
-            char *obj = generate_object_code(t);
-            if (obj && *obj) {
-                int len = strlen(obj) / 2;
-                int addr = locctr_table[k];     // 이 addrdms 0부터 카운트된 섹션 상대주소
-                if (addr + len > secLength)
-                    secLength = addr + len;
-            }
-            free(obj);
+        // H Rec: 섹션 길이는 패스1이 section_length에 기록해 두었다
+        if (oc) {
+            if (obj_add_section(oc, progName, secStart, section_length[sectionCount]) < 0)
+                return -1;
+        } else {
+            STAT_RECORD('H', fprintf(out, "H%-7s%06X%06X\n", progName, secStart, section_length[sectionCount]));
         }
 
-        fprintf(fp, "H%-7s%06X%06X\n", progName, secStart, section_length[sectionCount]);
-
         // D, R 레코드 생성
         char dRecord[256] = {0};
         char rRecord[256] = {0};
@@ -1300,28 +4196,24 @@ static int assem_pass2(void)
             token *t = token_table[k];
             if (!strcasecmp(t->operator, "EXTDEF")) {
                 char *operand_copy = strdup(t->operand[0]);
-                char *sym = strtok(t->operand[0], ",");
+                char *sym = strtok(operand_copy, ",");
                 while (sym) {
                     // sym_table에서 같은 섹션(currentSectionCount)와 같이 이름이 일치하는 addr 검색
-                    unsigned int addr = 0;
-                    for (int s = 0; s < label_num; s++) {
-                        if (!strcmp(sym_table[s].symbol, sym) 
-                            && sym_table[s].section == sectionCount) {
-                            addr = sym_table[s].addr;
-                            break;
-                        }
-                    }
+                    int s = sym_lookup(sym, sectionCount);
+                    unsigned int addr = s >= 0 ? sym_table[s].addr : 0;
                     char tmp[32];
                     // %-6s: 이름, %06X: 6자리 16진수
                     sprintf(tmp, "%-6s%06X", sym, addr);
                     strcat(dRecord, tmp);
+                    if (oc)
+                        obj_add_symbol(oc, 0, sym, addr);
                     sym = strtok(NULL, ",");
                 }
                 free(operand_copy);
             }
             if (!strcasecmp(t->operator, "EXTREF")) {
                 char *operand_copy = strdup(t->operand[0]);
-                char *sym = strtok(t->operand[0], ",");
+                char *sym = strtok(operand_copy, ",");
                 while (sym) {
                 strcpy(extref_table[extref_count++], sym);
 
@@ -1329,140 +4221,99 @@ static int assem_pass2(void)
                 char tmp[8];
                 sprintf(tmp, "%-6s", sym);
                 strcat(rRecord, tmp);
+                if (oc)
+                    obj_add_symbol(oc, 1, sym, 0);
 
                 sym = strtok(NULL, ",");
                 }
                 free(operand_copy);
             }
         }
-        if (dRecord[0]) fprintf(fp, "D%s\n", dRecord);
-        if (rRecord[0]) fprintf(fp, "R%s\n", rRecord);
+        if (!oc && dRecord[0]) STAT_RECORD('D', fprintf(out, "D%s\n", dRecord));
+        if (!oc && rRecord[0]) STAT_RECORD('R', fprintf(out, "R%s\n", rRecord));
 
         // T, M 레코드 생성
-        int tRecStart = -1, tRecLen = 0, modCount = 0;
-        char tRecord[MAX_TEXT_RECORD_LENGTH * 2 + 1] = {0};
-        char modRecords[100][32];
+        section_writer w;
+        sw_begin(&w, out, oc);
+
+        // --size-profile: 인코딩 결과를 섹션별로 센다
+        size_profile* prof = NULL;
+        if (size_profile_file && sec <= MAX_SECTIONS) {
+            prof = &size_profiles[sec];
+            snprintf(prof->name, sizeof(prof->name), "%s", progName);
+            if (sec > size_profile_count)
+                size_profile_count = sec;
+        }
 
-        
-        // 섹션 내 모든 토큰 돌면서 T 레코드 축적 + M 레코드 모으기
-        for (int k = sectStartIdx + 1; k < endIdx; k++) {
-            token *t = token_table[k];
+        // 3/4형식 명령어는 섹션 단위로 먼저 한꺼번에 인코딩해 둔다
+        char** preObj = calloc(endIdx - sectStartIdx, sizeof(char*));
+        if (preObj)
+            batch_encode_section(sectStartIdx + 1, endIdx, preObj + 1);
 
-            // LTORG 처리
-            if (!strcasecmp(t->operator, "LTORG")) {
-                // 1) 남은 T–레코드 flush
-                if (tRecLen > 0) {
-                    fprintf(fp, "T%06X%02X%s\n", tRecStart, tRecLen, tRecord);
-                    tRecLen = 0; tRecord[0] = '\0';
-                }
-                // 2) 아직 출력 안 한 리터럴만 독립 레코드로
-                for (int j = literalPoolStartSec[sec]; j < literalPoolEndSec[sec]; j++) {
-                    int relAddr = literal_table[j].addr - sectionStartAddr[sec];
-                    char litValue[64];
-                    extract_literal(literal_table[j].symbol, litValue);
-                    int litBytes = (toupper(literal_table[j].symbol[1])=='C')
-                                ? strlen(litValue)
-                                : strlen(litValue)/2;
-                    // 독립 T–레코드
-                    fprintf(fp, "T%06X%02X", relAddr, litBytes);
-                    if (toupper(literal_table[j].symbol[1])=='C') {
-                        for (int x = 0; x < litBytes; x++)
-                            fprintf(fp, "%02X", (unsigned char)litValue[x]);
-                    } else {
-                        fprintf(fp, "%s", litValue);
-                    }
-                    fprintf(fp, "\n");
+        // 섹션 내 모든 토큰 돌면서 T 레코드 축적 + M 레코드 모으기
+        // USE 블록이 있으면 블록 순서(= 주소 순서)대로 그 블록의 토큰만 골라 출력한다
+        // END 없이 끝난 소스는 마지막 섹션이 토큰 테이블 끝에서 끝난다
+        token* endTok = endIdx < token_line ? token_table[endIdx] : NULL;
+        _Bool isLastSection = !endTok || !strcasecmp(endTok->operator, "END");
+        int blockCount = block_count[sec] > 0 ? block_count[sec] : 1;
+        for (int b = 0; b < blockCount; b++) {
+            for (int k = sectStartIdx + 1; k < endIdx; k++) {
+                token *t = token_table[k];
+                if (t->block != b) continue;
+
+                // LTORG 처리: 이 위치에 배치된 리터럴을 T 레코드에 이어 붙인다
+                if (!strcasecmp(t->operator, "LTORG")) {
+                    t->lit_start = literalPoolStartSec[sec];
+                    sw_append_pool(&w, sec, locctr_table[k]);
+                    t->lit_end = literalPoolStartSec[sec];
+                    continue;
                 }
-                // 출력 완료 표시
-                literalPoolStartSec[sec] = literalPoolEndSec[sec];
-                continue;
-            }
 
-            // (2) 텍스트 레코드에 포함되지 않을 토큰은 건너뛴다
-            if (!isTextRecordable(t)) continue;
-
-            // 3) 객체 코드 생성 및 T-레코드 overflow 체크
-            char *obj = generate_object_code(t);
-            int objBytes = strlen(obj)/2;
-            int addr     = locctr_table[k];
-            if (tRecLen == 0) tRecStart = addr;
-            if (tRecLen + objBytes > MAX_TEXT_RECORD_LENGTH) {
-                fprintf(fp, "T%06X%02X%s\n", tRecStart, tRecLen, tRecord);
-                tRecLen = 0; tRecord[0] = '\0';
-                tRecStart = addr;
-            }
-            strcat(tRecord, obj);
-            tRecLen += objBytes;
-            free(obj);
-
-            // 6) format 4 명령어거나 WORD 디렉티브면 M 레코드도 모아두기
-            if (t->operator[0] == '+' || !strcasecmp(t->operator, "WORD")) {
-                int mcount = 0;
-                char **mods = generate_modification_records(t, &mcount);
-                for (int m = 0; m < mcount && modCount < 100; m++) {
-                    strncpy(modRecords[modCount], mods[m], sizeof(modRecords[0]) - 1);
-                    modRecords[modCount][sizeof(modRecords[0]) - 1] = '\0';
-                    modCount++;
-                    free(mods[m]);
-                }
-                free(mods);
+                // (2) 텍스트 레코드에 포함되지 않을 토큰은 건너뛴다
+                if (!isTextRecordable(t)) continue;
+
+                // 3) 객체 코드 생성 및 T-레코드 overflow 체크
+                //    생성한 코드는 전체 리스트 출력을 위해 토큰에 보관한다
+                char *obj = preObj && preObj[k - sectStartIdx] ? preObj[k - sectStartIdx]
+                                                                : generate_object_code(t);
+                if (preObj)
+                    preObj[k - sectStartIdx] = NULL;
+                sw_append_text(&w, locctr_table[k], obj);
+                free(t->obj);
+                t->obj = obj;
+                if (prof)
+                    profile_token(prof, t, k + 1, obj);
+
+                // 6) format 4 명령어거나 WORD 디렉티브면 M 레코드도 모아두기
+                sw_add_mods(&w, t);
             }
-        }
 
-        // END
-        if (!strcasecmp(token_table[endIdx]->operator, "END")) {
-            // 아직 출력 안 한 리터럴만
-            for (int j = literalPoolStartSec[sec]; j < literalPoolEndSec[sec]; j++) {
-                int relAddr = literal_table[j].addr - sectionStartAddr[sec];
-                char litValue[64];
-                extract_literal(literal_table[j].symbol, litValue);
-                int litBytes = (toupper(literal_table[j].symbol[1])=='C')
-                            ? strlen(litValue)
-                            : strlen(litValue)/2;
-
-                // 공간 체크: append 가능한지
-                if (tRecLen + litBytes > MAX_TEXT_RECORD_LENGTH) {
-                    // 넘으면 flush
-                    fprintf(fp, "T%06X%02X%s\n", tRecStart, tRecLen, tRecord);
-                    tRecLen = 0; tRecord[0] = '\0';
-                    tRecStart = relAddr;
-                }
-                // append
-                if (toupper(literal_table[j].symbol[1])=='C') {
-                    for (int x = 0; x < litBytes; x++) {
-                        char hx[3];
-                        sprintf(hx, "%02X", (unsigned char)litValue[x]);
-                        strcat(tRecord, hx);
-                    }
-                } else {
-                    strcat(tRecord, litValue);
+            // END/CSECT: 섹션 끝에 배치된 리터럴은 그때의 블록 끝에 이어 붙인다
+            if ((endTok && b == endTok->block) || b == blockCount - 1) {
+                if (endTok && literalPoolStartSec[sec] < literalPoolEndSec[sec]) {
+                    endTok->lit_start = literalPoolStartSec[sec];
+                    endTok->lit_end = literalPoolEndSec[sec];
                 }
-                tRecLen += litBytes;
+                sw_append_pool(&w, sec, -1);
             }
         }
 
-        // 마지막 T-레코드 flush
-        if (tRecLen > 0) {
-            fprintf(fp, "T%06X%02X%s\n", tRecStart, tRecLen, tRecord);
+        if (preObj) {
+            for (int k = 0; k < endIdx - sectStartIdx; k++)
+                free(preObj[k]);
+            free(preObj);
         }
 
-
-        // 모아놓은 모든 M 레코드 순서대로 출력
-        for (int m = 0; m < modCount; m++) {
-            fprintf(fp, "%s\n", modRecords[m]);
+        if (prof) {
+            prof->literal_bytes = w.literal_bytes;
+            profile_mods(prof, &w);
         }
 
-        // E 레코드 출력
-        _Bool isLastSection = !strcasecmp(token_table[endIdx]->operator, "END");
-        if (i == 0) {
-            // 첫 섹션은 E레코드 뒤에 빈 줄 하나
-            fprintf(fp, "E%06X\n\n", secStart);
-        } else if (isLastSection) {
-            // 마지막 섹션이면 개행 하나만
-            fprintf(fp, "E\n");
-        } else {
-            // 중간 섹션은 빈 줄 하나
-            fprintf(fp, "E\n\n");
+        // 마지막 T-레코드 flush, M 레코드, E 레코드 출력
+        sw_end_section(&w, !firstEmitted++, isLastSection || sec == last_live_section, secStart);
+        if (out != fp) {
+            fclose(out);
+            writer_submit_buffer(fp, secBuf, secLen, echo_object && fp != stdout);
         }
 
         // 다음 섹션으로 이동
@@ -1470,10 +4321,269 @@ static int assem_pass2(void)
         sec++;
     }
 
-    fclose(fp);
     return 0;
 }
 
+/* ------------------- 코드 크기/재배치 통계 (--size-profile) ------------------- */
+/* operand_symbol(): 피연산자에서 #, @, ",X"를 떼어낸 심볼 이름을 out에 복사 */
+static void operand_symbol(const char* operand, char* out, int size)
+{
+    if (operand[0] == '#' || operand[0] == '@')
+        operand++;
+    snprintf(out, size, "%s", operand);
+    char* comma = strstr(out, ",X");
+    if (comma)
+        *comma = '\0';
+}
+
+/* section_relative(): 4형식 명령어의 피연산자가 calc_nixbpe와 같은 규칙으로 찾은 같은 섹션의
+   라벨(혹은 상대값 EQU)이면 1. 그 주소는 섹션 시작 기준이므로 주소 필드에 넣고 섹션 이름의 M 레코드로 재배치한다.
+   리터럴, 숫자 상수, 외부 참조, 다른 섹션 심볼, 절대값 EQU 심볼은 0 */
+static int section_relative(token* t)
+{
+    if (t->operator[0] != '+' || !t->operand[0] || t->section < 1 || t->section > MAX_SECTIONS)
+        return 0;
+    char name[64];
+    operand_symbol(t->operand[0], name, sizeof(name));
+    if (!name[0] || name[0] == '=' || isdigit((unsigned char)name[0]) || is_extref(name))
+        return 0;
+    int k = (t->operand[0][0] == '#' || t->operand[0][0] == '@') ? sym_lookup(name, 0)
+                                                                 : find_symbol(name, t->section);
+    return k >= 0 && sym_table[k].section == t->section && !equ_absolute[k];
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : pass2가 방금 인코딩한 토큰 하나를 섹션 통계에 더한다.
+*        오브젝트 코드 길이로 형식을, t->nixbpe로 주소 지정 방식을 구분하고,
+*        4형식이면 pass2가 구한 목표 주소(t->target)로 3형식 disp에 들어가는지 본다.
+* 매개 : 섹션 통계, 토큰, 토큰 번호(1부터), 오브젝트 코드
+* 반환 : 없음
+* 주의 : 3형식으로 줄였을 때의 PC는 (주소 + 3)으로 계산한다. 실제로 줄이면 뒤쪽 주소가
+*        당겨지므로 경계에 걸친 후보는 다시 어셈블해서 확인해야 한다.
+* -----------------------------------------------------------------------------------
+*/
+static void profile_token(size_profile* p, token* t, int line, const char* obj)
+{
+    int len = strlen(obj) / 2;
+    if (!strcasecmp(t->operator, "BYTE") || !strcasecmp(t->operator, "WORD")) {
+        p->data_bytes += len;
+        return;
+    }
+    p->code_bytes += len;
+    if (len >= 1 && len <= 4)
+        p->formats[len]++;
+    int op = find_inst_index(t->operator);
+    if (op >= 0)
+        p->opcodes[op]++;
+    if (len < 3)
+        return;
+
+    int bits = t->nixbpe;
+    int ni = (bits >> 4) & 0x03;
+    if (bits & 0x01)
+        p->modes[PROF_EXTENDED]++;
+    else if (bits & 0x02)
+        p->modes[PROF_PC]++;
+    else if (bits & 0x04)
+        p->modes[PROF_BASE]++;
+    else
+        p->modes[PROF_ABSOLUTE]++;
+    p->modes[ni == 1 ? PROF_IMMEDIATE : ni == 2 ? PROF_INDIRECT : PROF_SIMPLE]++;
+    if (bits & 0x08)
+        p->modes[PROF_INDEXED]++;
+
+    if (!(bits & 0x01) || !t->operand[0])
+        return;
+    // 4형식: 외부 참조가 아니고 목표가 12비트 disp 안이면 3형식으로 충분했다
+    char name[64];
+    operand_symbol(t->operand[0], name, sizeof(name));
+    char reason = 0;
+    int value = 0;
+    if (isdigit((unsigned char)name[0])) {
+        if (t->target >= 0 && t->target <= 4095)
+            reason = ni == 1 ? 'I' : 'A', value = t->target;
+    } else if (!is_extref(name) && find_symbol(name, t->section) >= 0) {
+        int disp = t->target - (t->addr + 3);
+        if (disp >= -2048 && disp <= 2047)
+            reason = 'P', value = disp;
+        else if (t->base >= 0 && t->target - t->base >= 0 && t->target - t->base <= 4095)
+            reason = 'B', value = t->target - t->base;
+    }
+    if (!reason)
+        return;
+    if (dis_grow((void**)&p->shrinks, &p->shrink_cap, p->shrink_count + 1, sizeof(prof_shrink)) < 0)
+        return;
+    prof_shrink* sh = &p->shrinks[p->shrink_count++];
+    sh->line = line;
+    sh->addr = t->addr;
+    sh->reason = reason;
+    sh->value = value;
+}
+
+/* profile_mods(): 섹션에 모인 M 레코드("M%06X%02X%c%s")를 참조 심볼별로 센다 */
+static void profile_mods(size_profile* p, const section_writer* w)
+{
+    for (int m = 0; m < w->modCount; m++) {
+        const char* rec = w->modRecords[m];
+        if (strlen(rec) < 10)
+            continue;
+        const char* name = rec + 10;
+        int k;
+        for (k = 0; k < p->mod_count; k++)
+            if (!strcmp(p->mods[k].name, name))
+                break;
+        if (k == p->mod_count) {
+            if (dis_grow((void**)&p->mods, &p->mod_cap, p->mod_count + 1, sizeof(prof_mod)) < 0)
+                return;
+            memset(&p->mods[k], 0, sizeof(prof_mod));
+            snprintf(p->mods[k].name, sizeof(p->mods[k].name), "%s", name);
+            p->mod_count++;
+        }
+        p->mods[k].count++;
+        if (hex_value(rec + 7, 2) == 6)
+            p->mods[k].words++;
+    }
+}
+
+static void free_size_profiles(void)
+{
+    for (int s = 0; s <= MAX_SECTIONS; s++) {
+        free(size_profiles[s].mods);
+        free(size_profiles[s].shrinks);
+    }
+    memset(size_profiles, 0, sizeof(size_profiles));
+    size_profile_count = 0;
+}
+
+static const size_profile* opcode_sort_profile;
+
+/* 명령어 수 내림차순, 같으면 이름순 */
+static int opcode_count_cmp(const void* a, const void* b)
+{
+    int x = *(const int*)a, y = *(const int*)b;
+    int d = opcode_sort_profile->opcodes[y] - opcode_sort_profile->opcodes[x];
+    return d ? d : strcmp(inst_table[x]->str, inst_table[y]->str);
+}
+
+static int prof_mod_cmp(const void* a, const void* b)
+{
+    const prof_mod* x = a;
+    const prof_mod* y = b;
+    return x->count != y->count ? y->count - x->count : strcmp(x->name, y->name);
+}
+
+/* write_size_profile(): 섹션 하나(혹은 합계)의 통계를 출력 */
+static void write_size_profile(FILE* fp, size_profile* p, int with_lines)
+{
+    int total = p->code_bytes + p->data_bytes + p->literal_bytes;
+    fprintf(fp, "  bytes       : code %d, data %d, literal %d, total %d\n",
+            p->code_bytes, p->data_bytes, p->literal_bytes, total);
+    fprintf(fp, "  format      : 1=%d 2=%d 3=%d 4=%d\n",
+            p->formats[1], p->formats[2], p->formats[3], p->formats[4]);
+    fprintf(fp, "  addressing  : pc-relative %d, base-relative %d, absolute %d, extended %d\n",
+            p->modes[PROF_PC], p->modes[PROF_BASE], p->modes[PROF_ABSOLUTE], p->modes[PROF_EXTENDED]);
+    fprintf(fp, "  operand     : simple %d, immediate %d, indirect %d, indexed %d\n",
+            p->modes[PROF_SIMPLE], p->modes[PROF_IMMEDIATE], p->modes[PROF_INDIRECT], p->modes[PROF_INDEXED]);
+
+    int order[MAX_INST], n = 0;
+    for (int k = 0; k < inst_index; k++)
+        if (p->opcodes[k])
+            order[n++] = k;
+    opcode_sort_profile = p;
+    qsort(order, n, sizeof(int), opcode_count_cmp);
+    fprintf(fp, "  opcodes     :");
+    for (int k = 0; k < n; k++)
+        fprintf(fp, "%s %s %d", k ? "," : "", inst_table[order[k]]->str, p->opcodes[order[k]]);
+    fprintf(fp, "\n");
+
+    int mods = 0;
+    for (int k = 0; k < p->mod_count; k++)
+        mods += p->mods[k].count;
+    if (p->mod_count > 0)
+        qsort(p->mods, p->mod_count, sizeof(prof_mod), prof_mod_cmp);
+    fprintf(fp, "  M records   : %d", mods);
+    for (int k = 0; k < p->mod_count; k++) {
+        fprintf(fp, "%s %s %d", k ? "," : " -", p->mods[k].name, p->mods[k].count);
+        if (p->mods[k].words)
+            fprintf(fp, " (WORD %d)", p->mods[k].words);
+    }
+    fprintf(fp, "\n");
+
+    fprintf(fp, "  format 4 -> 3 candidates : %d (%d bytes)\n", p->shrink_count, p->shrink_count);
+    if (!with_lines)
+        return;
+    for (int k = 0; k < p->shrink_count; k++) {
+        const prof_shrink* sh = &p->shrinks[k];
+        token* t = token_table[sh->line - 1];
+        const char* why = sh->reason == 'P' ? "pc-relative disp" :
+                          sh->reason == 'B' ? "base-relative disp" :
+                          sh->reason == 'I' ? "12-bit immediate" : "12-bit address";
+        fprintf(fp, "    line %-6d %04X  %-8s %-8s %-12s %s %d\n", sh->line, sh->addr & 0xFFFF,
+                t->label, t->operator, t->operand[0] ? t->operand[0] : "", why, sh->value);
+    }
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : pass2가 섹션별로 모은 코드 크기/재배치 통계를 출력한다 (--size-profile).
+*        섹션마다 바이트 구성(코드/데이터/리터럴), 형식별/주소 지정 방식별/명령어별 개수,
+*        참조 심볼별 M 레코드 수, 3형식으로 충분했던 4형식 명령어를 보여주고 마지막에 합계를 낸다.
+* 매개 : 생성할 파일명 ("-"이면 stdout)
+* 반환 : 없음
+* 주의 : pass2가 끝난 뒤에 불러야 한다.
+* -----------------------------------------------------------------------------------
+*/
+void make_size_profile_output(char* file_name)
+{
+    FILE* fp = open_output(file_name, "size profile");
+    if (!fp)
+        return;
+
+    size_profile* sum = calloc(1, sizeof(size_profile));
+    if (!sum) {
+        perror("size profile");
+        close_stream(fp);
+        return;
+    }
+    for (int s = 1; s <= size_profile_count; s++) {
+        size_profile* p = &size_profiles[s];
+        fprintf(fp, "SECTION %-6s (length %06X)\n", p->name, section_length[s < MAX_SECTIONS ? s : 0]);
+        write_size_profile(fp, p, 1);
+        fprintf(fp, "\n");
+
+        sum->code_bytes += p->code_bytes;
+        sum->data_bytes += p->data_bytes;
+        sum->literal_bytes += p->literal_bytes;
+        for (int k = 0; k < 5; k++)
+            sum->formats[k] += p->formats[k];
+        for (int k = 0; k < PROF_MODES; k++)
+            sum->modes[k] += p->modes[k];
+        for (int k = 0; k < inst_index; k++)
+            sum->opcodes[k] += p->opcodes[k];
+        for (int m = 0; m < p->mod_count; m++) {
+            int k;
+            for (k = 0; k < sum->mod_count; k++)
+                if (!strcmp(sum->mods[k].name, p->mods[m].name))
+                    break;
+            if (k == sum->mod_count) {
+                if (dis_grow((void**)&sum->mods, &sum->mod_cap, sum->mod_count + 1, sizeof(prof_mod)) < 0)
+                    break;
+                memset(&sum->mods[k], 0, sizeof(prof_mod));
+                strcpy(sum->mods[k].name, p->mods[m].name);
+                sum->mod_count++;
+            }
+            sum->mods[k].count += p->mods[m].count;
+            sum->mods[k].words += p->mods[m].words;
+        }
+        sum->shrink_count += p->shrink_count;
+    }
+    fprintf(fp, "TOTAL (%d sections)\n", size_profile_count);
+    write_size_profile(fp, sum, 0);
+
+    free(sum->mods);
+    free(sum);
+    close_stream(fp);
+}
+
 /* ----------------------------------------------------------------------------------
 * 설명 : 입력된 문자열의 이름을 가진 파일에 프로그램의 결과를 저장하는 함수이다.
 *        여기서 출력되는 내용은 object code이다.
@@ -1488,6 +4598,8 @@ static int assem_pass2(void)
 */
 void make_objectcode_output(char *file_name)
 {
+    if (!strcmp(file_name, "-"))
+        return;     // 이미 stdout으로 출력됨
     FILE* fp = fopen(file_name, "r");
     if (fp == NULL) {
         perror("Error reading object code output file");
@@ -1506,4 +4618,4413 @@ int is_extref(const char* symbol) {
             return 1;
     }
     return 0;
-}
\ No newline at end of file
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : 스트리밍 모드(--stream)로 어셈블하는 함수이다.
+*        pass1은 소스를 한 줄씩 읽어 토큰으로 분석한 뒤, 라인마다 압축된 바이너리
+*        중간 레코드를 임시 파일에 기록한다. 메모리에는 심볼/리터럴 테이블과
+*        섹션별 EXTDEF/EXTREF 목록만 남는다.
+*        pass2는 중간 파일을 처음부터 다시 읽으며 곧바로 H/D/R/T/M/E 레코드를 출력한다.
+* 매개 : 어셈블리할 소스파일명
+* 반환 : 정상종료 = 0, 에러 < 0
+* 주의 : input_data, token_table, locctr_table을 사용하지 않으므로 메모리 사용량이
+*        라인 수가 아니라 심볼 수에 비례한다.
+* -----------------------------------------------------------------------------------
+*/
+static int assem_stream(void)
+{
+    phase_begin();
+    if (init_inst_file("inst_table.txt") < 0) {
+        fprintf(stderr, "init_my_assembler: 프로그램 초기화에 실패 했습니다.\n");
+        return -1;
+    }
+    phase_end("init_inst_file");
+
+    FILE* src = open_input(input_file);
+    if (!src)
+        return -1;
+    FILE* imed = tmpfile();
+    if (!imed) {
+        perror("Error creating intermediate file");
+        close_stream(src);
+        return -1;
+    }
+
+    phase_begin();
+    int result = stream_pass1(src, imed);
+    close_stream(src);
+    if (result < 0) {
+        fprintf(stderr, "assem_pass1: 패스1 과정에서 실패하였습니다.  \n");
+        fclose(imed);
+        return -1;
+    }
+    phase_end("stream_pass1");
+
+    if (symtab_file) {
+        phase_begin();
+        make_symtab_output(symtab_file);
+        phase_end("make_symtab_output");
+    }
+    if (littab_file) {
+        phase_begin();
+        make_literaltab_output(littab_file);
+        phase_end("make_literaltab_output");
+    }
+    if (symindex_file) {
+        phase_begin();
+        make_symindex_output(symindex_file);
+        phase_end("make_symindex_output");
+    }
+
+    FILE* obj_fp = open_output(output_file, "object code");
+    if (!obj_fp) {
+        fclose(imed);
+        return -1;
+    }
+    FILE* list_fp = open_output(listing_file, "listing");
+
+    phase_begin();
+    result = stream_pass2(imed, obj_fp, list_fp);
+    close_stream(obj_fp);
+    close_stream(list_fp);
+    fclose(imed);
+    if (result < 0) {
+        fprintf(stderr, " assem_pass2: 패스2 과정에서 실패하였습니다.  \n");
+        return -1;
+    }
+    phase_end("stream_pass2");
+
+    if (echo_object) {
+        phase_begin();
+        make_objectcode_output(output_file);
+        phase_end("make_objectcode_output");
+    }
+    return 0;
+}
+
+/* open_input(): 입력 경로를 연다. "-"면 stdin */
+static FILE* open_input(const char* path)
+{
+    if (!strcmp(path, "-"))
+        return stdin;
+    FILE* fp = fopen(path, "r");
+    if (!fp)
+        perror("Error opening input file");
+    return fp;
+}
+
+/* open_output(): 출력 경로를 연다. NULL이면 출력하지 않으므로 NULL, "-"면 stdout */
+static FILE* open_output(const char* path, const char* what)
+{
+    if (path == NULL)
+        return NULL;
+    if (!strcmp(path, "-"))
+        return stdout;
+    FILE* fp = fopen(path, "w");
+    if (!fp)
+        fprintf(stderr, "Error opening %s output file %s: %s\n", what, path, strerror(errno));
+    return fp;
+}
+
+/* close_stream(): stdin/stdout이 아닌 스트림만 닫는다 */
+static void close_stream(FILE* fp)
+{
+    if (fp && fp != stdin && fp != stdout)
+        fclose(fp);
+}
+
+/* ------------------- 백그라운드 출력 (--async-output) ------------------- */
+static pthread_t writer_thread;
+static pthread_mutex_t writer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writer_cond = PTHREAD_COND_INITIALIZER;
+static writer_job* writer_head = NULL;     // 제출 순서대로 처리할 작업 큐
+static writer_job* writer_tail = NULL;
+static int writer_running = 0;
+static int writer_busy = 0;                // 큐에서 꺼내 처리 중인 작업이 있는지
+static int writer_stopping = 0;
+static int writer_error = 0;
+
+/* writer_exec(): 작업 하나를 처리한다 (buf는 해제한다) */
+static void writer_exec(const writer_job* job)
+{
+    if (job->make)
+        job->make(job->path);
+    if (job->buf) {
+        if (fwrite(job->buf, 1, job->len, job->fp) != job->len)
+            writer_error = 1;
+        if (job->echo)
+            fwrite(job->buf, 1, job->len, stdout);
+        free(job->buf);
+    }
+    if (job->close) {
+        if (job->fp != stdout && fflush(job->fp) != 0)
+            writer_error = 1;
+        close_stream(job->fp);
+    }
+}
+
+/* writer_run(): writer 스레드 본체. 큐가 비고 종료 요청이 오면 끝난다 */
+static void* writer_run(void* arg)
+{
+    (void)arg;
+    pthread_mutex_lock(&writer_lock);
+    for (;;) {
+        while (!writer_head && !writer_stopping)
+            pthread_cond_wait(&writer_cond, &writer_lock);
+        if (!writer_head)
+            break;
+        writer_job* job = writer_head;
+        writer_head = job->next;
+        if (!writer_head)
+            writer_tail = NULL;
+        writer_busy = 1;
+        pthread_mutex_unlock(&writer_lock);
+
+        writer_exec(job);
+        free(job);
+
+        pthread_mutex_lock(&writer_lock);
+        writer_busy = 0;
+        pthread_cond_broadcast(&writer_cond);
+    }
+    pthread_mutex_unlock(&writer_lock);
+    return NULL;
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : 출력 파일 쓰기를 맡을 writer 스레드를 시작한다.
+*        이후 run_output()과 pass2의 섹션 버퍼는 큐에 들어가 제출 순서대로 쓰인다.
+* 매개 : 없음
+* 반환 : 정상종료 = 0, 스레드를 만들지 못하면 < 0 (이때는 동기 출력을 그대로 쓴다)
+* 주의 : 작업은 스레드 하나가 차례로 처리하므로 같은 스트림에 쓰는 순서는 동기 모드와 같다.
+* -----------------------------------------------------------------------------------
+*/
+static int writer_start(void)
+{
+    writer_head = writer_tail = NULL;
+    writer_busy = writer_stopping = writer_error = 0;
+    if (pthread_create(&writer_thread, NULL, writer_run, NULL) != 0)
+        return -1;
+    writer_running = 1;
+    return 0;
+}
+
+/* writer_active(): writer 스레드가 떠 있는지 */
+static int writer_active(void)
+{
+    return writer_running;
+}
+
+/* writer_submit(): 작업을 큐 끝에 넣는다. 메모리가 없으면 호출한 스레드에서 바로 처리 */
+static void writer_submit(const writer_job* proto)
+{
+    writer_job* job = malloc(sizeof(writer_job));
+    if (!job) {
+        writer_drain();     // 순서를 지키기 위해 앞선 작업을 먼저 끝낸다
+        writer_exec(proto);
+        return;
+    }
+    *job = *proto;
+    job->next = NULL;
+    pthread_mutex_lock(&writer_lock);
+    if (writer_tail)
+        writer_tail->next = job;
+    else
+        writer_head = job;
+    writer_tail = job;
+    pthread_cond_broadcast(&writer_cond);
+    pthread_mutex_unlock(&writer_lock);
+}
+
+/* writer_submit_make(): make(path) 호출을 writer에 맡긴다 */
+static void writer_submit_make(void (*make)(char*), char* path)
+{
+    writer_job job = { NULL, make, path, NULL, NULL, 0, 0, 0 };
+    writer_submit(&job);
+}
+
+/* writer_submit_buffer(): buf를 fp에 쓰는 작업 (buf는 writer가 해제한다, echo면 stdout에도) */
+static void writer_submit_buffer(FILE* fp, char* buf, size_t len, int echo)
+{
+    writer_job job = { NULL, NULL, NULL, fp, buf, len, echo, 0 };
+    writer_submit(&job);
+}
+
+/* writer_submit_close(): 앞선 작업이 끝난 뒤 fp를 닫는 작업 */
+static void writer_submit_close(FILE* fp)
+{
+    writer_job job = { NULL, NULL, NULL, fp, NULL, 0, 0, 1 };
+    writer_submit(&job);
+}
+
+/* writer_drain(): 지금까지 제출한 작업이 모두 끝날 때까지 기다린다 */
+static void writer_drain(void)
+{
+    if (!writer_running)
+        return;
+    pthread_mutex_lock(&writer_lock);
+    while (writer_head || writer_busy)
+        pthread_cond_wait(&writer_cond, &writer_lock);
+    pthread_mutex_unlock(&writer_lock);
+}
+
+/* writer_stop(): 남은 작업을 모두 처리한 뒤 writer 스레드를 끝낸다. 쓰기 실패가 있었으면 < 0 */
+static int writer_stop(void)
+{
+    if (!writer_running)
+        return 0;
+    pthread_mutex_lock(&writer_lock);
+    writer_stopping = 1;
+    pthread_cond_broadcast(&writer_cond);
+    pthread_mutex_unlock(&writer_lock);
+    pthread_join(writer_thread, NULL);
+    writer_running = 0;
+    return writer_error ? -1 : 0;
+}
+
+/* run_output(): writer가 있으면 출력 함수를 맡기고, 없으면 바로 실행하며 소요 시간을 기록 */
+static void run_output(const char* phase, void (*make)(char*), char* path)
+{
+    if (writer_running) {
+        writer_submit_make(make, path);
+        return;
+    }
+    phase_begin();
+    make(path);
+    phase_end(phase);
+}
+
+/* find_inst_index(): 명령어 이름('+' 허용)의 inst_table 인덱스, 없으면 -1 */
+static int find_inst_index(const char* name)
+{
+    if (name[0] == '+')
+        name++;
+    STAT_LOOKUP(opcode);
+    for (int i = 0; i < inst_index; i++) {
+        STAT_PROBE(opcode);
+        if (strcasecmp(inst_table[i]->str, name) == 0)
+            return i;
+    }
+    return -1;
+}
+
+/* append_list(): 섹션별 EXTDEF/EXTREF 목록 문자열에 ','로 이어 붙인다 */
+static void append_list(char** list, const char* items)
+{
+    size_t old_len = *list ? strlen(*list) : 0;
+    char* grown = realloc(*list, old_len + strlen(items) + 2);
+    if (!grown)
+        return;
+    if (old_len > 0)
+        grown[old_len++] = ',';
+    strcpy(grown + old_len, items);
+    *list = grown;
+}
+
+/* list_has(): 쉼표로 구분된 목록 list(NULL 허용)에 name이 있는가 */
+static int list_has(const char* list, const char* name)
+{
+    size_t len = strlen(name);
+    for (const char* p = list; p && *p; ) {
+        const char* comma = strchr(p, ',');
+        size_t n = comma ? (size_t)(comma - p) : strlen(p);
+        if (n == len && !strncmp(p, name, len))
+            return 1;
+        p = comma ? comma + 1 : NULL;
+    }
+    return 0;
+}
+
+/* imed_write_str(), imed_read_str(): 중간 레코드 뒤에 붙는 문자열 입출력 */
+static void imed_write_str(FILE* imed, const char* str, int len)
+{
+    if (len > 0)
+        fwrite(str, 1, len, imed);
+}
+
+static int imed_read_str(FILE* imed, char* buf, int len)
+{
+    if (len > 0 && fread(buf, 1, len, imed) != (size_t)len)
+        return -1;
+    buf[len] = '\0';
+    return 0;
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : 스트리밍 모드의 패스1. 소스를 순차적으로 읽어 주소를 배정하고
+*        라인마다 중간 레코드(종류, 주소, 섹션, 명령어 ID, 문자열 길이 + 문자열)를 기록한다.
+* 매개 : 소스 파일, 중간 파일
+* 반환 : 정상종료 = 0, 에러 < 0
+* 주의 : 명령어는 inst_table 인덱스로만 기록하고, 지시어만 문자열로 기록한다.
+*        operand는 전방 참조가 남아 있을 수 있으므로 문자열 그대로 기록한다.
+* -----------------------------------------------------------------------------------
+*/
+/* imed_write_token(): 토큰 하나를 중간 파일 레코드로 기록 */
+static void imed_write_token(FILE* imed, token* t)
+{
+    imed_record r;
+    memset(&r, 0, sizeof(r));
+    r.addr = t->addr;
+    r.section = (unsigned short)t->section;
+    r.op_id = -1;
+    if (t->comment[0] == '.') {
+        r.kind = IMED_COMMENT;
+        r.operand_len = (unsigned char)strlen(t->comment);
+        fwrite(&r, sizeof(r), 1, imed);
+        imed_write_str(imed, t->comment, r.operand_len);
+        return;
+    }
+    r.kind = IMED_LINE;
+    if (t->operator[0] == '+')
+        r.kind |= IMED_EXTENDED;
+    r.op_id = (short)find_inst_index(t->operator);
+    r.label_len = (unsigned char)strlen(t->label);
+    r.operator_len = (r.op_id >= 0) ? 0 : (unsigned char)strlen(t->operator);
+    r.operand_len = (unsigned char)strlen(t->operand[0]);
+    fwrite(&r, sizeof(r), 1, imed);
+    imed_write_str(imed, t->label, r.label_len);
+    imed_write_str(imed, t->operator, r.operator_len);
+    imed_write_str(imed, t->operand[0], r.operand_len);
+}
+
+/* stream_auto_ltorg(): --auto-ltorg가 고른 위치에 LTORG 라인을 중간 파일에 넣고 패스1에서 처리 */
+static int stream_auto_ltorg(FILE* imed)
+{
+    char empty[1] = "", ltorg[] = "LTORG";
+    token t;
+    memset(&t, 0, sizeof(t));
+    t.label = empty;
+    t.operator = ltorg;
+    t.operand[0] = empty;
+    t.addr = locctr;
+    t.section = current_section;
+    imed_write_token(imed, &t);
+    return pass1_token(&t, source_lines) < 0 ? -1 : 0;
+}
+
+static int stream_pass1(FILE* src, FILE* imed)
+{
+    char line[256];
+
+    locctr = 0;
+    literalPoolStart = 0;
+    literalFirstUse = -1;
+    current_section = 1;
+    literalPoolStartSec[current_section] = 0;
+    literalPoolEndSec[current_section] = 0;
+    sectionStartAddr[current_section] = locctr;
+
+    while (fgets(line, sizeof(line), src) != NULL) {
+        source_lines++;
+        source_bytes += strlen(line);
+        line[strcspn(line, "\n")] = '\0';
+
+        token t;
+        memset(&t, 0, sizeof(t));
+        int parsed = tokenize_line(line, &t);
+        if (parsed < 0)
+            return -1;
+        if (parsed == 0)
+            continue;
+        if (!strcasecmp(t.operator, "INCLUDE") || !strcasecmp(t.operator, "MACRO") ||
+            !strcasecmp(t.operator, "USE")) {
+            diag("%s는 기본(두 패스) 모드에서만 지원합니다.\n", t.operator);
+            return -1;
+        }
+
+        // --auto-ltorg: RESW/RESB 앞에 리터럴 풀을 먼저 넣는다
+        if (auto_pool_point(&t, 0, -1) && stream_auto_ltorg(imed) < 0)
+            return -1;
+
+        t.addr = locctr;
+        t.section = current_section;
+        imed_write_token(imed, &t);
+
+        // pass2의 D/R 레코드를 위해 섹션별 외부 심볼 목록만 메모리에 유지
+        if (t.comment[0] != '.') {
+            if (!strcasecmp(t.operator, "EXTDEF"))
+                append_list(&sec_extdef[current_section], t.operand[0]);
+            else if (!strcasecmp(t.operator, "EXTREF"))
+                append_list(&sec_extref[current_section], t.operand[0]);
+        }
+
+        int result = pass1_token(&t, source_lines);
+        // --auto-ltorg: 무조건 분기 뒤에 리터럴 풀을 넣는다
+        if (result == 0 && auto_pool_point(&t, 1, -1))
+            result = stream_auto_ltorg(imed);
+        free(t.label);
+        free(t.operator);
+        free(t.operand[0]);
+        if (result < 0)
+            return -1;
+        if (result > 0)
+            break;
+    }
+
+    if (resolve_equ_symbols() < 0)
+        return -1;
+    return 0;
+}
+
+/* stream_write_dr(): 섹션 sec의 D/R 레코드를 pass1에서 모아둔 목록으로 출력하고
+   M 레코드 판별을 위한 extref_table을 채운다 */
+static void stream_write_dr(FILE* fp, int sec)
+{
+    char list[256];
+
+    extref_count = 0;
+    if (sec_extdef[sec]) {
+        strncpy(list, sec_extdef[sec], sizeof(list) - 1);
+        list[sizeof(list) - 1] = '\0';
+        STAT_RECORD('D', fprintf(fp, "D"));
+        for (char* sym = strtok(list, ","); sym; sym = strtok(NULL, ",")) {
+            int s = sym_lookup(sym, sec);
+            unsigned int addr = s >= 0 ? sym_table[s].addr : 0;
+            STAT_BYTES('D', fprintf(fp, "%-6s%06X", sym, addr));
+        }
+        STAT_BYTES('D', fprintf(fp, "\n"));
+    }
+    if (sec_extref[sec]) {
+        strncpy(list, sec_extref[sec], sizeof(list) - 1);
+        list[sizeof(list) - 1] = '\0';
+        STAT_RECORD('R', fprintf(fp, "R"));
+        for (char* sym = strtok(list, ","); sym; sym = strtok(NULL, ",")) {
+            if (extref_count < MAX_EXTREF)
+                strcpy(extref_table[extref_count++], sym);
+            STAT_BYTES('R', fprintf(fp, "%-6s", sym));
+        }
+        STAT_BYTES('R', fprintf(fp, "\n"));
+    }
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : 스트리밍 모드의 패스2. 중간 파일을 처음부터 읽으며 라인마다 오브젝트 코드를
+*        생성하고, 섹션별 H/D/R/T/M/E 레코드를 곧바로 출력한다.
+* 매개 : 중간 파일, 오브젝트 코드 출력 파일, opcode 리스트 출력 파일(NULL 허용)
+* 반환 : 정상종료 = 0, 에러 < 0
+* 주의 : 섹션은 첫 라인과 CSECT에서 시작한다. (토큰 테이블 기반 pass2와 동일)
+*        PC/BASE relative로 닿지 않는 3형식 명령어는 check_displacement()로 모두 보고하고
+*        실패를 리턴한다. 이미 출력한 레코드는 되돌리지 않는다.
+* -----------------------------------------------------------------------------------
+*/
+static int stream_pass2(FILE* imed, FILE* fp, FILE* list_fp)
+{
+    char label[256], operator[256], operand[256];
+    section_writer w;
+    imed_record r;
+    int sec = 0;
+    int cur_base = 0;       // 이 위치에서 유효한 BASE 주소 (주소는 패스1에서 모두 확정됐다)
+    int line = 0;           // 토큰 테이블 인덱스 + 1과 같은 라인 번호 (진단 메시지용)
+    int errors = 0;
+
+    rewind(imed);
+    while (fread(&r, sizeof(r), 1, imed) == 1) {
+        line++;
+        token t;
+        memset(&t, 0, sizeof(t));
+        t.label = label;
+        t.operator = operator;
+        t.operand[0] = operand;
+        t.addr = r.addr;
+        t.section = r.section;
+        t.base = -1;
+        label[0] = operator[0] = '\0';
+
+        if ((r.kind & IMED_KIND_MASK) == IMED_COMMENT) {
+            if (imed_read_str(imed, operand, r.operand_len) < 0)
+                return -1;
+            size_t clen = strlen(operand);
+            if (clen >= sizeof(t.comment))
+                clen = sizeof(t.comment) - 1;
+            memcpy(t.comment, operand, clen);
+            operand[0] = '\0';
+        } else {
+            if (imed_read_str(imed, label, r.label_len) < 0 ||
+                imed_read_str(imed, operator, r.operator_len) < 0 ||
+                imed_read_str(imed, operand, r.operand_len) < 0)
+                return -1;
+            if (r.op_id >= 0)
+                sprintf(operator, "%s%s", (r.kind & IMED_EXTENDED) ? "+" : "",
+                        inst_table[r.op_id]->str);
+        }
+
+        if (list_fp)
+            write_opcode_line(list_fp, &t);
+
+        // 섹션 시작: 첫 라인 혹은 CSECT
+        if (sec == 0 || !strcasecmp(t.operator, "CSECT")) {
+            if (sec > 0) {
+                sw_append_pool(&w, sec, -1);
+                sw_end_section(&w, sec == 1, 0, 0);
+            }
+            sec++;
+            char progName[7] = {0};
+            strncpy(progName, t.label, 6);
+            STAT_RECORD('H', fprintf(fp, "H%-7s%06X%06X\n", progName, 0, section_length[sec]));
+            stream_write_dr(fp, sec);
+            sw_begin(&w, fp, NULL);
+            cur_base = 0;
+            continue;
+        }
+
+        if (!strcasecmp(t.operator, "BASE") || !strcasecmp(t.operator, "NOBASE")) {
+            cur_base = !strcasecmp(t.operator, "BASE") ? base_operand_addr(t.operand[0], t.section) : 0;
+            continue;
+        }
+        t.base = cur_base;
+
+        if (!strcasecmp(t.operator, "END")) {
+            sw_append_pool(&w, sec, -1);
+            sw_end_section(&w, sec == 1, 1, 0);
+            return errors > 0 ? -1 : 0;
+        }
+
+        if (!strcasecmp(t.operator, "LTORG")) {
+            sw_append_pool(&w, sec, t.addr);
+            continue;
+        }
+
+        if (!isTextRecordable(&t))
+            continue;
+        if (check_displacement(&t, line) < 0)
+            errors++;
+
+        char* obj = generate_object_code(&t);
+        sw_append_text(&w, t.addr, obj);
+        free(obj);
+        sw_add_mods(&w, &t);
+    }
+
+    // END 없이 끝난 경우 마지막 섹션 마무리
+    if (sec > 0)
+        sw_end_section(&w, sec == 1, 1, 0);
+    return errors > 0 ? -1 : 0;
+}
+
+/* ------------------- 단일 패스 모드 (--one-pass) ------------------- */
+static op_section op_sections[MAX_SECTIONS+1];
+static int op_section_count = 0;
+static int op_next_flush = 1;       // 다음에 출력할 섹션 번호
+static fixup* fixups = NULL;
+static int fixup_count = 0, fixup_cap = 0;
+static fix_chain fix_chains[FIX_CHAIN_SIZE];
+static int live_chains[FIX_CHAIN_SIZE];     // 사용 중인 fix_chains 슬롯 번호
+static int live_chain_count = 0;
+static int chain_stamp = 0;
+static int base_fixups = -1;        // BASE 값이 확정되어야 하는 fixup 목록
+static char op_base_name[20];       // 읽는 위치에서 유효한 BASE 피연산자 ("" = BASE 없음)
+
+/* fix_chain_slot(): 심볼(혹은 리터럴) 이름의 fixup 체인 슬롯을 찾는다. create면 새로 만든다 */
+static fix_chain* fix_chain_slot(const char* name, int create)
+{
+    unsigned int h = 0;
+    for (const char* c = name; *c; c++)
+        h = h * 31 + (unsigned char)*c;
+    for (int probe = 0; probe < FIX_CHAIN_SIZE; probe++) {
+        fix_chain* slot = &fix_chains[(h + probe) % FIX_CHAIN_SIZE];
+        if (slot->name[0] == '\0') {
+            if (!create)
+                return NULL;
+            strncpy(slot->name, name, sizeof(slot->name) - 1);
+            slot->head = -1;
+            slot->stamp = 0;
+            live_chains[live_chain_count++] = (h + probe) % FIX_CHAIN_SIZE;
+            return slot;
+        }
+        if (!strcmp(slot->name, name))
+            return slot;
+    }
+    return NULL;
+}
+
+/* op_reset_chains(): 사용한 fix_chains 슬롯만 비운다 */
+static void op_reset_chains(void)
+{
+    for (int c = 0; c < live_chain_count; c++) {
+        fix_chain* slot = &fix_chains[live_chains[c]];
+        slot->name[0] = '\0';
+        slot->head = -1;
+    }
+    live_chain_count = 0;
+}
+
+/* op_add_item(): 섹션 sec의 항목 목록에 하나를 추가하고 인덱스를 리턴 */
+static int op_add_item(int sec, int kind, int addr, char* obj)
+{
+    op_section* os = &op_sections[sec];
+    if (os->item_count == os->item_cap) {
+        int cap = os->item_cap ? os->item_cap * 2 : 64;
+        op_item* grown = realloc(os->items, sizeof(op_item) * cap);
+        if (!grown)
+            return -1;
+        os->items = grown;
+        os->item_cap = cap;
+    }
+    op_item* it = &os->items[os->item_count];
+    it->kind = kind;
+    it->addr = addr;
+    it->obj = obj;
+    it->mod_operator = NULL;
+    it->mod_operand = NULL;
+    return os->item_count++;
+}
+
+/* op_lookup_target(): 두 패스 모드의 calc_nixbpe와 같은 규칙으로 fixup의 목표 심볼을 찾는다.
+   반환: 심볼/리터럴 인덱스, 아직 확정할 수 없으면 -1 */
+static int op_lookup_target(fixup* f)
+{
+    if (f->rule == FIX_LITERAL) {
+        int j = find_literal(f->name, f->section, f->addr);
+        return (j < 0 || literal_table[j].addr == -1) ? -1 : j;
+    }
+    int k = sym_lookup(f->name, (f->rule == FIX_SAME) ? f->section : 0);
+    if (k >= 0 && equ_pending[k])
+        return -1;
+    return k;
+}
+
+/* op_wide_word(): 4형식 명령어 워드. 목표가 같은 섹션 라벨(k)이면 그 주소를 넣고, 아니면 0 (M 레코드가 채운다).
+   section_relative()와 같은 규칙이다 */
+static unsigned int op_wide_word(int finalOpcode, int x, int k, int section)
+{
+    int addr = (k >= 0 && sym_table[k].section == section && !equ_absolute[k]) ? sym_table[k].addr : 0;
+    return ((unsigned int)finalOpcode << 24) | (unsigned int)(((x << 3) | 1) << 20) | (addr & 0xFFFFF);
+}
+
+/* op_patch(): 목표 주소로 format 3 명령어의 disp를 다시 계산해 인코딩된 워드를 고친다.
+   final이 아니면 BASE가 필요한 경우 BASE 확정(END)까지 미룬다.
+   k는 찾은 심볼/리터럴 인덱스(-1 = 못 찾음)로, 같은 섹션 심볼이나 리터럴이면
+   check_displacements()처럼 PC/BASE 어느 쪽으로도 닿지 않는 목표를 보고한다.
+   4형식 fixup은 변위 없이 주소 필드만 채운다. 반환: 완료 = 1, 보류 = 0, 닿지 않음 < 0 */
+static int op_patch(int f_idx, int target, int final, int k)
+{
+    fixup* f = &fixups[f_idx];
+    if (f->wide) {
+        sprintf(op_sections[f->section].items[f->item].obj, "%08X",
+                op_wide_word(f->finalOpcode, f->x, f->rule == FIX_LITERAL ? -1 : k, f->section));
+        op_sections[f->section].pending--;
+        return 1;
+    }
+    int checked = k >= 0 && (f->rule == FIX_LITERAL || sym_table[k].section == f->section);
+    int flag_b = 0, flag_p = 0;
+    int base = !final ? -1 : f->base[0] ? base_operand_addr(f->base, f->section) : 0;
+    int disp = calc_disp(target, f->addr, 3, base, 0, &flag_b, &flag_p);
+    if (!flag_p && !final) {
+        f->rule = FIX_BASE;
+        f->next = base_fixups;
+        base_fixups = f_idx;
+        return 0;
+    }
+    if (!flag_p && !flag_b && checked &&
+        strcasecmp(f->op, "TD") && strcasecmp(f->op, "WD")) {
+        diag("%d행: %s %s: 목표 주소 %04X가 PC relative 범위 밖이고 BASE relative로도 닿지 않습니다. "
+             "(BASE를 지정하거나 4형식으로 쓰십시오)\n",
+             f->line, f->op, f->operand, target);
+        return -1;
+    }
+    int flags = (f->x << 3) | (flag_b << 2) | (flag_p << 1);
+    unsigned int instr = (f->finalOpcode << 16) | (flags << 12) | (disp & 0xFFF);
+    sprintf(op_sections[f->section].items[f->item].obj, "%06X", instr);
+    op_sections[f->section].pending--;
+    return 1;
+}
+
+/* op_fire_chain(): 이름이 name인 심볼/리터럴이 정의되었을 때 그 체인의 fixup을 처리한다 */
+static void op_fire_chain(const char* name)
+{
+    fix_chain* slot = fix_chain_slot(name, 0);
+    if (!slot)
+        return;
+    int keep = -1;
+    int f_idx = slot->head;
+    while (f_idx >= 0) {
+        int next = fixups[f_idx].next;
+        int k = op_lookup_target(&fixups[f_idx]);
+        if (k < 0) {
+            fixups[f_idx].next = keep;
+            keep = f_idx;
+        } else {
+            int target = (fixups[f_idx].rule == FIX_LITERAL) ? literal_table[k].addr : sym_table[k].addr;
+            op_patch(f_idx, target, 0, k);
+        }
+        f_idx = next;
+    }
+    slot->head = keep;
+}
+
+/* op_add_fixup(): 아직 확정되지 않은 format 3 명령어를 name의 체인에 등록한다 */
+static int op_add_fixup(int sec, int item, token* t, int rule, const char* name,
+                        int finalOpcode, int x, int wide)
+{
+    if (fixup_count == fixup_cap) {
+        int cap = fixup_cap ? fixup_cap * 2 : 64;
+        fixup* grown = realloc(fixups, sizeof(fixup) * cap);
+        if (!grown)
+            return -1;
+        fixups = grown;
+        fixup_cap = cap;
+    }
+    fixup* f = &fixups[fixup_count];
+    f->section = sec;
+    f->item = item;
+    f->addr = t->addr;
+    f->finalOpcode = finalOpcode;
+    f->x = x;
+    f->wide = wide;
+    f->rule = rule;
+    strncpy(f->name, name, sizeof(f->name) - 1);
+    f->name[sizeof(f->name) - 1] = '\0';
+    memcpy(f->base, op_base_name, sizeof(f->base));
+    f->line = source_lines;
+    snprintf(f->op, sizeof(f->op), "%s", t->operator);
+    snprintf(f->operand, sizeof(f->operand), "%s", t->operand[0]);
+    op_sections[sec].pending++;
+
+    f->sec_next = -1;
+    if (rule == FIX_SAME) {
+        f->sec_next = op_sections[sec].same_fixups;
+        op_sections[sec].same_fixups = fixup_count;
+    }
+    if (rule == FIX_BASE) {
+        f->next = base_fixups;
+        base_fixups = fixup_count;
+    } else {
+        fix_chain* slot = fix_chain_slot(f->name, 1);
+        if (!slot) {
+            fprintf(stderr, "one-pass: fixup 체인 테이블이 가득 찼습니다.\n");
+            return -1;
+        }
+        f->next = slot->head;
+        slot->head = fixup_count;
+    }
+    fixup_count++;
+    return 0;
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : 단일 패스 모드에서 토큰 하나를 즉시 인코딩하는 함수이다.
+*        format 3 명령어의 목표 심볼이 아직 정의되지 않았거나 BASE가 필요한 경우
+*        일단 인코딩해 두고 fixup을 등록한다.
+* 매개 : 섹션 번호, 토큰
+* 반환 : 정상종료 = 0, 에러 < 0
+* 주의 : 목표 심볼을 찾는 규칙은 calc_nixbpe와 같다.
+*        (직접 주소: 같은 섹션 우선, #/@: 첫 번째 심볼, '=': 리터럴)
+* -----------------------------------------------------------------------------------
+*/
+static int op_encode_token(int sec, token* t)
+{
+    char* obj = generate_object_code(t);
+    int item = op_add_item(sec, OPI_TEXT, t->addr, obj);
+    if (item < 0)
+        return -1;
+
+    // M 레코드는 섹션 출력 시 EXTREF 목록을 보고 만든다
+    if (t->operator[0] == '+' || !strcasecmp(t->operator, "WORD")) {
+        op_sections[sec].items[item].mod_operator = strdup(t->operator);
+        op_sections[sec].items[item].mod_operand = strdup(t->operand[0]);
+    }
+
+    // 심볼을 참조하는 format 3 명령어와, 같은 섹션 라벨일 수 있는 format 4 명령어가 fixup 대상
+    const char* opnd = t->operand[0];
+    int wide = t->operator[0] == '+';
+    if (!strcasecmp(t->operator, "RSUB") ||
+        !strcasecmp(t->operator, "BYTE") || !strcasecmp(t->operator, "WORD"))
+        return 0;
+    if (!wide && get_instruction_length(t->operator) != 3 &&
+        strcasecmp(t->operator, "TD") && strcasecmp(t->operator, "WD"))
+        return 0;
+    if (opnd[0] == '\0' || isdigit((unsigned char)opnd[0]) ||
+        ((opnd[0] == '#' || opnd[0] == '@') && isdigit((unsigned char)opnd[1])))
+        return 0;
+
+    fixup probe;
+    memset(&probe, 0, sizeof(probe));
+    probe.section = sec;
+    if (opnd[0] == '=') {
+        probe.rule = FIX_LITERAL;
+        strncpy(probe.name, opnd, sizeof(probe.name) - 1);
+    } else if (opnd[0] == '#' || opnd[0] == '@') {
+        probe.rule = FIX_ANY;
+        strncpy(probe.name, opnd + 1, sizeof(probe.name) - 1);
+    } else {
+        probe.rule = FIX_SAME;
+        strncpy(probe.name, opnd, sizeof(probe.name) - 1);
+        char* comma = strstr(probe.name, ",X");
+        if (comma)
+            *comma = '\0';
+        if (isdigit((unsigned char)probe.name[0]))
+            return 0;
+    }
+
+    int baseOpcode = search_opcode(t->operator);
+    if (baseOpcode < 0) baseOpcode = 0;
+    int finalOpcode, n, i, x, e, targetAddr = 0;
+    calc_nixbpe(t, baseOpcode, &finalOpcode, &n, &i, &x, &e, &targetAddr);
+
+    // format 4: 리터럴과 이 섹션의 EXTREF는 주소 0 그대로 두고 M 레코드에 맡긴다.
+    // 목표가 이미 확정됐으면 바로 채운다 (extref_table은 출력한 섹션 기준이라 여기서는 쓰지 않는다)
+    if (wide) {
+        if (probe.rule == FIX_LITERAL || list_has(sec_extref[sec], probe.name))
+            return 0;
+        int k = op_lookup_target(&probe);
+        if (k >= 0) {
+            sprintf(op_sections[sec].items[item].obj, "%08X", op_wide_word(finalOpcode, x, k, sec));
+            return 0;
+        }
+        return op_add_fixup(sec, item, t, probe.rule, probe.name, finalOpcode, x, 1);
+    }
+
+    if (op_lookup_target(&probe) >= 0) {
+        // 목표는 확정됐지만 BASE 상대 주소가 필요하면 BASE가 확정될 때까지 보류
+        int flag_b = 0, flag_p = 0;
+        calc_disp(targetAddr, t->addr, 3, -1, 0, &flag_b, &flag_p);
+        if (flag_p)
+            return 0;
+        probe.rule = FIX_BASE;
+    }
+    return op_add_fixup(sec, item, t, probe.rule, probe.name, finalOpcode, x, 0);
+}
+
+/* op_auto_ltorg(): --auto-ltorg가 고른 위치에 리터럴 풀을 배치하고 그 리터럴을 기다리던 fixup을 처리 */
+static void op_auto_ltorg(int sec, FILE* list_fp)
+{
+    char empty[1] = "", ltorg[] = "LTORG";
+    token t;
+    memset(&t, 0, sizeof(t));
+    t.label = empty;
+    t.operator = ltorg;
+    t.operand[0] = empty;
+    t.addr = locctr;
+    t.section = sec;
+    t.base = -1;
+
+    int old_pool_start = literalPoolStart;
+    pass1_token(&t, source_lines);
+    for (int j = old_pool_start; j < literal_count; j++)
+        op_fire_chain(literal_table[j].symbol);
+    op_add_item(sec, OPI_LTORG, t.addr, NULL);
+    if (list_fp)
+        write_opcode_line(list_fp, &t);
+}
+
+/* op_try_eval_equ(): 마지막으로 등록된 EQU가 같은 섹션의 확정된 심볼만 참조하면 바로 계산한다 */
+static void op_try_eval_equ(int n)
+{
+    equ_node* node = &equ_nodes[n];
+    int section = sym_table[node->sym].section;
+    int value = 0;
+    for (int k = 0; k < node->term_count; k++) {
+        equ_term* term = &node->terms[k];
+        if (term->name[0] == '\0') {
+            value += term->sign * term->value;
+            continue;
+        }
+        int s = sym_lookup(term->name, section);
+        if (s < 0 || equ_pending[s])
+            return;
+        term->sym = s;
+        value += term->sign * sym_table[s].addr;
+    }
+    sym_table[node->sym].addr = value;
+    node->resolved = 1;
+    equ_pending[node->sym] = 0;
+    mark_equ_absolute(node);
+}
+
+/* op_section_ready(): 섹션이 끝났고 남은 fixup이 없으며 D 레코드 심볼이 모두 확정되었는가 */
+static int op_section_ready(int sec)
+{
+    op_section* os = &op_sections[sec];
+    if (!os->ended || os->pending > 0)
+        return 0;
+    if (sec_extdef[sec]) {
+        char list[256];
+        strncpy(list, sec_extdef[sec], sizeof(list) - 1);
+        list[sizeof(list) - 1] = '\0';
+        for (char* sym = strtok(list, ","); sym; sym = strtok(NULL, ",")) {
+            int s = sym_lookup(sym, sec);
+            if (s >= 0 && equ_pending[s])
+                return 0;
+        }
+    }
+    return 1;
+}
+
+/* op_flush_section(): 완성된 섹션 하나의 H/D/R/T/M/E 레코드를 출력하고 항목 메모리를 해제 */
+static void op_flush_section(FILE* fp, int sec)
+{
+    op_section* os = &op_sections[sec];
+    section_writer w;
+
+    STAT_RECORD('H', fprintf(fp, "H%-7s%06X%06X\n", os->name, 0, section_length[sec]));
+    stream_write_dr(fp, sec);
+    sw_begin(&w, fp, NULL);
+    for (int k = 0; k < os->item_count; k++) {
+        op_item* it = &os->items[k];
+        if (it->kind == OPI_LTORG) {
+            sw_append_pool(&w, sec, it->addr);
+            continue;
+        }
+        sw_append_text(&w, it->addr, it->obj);
+        if (it->mod_operator) {
+            token t;
+            memset(&t, 0, sizeof(t));
+            t.operator = it->mod_operator;
+            t.operand[0] = it->mod_operand;
+            t.addr = it->addr;
+            t.section = sec;
+            sw_add_mods(&w, &t);
+        }
+        free(it->obj);
+        free(it->mod_operator);
+        free(it->mod_operand);
+    }
+    sw_append_pool(&w, sec, -1);
+    sw_end_section(&w, sec == 1, os->is_last, 0);
+
+    free(os->items);
+    os->items = NULL;
+    os->item_count = os->item_cap = 0;
+}
+
+/* op_flush_ready(): 앞에서부터 출력 가능한 섹션을 순서대로 출력 */
+static void op_flush_ready(FILE* fp)
+{
+    while (op_next_flush <= op_section_count && op_section_ready(op_next_flush))
+        op_flush_section(fp, op_next_flush++);
+}
+
+/* op_end_section(): 섹션이 끝나면 같은 섹션 심볼을 기다리던 fixup을 다른 섹션 심볼 규칙으로 바꾼다 */
+static void op_end_section(int sec, int is_last)
+{
+    op_sections[sec].ended = 1;
+    op_sections[sec].is_last = is_last;
+    chain_stamp++;
+    for (int f_idx = op_sections[sec].same_fixups; f_idx >= 0; f_idx = fixups[f_idx].sec_next)
+        if (fixups[f_idx].rule == FIX_SAME)
+            fixups[f_idx].rule = FIX_ANY;
+    // 이미 다른 섹션에 정의된 심볼이 있으면 그 체인에서 바로 처리된다. 체인마다 한 번만 본다
+    for (int f_idx = op_sections[sec].same_fixups; f_idx >= 0; f_idx = fixups[f_idx].sec_next) {
+        fix_chain* slot = fix_chain_slot(fixups[f_idx].name, 0);
+        if (slot && slot->stamp != chain_stamp) {
+            slot->stamp = chain_stamp;
+            op_fire_chain(slot->name);
+        }
+    }
+    op_sections[sec].same_fixups = -1;
+}
+
+/* op_finalize(): END에서 BASE와 EQU가 모두 확정된 뒤 남은 fixup을 두 패스 모드와 같은 규칙으로 처리.
+   같은 섹션 심볼이나 리터럴에 닿지 않는 명령어가 있으면 모두 보고하고 -1 */
+static int op_finalize(void)
+{
+    int errors = 0;
+    for (int c = 0; c < live_chain_count; c++) {
+        fix_chain* slot = &fix_chains[live_chains[c]];
+        int f_idx = slot->head;
+        while (f_idx >= 0) {
+            fixup* f = &fixups[f_idx];
+            int next = f->next;
+            int k = op_lookup_target(f);
+            int target = 0;
+            if (k >= 0)
+                target = (f->rule == FIX_LITERAL) ? literal_table[k].addr : sym_table[k].addr;
+            else if (f->rule != FIX_LITERAL)
+                target = (int)strtol(f->name, NULL, 16);
+            if (op_patch(f_idx, target, 1, k) < 0)
+                errors++;
+            f_idx = next;
+        }
+        slot->head = -1;
+    }
+    for (int f_idx = base_fixups; f_idx >= 0; ) {
+        fixup* f = &fixups[f_idx];
+        int next = f->next;
+        int k = -1;
+        if (f->name[0] == '=') {
+            f->rule = FIX_LITERAL;
+            k = op_lookup_target(f);
+        } else {
+            k = find_symbol(f->name, f->section);
+        }
+        int target = (k < 0) ? 0 : (f->name[0] == '=') ? literal_table[k].addr : sym_table[k].addr;
+        if (op_patch(f_idx, target, 1, k) < 0)
+            errors++;
+        f_idx = next;
+    }
+    base_fixups = -1;
+    return errors > 0 ? -1 : 0;
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : 단일 패스 모드(--one-pass)로 어셈블하는 함수이다.
+*        라인을 읽어 토큰화하자마자 주소를 배정하고 바로 인코딩한다.
+*        아직 정의되지 않은 심볼을 참조하면 심볼별 fixup 체인에 등록해 두었다가
+*        라벨이 정의되는 순간 인코딩된 워드를 고친다. 섹션의 fixup이 모두 해결되면
+*        그 섹션의 레코드를 바로 출력한다.
+* 매개 : 어셈블리할 소스파일명
+* 반환 : 정상종료 = 0, 에러 < 0
+* 주의 : 오브젝트 코드 출력은 두 패스 모드와 동일하다. BASE 상대 주소가 필요한 명령어와
+*        아직 계산되지 않은 EQU 심볼은 END에서 확정되므로, 이를 참조하는 섹션은 END까지 출력이 미뤄진다.
+* -----------------------------------------------------------------------------------
+*/
+static int assem_one_pass(void)
+{
+    phase_begin();
+    if (init_inst_file("inst_table.txt") < 0) {
+        fprintf(stderr, "init_my_assembler: 프로그램 초기화에 실패 했습니다.\n");
+        return -1;
+    }
+    phase_end("init_inst_file");
+    phase_begin();
+    FILE* src = open_input(input_file);
+    if (!src)
+        return -1;
+    FILE* fp = open_output(output_file, "object code");
+    if (!fp) {
+        close_stream(src);
+        return -1;
+    }
+    FILE* list_fp = open_output(listing_file, "listing");
+
+    char line[256];
+    int result = 0;
+
+    op_base_name[0] = '\0';
+    locctr = 0;
+    literalPoolStart = 0;
+    literalFirstUse = -1;
+    current_section = 1;
+    literalPoolStartSec[current_section] = 0;
+    literalPoolEndSec[current_section] = 0;
+    sectionStartAddr[current_section] = locctr;
+
+    while (result == 0 && fgets(line, sizeof(line), src) != NULL) {
+        source_lines++;
+        source_bytes += strlen(line);
+        line[strcspn(line, "\n")] = '\0';
+
+        token t;
+        memset(&t, 0, sizeof(t));
+        t.base = -1;    // BASE가 필요한 참조는 fixup으로 END까지 미룬다
+        int parsed = tokenize_line(line, &t);
+        if (parsed < 0) {
+            result = -1;
+            break;
+        }
+        if (parsed == 0)
+            continue;
+        if (!strcasecmp(t.operator, "INCLUDE") || !strcasecmp(t.operator, "MACRO") ||
+            !strcasecmp(t.operator, "USE")) {
+            diag("%s는 기본(두 패스) 모드에서만 지원합니다.\n", t.operator);
+            result = -1;
+            break;
+        }
+
+        // --auto-ltorg: RESW/RESB 앞에 리터럴 풀을 먼저 넣는다
+        if (op_section_count > 0 && auto_pool_point(&t, 0, -1))
+            op_auto_ltorg(current_section, list_fp);
+
+        t.addr = locctr;
+        t.section = current_section;
+        int sec = current_section;
+        int old_label_num = label_num;
+        int old_equ_count = equ_count;
+        int old_pool_start = literalPoolStart;
+        int is_comment = (t.comment[0] == '.');
+        int is_csect = !is_comment && !strcasecmp(t.operator, "CSECT");
+        int is_end = !is_comment && !strcasecmp(t.operator, "END");
+
+        if (!is_comment) {
+            if (!strcasecmp(t.operator, "EXTDEF"))
+                append_list(&sec_extdef[sec], t.operand[0]);
+            else if (!strcasecmp(t.operator, "EXTREF"))
+                append_list(&sec_extref[sec], t.operand[0]);
+        }
+
+        int p1 = pass1_token(&t, source_lines);
+        if (p1 < 0) {
+            result = -1;
+        } else {
+            // 1) 이번 라인에서 배치된 리터럴과 새로 정의된 심볼의 fixup 처리
+            if (literalPoolStart != old_pool_start)
+                for (int j = old_pool_start; j < literal_count; j++)
+                    op_fire_chain(literal_table[j].symbol);
+            if (equ_count > old_equ_count)
+                op_try_eval_equ(equ_count - 1);
+            for (int k = old_label_num; k < label_num; k++)
+                if (!equ_pending[k])
+                    op_fire_chain(sym_table[k].symbol);
+
+            // 2) 섹션 경계와 라인 인코딩
+            if (op_section_count == 0 || is_csect) {
+                op_base_name[0] = '\0';
+                if (is_csect) {
+                    op_end_section(sec, 0);
+                    op_flush_ready(fp);
+                }
+                op_section_count = current_section;
+                op_sections[current_section].same_fixups = -1;
+                strncpy(op_sections[current_section].name, t.label, 6);
+            } else if (is_end) {
+                if (resolve_equ_symbols() < 0) {
+                    result = -1;
+                } else {
+                    op_end_section(sec, 1);
+                    if (op_finalize() < 0)
+                        result = -1;
+                    else
+                        op_flush_ready(fp);
+                }
+            } else if (!is_comment && !strcasecmp(t.operator, "LTORG")) {
+                op_add_item(sec, OPI_LTORG, t.addr, NULL);
+            } else if (!is_comment && !strcasecmp(t.operator, "BASE")) {
+                snprintf(op_base_name, sizeof(op_base_name), "%s", t.operand[0]);
+            } else if (!is_comment && !strcasecmp(t.operator, "NOBASE")) {
+                op_base_name[0] = '\0';
+            } else if (isTextRecordable(&t)) {
+                if (op_encode_token(sec, &t) < 0)
+                    result = -1;
+            }
+        }
+
+        if (list_fp)
+            write_opcode_line(list_fp, &t);
+        // --auto-ltorg: 무조건 분기 뒤에 리터럴 풀을 넣는다
+        if (result == 0 && !is_end && auto_pool_point(&t, 1, -1))
+            op_auto_ltorg(sec, list_fp);
+        free(t.label);
+        free(t.operator);
+        free(t.operand[0]);
+        if (is_end)
+            break;
+    }
+    close_stream(src);
+
+    // END 없이 끝난 경우
+    if (result == 0 && op_next_flush <= op_section_count) {
+        if (resolve_equ_symbols() < 0) {
+            result = -1;
+        } else {
+            op_end_section(current_section, 1);
+            if (op_finalize() < 0)
+                result = -1;
+            else
+                op_flush_ready(fp);
+        }
+    }
+    close_stream(fp);
+    close_stream(list_fp);
+    fixup_count = 0;    // 배열은 teardown_assembler()에서 해제
+    op_reset_chains();
+
+    if (result < 0) {
+        fprintf(stderr, "assem_one_pass: 단일 패스 어셈블 과정에서 실패하였습니다.\n");
+        return -1;
+    }
+    phase_end("assem_one_pass");
+
+    if (symtab_file) {
+        phase_begin();
+        make_symtab_output(symtab_file);
+        phase_end("make_symtab_output");
+    }
+    if (littab_file) {
+        phase_begin();
+        make_literaltab_output(littab_file);
+        phase_end("make_literaltab_output");
+    }
+    if (symindex_file) {
+        phase_begin();
+        make_symindex_output(symindex_file);
+        phase_end("make_symindex_output");
+    }
+    if (echo_object) {
+        phase_begin();
+        make_objectcode_output(output_file);
+        phase_end("make_objectcode_output");
+    }
+    return 0;
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : 한 번의 어셈블로 쌓인 상태(소스 라인, 토큰, 심볼/리터럴 테이블, 섹션 정보, 매크로,
+*        각종 카운터)를 모두 비워 같은 프로세스에서 다시 어셈블할 수 있게 하는 함수이다.
+* 매개 : 없음
+* 반환 : 없음
+* 주의 : inst_table과 INCLUDE 캐시는 그대로 유지한다. 소스 버퍼, 토큰 구조체(token_pool),
+*        fixup 배열은 비우기만 하고 용량을 남겨두므로 반복해서 어셈블해도 메모리가 늘지 않는다.
+*        모두 해제하려면 teardown_assembler()를 부른다.
+* -----------------------------------------------------------------------------------
+*/
+static void reset_assembler(void)
+{
+    for (int i = 0; i < line_num; i++)
+        input_data[i] = NULL;
+    line_num = 0;
+    source_lines = 0;
+    source_bytes = 0;
+
+    for (int i = 0; i < token_line; i++) {
+        free_token(token_table[i]);
+        token_table[i] = NULL;
+    }
+    token_line = 0;
+
+    reset_macros();
+    for (int s = 0; s <= MAX_SECTIONS; s++) {
+        free(sec_extdef[s]);
+        free(sec_extref[s]);
+        sec_extdef[s] = sec_extref[s] = NULL;
+    }
+    reset_layout();
+
+    literalPoolStart = 0;
+    current_section = 1;
+    current_block = 0;
+    blocks_used = 0;
+    locctr = 0;
+    extref_count = 0;
+    fixup_count = 0;
+    op_reset_chains();
+    free_size_profiles();
+}
+
+/* free_inst_table(): inst_table의 명령어들을 해제 */
+static void free_inst_table(void)
+{
+    for (int k = 0; k < inst_index; k++) {
+        free(inst_table[k]);
+        inst_table[k] = NULL;
+    }
+    inst_index = 0;
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : reset_assembler()로 상태를 비운 뒤, 재사용을 위해 남겨둔 용량과 프로세스 수명 동안
+*        유지하던 자료(inst_table, INCLUDE 캐시, 토큰 풀, 소스 버퍼, fixup 배열)까지 모두 해제한다.
+* 매개 : 없음
+* 반환 : 없음
+* 주의 : 프로그램 종료 직전에 부른다. 이후 다시 어셈블하려면 초기화부터 다시 해야 한다.
+* -----------------------------------------------------------------------------------
+*/
+static void teardown_assembler(void)
+{
+    reset_assembler();
+
+    while (include_cache)
+        free_include(include_cache);
+    for (int k = 0; k < token_pool_count; k++)
+        free(token_pool[k]);
+    free(token_pool);
+    token_pool = NULL;
+    token_pool_count = token_pool_cap = 0;
+
+    free(source_buf);
+    source_buf = NULL;
+    source_cap = 0;
+    free(fixups);
+    fixups = NULL;
+    fixup_count = fixup_cap = 0;
+    free_inst_table();
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : 메모리 버퍼의 소스를 두 패스로 어셈블하여 결과를 각 스트림에 출력하는 함수이다.
+*        데몬 모드에서 요청 하나를 처리할 때 사용한다.
+* 매개 : 소스 버퍼와 길이, 오브젝트/심볼/리터럴/리스트/진단 출력 스트림 (list_fp는 NULL 허용)
+* 반환 : 정상종료 = 0, 에러 < 0 (섹션/라인 수 초과 등 패스1 오류 포함, 진단은 diag_out에)
+* 주의 : 전역 테이블을 사용하므로 호출자가 동시에 하나만 실행되도록 보장해야 한다.
+*        실패한 요청이 남긴 테이블은 다음 요청의 reset_assembler()가 비운다.
+* -----------------------------------------------------------------------------------
+*/
+static int assemble_buffer(const char* src, size_t len, FILE* obj_fp, FILE* sym_fp,
+                           FILE* lit_fp, FILE* list_fp, FILE* diag_out)
+{
+    int result = 0;
+
+    reset_assembler();
+    diag_fp = diag_out;
+
+    if (len > 0) {
+        FILE* in = fmemopen((void*)src, len, "r");
+        if (!in) {
+            diag("소스 버퍼를 열 수 없습니다.\n");
+            diag_fp = NULL;
+            return -1;
+        }
+        int loaded = init_input_stream(in);
+        fclose(in);
+        if (loaded < 0) {
+            diag_fp = NULL;
+            return -1;
+        }
+    }
+
+    if (assem_pass1() < 0) {
+        diag("assem_pass1: 패스1 과정에서 실패하였습니다.  \n");
+        result = -1;
+    } else {
+        write_symtab(sym_fp);
+        write_littab(lit_fp);
+        if (write_object_program(obj_fp, NULL) < 0) {
+            diag(" assem_pass2: 패스2 과정에서 실패하였습니다.  \n");
+            result = -1;
+        } else if (list_fp) {
+            for (int i = 0; i < token_line; i++)
+                write_opcode_line(list_fp, token_table[i]);
+        }
+    }
+    diag_fp = NULL;
+    return result;
+}
+
+/* read_full(), write_full(): 소켓에서 정확히 len 바이트를 읽거나 쓴다. 실패 시 -1 */
+static int read_full(int fd, void* buf, size_t len)
+{
+    char* p = buf;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int write_full(int fd, const void* buf, size_t len)
+{
+    const char* p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static pthread_mutex_t assemble_lock = PTHREAD_MUTEX_INITIALIZER;
+static int daemon_listen_fd = -1;
+
+/* daemon_serve(): 연결 하나에서 요청이 끝날 때까지 요청/응답을 반복한다 */
+static void daemon_serve(int fd)
+{
+    daemon_request req;
+    while (read_full(fd, &req, sizeof(req)) == 0) {
+        if (req.magic != DAEMON_MAGIC || req.source_len > DAEMON_MAX_SOURCE)
+            return;
+        char* src = malloc(req.source_len + 1);
+        if (!src || read_full(fd, src, req.source_len) < 0) {
+            free(src);
+            return;
+        }
+
+        char* out[DAEMON_OUTPUTS] = {0};
+        size_t out_len[DAEMON_OUTPUTS] = {0};
+        FILE* fps[DAEMON_OUTPUTS];
+        for (int k = 0; k < DAEMON_OUTPUTS; k++)
+            fps[k] = open_memstream(&out[k], &out_len[k]);
+
+        // 어셈블러 본체는 전역 테이블을 쓰므로 한 번에 하나씩 실행한다
+        pthread_mutex_lock(&assemble_lock);
+        int status = assemble_buffer(src, req.source_len,
+                                     fps[DAEMON_OUT_OBJECT], fps[DAEMON_OUT_SYMTAB],
+                                     fps[DAEMON_OUT_LITTAB],
+                                     (req.flags & DAEMON_OPT_LISTING) ? fps[DAEMON_OUT_LISTING] : NULL,
+                                     fps[DAEMON_OUT_DIAG]);
+        pthread_mutex_unlock(&assemble_lock);
+        free(src);
+
+        daemon_response resp;
+        resp.magic = DAEMON_MAGIC;
+        resp.status = status;
+        for (int k = 0; k < DAEMON_OUTPUTS; k++) {
+            fclose(fps[k]);
+            resp.len[k] = (uint32_t)out_len[k];
+        }
+        int ok = write_full(fd, &resp, sizeof(resp)) == 0;
+        for (int k = 0; k < DAEMON_OUTPUTS; k++) {
+            if (ok && out_len[k] > 0)
+                ok = write_full(fd, out[k], out_len[k]) == 0;
+            free(out[k]);
+        }
+        if (!ok)
+            return;
+    }
+}
+
+/* daemon_worker(): 작업 스레드. 공유된 listen 소켓에서 연결을 받아 처리한다 */
+static void* daemon_worker(void* arg)
+{
+    (void)arg;
+    for (;;) {
+        int fd = accept(daemon_listen_fd, NULL, NULL);
+        if (fd < 0)
+            continue;
+        daemon_serve(fd);
+        close(fd);
+    }
+    return NULL;
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : 데몬 모드(--daemon SOCKET). Unix 도메인 소켓에서 요청을 받아 어셈블 결과를 돌려준다.
+*        inst_table은 시작할 때 한 번만 읽고, 작업 스레드 풀이 여러 클라이언트를 동시에 처리한다.
+* 매개 : 소켓 경로, 작업 스레드 수
+* 반환 : 에러 < 0 (정상적으로는 반환하지 않는다)
+* 주의 : 요청 읽기/응답 쓰기는 스레드별로 동시에 진행되지만, 어셈블러 본체는 전역 테이블을
+*        사용하므로 assemble_lock으로 직렬화한다.
+* -----------------------------------------------------------------------------------
+*/
+static int run_daemon(const char* sock_path, int workers)
+{
+    if (init_inst_file("inst_table.txt") < 0) {
+        fprintf(stderr, "init_my_assembler: 프로그램 초기화에 실패 했습니다.\n");
+        return -1;
+    }
+    if (workers < 1)
+        workers = 1;
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(sock_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "소켓 경로가 너무 깁니다: %s\n", sock_path);
+        return -1;
+    }
+    strcpy(addr.sun_path, sock_path);
+
+    signal(SIGPIPE, SIG_IGN);
+    daemon_listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (daemon_listen_fd < 0) {
+        perror("Error creating socket");
+        return -1;
+    }
+    unlink(sock_path);
+    if (bind(daemon_listen_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+        listen(daemon_listen_fd, 64) < 0) {
+        perror("Error binding socket");
+        close(daemon_listen_fd);
+        return -1;
+    }
+
+    pthread_t tid;
+    for (int w = 1; w < workers; w++)
+        pthread_create(&tid, NULL, daemon_worker, NULL);
+    daemon_worker(NULL);
+    return 0;
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : 클라이언트 모드(--client SOCKET). 소스 파일을 데몬에 보내고, 받은 결과를
+*        기본 모드와 같은 출력 파일에 기록한 뒤 오브젝트 코드를 화면에 출력한다.
+* 매개 : 소켓 경로
+* 반환 : 정상종료 = 0, 에러 < 0
+* 주의 : 입출력 경로는 main의 옵션(input_file, output_file 등)을 그대로 따른다.
+*        리스트는 listing_file이 지정된 경우에만 요청한다.
+* -----------------------------------------------------------------------------------
+*/
+static int run_client(const char* sock_path)
+{
+    int flags = listing_file ? DAEMON_OPT_LISTING : 0;
+    FILE* src = open_input(input_file);
+    if (!src)
+        return -1;
+    size_t src_len = 0, cap = 4096;
+    char* buf = malloc(cap);
+    size_t n;
+    while (buf && (n = fread(buf + src_len, 1, cap - src_len, src)) > 0) {
+        src_len += n;
+        if (src_len == cap) {
+            char* grown = realloc(buf, cap * 2);
+            if (!grown) {
+                free(buf);
+                buf = NULL;
+                break;
+            }
+            buf = grown;
+            cap *= 2;
+        }
+    }
+    close_stream(src);
+    if (!buf)
+        return -1;
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, sock_path, sizeof(addr.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("Error connecting to assembler daemon");
+        if (fd >= 0)
+            close(fd);
+        free(buf);
+        return -1;
+    }
+
+    daemon_request req;
+    req.magic = DAEMON_MAGIC;
+    req.flags = flags;
+    req.source_len = (uint32_t)src_len;
+    daemon_response resp;
+    if (write_full(fd, &req, sizeof(req)) < 0 || write_full(fd, buf, src_len) < 0 ||
+        read_full(fd, &resp, sizeof(resp)) < 0 || resp.magic != DAEMON_MAGIC) {
+        fprintf(stderr, "데몬과 통신하는 중 오류가 발생했습니다.\n");
+        close(fd);
+        free(buf);
+        return -1;
+    }
+    free(buf);
+
+    const char* out_names[DAEMON_OUTPUTS] = {
+        output_file, symtab_file, littab_file, listing_file, NULL
+    };
+    int result = resp.status;
+    for (int k = 0; k < DAEMON_OUTPUTS; k++) {
+        char* data = malloc(resp.len[k] + 1);
+        if (!data || read_full(fd, data, resp.len[k]) < 0) {
+            free(data);
+            close(fd);
+            return -1;
+        }
+        if (k == DAEMON_OUT_DIAG) {
+            fwrite(data, 1, resp.len[k], stdout);
+        } else if (resp.status == 0 && out_names[k]) {
+            FILE* fp = open_output(out_names[k], "daemon");
+            if (fp) {
+                fwrite(data, 1, resp.len[k], fp);
+                close_stream(fp);
+            }
+            if (k == DAEMON_OUT_OBJECT && echo_object && fp != stdout)
+                fwrite(data, 1, resp.len[k], stdout);
+        }
+        free(data);
+    }
+    close(fd);
+    return result;
+}
+
+/* ------------------- 단계별 시간 측정 (--bench-json) ------------------- */
+static double phase_start_ms = 0;
+static long phase_start_rss_kb = 0;
+
+/* now_ms(): 단조 증가 시계의 현재 시각 (ms) */
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/* max_rss_kb(): 지금까지의 프로세스 최대 RSS (KB) */
+static long max_rss_kb(void)
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss;
+}
+
+/* phase_begin(): 단계 측정 시작 */
+static void phase_begin(void)
+{
+    phase_start_ms = now_ms();
+    phase_start_rss_kb = max_rss_kb();
+}
+
+/* phase_end(): 직전 phase_begin() 이후 경과 시간과 최대 RSS의 증가량을 기록 */
+static void phase_end(const char* name)
+{
+    if (phase_count >= MAX_PHASES)
+        return;
+    phases[phase_count].name = name;
+    phases[phase_count].start_ms = phase_start_ms;
+    phases[phase_count].wall_ms = now_ms() - phase_start_ms;
+    phases[phase_count].max_rss_kb = max_rss_kb();
+    phases[phase_count].rss_growth_kb = phases[phase_count].max_rss_kb - phase_start_rss_kb;
+    phase_count++;
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : 단계별 측정 결과를 JSON 한 줄로 path 파일 끝에 덧붙이는 함수이다.
+*        벤치마크 스크립트가 여러 실행 결과를 한 파일(JSON Lines)로 모을 수 있다.
+* 매개 : 출력 파일 경로, 실행 모드 이름, 어셈블 결과
+* 반환 : 없음
+* 주의 : 처리량은 소스 라인 수 / 단계 소요 시간이다.
+*        max_rss_kb는 해당 단계가 끝난 시점까지의 최대 RSS(getrusage)로 앞 단계를 포함한
+*        누적값이고, 단계 자체의 메모리 사용은 rss_growth_kb(단계 동안의 증가량)로 본다.
+* -----------------------------------------------------------------------------------
+*/
+static void write_bench_json(const char* path, const char* mode, int result)
+{
+    FILE* fp = fopen(path, "a");
+    if (!fp) {
+        perror("Error opening bench output file");
+        return;
+    }
+    double total = 0;
+    for (int k = 0; k < phase_count; k++)
+        total += phases[k].wall_ms;
+
+    fprintf(fp, "{\"mode\":\"%s\",\"input\":\"%s\",\"status\":%d,"
+                "\"lines\":%ld,\"bytes\":%ld,\"symbols\":%d,\"literals\":%d,"
+                "\"total_ms\":%.3f,\"phases\":[",
+            mode, input_file, result, source_lines, source_bytes,
+            label_num, literal_count, total);
+    for (int k = 0; k < phase_count; k++) {
+        double secs = phases[k].wall_ms / 1000.0;
+        fprintf(fp, "%s{\"name\":\"%s\",\"wall_ms\":%.3f,\"lines_per_sec\":%.0f,"
+                    "\"max_rss_kb\":%ld,\"rss_growth_kb\":%ld}",
+                k ? "," : "", phases[k].name, phases[k].wall_ms,
+                secs > 0 ? source_lines / secs : 0.0, phases[k].max_rss_kb,
+                phases[k].rss_growth_kb);
+    }
+    fprintf(fp, "]}\n");
+    fclose(fp);
+}
+
+#ifdef ASM_STATS
+/* stat_record(): 레코드 종류별 출력 횟수와 바이트 수를 누적하고 written을 그대로 돌려준다 */
+int stat_record(char kind, int is_new, int written)
+{
+    const char* p = strchr(STAT_RECORD_KINDS, kind);
+    if (p && written > 0) {
+        stats.records[p - STAT_RECORD_KINDS] += is_new;
+        stats.record_bytes[p - STAT_RECORD_KINDS] += written;
+    }
+    return written;
+}
+
+/* write_probe_json(): 탐색 카운터 하나를 JSON 객체로 출력 */
+static void write_probe_json(FILE* fp, const char* name, const stat_probe* p)
+{
+    fprintf(fp, "\"%s\":{\"lookups\":%ld,\"probes\":%ld,\"avg_probe\":%.2f,\"max_probe\":%ld}",
+            name, p->lookups, p->probes, p->lookups ? (double)p->probes / p->lookups : 0.0,
+            p->max_probe);
+}
+#endif
+
+/* ----------------------------------------------------------------------------------
+* 설명 : 단계별 시간과 내부 카운터를 JSON 보고서로 path에 쓰는 함수이다.
+* 매개 : 출력 파일 경로, 실행 모드 이름, 어셈블 결과
+* 반환 : 없음
+* 주의 : 카운터는 ASM_STATS로 빌드했을 때만 수집되며, 그렇지 않으면 "counters"는 null이다.
+*        카운터는 프로세스 전체 값이므로 데몬 모드에서는 의미가 없다.
+* -----------------------------------------------------------------------------------
+*/
+static void write_stats_json(const char* path, const char* mode, int result)
+{
+    FILE* fp = open_output(path, "stats");
+    if (!fp)
+        return;
+    fprintf(fp, "{\n  \"mode\": \"%s\",\n  \"input\": \"%s\",\n  \"status\": %d,\n"
+                "  \"lines\": %ld,\n  \"symbols\": %d,\n  \"literals\": %d,\n  \"phases\": {",
+            mode, input_file, result, source_lines, label_num, literal_count);
+    for (int k = 0; k < phase_count; k++)
+        fprintf(fp, "%s\"%s\": %.3f", k ? ", " : "", phases[k].name, phases[k].wall_ms);
+    fprintf(fp, "},\n  \"counters\": ");
+#ifdef ASM_STATS
+    fprintf(fp, "{\n    ");
+    write_probe_json(fp, "symbol", &stats.symbol);
+    fprintf(fp, ",\n    ");
+    write_probe_json(fp, "opcode", &stats.opcode);
+    fprintf(fp, ",\n    ");
+    write_probe_json(fp, "literal", &stats.literal);
+    fprintf(fp, ",\n    \"generate_object_code\": {\"calls\": %ld},", stats.gen_obj_calls);
+    fprintf(fp, "\n    \"allocations\": {\"calls\": %ld, \"bytes\": %ld},\n    \"records\": {",
+            stats.allocs, stats.alloc_bytes);
+    for (int k = 0; STAT_RECORD_KINDS[k]; k++)
+        fprintf(fp, "%s\"%c\": {\"count\": %ld, \"bytes\": %ld}", k ? ", " : "",
+                STAT_RECORD_KINDS[k], stats.records[k], stats.record_bytes[k]);
+    fprintf(fp, "}\n  }\n}\n");
+#else
+    fprintf(stderr, "--stats: ASM_STATS 없이 빌드되어 단계별 시간만 기록합니다.\n");
+    fprintf(fp, "null\n}\n");
+#endif
+    close_stream(fp);
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : 단계별 측정 결과를 Chrome trace-event 형식(chrome://tracing, Perfetto)으로 쓰는 함수이다.
+*        각 단계는 "X"(complete) 이벤트, 카운터는 마지막에 "C"(counter) 이벤트로 기록된다.
+* 매개 : 출력 파일 경로
+* 반환 : 없음
+* -----------------------------------------------------------------------------------
+*/
+static void write_trace_json(const char* path)
+{
+    FILE* fp = open_output(path, "trace");
+    if (!fp)
+        return;
+    double origin = phase_count ? phases[0].start_ms : 0;
+    fprintf(fp, "{\"traceEvents\":[\n");
+    for (int k = 0; k < phase_count; k++) {
+        double ts = (phases[k].start_ms - origin) * 1000.0;
+        fprintf(fp, "%s{\"name\":\"%s\",\"cat\":\"phase\",\"ph\":\"X\",\"pid\":1,\"tid\":1,"
+                    "\"ts\":%.1f,\"dur\":%.1f,\"args\":{\"max_rss_kb\":%ld,\"rss_growth_kb\":%ld}}",
+                k ? ",\n" : "", phases[k].name, ts, phases[k].wall_ms * 1000.0,
+                phases[k].max_rss_kb, phases[k].rss_growth_kb);
+    }
+#ifdef ASM_STATS
+    double last = phase_count ? (phases[phase_count - 1].start_ms - origin +
+                                 phases[phase_count - 1].wall_ms) * 1000.0 : 0;
+    fprintf(fp, "%s{\"name\":\"lookups\",\"ph\":\"C\",\"pid\":1,\"ts\":%.1f,"
+                "\"args\":{\"symbol\":%ld,\"opcode\":%ld,\"literal\":%ld}}",
+            phase_count ? ",\n" : "", last,
+            stats.symbol.lookups, stats.opcode.lookups, stats.literal.lookups);
+    fprintf(fp, ",\n{\"name\":\"probes\",\"ph\":\"C\",\"pid\":1,\"ts\":%.1f,"
+                "\"args\":{\"symbol\":%ld,\"opcode\":%ld,\"literal\":%ld}}",
+            last, stats.symbol.probes, stats.opcode.probes, stats.literal.probes);
+    fprintf(fp, ",\n{\"name\":\"generate_object_code\",\"ph\":\"C\",\"pid\":1,\"ts\":%.1f,"
+                "\"args\":{\"calls\":%ld}}",
+            last, stats.gen_obj_calls);
+    fprintf(fp, ",\n{\"name\":\"allocations\",\"ph\":\"C\",\"pid\":1,\"ts\":%.1f,"
+                "\"args\":{\"calls\":%ld,\"bytes\":%ld}}",
+            last, stats.allocs, stats.alloc_bytes);
+#endif
+    fprintf(fp, "\n],\"displayTimeUnit\":\"ms\"}\n");
+    close_stream(fp);
+}
+
+/* ------------------- 역어셈블러 (--disasm) ------------------- */
+static inst* dis_table[256];    // 첫 바이트 -> 명령어 (3/4형식은 ni 비트 4가지 모두 채운다)
+static const char* dis_reg_names[] = { "A", "X", "L", "B", "S", "T", "F", "?", "PC", "SW" };
+
+/* build_dis_table(): inst_table로부터 256칸 opcode 직접 색인 배열을 만든다 */
+static void build_dis_table(void)
+{
+    memset(dis_table, 0, sizeof(dis_table));
+    for (int k = 0; k < inst_index; k++)
+        if (inst_table[k]->format == 3)
+            for (int ni = 0; ni < 4; ni++)
+                dis_table[(inst_table[k]->op & 0xFC) | ni] = inst_table[k];
+    for (int k = 0; k < inst_index; k++)
+        if (inst_table[k]->format != 3)
+            dis_table[inst_table[k]->op] = inst_table[k];
+}
+
+/* dis_grow(): 동적 배열 *items의 용량을 need 이상으로 늘린다. 실패하면 -1 */
+static int dis_grow(void** items, int* cap, int need, size_t size)
+{
+    if (need <= *cap)
+        return 0;
+    int cap2 = *cap ? *cap : 64;
+    while (cap2 < need)
+        cap2 *= 2;
+    void* grown = realloc(*items, size * cap2);
+    if (!grown)
+        return -1;
+    *items = grown;
+    *cap = cap2;
+    return 0;
+}
+
+static int hex_value(const char* p, int digits)
+{
+    int v = 0;
+    for (int k = 0; k < digits; k++) {
+        int c = toupper((unsigned char)p[k]);
+        if (!isxdigit(c))
+            return -1;
+        v = v * 16 + (isdigit(c) ? c - '0' : c - 'A' + 10);
+    }
+    return v;
+}
+
+/* copy_name(): 6칸 고정폭 이름을 뒤 공백을 지우고 복사 */
+static void copy_name(char* dst, const char* src)
+{
+    int n = 0;
+    while (n < 6 && src[n] && src[n] != '\n' && src[n] != '\r')
+        n++;
+    memcpy(dst, src, n);
+    while (n > 0 && dst[n - 1] == ' ')
+        n--;
+    dst[n] = '\0';
+}
+
+static int dis_mod_cmp(const void* a, const void* b)
+{
+    return ((const dis_mod*)a)->addr - ((const dis_mod*)b)->addr;
+}
+
+/* dis_find_mod(): [addr, addr+len) 안에서 시작하는 첫 M 레코드 인덱스 (없으면 -1) */
+static int dis_find_mod(const dis_section* sec, int addr, int len)
+{
+    int lo = 0, hi = sec->mod_count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (sec->mods[mid].addr < addr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return (lo < sec->mod_count && sec->mods[lo].addr < addr + len) ? lo : -1;
+}
+
+/* dis_mod_start(): [addr+1, addr+len) 안에서 M 레코드로 알 수 있는 첫 명령어/WORD 시작 주소.
+   4형식 주소 필드(5 half-byte)는 명령어 시작 다음 바이트, WORD(6 half-byte)는 그 주소에서 시작한다.
+   없으면 -1 */
+static int dis_mod_start(const dis_section* sec, int addr, int len)
+{
+    for (int m = dis_find_mod(sec, addr + 1, len); m >= 0 && m < sec->mod_count &&
+         sec->mods[m].addr <= addr + len; m++) {
+        int start = sec->mods[m].addr - (sec->mods[m].halfbytes == 5 ? 1 : 0);
+        if (start > addr && start < addr + len)
+            return start;
+    }
+    return -1;
+}
+
+/* dis_def_name(): 목표 주소가 D 레코드 심볼과 같으면 그 이름 */
+static const char* dis_def_name(const dis_section* sec, int addr)
+{
+    for (int k = 0; k < sec->def_count; k++)
+        if (sec->defs[k].addr == addr)
+            return sec->defs[k].name;
+    return NULL;
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : 바이트열 p(남은 길이 avail)의 명령어 하나를 해석해 니모닉/피연산자/주석을 만든다.
+* 매개 : 섹션, 명령어 주소, 바이트열, 남은 바이트 수, 출력 버퍼들
+* 반환 : 명령어 길이, 명령어로 해석할 수 없으면 0
+* 주의 : 3형식의 BASE 상대 주소는 BASE 값을 알 수 없으므로 (B)+disp로 표시한다.
+* -----------------------------------------------------------------------------------
+*/
+static int dis_decode(const dis_section* sec, int addr, const unsigned char* p, int avail,
+                      char* mnemonic, char* operand, char* note)
+{
+    inst* in = dis_table[p[0]];
+    note[0] = '\0';
+    if (!in)
+        return 0;
+
+    if (in->format == 1) {
+        strcpy(mnemonic, in->str);
+        operand[0] = '\0';
+        return 1;
+    }
+    if (in->format == 2) {
+        if (avail < 2)
+            return 0;
+        int r1 = p[1] >> 4, r2 = p[1] & 0x0F;
+        strcpy(mnemonic, in->str);
+        if (!strcasecmp(in->str, "SVC"))
+            sprintf(operand, "%d", r1);
+        else if (!strcasecmp(in->str, "SHIFTL") || !strcasecmp(in->str, "SHIFTR"))
+            sprintf(operand, "%s,%d", r1 < 10 ? dis_reg_names[r1] : "?", r2 + 1);
+        else if (in->ops == 1)
+            sprintf(operand, "%s", r1 < 10 ? dis_reg_names[r1] : "?");
+        else
+            sprintf(operand, "%s,%s", r1 < 10 ? dis_reg_names[r1] : "?", r2 < 10 ? dis_reg_names[r2] : "?");
+        return 2;
+    }
+
+    if (avail < 3)
+        return 0;
+    int ni = p[0] & 0x03;
+    int x = (p[1] >> 7) & 1;
+    if (ni == 0) {
+        // SIC 호환 형식: 15비트 주소
+        int ta = ((p[1] & 0x7F) << 8) | p[2];
+        strcpy(mnemonic, in->str);
+        sprintf(operand, "%04X%s", ta, x ? ",X" : "");
+        strcpy(note, "SIC");
+        return 3;
+    }
+    int b = (p[1] >> 6) & 1, pc = (p[1] >> 5) & 1, e = (p[1] >> 4) & 1;
+    int len = e ? 4 : 3;
+    if (avail < len || (b && pc))
+        return 0;
+
+    int disp, ta = -1;
+    if (e)
+        disp = ((p[1] & 0x0F) << 16) | (p[2] << 8) | p[3];
+    else
+        disp = ((p[1] & 0x0F) << 8) | p[2];
+
+    char target[32];
+    if (pc) {
+        if (disp & 0x800)
+            disp -= 0x1000;
+        ta = (addr + len + disp) & 0xFFFFF;
+        sprintf(target, "%04X", ta);
+    } else if (b) {
+        sprintf(target, "(B)+%03X", disp);
+    } else {
+        ta = disp;
+        sprintf(target, e ? "%05X" : "%X", disp);
+    }
+
+    const char* prefix = ni == 1 ? "#" : ni == 2 ? "@" : "";
+    sprintf(mnemonic, "%s%s", e ? "+" : "", in->str);
+    if (in->ops == 0 && disp == 0 && !x)
+        operand[0] = '\0';
+    else {
+        const char* name = ta >= 0 && ni != 1 ? dis_def_name(sec, ta) : NULL;
+        int m = e ? dis_find_mod(sec, addr + 1, 1) : -1;
+        if (m >= 0 && sec->mods[m].halfbytes == 5 && disp == 0)
+            name = sec->mods[m].name;   // 외부 참조 등 재배치로 채워질 주소
+        sprintf(operand, "%s%s%s", prefix, name ? name : target, x ? ",X" : "");
+    }
+    sprintf(note, "nixbpe=%d%d%d%d%d%d", ni >> 1, ni & 1, x, b, pc, e);
+    return len;
+}
+
+/* dis_flush_section(): 모아둔 섹션 하나를 역어셈블해 출력하고 상태를 비운다 */
+static void dis_flush_section(FILE* out, dis_section* sec, const char* end_line)
+{
+    fprintf(out, "%-6s  START %06X  LENGTH %06X\n", sec->name, sec->start, sec->length);
+    if (sec->def_count) {
+        fprintf(out, "        EXTDEF ");
+        for (int k = 0; k < sec->def_count; k++)
+            fprintf(out, "%s%s=%06X", k ? "," : "", sec->defs[k].name, sec->defs[k].addr);
+        fprintf(out, "\n");
+    }
+    if (sec->ref_len)
+        fprintf(out, "        EXTREF %s\n", sec->refs);
+
+    qsort(sec->mods, sec->mod_count, sizeof(dis_mod), dis_mod_cmp);
+    for (int t = 0; t < sec->text_count; t++) {
+        const dis_text* tx = &sec->texts[t];
+        const unsigned char* p = sec->bytes + tx->offset;
+        int k = 0;
+        while (k < tx->len) {
+            char mnemonic[16], operand[48], note[32];
+            int addr = tx->addr + k;
+            int m = dis_find_mod(sec, addr, 1);
+            int len;
+            if (m >= 0 && sec->mods[m].halfbytes == 6 && tx->len - k >= 3) {
+                // 6 half-byte 재배치가 걸린 3바이트는 WORD 식이다
+                len = 3;
+                strcpy(mnemonic, "WORD");
+                sprintf(operand, "%06X", (p[k] << 16) | (p[k + 1] << 8) | p[k + 2]);
+                note[0] = '\0';
+            }
+            else
+                len = dis_decode(sec, addr, p + k, tx->len - k, mnemonic, operand, note);
+            // 데이터를 명령어로 읽어 M 레코드가 가리키는 명령어 경계를 넘으면 그 앞까지만 데이터로 본다
+            int cut = len ? dis_mod_start(sec, addr, len) : -1;
+            if (cut >= 0)
+                len = 0;
+            if (len == 0) {
+                // 명령어가 아니면 다음 명령어 경계가 나올 때까지 데이터로 본다
+                len = 1;
+                note[0] = '\0';
+                while (k + len < tx->len && len < 3 && !dis_table[p[k + len]])
+                    len++;
+                if (cut < 0)
+                    cut = dis_mod_start(sec, addr, len);
+                if (cut >= 0)
+                    len = cut - addr;
+                strcpy(mnemonic, "BYTE");
+                strcpy(operand, "X'");
+                for (int d = 0; d < len; d++)
+                    sprintf(operand + 2 + d * 2, "%02X", p[k + d]);
+                strcat(operand, "'");
+            }
+            char obj[12];
+            for (int d = 0; d < len; d++)
+                sprintf(obj + d * 2, "%02X", p[k + d]);
+            fprintf(out, "%06X  %-8s  %-8s %-16s %s", addr, obj, mnemonic, operand, note);
+            for (int m = dis_find_mod(sec, addr, len); m >= 0 && m < sec->mod_count &&
+                 sec->mods[m].addr < addr + len; m++)
+                fprintf(out, " [M %02d %c%s]", sec->mods[m].halfbytes, sec->mods[m].sign,
+                        sec->mods[m].name);
+            fprintf(out, "\n");
+            k += len;
+        }
+    }
+    fprintf(out, "%s\n", end_line);
+
+    sec->byte_count = sec->text_count = sec->mod_count = sec->def_count = 0;
+    sec->ref_len = 0;
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : 오브젝트 프로그램(H/D/R/T/M/E 레코드)을 읽어 섹션 단위로 역어셈블하는 함수이다.
+*        opcode는 inst_table에서 만든 256칸 배열(dis_table)로 바로 찾고,
+*        3/4형식은 nixbpe와 목표 주소를, M 레코드가 걸린 명령어에는 재배치 정보를 표시한다.
+* 매개 : 오브젝트 파일 경로("-"이면 stdin), 출력 경로("-"이면 stdout)
+* 반환 : 정상종료 = 0, 에러 < 0
+* 주의 : T 레코드 안의 데이터와 명령어는 구분되지 않으므로 앞에서부터 명령어로 해석하고,
+*        해석할 수 없는 바이트만 BYTE로 출력한다. 메모리에는 한 섹션만 유지한다.
+* -----------------------------------------------------------------------------------
+*/
+static int run_disasm(const char* obj_path, const char* out_path)
+{
+    if (init_inst_file("inst_table.txt") < 0) {
+        fprintf(stderr, "init_my_assembler: 프로그램 초기화에 실패 했습니다.\n");
+        return -1;
+    }
+    build_dis_table();
+
+    FILE* in = open_input(obj_path);
+    if (!in)
+        return -1;
+    FILE* out = open_output(out_path, "disassembly");
+    if (!out) {
+        close_stream(in);
+        return -1;
+    }
+    if (out != stdout)
+        setvbuf(out, NULL, _IOFBF, 1 << 20);
+
+    dis_section sec;
+    memset(&sec, 0, sizeof(sec));
+    // D/R 레코드는 길이 제한이 없으므로 줄 버퍼도 getline으로 늘려 가며 읽는다
+    char* line = NULL;
+    size_t line_cap = 0;
+    int in_section = 0, result = 0, line_no = 0;
+    while (getline(&line, &line_cap, in) != -1) {
+        line_no++;
+        line[strcspn(line, "\r\n")] = '\0';
+        int n = strlen(line);
+        if (n == 0)
+            continue;
+        switch (line[0]) {
+        case 'H': {
+            // 이 어셈블러는 이름을 7칸("H%-7s")으로 쓰므로 두 폭을 모두 받는다
+            if (n < 19) goto bad;
+            int w = n >= 20 ? 7 : 6;
+            copy_name(sec.name, line + 1);
+            sec.start = hex_value(line + 1 + w, 6);
+            sec.length = hex_value(line + 7 + w, 6);
+            in_section = 1;
+            break;
+        }
+        case 'D':
+            for (int k = 1; k + 12 <= n; k += 12) {
+                if (dis_grow((void**)&sec.defs, &sec.def_cap, sec.def_count + 1, sizeof(dis_def)) < 0)
+                    goto nomem;
+                copy_name(sec.defs[sec.def_count].name, line + k);
+                sec.defs[sec.def_count].addr = hex_value(line + k + 6, 6);
+                sec.def_count++;
+            }
+            break;
+        case 'R': {
+            sec.ref_len = 0;
+            for (int k = 1; k < n; k += 6) {
+                char name[8];
+                copy_name(name, line + k);
+                if (dis_grow((void**)&sec.refs, &sec.ref_cap, sec.ref_len + (int)strlen(name) + 2, 1) < 0)
+                    goto nomem;
+                sec.ref_len += sprintf(sec.refs + sec.ref_len, "%s%s", sec.ref_len ? "," : "", name);
+            }
+            break;
+        }
+        case 'T': {
+            int len = n >= 9 ? hex_value(line + 7, 2) : -1;
+            if (len < 0 || n < 9 + len * 2) goto bad;
+            if (dis_grow((void**)&sec.texts, &sec.text_cap, sec.text_count + 1, sizeof(dis_text)) < 0 ||
+                dis_grow((void**)&sec.bytes, &sec.byte_cap, sec.byte_count + len, 1) < 0)
+                goto nomem;
+            // 주소가 이어지는 레코드는 합쳐서, 레코드 경계에 걸친 명령어(--convert 출력)도 해석한다
+            int addr = hex_value(line + 1, 6);
+            dis_text* tx = sec.text_count ? &sec.texts[sec.text_count - 1] : NULL;
+            if (tx && tx->addr + tx->len == addr)
+                tx->len += len;
+            else {
+                tx = &sec.texts[sec.text_count++];
+                tx->addr = addr;
+                tx->len = len;
+                tx->offset = sec.byte_count;
+            }
+            for (int k = 0; k < len; k++)
+                sec.bytes[sec.byte_count++] = (unsigned char)hex_value(line + 9 + k * 2, 2);
+            break;
+        }
+        case 'M': {
+            if (n < 10) goto bad;
+            if (dis_grow((void**)&sec.mods, &sec.mod_cap, sec.mod_count + 1, sizeof(dis_mod)) < 0)
+                goto nomem;
+            dis_mod* m = &sec.mods[sec.mod_count++];
+            m->addr = hex_value(line + 1, 6);
+            m->halfbytes = hex_value(line + 7, 2);
+            m->sign = line[9];
+            copy_name(m->name, line + 10);
+            break;
+        }
+        case 'E': {
+            char end_line[32] = "END";
+            if (n >= 7)
+                sprintf(end_line, "END     %06X", hex_value(line + 1, 6));
+            if (in_section)
+                dis_flush_section(out, &sec, end_line);
+            fprintf(out, "\n");
+            in_section = 0;
+            break;
+        }
+        default:
+            goto bad;
+        }
+        continue;
+bad:
+        fprintf(stderr, "disasm: %d번째 줄의 레코드 형식이 잘못되었습니다: %s\n", line_no, line);
+        result = -1;
+        continue;
+nomem:
+        perror("disasm");
+        result = -1;
+        break;
+    }
+    if (in_section)
+        dis_flush_section(out, &sec, "END (E 레코드 없음)");
+
+    free(sec.bytes);
+    free(sec.texts);
+    free(sec.mods);
+    free(sec.defs);
+    free(sec.refs);
+    free(line);
+    close_stream(in);
+    close_stream(out);
+    return result;
+}
+
+/* ------------------- 오브젝트 프로그램 표현 (텍스트/바이너리) ------------------- */
+static void obj_init(object_code* oc)
+{
+    memset(oc, 0, sizeof(*oc));
+}
+
+static void obj_free(object_code* oc)
+{
+    free(oc->sections);
+    free(oc->segs);
+    free(oc->mods);
+    free(oc->defs);
+    free(oc->refs);
+    free(oc->text);
+    obj_init(oc);
+}
+
+/* obj_add_section(): 새 섹션을 추가한다. 이후의 세그먼트/M/D/R 항목은 이 섹션에 속한다 */
+static int obj_add_section(object_code* oc, const char* name, int start, int length)
+{
+    if (dis_grow((void**)&oc->sections, &oc->section_cap, oc->section_count + 1, sizeof(obj_section)) < 0) {
+        perror("object_code");
+        return -1;
+    }
+    obj_section* sec = &oc->sections[oc->section_count++];
+    memset(sec, 0, sizeof(*sec));
+    snprintf(sec->name, sizeof(sec->name), "%s", name);
+    sec->start = start;
+    sec->length = length;
+    sec->entry = -1;
+    sec->seg_first = oc->seg_count;
+    sec->mod_first = oc->mod_count;
+    sec->def_first = oc->def_count;
+    sec->ref_first = oc->ref_count;
+    return 0;
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : 현재 섹션의 addr 위치에 16진 문자열 hex의 바이트를 추가한다.
+*        직전 세그먼트가 addr에서 끝나면 그 세그먼트를 늘리고, 아니면 새 세그먼트를 연다.
+* 매개 : object_code, 섹션 상대 주소, 오브젝트 코드 16진 문자열
+* 반환 : 정상종료 = 0, 에러 < 0
+* 주의 : T 레코드의 30바이트 제한은 텍스트 형식에만 있으므로 여기서는 연속 구간이 하나로 합쳐진다.
+* -----------------------------------------------------------------------------------
+*/
+static int obj_add_text(object_code* oc, int addr, const char* hex)
+{
+    if (oc->section_count == 0)
+        return -1;
+    obj_section* sec = &oc->sections[oc->section_count - 1];
+    int len = strlen(hex) / 2;
+    if (len == 0)
+        return 0;
+    if (dis_grow((void**)&oc->text, &oc->text_cap, oc->text_len + len, 1) < 0)
+        goto nomem;
+    for (int k = 0; k < len; k++) {
+        int v = hex_value(hex + k * 2, 2);
+        if (v < 0)
+            return -1;
+        oc->text[oc->text_len + k] = (unsigned char)v;
+    }
+
+    obj_segment* last = sec->seg_count ? &oc->segs[oc->seg_count - 1] : NULL;
+    if (last && last->addr + last->length == addr && last->offset + last->length == oc->text_len) {
+        last->length += len;
+    } else {
+        if (dis_grow((void**)&oc->segs, &oc->seg_cap, oc->seg_count + 1, sizeof(obj_segment)) < 0)
+            goto nomem;
+        obj_segment* seg = &oc->segs[oc->seg_count++];
+        seg->addr = addr;
+        seg->length = len;
+        seg->offset = oc->text_len;
+        sec->seg_count++;
+    }
+    oc->text_len += len;
+    return 0;
+nomem:
+    perror("object_code");
+    return -1;
+}
+
+/* obj_add_mod(): "M%06X%02X%c%s" 형식의 M 레코드 하나를 현재 섹션에 추가한다 */
+static int obj_add_mod(object_code* oc, const char* record)
+{
+    if (oc->section_count == 0 || strlen(record) < 10)
+        return -1;
+    if (dis_grow((void**)&oc->mods, &oc->mod_cap, oc->mod_count + 1, sizeof(obj_mod)) < 0) {
+        perror("object_code");
+        return -1;
+    }
+    obj_mod* m = &oc->mods[oc->mod_count++];
+    m->addr = hex_value(record + 1, 6);
+    m->halfbytes = hex_value(record + 7, 2);
+    m->sign = record[9];
+    snprintf(m->name, sizeof(m->name), "%s", record + 10);
+    oc->sections[oc->section_count - 1].mod_count++;
+    return 0;
+}
+
+/* obj_add_symbol(): 현재 섹션에 D(is_ref = 0) 혹은 R(is_ref = 1) 심볼을 추가한다 */
+static int obj_add_symbol(object_code* oc, int is_ref, const char* name, int addr)
+{
+    if (oc->section_count == 0)
+        return -1;
+    obj_symbol** items = is_ref ? &oc->refs : &oc->defs;
+    int* count = is_ref ? &oc->ref_count : &oc->def_count;
+    int* cap = is_ref ? &oc->ref_cap : &oc->def_cap;
+    if (dis_grow((void**)items, cap, *count + 1, sizeof(obj_symbol)) < 0) {
+        perror("object_code");
+        return -1;
+    }
+    obj_symbol* sym = &(*items)[(*count)++];
+    snprintf(sym->name, sizeof(sym->name), "%s", name);
+    sym->addr = addr;
+    obj_section* sec = &oc->sections[oc->section_count - 1];
+    if (is_ref)
+        sec->ref_count++;
+    else
+        sec->def_count++;
+    return 0;
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : H/D/R/T/M/E 텍스트 오브젝트 프로그램을 읽어 object_code를 채운다.
+* 매개 : 입력 스트림, 채울 object_code (obj_init된 상태)
+* 반환 : 정상종료 = 0, 에러 < 0
+* 주의 : H 레코드 이름은 --disasm과 같이 6칸/7칸을 모두 받는다.
+* -----------------------------------------------------------------------------------
+*/
+static int obj_read_text(FILE* fp, object_code* oc)
+{
+    char* line = NULL;
+    size_t line_cap = 0;
+    int line_no = 0, result = 0;
+    while (result == 0 && getline(&line, &line_cap, fp) != -1) {
+        line_no++;
+        line[strcspn(line, "\r\n")] = '\0';
+        int n = strlen(line);
+        if (n == 0)
+            continue;
+        if (line[0] != 'H' && oc->section_count == 0)
+            goto bad;
+
+        char name[8];
+        switch (line[0]) {
+        case 'H': {
+            if (n < 19) goto bad;
+            int w = n >= 20 ? 7 : 6;
+            copy_name(name, line + 1);
+            if (obj_add_section(oc, name, hex_value(line + 1 + w, 6), hex_value(line + 7 + w, 6)) < 0)
+                result = -1;
+            break;
+        }
+        case 'D':
+            for (int k = 1; k + 12 <= n; k += 12) {
+                copy_name(name, line + k);
+                if (result == 0 && obj_add_symbol(oc, 0, name, hex_value(line + k + 6, 6)) < 0)
+                    result = -1;
+            }
+            break;
+        case 'R':
+            for (int k = 1; k < n; k += 6) {
+                copy_name(name, line + k);
+                if (result == 0 && obj_add_symbol(oc, 1, name, 0) < 0)
+                    result = -1;
+            }
+            break;
+        case 'T': {
+            int len = n >= 9 ? hex_value(line + 7, 2) : -1;
+            if (len < 0 || n < 9 + len * 2) goto bad;
+            line[9 + len * 2] = '\0';
+            if (obj_add_text(oc, hex_value(line + 1, 6), line + 9) < 0)
+                goto bad;
+            break;
+        }
+        case 'M':
+            if (n < 10 || obj_add_mod(oc, line) < 0) goto bad;
+            break;
+        case 'E':
+            oc->sections[oc->section_count - 1].entry = n >= 7 ? hex_value(line + 1, 6) : -1;
+            break;
+        default:
+            goto bad;
+        }
+        continue;
+bad:
+        fprintf(stderr, "convert: %d번째 줄의 레코드 형식이 잘못되었습니다: %s\n", line_no, line);
+        result = -1;
+    }
+    free(line);
+    return result;
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : object_code를 H/D/R/T/M/E 텍스트 형식으로 출력한다.
+*        세그먼트는 text_record_max 바이트씩 잘라 T 레코드로 만들고,
+*        섹션 사이의 빈 줄과 E 레코드 모양은 pass2 출력과 같게 맞춘다.
+* 매개 : 출력 스트림, object_code
+* 반환 : 정상종료 = 0
+* 주의 : LTORG 리터럴처럼 pass2가 따로 끊은 레코드는 연속 구간이면 합쳐져서 나온다.
+* -----------------------------------------------------------------------------------
+*/
+static int obj_write_text(FILE* fp, const object_code* oc)
+{
+    for (int s = 0; s < oc->section_count; s++) {
+        const obj_section* sec = &oc->sections[s];
+        fprintf(fp, "H%-7s%06X%06X\n", sec->name, sec->start, sec->length);
+        if (sec->def_count) {
+            fputc('D', fp);
+            for (int k = sec->def_first; k < sec->def_first + sec->def_count; k++)
+                fprintf(fp, "%-6s%06X", oc->defs[k].name, oc->defs[k].addr);
+            fputc('\n', fp);
+        }
+        if (sec->ref_count) {
+            fputc('R', fp);
+            for (int k = sec->ref_first; k < sec->ref_first + sec->ref_count; k++)
+                fprintf(fp, "%-6s", oc->refs[k].name);
+            fputc('\n', fp);
+        }
+        for (int k = sec->seg_first; k < sec->seg_first + sec->seg_count; k++) {
+            const obj_segment* seg = &oc->segs[k];
+            for (int off = 0; off < seg->length; off += text_record_max) {
+                int len = seg->length - off < text_record_max ? seg->length - off : text_record_max;
+                fprintf(fp, "T%06X%02X", seg->addr + off, len);
+                for (int b = 0; b < len; b++)
+                    fprintf(fp, "%02X", oc->text[seg->offset + off + b]);
+                fputc('\n', fp);
+            }
+        }
+        for (int k = sec->mod_first; k < sec->mod_first + sec->mod_count; k++)
+            fprintf(fp, "M%06X%02X%c%s\n", oc->mods[k].addr, oc->mods[k].halfbytes,
+                    oc->mods[k].sign, oc->mods[k].name);
+        if (sec->entry >= 0)
+            fprintf(fp, "E%06X\n", sec->entry);
+        else
+            fprintf(fp, "E\n");
+        if (s == 0 || s < oc->section_count - 1)
+            fputc('\n', fp);
+    }
+    return 0;
+}
+
+/* 바이너리 출력용 문자열 풀. 같은 이름(M 레코드의 외부 심볼 등)은 한 번만 저장한다 */
+typedef struct _obj_strpool {
+    char* data;
+    int len, cap;
+    int* slots;     // 해시 -> 오프셋 + 1 (0: 빈 칸)
+    int mask;
+} obj_strpool;
+
+static int strpool_add(obj_strpool* sp, const char* name)
+{
+    unsigned int h = name_hash(name, strlen(name));
+    for (unsigned int k = h & sp->mask; ; k = (k + 1) & sp->mask) {
+        if (sp->slots[k] == 0)
+            break;
+        if (!strcmp(sp->data + sp->slots[k] - 1, name))
+            return sp->slots[k] - 1;
+    }
+    int n = strlen(name) + 1;
+    if (dis_grow((void**)&sp->data, &sp->cap, sp->len + n, 1) < 0)
+        return -1;
+    memcpy(sp->data + sp->len, name, n);
+    for (unsigned int k = h & sp->mask; ; k = (k + 1) & sp->mask)
+        if (sp->slots[k] == 0) {
+            sp->slots[k] = sp->len + 1;
+            break;
+        }
+    sp->len += n;
+    return sp->len - n;
+}
+
+#define OBJB_ALIGN(n) (((n) + 3u) & ~3u)
+
+/* ----------------------------------------------------------------------------------
+* 설명 : object_code를 바이너리 오브젝트 형식(objb_*)으로 출력한다.
+*        파일 전체를 메모리에 만든 뒤 한 번에 쓴다.
+* 매개 : 출력 스트림, object_code
+* 반환 : 정상종료 = 0, 에러 < 0
+* 주의 : 필드는 호스트 바이트 순서로 기록하므로 리틀 엔디안 호스트를 가정한다.
+*        (다른 순서의 호스트에서는 매직 넘버가 맞지 않아 읽기를 거부한다.)
+* -----------------------------------------------------------------------------------
+*/
+static int obj_write_binary(FILE* fp, const object_code* oc)
+{
+    int names = oc->section_count + oc->mod_count + oc->def_count + oc->ref_count;
+    obj_strpool sp = { NULL, 0, 0, NULL, 0 };
+    int slot_count = 16;
+    while (slot_count < names * 2)
+        slot_count *= 2;
+    sp.slots = calloc(slot_count, sizeof(int));
+    sp.mask = slot_count - 1;
+    if (!sp.slots) {
+        perror("object_code");
+        return -1;
+    }
+
+    // 이름을 먼저 풀에 넣어 크기를 정한다 (섹션, M, D, R 순서)
+    int* name_off = malloc(sizeof(int) * (names ? names : 1));
+    if (!name_off) {
+        free(sp.slots);
+        perror("object_code");
+        return -1;
+    }
+    int ni = 0, result = 0;
+    for (int k = 0; k < oc->section_count && result == 0; k++)
+        result = (name_off[ni++] = strpool_add(&sp, oc->sections[k].name)) < 0;
+    for (int k = 0; k < oc->mod_count && result == 0; k++)
+        result = (name_off[ni++] = strpool_add(&sp, oc->mods[k].name)) < 0;
+    for (int k = 0; k < oc->def_count && result == 0; k++)
+        result = (name_off[ni++] = strpool_add(&sp, oc->defs[k].name)) < 0;
+    for (int k = 0; k < oc->ref_count && result == 0; k++)
+        result = (name_off[ni++] = strpool_add(&sp, oc->refs[k].name)) < 0;
+
+    objb_header h;
+    memset(&h, 0, sizeof(h));
+    h.magic = OBJB_MAGIC;
+    h.version = OBJB_VERSION;
+    h.section_count = oc->section_count;
+    h.seg_offset = sizeof(objb_header) + sizeof(objb_section) * oc->section_count;
+    h.seg_count = oc->seg_count;
+    h.mod_offset = h.seg_offset + sizeof(objb_segment) * oc->seg_count;
+    h.mod_count = oc->mod_count;
+    h.def_offset = h.mod_offset + sizeof(objb_mod) * oc->mod_count;
+    h.def_count = oc->def_count;
+    h.ref_offset = h.def_offset + sizeof(objb_symbol) * oc->def_count;
+    h.ref_count = oc->ref_count;
+    h.text_offset = h.ref_offset + sizeof(objb_symbol) * oc->ref_count;
+    h.text_size = oc->text_len;
+    h.string_offset = OBJB_ALIGN(h.text_offset + h.text_size);
+    h.string_size = sp.len;
+    h.file_size = OBJB_ALIGN(h.string_offset + h.string_size);
+
+    unsigned char* image = result == 0 ? calloc(1, h.file_size) : NULL;
+    if (!image) {
+        if (result == 0)
+            perror("object_code");
+        free(name_off);
+        free(sp.slots);
+        free(sp.data);
+        return -1;
+    }
+    memcpy(image, &h, sizeof(h));
+
+    objb_section* bsec = (objb_section*)(image + sizeof(objb_header));
+    for (int k = 0; k < oc->section_count; k++) {
+        const obj_section* sec = &oc->sections[k];
+        bsec[k].name = name_off[k];
+        bsec[k].start = sec->start;
+        bsec[k].length = sec->length;
+        bsec[k].entry = sec->entry >= 0 ? (uint32_t)sec->entry : OBJB_NO_ENTRY;
+        bsec[k].seg_first = sec->seg_first;
+        bsec[k].seg_count = sec->seg_count;
+        bsec[k].mod_first = sec->mod_first;
+        bsec[k].mod_count = sec->mod_count;
+        bsec[k].def_first = sec->def_first;
+        bsec[k].def_count = sec->def_count;
+        bsec[k].ref_first = sec->ref_first;
+        bsec[k].ref_count = sec->ref_count;
+    }
+    ni = oc->section_count;
+    objb_segment* bseg = (objb_segment*)(image + h.seg_offset);
+    for (int k = 0; k < oc->seg_count; k++) {
+        bseg[k].addr = oc->segs[k].addr;
+        bseg[k].length = oc->segs[k].length;
+        bseg[k].offset = oc->segs[k].offset;
+    }
+    objb_mod* bmod = (objb_mod*)(image + h.mod_offset);
+    for (int k = 0; k < oc->mod_count; k++) {
+        bmod[k].addr = oc->mods[k].addr;
+        bmod[k].halfbytes_sign = (oc->mods[k].halfbytes & 0xFF) | (oc->mods[k].sign == '-' ? 0x100 : 0);
+        bmod[k].name = name_off[ni++];
+    }
+    objb_symbol* bsym = (objb_symbol*)(image + h.def_offset);
+    for (int k = 0; k < oc->def_count; k++) {
+        bsym[k].name = name_off[ni++];
+        bsym[k].addr = oc->defs[k].addr;
+    }
+    bsym = (objb_symbol*)(image + h.ref_offset);
+    for (int k = 0; k < oc->ref_count; k++) {
+        bsym[k].name = name_off[ni++];
+        bsym[k].addr = 0;
+    }
+    if (oc->text_len)
+        memcpy(image + h.text_offset, oc->text, oc->text_len);
+    if (sp.len)
+        memcpy(image + h.string_offset, sp.data, sp.len);
+
+    if (fwrite(image, 1, h.file_size, fp) != h.file_size) {
+        perror("object_code");
+        result = -1;
+    }
+    free(image);
+    free(name_off);
+    free(sp.slots);
+    free(sp.data);
+    return result;
+}
+
+/* objb_range_ok(): [offset, offset + count * size)가 파일 안에 있고 4바이트 정렬인지 */
+static int objb_range_ok(uint32_t offset, uint32_t count, uint32_t size, size_t file_size)
+{
+    return offset % 4 == 0 && offset <= file_size &&
+           (uint64_t)count * size <= file_size - offset;
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : 바이너리 오브젝트 파일을 mmap하여 obj_parse_binary()로 읽어 들인다.
+* 매개 : 정규 파일의 파일 디스크립터, 진단용 경로, 채울 object_code (obj_init된 상태)
+* 반환 : 정상종료 = 0, 에러 < 0
+* 주의 : fd는 닫지 않는다.
+* -----------------------------------------------------------------------------------
+*/
+static int obj_read_binary(int fd, const char* path, object_code* oc)
+{
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(objb_header)) {
+        fprintf(stderr, "convert: %s: 바이너리 오브젝트 헤더가 없습니다.\n", path);
+        return -1;
+    }
+    size_t size = st.st_size;
+    unsigned char* image = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (image == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    int result = obj_parse_binary(image, size, path, oc);
+    munmap(image, size);
+    return result;
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : 메모리에 올라온 바이너리 오브젝트 이미지를 object_code로 읽어 들인다.
+*        헤더의 오프셋/개수와 섹션별 범위, 이름 오프셋을 모두 검사한 뒤 복사한다.
+* 매개 : 이미지(4바이트 정렬)와 크기, 진단용 경로, 채울 object_code (obj_init된 상태)
+* 반환 : 정상종료 = 0, 에러 < 0
+* 주의 : 레코드를 해석하는 과정이 없으므로 읽는 비용은 검사와 복사뿐이다.
+* -----------------------------------------------------------------------------------
+*/
+static int obj_parse_binary(const unsigned char* image, size_t size, const char* path, object_code* oc)
+{
+    if (size < sizeof(objb_header)) {
+        fprintf(stderr, "convert: %s: 바이너리 오브젝트 헤더가 없습니다.\n", path);
+        return -1;
+    }
+    const objb_header* h = (const objb_header*)image;
+    const objb_section* bsec = (const objb_section*)(image + sizeof(objb_header));
+    const objb_segment* bseg = (const objb_segment*)(image + h->seg_offset);
+    const objb_mod* bmod = (const objb_mod*)(image + h->mod_offset);
+    const objb_symbol* bdef = (const objb_symbol*)(image + h->def_offset);
+    const objb_symbol* bref = (const objb_symbol*)(image + h->ref_offset);
+    const char* strings = (const char*)image + h->string_offset;
+    int result = -1;
+
+    if (h->magic != OBJB_MAGIC || h->version != OBJB_VERSION || h->file_size != size)
+        goto bad;
+    if (!objb_range_ok(sizeof(objb_header), h->section_count, sizeof(objb_section), size) ||
+        !objb_range_ok(h->seg_offset, h->seg_count, sizeof(objb_segment), size) ||
+        !objb_range_ok(h->mod_offset, h->mod_count, sizeof(objb_mod), size) ||
+        !objb_range_ok(h->def_offset, h->def_count, sizeof(objb_symbol), size) ||
+        !objb_range_ok(h->ref_offset, h->ref_count, sizeof(objb_symbol), size) ||
+        h->text_offset > size || h->text_size > size - h->text_offset ||
+        h->string_offset > size || h->string_size > size - h->string_offset ||
+        (h->string_size && strings[h->string_size - 1] != '\0'))
+        goto bad;
+
+#define OBJB_NAME_OK(off) ((off) < h->string_size)
+    for (uint32_t k = 0; k < h->seg_count; k++)
+        if (bseg[k].offset > h->text_size || bseg[k].length > h->text_size - bseg[k].offset)
+            goto bad;
+    for (uint32_t k = 0; k < h->mod_count; k++)
+        if (!OBJB_NAME_OK(bmod[k].name))
+            goto bad;
+    for (uint32_t k = 0; k < h->def_count; k++)
+        if (!OBJB_NAME_OK(bdef[k].name))
+            goto bad;
+    for (uint32_t k = 0; k < h->ref_count; k++)
+        if (!OBJB_NAME_OK(bref[k].name))
+            goto bad;
+
+    for (uint32_t s = 0; s < h->section_count; s++) {
+        const objb_section* bs = &bsec[s];
+        // 각 테이블은 섹션 순서대로 이어져 있어야 한다
+        if (!OBJB_NAME_OK(bs->name) ||
+            bs->seg_first != (uint32_t)oc->seg_count || bs->seg_count > h->seg_count - bs->seg_first ||
+            bs->mod_first != (uint32_t)oc->mod_count || bs->mod_count > h->mod_count - bs->mod_first ||
+            bs->def_first != (uint32_t)oc->def_count || bs->def_count > h->def_count - bs->def_first ||
+            bs->ref_first != (uint32_t)oc->ref_count || bs->ref_count > h->ref_count - bs->ref_first)
+            goto bad;
+        if (obj_add_section(oc, strings + bs->name, bs->start, bs->length) < 0)
+            goto out;
+        obj_section* sec = &oc->sections[oc->section_count - 1];
+        sec->entry = bs->entry == OBJB_NO_ENTRY ? -1 : (int)bs->entry;
+
+        for (uint32_t k = bs->seg_first; k < bs->seg_first + bs->seg_count; k++) {
+            if (dis_grow((void**)&oc->segs, &oc->seg_cap, oc->seg_count + 1, sizeof(obj_segment)) < 0)
+                goto nomem;
+            oc->segs[oc->seg_count].addr = bseg[k].addr;
+            oc->segs[oc->seg_count].length = bseg[k].length;
+            oc->segs[oc->seg_count].offset = bseg[k].offset;
+            oc->seg_count++;
+            sec->seg_count++;
+        }
+        for (uint32_t k = bs->mod_first; k < bs->mod_first + bs->mod_count; k++) {
+            if (dis_grow((void**)&oc->mods, &oc->mod_cap, oc->mod_count + 1, sizeof(obj_mod)) < 0)
+                goto nomem;
+            obj_mod* m = &oc->mods[oc->mod_count++];
+            m->addr = bmod[k].addr;
+            m->halfbytes = bmod[k].halfbytes_sign & 0xFF;
+            m->sign = (bmod[k].halfbytes_sign & 0x100) ? '-' : '+';
+            snprintf(m->name, sizeof(m->name), "%s", strings + bmod[k].name);
+            sec->mod_count++;
+        }
+        for (uint32_t k = bs->def_first; k < bs->def_first + bs->def_count; k++)
+            if (obj_add_symbol(oc, 0, strings + bdef[k].name, bdef[k].addr) < 0)
+                goto out;
+        for (uint32_t k = bs->ref_first; k < bs->ref_first + bs->ref_count; k++)
+            if (obj_add_symbol(oc, 1, strings + bref[k].name, 0) < 0)
+                goto out;
+    }
+#undef OBJB_NAME_OK
+    if (oc->seg_count != (int)h->seg_count || oc->mod_count != (int)h->mod_count ||
+        oc->def_count != (int)h->def_count || oc->ref_count != (int)h->ref_count)
+        goto bad;
+
+    if (dis_grow((void**)&oc->text, &oc->text_cap, h->text_size ? h->text_size : 1, 1) < 0)
+        goto nomem;
+    memcpy(oc->text, image + h->text_offset, h->text_size);
+    oc->text_len = h->text_size;
+    result = 0;
+    goto out;
+
+bad:
+    fprintf(stderr, "convert: %s: 바이너리 오브젝트 형식이 잘못되었습니다.\n", path);
+    goto out;
+nomem:
+    perror("object_code");
+out:
+    return result;
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : 오브젝트 파일을 object_code로 읽는다. 앞 4바이트가 OBJB_MAGIC이면 바이너리,
+*        아니면 텍스트(H/D/R/T/M/E) 형식으로 본다.
+* 매개 : 입력 경로("-"이면 stdin), 채울 object_code, 바이너리 여부를 받을 곳 (NULL 가능)
+* 반환 : 정상종료 = 0, 에러 < 0
+* 주의 : 정규 파일은 앞 4바이트만 보고 바이너리면 mmap한다.
+*        파이프처럼 되감을 수 없는 입력은 전부 메모리로 읽은 뒤 형식을 판단한다.
+* -----------------------------------------------------------------------------------
+*/
+static int obj_read_file(const char* path, object_code* oc, int* is_binary)
+{
+    FILE* in = open_input(path);
+    if (!in)
+        return -1;
+    int fd = fileno(in);
+    uint32_t magic = 0;
+    int binary = 0, result = -1;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        binary = pread(fd, &magic, sizeof(magic), 0) == (ssize_t)sizeof(magic) && magic == OBJB_MAGIC;
+        if (is_binary)
+            *is_binary = binary;
+        result = binary ? obj_read_binary(fd, path, oc) : obj_read_text(in, oc);
+        close_stream(in);
+        return result;
+    }
+
+    size_t len = 0, cap = 4096;
+    unsigned char* buf = malloc(cap);
+    size_t n;
+    while (buf && (n = fread(buf + len, 1, cap - len, in)) > 0) {
+        len += n;
+        if (len == cap) {
+            unsigned char* grown = realloc(buf, cap * 2);
+            if (!grown) {
+                free(buf);
+                buf = NULL;
+                break;
+            }
+            buf = grown;
+            cap *= 2;
+        }
+    }
+    close_stream(in);
+    if (!buf) {
+        perror("object_code");
+        return -1;
+    }
+    if (len >= sizeof(magic))
+        memcpy(&magic, buf, sizeof(magic));
+    binary = magic == OBJB_MAGIC;
+    if (is_binary)
+        *is_binary = binary;
+    if (binary)
+        result = obj_parse_binary(buf, len, path, oc);
+    else {
+        FILE* mem = fmemopen(buf, len, "r");
+        if (!mem)
+            perror("fmemopen");
+        else {
+            result = obj_read_text(mem, oc);
+            fclose(mem);
+        }
+    }
+    free(buf);
+    return result;
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : 오브젝트 프로그램을 텍스트 <-> 바이너리로 변환한다 (--convert).
+*        입력 파일 앞 4바이트가 OBJB_MAGIC이면 바이너리 -> 텍스트, 아니면 텍스트 -> 바이너리.
+* 매개 : 입력 경로("-"이면 stdin), 출력 경로("-"이면 stdout)
+* 반환 : 정상종료 = 0, 에러 < 0
+* 주의 : 읽기에 실패하면 출력 파일을 만들지 않는다.
+* -----------------------------------------------------------------------------------
+*/
+static int run_convert(const char* in_path, const char* out_path)
+{
+    object_code oc;
+    obj_init(&oc);
+    int is_binary = 0;
+    int result = obj_read_file(in_path, &oc, &is_binary);
+
+    if (result == 0) {
+        FILE* out = open_output(out_path, "object code");
+        if (!out)
+            result = -1;
+        else {
+            result = is_binary ? obj_write_text(out, &oc) : obj_write_binary(out, &oc);
+            close_stream(out);
+        }
+    }
+    obj_free(&oc);
+    return result;
+}
+
+/* ------------------- 오브젝트 모듈 아카이브 (--archive, --ar-create, --ar-pull) ------------------- */
+/* ----------------------------------------------------------------------------------
+* 설명 : 아카이브 파일을 mmap하고 헤더와 모든 오프셋/범위를 검사한다.
+*        로더는 arx_find()로 이름을 찾고 arx_module_text()로 필요한 모듈만 읽는다.
+* 매개 : 아카이브 경로, 채울 sx_archive
+* 반환 : 정상종료 = 0, 에러 < 0
+* 주의 : 사용이 끝나면 arx_close()로 매핑을 해제해야 한다.
+* -----------------------------------------------------------------------------------
+*/
+int arx_open(const char* path, sx_archive* ar)
+{
+    ar->image = NULL;
+    ar->size = 0;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror("Error opening archive");
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(arx_header)) {
+        fprintf(stderr, "archive: %s: 아카이브 헤더가 없습니다.\n", path);
+        close(fd);
+        return -1;
+    }
+    size_t size = st.st_size;
+    unsigned char* image = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+
+    const arx_header* h = (const arx_header*)image;
+    const arx_module* modules = (const arx_module*)(image + h->module_offset);
+    const arx_symbol* symbols = (const arx_symbol*)(image + h->symbol_offset);
+    const uint32_t* slots = (const uint32_t*)(image + h->hash_offset);
+    int ok = h->magic == ARX_MAGIC && h->version == ARX_VERSION && h->file_size == size &&
+             h->module_offset == sizeof(arx_header) &&
+             objb_range_ok(h->module_offset, h->module_count, sizeof(arx_module), size) &&
+             h->symbol_offset == h->module_offset + h->module_count * sizeof(arx_module) &&
+             objb_range_ok(h->symbol_offset, h->symbol_count, sizeof(arx_symbol), size) &&
+             h->hash_offset == h->symbol_offset + h->symbol_count * sizeof(arx_symbol) &&
+             h->hash_size && !(h->hash_size & (h->hash_size - 1)) && h->hash_size > h->symbol_count &&
+             objb_range_ok(h->hash_offset, h->hash_size, sizeof(uint32_t), size) &&
+             h->string_offset == h->hash_offset + h->hash_size * sizeof(uint32_t) &&
+             h->string_size <= size - h->string_offset &&
+             (h->string_size == 0 || image[h->string_offset + h->string_size - 1] == '\0') &&
+             h->text_offset <= size && h->text_size <= size - h->text_offset;
+    for (uint32_t k = 0; ok && k < h->module_count; k++)
+        ok = modules[k].name < h->string_size && modules[k].offset <= h->text_size &&
+             modules[k].length <= h->text_size - modules[k].offset;
+    for (uint32_t k = 0; ok && k < h->symbol_count; k++)
+        ok = symbols[k].name < h->string_size && symbols[k].module < h->module_count;
+    for (uint32_t k = 0; ok && k < h->hash_size; k++)
+        ok = slots[k] <= h->symbol_count;
+    if (!ok) {
+        fprintf(stderr, "archive: %s: 아카이브 형식이 잘못되었습니다.\n", path);
+        munmap(image, size);
+        return -1;
+    }
+    ar->image = image;
+    ar->size = size;
+    return 0;
+}
+
+/* arx_close(): arx_open()의 매핑을 해제 */
+void arx_close(sx_archive* ar)
+{
+    if (ar->image)
+        munmap(ar->image, ar->size);
+    ar->image = NULL;
+    ar->size = 0;
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : 섹션 이름 혹은 D 레코드 심볼 name을 내보내는 모듈을 해시 탐사로 찾는다.
+* 매개 : arx_open()한 아카이브, 찾을 이름, 심볼의 모듈 상대 주소를 받을 곳 (NULL 가능)
+* 반환 : 모듈 번호, 없으면 -1
+* 주의 : 같은 이름을 여러 모듈이 내보내면 먼저 추가된 모듈을 돌려준다.
+* -----------------------------------------------------------------------------------
+*/
+int arx_find(const sx_archive* ar, const char* name, int* addr)
+{
+    const arx_header* h = (const arx_header*)ar->image;
+    const arx_symbol* symbols = (const arx_symbol*)(ar->image + h->symbol_offset);
+    const uint32_t* slots = (const uint32_t*)(ar->image + h->hash_offset);
+    const char* strings = (const char*)ar->image + h->string_offset;
+    uint32_t mask = h->hash_size - 1;
+
+    uint32_t k = name_hash(name, strlen(name)) & mask;
+    for (uint32_t n = 0; n < h->hash_size && slots[k]; n++, k = (k + 1) & mask) {
+        const arx_symbol* s = &symbols[slots[k] - 1];
+        if (!strcmp(strings + s->name, name)) {
+            if (addr)
+                *addr = s->addr;
+            return s->module;
+        }
+    }
+    return -1;
+}
+
+/* arx_module_text(): 모듈의 H ~ E 레코드 텍스트 (NUL 종료 아님, 길이는 *length) */
+const char* arx_module_text(const sx_archive* ar, int module, int* length)
+{
+    const arx_header* h = (const arx_header*)ar->image;
+    const arx_module* m = (const arx_module*)(ar->image + h->module_offset) + module;
+    *length = m->length;
+    return (const char*)ar->image + h->text_offset + m->offset;
+}
+
+/* arx_module_name(): 모듈(control section) 이름 */
+const char* arx_module_name(const sx_archive* ar, int module)
+{
+    const arx_header* h = (const arx_header*)ar->image;
+    const arx_module* m = (const arx_module*)(ar->image + h->module_offset) + module;
+    return (const char*)ar->image + h->string_offset + m->name;
+}
+
+/* ar_free(): 아카이브 빌더의 모듈 텍스트와 배열 해제 */
+static void ar_free(ar_builder* b)
+{
+    for (int k = 0; k < b->count; k++)
+        free(b->members[k].text);
+    free(b->members);
+    b->members = NULL;
+    b->count = b->cap = 0;
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : 오브젝트 프로그램 텍스트를 H 레코드마다 잘라 섹션 하나씩 모듈로 넣는다.
+*        같은 이름의 모듈이 이미 있으면 새 것으로 바꾼다 (ar r과 같다).
+* 매개 : 아카이브 빌더, 오브젝트 프로그램 텍스트와 길이
+* 반환 : 정상종료 = 0, 에러 < 0
+* 주의 : 섹션 사이의 빈 줄은 버리고 각 모듈은 E 레코드의 개행으로 끝난다.
+* -----------------------------------------------------------------------------------
+*/
+static int ar_add_text(ar_builder* b, const char* text, size_t len)
+{
+    size_t pos = 0;
+    while (pos < len) {
+        size_t eol = pos;
+        while (eol < len && text[eol] != '\n')
+            eol++;
+        if (text[pos] != 'H') {
+            // 섹션 밖에는 빈 줄만 올 수 있다
+            for (size_t k = pos; k < eol; k++) {
+                if (text[k] != '\r' && text[k] != ' ') {
+                    fprintf(stderr, "archive: H 레코드로 시작하지 않는 오브젝트 프로그램입니다.\n");
+                    return -1;
+                }
+            }
+            pos = eol + 1;
+            continue;
+        }
+
+        // 다음 H 레코드 전까지가 한 모듈이다
+        size_t end = eol < len ? eol + 1 : len;
+        while (end < len && text[end] != 'H') {
+            while (end < len && text[end] != '\n')
+                end++;
+            if (end < len)
+                end++;
+        }
+        size_t body = end;
+        while (body > pos && (text[body - 1] == '\n' || text[body - 1] == '\r' || text[body - 1] == ' '))
+            body--;
+
+        char name[8];
+        copy_name(name, text + pos + 1);
+        int m = 0;
+        while (m < b->count && strcmp(b->members[m].name, name))
+            m++;
+        if (m == b->count) {
+            if (dis_grow((void**)&b->members, &b->cap, b->count + 1, sizeof(ar_member)) < 0) {
+                perror("archive");
+                return -1;
+            }
+            b->count++;
+            b->members[m].text = NULL;
+            strcpy(b->members[m].name, name);
+        }
+        free(b->members[m].text);
+        b->members[m].text = malloc(body - pos + 1);
+        if (!b->members[m].text) {
+            perror("archive");
+            b->members[m].length = 0;
+            return -1;
+        }
+        memcpy(b->members[m].text, text + pos, body - pos);
+        b->members[m].text[body - pos] = '\n';
+        b->members[m].length = body - pos + 1;
+        pos = end;
+    }
+    return 0;
+}
+
+/* ar_load(): 기존 아카이브의 모듈을 빌더로 읽는다. 파일이 없으면 빈 아카이브로 본다 */
+static int ar_load(ar_builder* b, const char* path)
+{
+    if (access(path, F_OK) < 0 && errno == ENOENT)
+        return 0;
+    sx_archive ar;
+    if (arx_open(path, &ar) < 0)
+        return -1;
+    const arx_header* h = (const arx_header*)ar.image;
+    int result = 0;
+    for (uint32_t m = 0; m < h->module_count && result == 0; m++) {
+        int len;
+        const char* text = arx_module_text(&ar, m, &len);
+        result = ar_add_text(b, text, len);
+    }
+    arx_close(&ar);
+    return result;
+}
+
+/* 색인 항목을 정렬하기 위한 임시 항목. 같은 이름은 먼저 추가된 모듈이 앞에 온다 */
+typedef struct _arx_item {
+    char name[8];
+    int module;
+    int addr;
+} arx_item;
+
+static int arx_item_cmp(const void* a, const void* b)
+{
+    const arx_item* x = a;
+    const arx_item* y = b;
+    int c = strcmp(x->name, y->name);
+    return c ? c : x->module - y->module;
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : 빌더의 모듈로 아카이브 파일(arx_*)을 만든다. 모듈마다 H/D 레코드를 읽어
+*        섹션 이름과 D 심볼을 색인에 넣고, (이름, 모듈) 순으로 정렬한 뒤 해시 슬롯을 채운다.
+* 매개 : 아카이브 빌더, 출력 경로
+* 반환 : 정상종료 = 0, 에러 < 0
+* 주의 : 임시 파일에 다 쓴 뒤 rename하므로 실패해도 기존 아카이브는 그대로 남는다.
+*        여러 모듈이 같은 이름을 내보내면 경고하고 먼저 추가된 모듈을 쓴다.
+* -----------------------------------------------------------------------------------
+*/
+static int ar_write(const ar_builder* b, const char* path)
+{
+    arx_item* items = NULL;
+    int item_count = 0, item_cap = 0, result = 0;
+    uint32_t text_size = 0;
+    for (int m = 0; m < b->count && result == 0; m++) {
+        object_code oc;
+        obj_init(&oc);
+        FILE* in = fmemopen(b->members[m].text, b->members[m].length, "r");
+        result = in ? obj_read_text(in, &oc) : -1;
+        if (in)
+            fclose(in);
+        int need = item_count + 1 + oc.def_count;
+        if (result == 0 && (oc.section_count != 1 ||
+                            dis_grow((void**)&items, &item_cap, need, sizeof(arx_item)) < 0)) {
+            fprintf(stderr, "archive: %s 모듈을 색인할 수 없습니다.\n", b->members[m].name);
+            result = -1;
+        }
+        if (result == 0) {
+            strcpy(items[item_count].name, b->members[m].name);
+            items[item_count].module = m;
+            items[item_count++].addr = oc.sections[0].start;
+            for (int k = 0; k < oc.def_count; k++) {
+                snprintf(items[item_count].name, sizeof(items[item_count].name), "%s", oc.defs[k].name);
+                items[item_count].module = m;
+                items[item_count++].addr = oc.defs[k].addr;
+            }
+        }
+        obj_free(&oc);
+        text_size += OBJB_ALIGN(b->members[m].length);
+    }
+    if (result < 0) {
+        free(items);
+        return -1;
+    }
+    if (item_count)
+        qsort(items, item_count, sizeof(arx_item), arx_item_cmp);
+
+    uint32_t string_size = 0;
+    for (int m = 0; m < b->count; m++)
+        string_size += strlen(b->members[m].name) + 1;
+    for (int i = 0; i < item_count; i++) {
+        if (i > 0 && !strcmp(items[i].name, items[i - 1].name) && items[i].module != items[i - 1].module)
+            fprintf(stderr, "archive: %s가 %s, %s 모듈에 중복 정의되어 %s 모듈을 씁니다.\n", items[i].name,
+                    b->members[items[i - 1].module].name, b->members[items[i].module].name,
+                    b->members[items[i - 1].module].name);
+        if (i == 0 || strcmp(items[i].name, items[i - 1].name))
+            string_size += strlen(items[i].name) + 1;
+    }
+
+    uint32_t hash_size = 16;
+    while (hash_size < (uint32_t)item_count * 2)
+        hash_size *= 2;
+
+    arx_header h;
+    memset(&h, 0, sizeof(h));
+    h.magic = ARX_MAGIC;
+    h.version = ARX_VERSION;
+    h.module_count = b->count;
+    h.module_offset = sizeof(arx_header);
+    h.symbol_count = item_count;
+    h.symbol_offset = h.module_offset + sizeof(arx_module) * b->count;
+    h.hash_size = hash_size;
+    h.hash_offset = h.symbol_offset + sizeof(arx_symbol) * item_count;
+    h.string_offset = h.hash_offset + sizeof(uint32_t) * hash_size;
+    h.string_size = string_size;
+    h.text_offset = OBJB_ALIGN(h.string_offset + string_size);
+    h.text_size = text_size;
+    h.file_size = h.text_offset + text_size;
+
+    unsigned char* image = calloc(1, h.file_size);
+    if (!image) {
+        perror("archive");
+        free(items);
+        return -1;
+    }
+    memcpy(image, &h, sizeof(h));
+    arx_module* modules = (arx_module*)(image + h.module_offset);
+    arx_symbol* symbols = (arx_symbol*)(image + h.symbol_offset);
+    uint32_t* slots = (uint32_t*)(image + h.hash_offset);
+    char* strings = (char*)image + h.string_offset;
+
+    uint32_t next_off = 0, text_off = 0;
+    for (int m = 0; m < b->count; m++) {
+        modules[m].name = next_off;
+        strcpy(strings + next_off, b->members[m].name);
+        next_off += strlen(b->members[m].name) + 1;
+        modules[m].offset = text_off;
+        modules[m].length = b->members[m].length;
+        memcpy(image + h.text_offset + text_off, b->members[m].text, b->members[m].length);
+        text_off += OBJB_ALIGN(b->members[m].length);
+    }
+    uint32_t name_off = 0;
+    for (int i = 0; i < item_count; i++) {
+        if (i == 0 || strcmp(items[i].name, items[i - 1].name)) {
+            name_off = next_off;
+            strcpy(strings + name_off, items[i].name);
+            next_off += strlen(items[i].name) + 1;
+        }
+        symbols[i].name = name_off;
+        symbols[i].module = items[i].module;
+        symbols[i].addr = items[i].addr;
+
+        uint32_t k = name_hash(items[i].name, strlen(items[i].name)) & (hash_size - 1);
+        while (slots[k])
+            k = (k + 1) & (hash_size - 1);
+        slots[k] = i + 1;
+    }
+    free(items);
+
+    char* tmp_path = malloc(strlen(path) + 5);
+    FILE* fp = NULL;
+    if (tmp_path) {
+        sprintf(tmp_path, "%s.tmp", path);
+        fp = fopen(tmp_path, "wb");
+    }
+    if (!fp) {
+        perror("Error opening archive");
+        free(tmp_path);
+        free(image);
+        return -1;
+    }
+    if (fwrite(image, 1, h.file_size, fp) != h.file_size)
+        result = -1;
+    if (fclose(fp) != 0)
+        result = -1;
+    if (result == 0 && rename(tmp_path, path) < 0)
+        result = -1;
+    if (result < 0) {
+        perror("archive");
+        remove(tmp_path);
+    }
+    free(tmp_path);
+    free(image);
+    return result;
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : 어셈블 결과(오브젝트 프로그램 텍스트)의 섹션들을 아카이브에 추가한다 (--archive).
+* 매개 : 아카이브 경로, 오브젝트 프로그램 텍스트와 길이
+* 반환 : 정상종료 = 0, 에러 < 0
+* 주의 : 아카이브가 없으면 새로 만들고, 이름이 같은 모듈은 새 것으로 바뀐다.
+* -----------------------------------------------------------------------------------
+*/
+static int append_archive(const char* path, const char* text, size_t len)
+{
+    ar_builder b = { NULL, 0, 0 };
+    int result = ar_load(&b, path);
+    if (result == 0)
+        result = ar_add_text(&b, text, len);
+    if (result == 0)
+        result = ar_write(&b, path);
+    ar_free(&b);
+    return result;
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : 오브젝트 파일들로 새 아카이브를 만든다 (--ar-create).
+*        바이너리 오브젝트는 텍스트 형식으로 바꾸어 넣는다.
+* 매개 : 아카이브 경로, 오브젝트 파일 경로 배열과 개수
+* 반환 : 정상종료 = 0, 에러 < 0
+* 주의 : 기존 아카이브가 있으면 덮어쓴다.
+* -----------------------------------------------------------------------------------
+*/
+static int run_ar_create(const char* path, char** objs, int count)
+{
+    ar_builder b = { NULL, 0, 0 };
+    int result = 0;
+    for (int i = 0; i < count && result == 0; i++) {
+        object_code oc;
+        obj_init(&oc);
+        char* text = NULL;
+        size_t len = 0;
+        FILE* mem = open_memstream(&text, &len);
+        FILE* in = mem ? fopen(objs[i], "rb") : NULL;
+        if (!in) {
+            perror(objs[i]);
+            result = -1;
+        } else {
+            uint32_t magic = 0;
+            if (fread(&magic, sizeof(magic), 1, in) == 1 && magic == OBJB_MAGIC) {
+                result = obj_read_binary(fileno(in), objs[i], &oc);
+                if (result == 0)
+                    result = obj_write_text(mem, &oc);
+            } else {
+                char buf[4096];
+                size_t n;
+                rewind(in);
+                while ((n = fread(buf, 1, sizeof(buf), in)) > 0)
+                    fwrite(buf, 1, n, mem);
+            }
+            fclose(in);
+        }
+        if (mem)
+            fclose(mem);
+        if (result == 0)
+            result = ar_add_text(&b, text, len);
+        free(text);
+        obj_free(&oc);
+    }
+    if (result == 0)
+        result = ar_write(&b, path);
+    if (result == 0)
+        printf("%s: 모듈 %d개\n", path, b.count);
+    ar_free(&b);
+    return result;
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : name을 내보내는 모듈부터 시작하여 R 레코드가 참조하는 모듈만 차례로 끌어와
+*        하나의 오브젝트 프로그램으로 출력한다 (--ar-pull). 로더가 쓰는 방식의 예이다.
+* 매개 : 아카이브 경로, 시작 이름, 출력 경로 ("-"이면 stdout)
+* 반환 : 정상종료 = 0, 찾지 못한 외부 참조가 있거나 에러면 < 0
+* 주의 : 모듈은 끌려온 순서대로 출력되고, 찾지 못한 이름은 stderr에 알린다.
+* -----------------------------------------------------------------------------------
+*/
+static int run_ar_pull(const char* path, const char* name, const char* out_path)
+{
+    sx_archive ar;
+    if (arx_open(path, &ar) < 0)
+        return -1;
+    const arx_header* h = (const arx_header*)ar.image;
+    int* order = malloc(sizeof(int) * (h->module_count ? h->module_count : 1));
+    char* pulled = calloc(h->module_count ? h->module_count : 1, 1);
+    if (!order || !pulled) {
+        perror("archive");
+        free(order);
+        free(pulled);
+        arx_close(&ar);
+        return -1;
+    }
+
+    int count = 0, missing = 0;
+    int first = arx_find(&ar, name, NULL);
+    if (first < 0) {
+        fprintf(stderr, "archive: %s를 내보내는 모듈이 없습니다.\n", name);
+        missing++;
+    } else {
+        pulled[first] = 1;
+        order[count++] = first;
+    }
+    for (int i = 0; i < count; i++) {
+        int len;
+        const char* text = arx_module_text(&ar, order[i], &len);
+        for (int pos = 0; pos < len; ) {
+            int eol = pos;
+            while (eol < len && text[eol] != '\n')
+                eol++;
+            for (int k = pos + 1; text[pos] == 'R' && k < eol; k += 6) {
+                char ref[8];
+                copy_name(ref, text + k);
+                int m = ref[0] ? arx_find(&ar, ref, NULL) : -2;
+                if (m == -1) {
+                    fprintf(stderr, "archive: %s 모듈의 외부 참조 %s를 찾을 수 없습니다.\n",
+                            arx_module_name(&ar, order[i]), ref);
+                    missing++;
+                } else if (m >= 0 && !pulled[m]) {
+                    pulled[m] = 1;
+                    order[count++] = m;
+                }
+            }
+            pos = eol + 1;
+        }
+    }
+
+    FILE* fp = open_output(out_path, "object code");
+    if (fp) {
+        for (int i = 0; i < count; i++) {
+            int len;
+            const char* text = arx_module_text(&ar, order[i], &len);
+            fwrite(text, 1, len, fp);
+            if (i == 0 || i < count - 1)
+                fputc('\n', fp);
+        }
+        close_stream(fp);
+    }
+    free(order);
+    free(pulled);
+    arx_close(&ar);
+    return fp && !missing ? 0 : -1;
+}
+
+/* ------------------- 오브젝트 프로그램 -> C 번역 (--translate) ------------------- */
+/*
+ * 번역된 프로그램의 런타임이다. 레지스터와 메모리를 전역으로 두고, 명령어의 의미는 SIC_* 매크로
+ * 한 곳에만 적어 번역된 블록과 대체 인터프리터(sic_step)가 같은 매크로를 쓴다.
+ * 장치 XX는 현재 디렉터리의 "XX.dev" 파일로 연결된다 (RD는 파일 끝에서 0을 읽는다).
+ * TD는 항상 준비 상태이고, $SIC_DEV_LATENCY=N이면 RD/WD 뒤 N번은 바쁨('=')을 돌려준다.
+ */
+static const char* const xl_prelude[] = {
+    "#include <stdio.h>",
+    "#include <stdlib.h>",
+    "",
+    "#define MEM_SIZE 0x100000",
+    "#define ADDR_MASK 0xFFFFF",
+    "#define MASK24 0xFFFFFF",
+    "#define SIC_HALT 0xFFFFF   /* L의 초기값. 이 주소로 돌아오면 끝난다 */",
+    "",
+    "static unsigned char mem[MEM_SIZE];",
+    "static unsigned char code_map[MEM_SIZE];  /* 1: 번역된 명령어 바이트 */",
+    "static int A, X, L, B, S, T, CC;          /* CC: -1 '<', 0 '=', 1 '>' */",
+    "static int smc;                           /* 번역된 코드에 쓰기가 일어나면 1, 이후는 인터프리터로 실행 */",
+    "static FILE* devices[256];",
+    "static int dev_busy[256], dev_latency;     /* RD/WD 뒤에 TD가 '='(바쁨)을 돌려줄 횟수 ($SIC_DEV_LATENCY) */",
+    "",
+    "static int sx24(int v) { return (v & 0x800000) ? (v | ~MASK24) : (v & MASK24); }",
+    "static int ld1(int a) { return mem[a & ADDR_MASK]; }",
+    "static int ld3(int a) { return (ld1(a) << 16) | (ld1(a + 1) << 8) | ld1(a + 2); }",
+    "static void st1(int a, int v) { a &= ADDR_MASK; smc |= code_map[a]; mem[a] = (unsigned char)v; }",
+    "static void st3(int a, int v) { st1(a, v >> 16); st1(a + 1, v >> 8); st1(a + 2, v); }",
+    "static int cmp24(int a, int b) { a = sx24(a); b = sx24(b); return a < b ? -1 : a > b; }",
+    "",
+    "static int div24(int a, int b)",
+    "{",
+    "    if (sx24(b) == 0) {",
+    "        fprintf(stderr, \"sic: division by zero\\n\");",
+    "        exit(2);",
+    "    }",
+    "    return (sx24(a) / sx24(b)) & MASK24;",
+    "}",
+    "",
+    "static FILE* dev(int id, const char* mode)",
+    "{",
+    "    if (!devices[id]) {",
+    "        char name[8];",
+    "        snprintf(name, sizeof(name), \"%02X.dev\", id);",
+    "        devices[id] = fopen(name, mode);",
+    "    }",
+    "    return devices[id];",
+    "}",
+    "",
+    "static int dev_test(int id) { return dev_busy[id] > 0 ? (dev_busy[id]--, 0) : -1; }",
+    "static int dev_read(int id) { FILE* f = dev(id, \"rb\"); int c = f ? fgetc(f) : EOF; dev_busy[id] = dev_latency; return c == EOF ? 0 : c; }",
+    "static void dev_write(int id, int c) { FILE* f = dev(id, \"wb\"); if (f) fputc(c, f); dev_busy[id] = dev_latency; }",
+    "",
+    "#define SIC_LDCH(v)     (A = (A & 0xFFFF00) | ((v) & 0xFF))",
+    "#define SIC_ADD(r, v)   (r = (r + (v)) & MASK24)",
+    "#define SIC_SUB(r, v)   (r = (r - (v)) & MASK24)",
+    "#define SIC_MUL(r, v)   (r = (int)(((long long)sx24(r) * sx24(v)) & MASK24))",
+    "#define SIC_DIV(r, v)   (r = div24(r, v))",
+    "#define SIC_COMP(r, v)  (CC = cmp24(r, v))",
+    "#define SIC_TIX(v)      (X = (X + 1) & MASK24, CC = cmp24(X, v))",
+    "#define SIC_SHIFTL(r, n) (r = ((r << (n)) | (r >> (24 - (n)))) & MASK24)",
+    "#define SIC_SHIFTR(r, n) (r = (sx24(r) >> (n)) & MASK24)",
+    "#define SIC_RD(v)       SIC_LDCH(dev_read((v) & 0xFF))",
+    "#define SIC_WD(v)       dev_write((v) & 0xFF, A & 0xFF)",
+    "#define SIC_TD(v)       (CC = dev_test((v) & 0xFF))",
+    "",
+    "/* -DSIC_PROFILE: 주소별 실행 횟수, 분기 결과, 장치 대기(TD를 향한 JEQ), 호출 스택별 실행 횟수 */",
+    "#ifdef SIC_PROFILE",
+    "#define PROF_STACKS 4096   /* 2의 거듭제곱 */",
+    "static unsigned long long prof_exec[MEM_SIZE], prof_taken[MEM_SIZE], prof_wait[MEM_SIZE];",
+    "static struct { int parent, func; unsigned long long count; } prof_stack[PROF_STACKS];",
+    "static int prof_hash[PROF_STACKS * 2];",
+    "static int prof_stacks = 1, prof_cur, prof_lost;",
+    "",
+    "/* prof_call(): JSUB. (현재 스택, 호출 대상)에 해당하는 스택 노드로 옮긴다 */",
+    "static void prof_call(int func)",
+    "{",
+    "    unsigned h = ((unsigned)prof_cur * 2654435761u ^ (unsigned)func) & (PROF_STACKS * 2 - 1);",
+    "    for (int s; (s = prof_hash[h]) != 0; h = (h + 1) & (PROF_STACKS * 2 - 1))",
+    "        if (prof_stack[s].parent == prof_cur && prof_stack[s].func == func) {",
+    "            prof_cur = s;",
+    "            return;",
+    "        }",
+    "    if (prof_stacks == PROF_STACKS) {",
+    "        prof_lost++;   /* 노드가 모자라면 호출자 스택에 합산한다 */",
+    "        return;",
+    "    }",
+    "    prof_stack[prof_stacks].parent = prof_cur;",
+    "    prof_stack[prof_stacks].func = func;",
+    "    prof_hash[h] = prof_stacks;",
+    "    prof_cur = prof_stacks++;",
+    "}",
+    "",
+    "static void prof_ret(void)",
+    "{",
+    "    if (prof_lost > 0)",
+    "        prof_lost--;",
+    "    else if (prof_cur > 0)",
+    "        prof_cur = prof_stack[prof_cur].parent;",
+    "}",
+    "",
+    "/* prof_write(): 프로파일을 $SIC_PROF(기본 sic.prof)에 쓴다. my_assembler --annotate로 읽는다 */",
+    "static void prof_write(void)",
+    "{",
+    "    const char* path = getenv(\"SIC_PROF\") ? getenv(\"SIC_PROF\") : \"sic.prof\";",
+    "    FILE* fp = fopen(path, \"w\");",
+    "    if (!fp) {",
+    "        perror(path);",
+    "        return;",
+    "    }",
+    "    fprintf(fp, \"SICPROF 1\\n\");",
+    "    for (int a = 0; a < MEM_SIZE; a++)",
+    "        if (prof_exec[a])",
+    "            fprintf(fp, \"I %05X %llu %llu %llu\\n\", a, prof_exec[a], prof_taken[a], prof_wait[a]);",
+    "    for (int s = 0; s < prof_stacks; s++) {",
+    "        int chain[PROF_STACKS], depth = 0;",
+    "        if (!prof_stack[s].count)",
+    "            continue;",
+    "        for (int k = s; k >= 0; k = k ? prof_stack[k].parent : -1)",
+    "            chain[depth++] = prof_stack[k].func;",
+    "        fprintf(fp, \"C %llu \", prof_stack[s].count);",
+    "        while (depth-- > 0)",
+    "            fprintf(fp, \"%05X%s\", chain[depth], depth ? \";\" : \"\");",
+    "        fprintf(fp, \"\\n\");",
+    "    }",
+    "    fclose(fp);",
+    "}",
+    "",
+    "#define PROF(a)     (prof_exec[a]++, prof_stack[prof_cur].count++)",
+    "#define TAKEN(a)    (prof_taken[a]++)",
+    "#define WAIT(a)     (prof_taken[a]++, prof_wait[a]++)",
+    "#define CALL(t)     prof_call(t)",
+    "#define RET()       prof_ret()",
+    "#else",
+    "#define PROF(a)     ((void)0)",
+    "#define TAKEN(a)    ((void)0)",
+    "#define WAIT(a)     ((void)0)",
+    "#define CALL(t)     ((void)0)",
+    "#define RET()       ((void)0)",
+    "#endif",
+    "",
+    "static int sic_fault(int pc, const char* why)",
+    "{",
+    "    fprintf(stderr, \"sic: %05X: %s\\n\", pc, why);",
+    "    return -1;",
+    "}",
+    "",
+    "static int* reg(int r)",
+    "{",
+    "    static int* const regs[] = { &A, &X, &L, &B, &S, &T };",
+    "    return r < 6 ? regs[r] : NULL;",
+    "}",
+    "",
+    "/* sic_step(): 명령어 하나를 해석해서 실행한다. 반환: 0 계속, 1 정지(J *), -1 오류 */",
+    "static int sic_step(int* pcp)",
+    "{",
+    "    int pc = *pcp, next, b1 = ld1(pc + 1), b2 = ld1(pc + 2), op = ld1(pc);",
+    "    PROF(pc);",
+    "    if (op >= 0x90 && op <= 0xB8 && (op & 3) == 0) {",
+    "        int *r1 = reg(b1 >> 4), *r2 = reg(b1 & 15), n = (b1 & 15) + 1;",
+    "        if (!r1 || (!r2 && op != 0xA4 && op != 0xA8 && op != 0xB4 && op != 0xB8))",
+    "            return sic_fault(pc, \"unsupported register\");",
+    "        switch (op) {",
+    "        case 0x90: SIC_ADD(*r2, *r1); break;",
+    "        case 0x94: SIC_SUB(*r2, *r1); break;",
+    "        case 0x98: SIC_MUL(*r2, *r1); break;",
+    "        case 0x9C: SIC_DIV(*r2, *r1); break;",
+    "        case 0xA0: SIC_COMP(*r1, *r2); break;",
+    "        case 0xA4: SIC_SHIFTL(*r1, n); break;",
+    "        case 0xA8: SIC_SHIFTR(*r1, n); break;",
+    "        case 0xAC: *r2 = *r1; break;",
+    "        case 0xB4: *r1 = 0; break;",
+    "        case 0xB8: SIC_TIX(*r1); break;",
+    "        default: return sic_fault(pc, \"unsupported instruction\");",
+    "        }",
+    "        *pcp = (pc + 2) & ADDR_MASK;",
+    "        return 0;",
+    "    }",
+    "",
+    "    int ni = op & 3, ea;",
+    "    if (ni == 0) {",
+    "        ea = ((b1 & 0x7F) << 8) | b2;",
+    "        next = pc + 3;",
+    "        ni = 3;",
+    "    } else if (b1 & 0x10) {",
+    "        ea = ((b1 & 15) << 16) | (b2 << 8) | ld1(pc + 3);",
+    "        next = pc + 4;",
+    "    } else {",
+    "        int disp = ((b1 & 15) << 8) | b2;",
+    "        next = pc + 3;",
+    "        if (b1 & 0x20)",
+    "            ea = next + ((disp & 0x800) ? disp - 0x1000 : disp);",
+    "        else",
+    "            ea = (b1 & 0x40) ? B + disp : disp;",
+    "    }",
+    "    if (b1 & 0x80)",
+    "        ea += X;",
+    "    ea &= ADDR_MASK;",
+    "    if (ni == 2)",
+    "        ea = ld3(ea) & ADDR_MASK;",
+    "    int v = ni == 1 ? ea : ld3(ea), c = ni == 1 ? ea & 0xFF : ld1(ea);",
+    "",
+    "    switch (op & 0xFC) {",
+    "    case 0x00: A = v; break;",
+    "    case 0x04: X = v; break;",
+    "    case 0x08: L = v; break;",
+    "    case 0x68: B = v; break;",
+    "    case 0x6C: S = v; break;",
+    "    case 0x74: T = v; break;",
+    "    case 0x50: SIC_LDCH(c); break;",
+    "    case 0x0C: st3(ea, A); break;",
+    "    case 0x10: st3(ea, X); break;",
+    "    case 0x14: st3(ea, L); break;",
+    "    case 0x78: st3(ea, B); break;",
+    "    case 0x7C: st3(ea, S); break;",
+    "    case 0x84: st3(ea, T); break;",
+    "    case 0x54: st1(ea, A); break;",
+    "    case 0x18: SIC_ADD(A, v); break;",
+    "    case 0x1C: SIC_SUB(A, v); break;",
+    "    case 0x20: SIC_MUL(A, v); break;",
+    "    case 0x24: SIC_DIV(A, v); break;",
+    "    case 0x40: A &= v; break;",
+    "    case 0x44: A |= v; break;",
+    "    case 0x28: SIC_COMP(A, v); break;",
+    "    case 0x2C: SIC_TIX(v); break;",
+    "    case 0xD8: SIC_RD(c); break;",
+    "    case 0xDC: SIC_WD(c); break;",
+    "    case 0xE0: SIC_TD(c); break;",
+    "    case 0x3C: if (ea == pc) return 1; next = ea; break;",
+    "    case 0x30:",
+    "        if (CC == 0) {",
+    "            if ((ld1(ea) & 0xFC) == 0xE0)",
+    "                WAIT(pc);",
+    "            else",
+    "                TAKEN(pc);",
+    "            next = ea;",
+    "        }",
+    "        break;",
+    "    case 0x34: if (CC > 0) { TAKEN(pc); next = ea; } break;",
+    "    case 0x38: if (CC < 0) { TAKEN(pc); next = ea; } break;",
+    "    case 0x48: L = next; next = ea; CALL(ea); break;",
+    "    case 0x4C: next = L; RET(); break;",
+    "    default: return sic_fault(pc, \"unsupported instruction\");",
+    "    }",
+    "    *pcp = next & ADDR_MASK;",
+    "    return 0;",
+    "}",
+    "",
+    NULL
+};
+
+/* 3/4형식 명령어의 번역 템플릿. %V = 피연산자 값(3바이트), %C = 1바이트, %E = 목표 주소 */
+static const struct { int op; const char* stmt; } xl_ops[] = {
+    { 0x00, "A = %V;" }, { 0x04, "X = %V;" }, { 0x08, "L = %V;" },
+    { 0x68, "B = %V;" }, { 0x6C, "S = %V;" }, { 0x74, "T = %V;" },
+    { 0x50, "SIC_LDCH(%C);" },
+    { 0x0C, "st3(%E, A);" }, { 0x10, "st3(%E, X);" }, { 0x14, "st3(%E, L);" },
+    { 0x78, "st3(%E, B);" }, { 0x7C, "st3(%E, S);" }, { 0x84, "st3(%E, T);" },
+    { 0x54, "st1(%E, A);" },
+    { 0x18, "SIC_ADD(A, %V);" }, { 0x1C, "SIC_SUB(A, %V);" }, { 0x20, "SIC_MUL(A, %V);" },
+    { 0x24, "SIC_DIV(A, %V);" }, { 0x40, "A &= %V;" }, { 0x44, "A |= %V;" },
+    { 0x28, "SIC_COMP(A, %V);" }, { 0x2C, "SIC_TIX(%V);" },
+    { 0xD8, "SIC_RD(%C);" }, { 0xDC, "SIC_WD(%C);" }, { 0xE0, "SIC_TD(%C);" },
+};
+
+/* 2형식 명령어의 번역 템플릿. %1/%2 = 레지스터, %n = 시프트 횟수 */
+static const struct { int op; const char* stmt; } xl_ops2[] = {
+    { 0x90, "SIC_ADD(%2, %1);" }, { 0x94, "SIC_SUB(%2, %1);" }, { 0x98, "SIC_MUL(%2, %1);" },
+    { 0x9C, "SIC_DIV(%2, %1);" }, { 0xA0, "SIC_COMP(%1, %2);" }, { 0xA4, "SIC_SHIFTL(%1, %n);" },
+    { 0xA8, "SIC_SHIFTR(%1, %n);" }, { 0xAC, "%2 = %1;" }, { 0xB4, "%1 = 0;" },
+    { 0xB8, "SIC_TIX(%1);" },
+};
+
+static const char* xl_reg_names[] = { "A", "X", "L", "B", "S", "T" };
+
+static void xl_free(sic_image* im)
+{
+    free(im->mem);
+    free(im->loaded);
+    free(im->insn);
+    free(im->code);
+    free(im->leader);
+}
+
+/* xl_symbol(): 적재된 섹션 이름과 D 레코드 심볼에서 name의 절대 주소를 찾는다. 없으면 -1 */
+static int xl_symbol(const object_code* oc, const int* csaddr, const char* name)
+{
+    for (int s = 0; s < oc->section_count; s++) {
+        const obj_section* sec = &oc->sections[s];
+        if (!strcmp(sec->name, name))
+            return csaddr[s];
+        for (int d = sec->def_first; d < sec->def_first + sec->def_count; d++)
+            if (!strcmp(oc->defs[d].name, name))
+                return csaddr[s] + oc->defs[d].addr - sec->start;
+    }
+    return -1;
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : 오브젝트 프로그램을 링킹 로더처럼 메모리 이미지에 적재한다.
+*        섹션은 첫 섹션의 시작 주소부터 차례로 이어 붙이고, T 레코드를 복사한 뒤
+*        섹션 이름과 D 레코드로 만든 ESTAB으로 M 레코드를 적용한다.
+* 매개 : 읽은 object_code, 채울 sic_image
+* 반환 : 정상종료 = 0, 에러 < 0
+* 주의 : 같은 섹션 안의 4형식 참조는 섹션 이름 M 레코드로 함께 옮겨진다.
+*        M 레코드가 없는 값(PC/BASE relative 변위, 상수)은 고치지 않는다.
+* -----------------------------------------------------------------------------------
+*/
+static int xl_load(const object_code* oc, sic_image* im)
+{
+    if (oc->section_count == 0) {
+        fprintf(stderr, "translate: 오브젝트 프로그램에 섹션이 없습니다.\n");
+        return -1;
+    }
+    int* csaddr = malloc(sizeof(int) * oc->section_count);
+    if (!csaddr)
+        return -1;
+
+    int next = oc->sections[0].start, result = 0;
+    for (int s = 0; s < oc->section_count && result == 0; s++) {
+        const obj_section* sec = &oc->sections[s];
+        csaddr[s] = next;
+        next += sec->length;
+        if (next > SIC_MEM_SIZE) {
+            fprintf(stderr, "translate: %s 섹션이 메모리 범위를 벗어납니다.\n", sec->name);
+            result = -1;
+            break;
+        }
+        for (int g = sec->seg_first; g < sec->seg_first + sec->seg_count; g++) {
+            const obj_segment* seg = &oc->segs[g];
+            int at = csaddr[s] + seg->addr - sec->start;
+            if (at < 0 || at + seg->length > SIC_MEM_SIZE) {
+                fprintf(stderr, "translate: %s 섹션의 T 레코드가 메모리 범위를 벗어납니다.\n", sec->name);
+                result = -1;
+                break;
+            }
+            memcpy(im->mem + at, oc->text + seg->offset, seg->length);
+            memset(im->loaded + at, 1, seg->length);
+        }
+    }
+
+    for (int s = 0; s < oc->section_count && result == 0; s++) {
+        const obj_section* sec = &oc->sections[s];
+        for (int m = sec->mod_first; m < sec->mod_first + sec->mod_count; m++) {
+            const obj_mod* mod = &oc->mods[m];
+            int at = csaddr[s] + mod->addr - sec->start;
+            int value = xl_symbol(oc, csaddr, mod->name);
+            if (value < 0 || at < 0 || at + 3 > SIC_MEM_SIZE) {
+                fprintf(stderr, "translate: %s 섹션의 M 레코드 %s를 적용할 수 없습니다.\n", sec->name, mod->name);
+                result = -1;
+                break;
+            }
+            unsigned char* p = im->mem + at;
+            int word = (p[0] << 16) | (p[1] << 8) | p[2];
+            int mask = mod->halfbytes == 5 ? 0xFFFFF : 0xFFFFFF;
+            int field = (word & mask) + (mod->sign == '-' ? -value : value);
+            word = (word & ~mask) | (field & mask);
+            p[0] = word >> 16;
+            p[1] = word >> 8;
+            p[2] = word;
+        }
+    }
+
+    im->entry = csaddr[0];
+    for (int s = 0; s < oc->section_count; s++)
+        if (oc->sections[s].entry >= 0) {
+            im->entry = csaddr[s] + oc->sections[s].entry - oc->sections[s].start;
+            break;
+        }
+    free(csaddr);
+    return result;
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : 주소 a의 명령어 하나를 해석한다. opcode는 dis_table에서 찾아 형식과 길이를 정하고,
+*        x/b/간접 주소 지정이 아니면 점프 목표를 미리 계산한다.
+* 매개 : 적재 이미지, 주소, 결과를 받을 sic_insn
+* 반환 : 명령어 길이, 해석할 수 없으면 0
+* 주의 : 명령어의 모든 바이트가 적재되어 있어야 하고, 1형식이라도 다음 바이트를 읽으므로
+*        메모리 마지막 바이트의 명령어는 해석하지 않는다. b와 p가 함께 켜진 변위는 PC relative로 본다.
+* -----------------------------------------------------------------------------------
+*/
+static int xl_decode(const sic_image* im, int a, sic_insn* d)
+{
+    if (a < 0 || a + 1 >= SIC_MEM_SIZE || !im->loaded[a])
+        return 0;
+    const unsigned char* p = im->mem + a;
+    inst* in = dis_table[p[0]];
+    if (!in)
+        return 0;
+
+    memset(d, 0, sizeof(*d));
+    d->target = -1;
+    if (in->format != 3) {
+        d->op = p[0];
+        d->format = d->len = in->format == 2 ? 2 : 1;
+        d->r1 = p[1] >> 4;
+        d->r2 = p[1] & 15;
+    } else {
+        d->op = p[0] & 0xFC;
+        d->ni = p[0] & 3;
+        d->x = p[1] >> 7;
+        if (d->ni == 0) {
+            d->format = d->len = 3;
+            d->ni = 3;
+            d->addr = ((p[1] & 0x7F) << 8) | p[2];
+        } else if (p[1] & 0x10) {
+            d->format = d->len = 4;
+            d->addr = ((p[1] & 15) << 16) | (p[2] << 8) | p[3];
+        } else {
+            d->format = d->len = 3;
+            int disp = ((p[1] & 15) << 8) | p[2];
+            d->b = (p[1] & 0x60) == 0x40;
+            if (p[1] & 0x20)
+                d->addr = (a + 3 + ((disp & 0x800) ? disp - 0x1000 : disp)) & (SIC_MEM_SIZE - 1);
+            else
+                d->addr = disp;
+        }
+        if (!d->x && !d->b && d->ni != 2)
+            d->target = d->addr;
+    }
+    if (a + d->len > SIC_MEM_SIZE)
+        return 0;
+    for (int k = 1; k < d->len; k++)
+        if (!im->loaded[a + k])
+            return 0;
+    return d->len;
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : 진입점에서 제어 흐름을 따라가며 번역할 명령어와 기본 블록의 시작을 찾는다.
+*        J/JEQ/JGT/JLT/JSUB의 정해진 목표와 조건 점프/JSUB의 다음 명령어가 블록 시작이고,
+*        J와 RSUB 뒤에서는 순차 해석을 멈춘다.
+* 매개 : 적재된 sic_image
+* 반환 : 정상종료 = 0, 에러 < 0
+* 주의 : 다른 명령어의 중간으로 점프하는 목표와 간접/인덱스 점프의 목표는 번역하지 않으며,
+*        실행 중에 그 주소로 가면 인터프리터가 실행한다.
+* -----------------------------------------------------------------------------------
+*/
+static int xl_discover(sic_image* im)
+{
+    int* work = NULL;
+    int count = 0, cap = 0;
+    if (dis_grow((void**)&work, &cap, 1, sizeof(int)) < 0)
+        return -1;
+    work[count++] = im->entry;
+    im->leader[im->entry] = 1;
+
+    while (count > 0) {
+        int a = work[--count];
+        sic_insn d;
+        while (a < SIC_MEM_SIZE && !im->code[a] && xl_decode(im, a, &d)) {
+            im->insn[a] = d.len;
+            memset(im->code + a, 1, d.len);
+
+            int jump = d.format >= 3 && (d.op == 0x3C || d.op == 0x30 || d.op == 0x34 ||
+                                         d.op == 0x38 || d.op == 0x48);
+            if (jump && d.target >= 0 && !im->leader[d.target]) {
+                if (dis_grow((void**)&work, &cap, count + 1, sizeof(int)) < 0) {
+                    free(work);
+                    return -1;
+                }
+                im->leader[d.target] = 1;
+                work[count++] = d.target;
+            }
+            if (d.format >= 3 && (d.op == 0x3C || d.op == 0x4C)) {
+                a = -1;
+                break;
+            }
+            a += d.len;
+            if (jump && a < SIC_MEM_SIZE)
+                im->leader[a] = 1;
+        }
+        if (a >= 0 && a < SIC_MEM_SIZE && im->insn[a])
+            im->leader[a] = 1;
+    }
+    free(work);
+
+    // 앞 명령어에서 이어지지 않는 명령어도 블록 시작으로 두고, 명령어가 아닌 곳의 표시는 지운다
+    int expect = -1;
+    for (int a = 0; a < SIC_MEM_SIZE; a++) {
+        if (!im->insn[a]) {
+            im->leader[a] = 0;
+            continue;
+        }
+        if (a != expect)
+            im->leader[a] = 1;
+        int op = im->mem[a] & 0xFC;
+        int stops = dis_table[im->mem[a]]->format == 3 && (op == 0x3C || op == 0x4C);
+        expect = stops ? -1 : a + im->insn[a];
+    }
+    return 0;
+}
+
+/* xl_supported(): 번역 템플릿이 있는 명령어인지. 없는 명령어는 인터프리터가 실행(오류 처리)한다 */
+static int xl_supported(const sic_insn* d)
+{
+    if (d->format == 1)
+        return 0;
+    if (d->format == 2) {
+        int one_reg = d->op == 0xA4 || d->op == 0xA8 || d->op == 0xB4 || d->op == 0xB8;
+        if (d->r1 >= 6 || (!one_reg && d->r2 >= 6))
+            return 0;
+        for (size_t k = 0; k < sizeof(xl_ops2) / sizeof(xl_ops2[0]); k++)
+            if (xl_ops2[k].op == d->op)
+                return 1;
+        return 0;
+    }
+    if (d->op == 0x3C || d->op == 0x30 || d->op == 0x34 || d->op == 0x38 || d->op == 0x48 || d->op == 0x4C)
+        return 1;
+    for (size_t k = 0; k < sizeof(xl_ops) / sizeof(xl_ops[0]); k++)
+        if (xl_ops[k].op == d->op)
+            return 1;
+    return 0;
+}
+
+/* xl_waits_on_device(): 목표가 TD 명령어인 조건 점프(TD/JEQ 대기 루프)인지 */
+static int xl_waits_on_device(const sic_image* im, const sic_insn* d)
+{
+    return d->target >= 0 && im->insn[d->target] && (im->mem[d->target] & 0xFC) == 0xE0;
+}
+
+/* xl_goto(): 정해진 목표 target으로 가는 문장을 쓴다. 번역된 블록이면 바로 goto한다 */
+static void xl_goto(FILE* out, const sic_image* im, int target)
+{
+    if (im->leader[target])
+        fprintf(out, "goto B_%05X;", target);
+    else
+        fprintf(out, "{ pc = 0x%05X; goto dispatch; }", target);
+}
+
+/* xl_expand(): 템플릿의 %V/%C/%E 또는 %1/%2/%n을 바꿔 쓴다 */
+static void xl_expand(FILE* out, const char* stmt, const char* const* subst)
+{
+    for (const char* p = stmt; *p; p++) {
+        const char* s = NULL;
+        if (p[0] == '%' && p[1]) {
+            switch (p[1]) {
+            case 'V': case '1': s = subst[0]; break;
+            case 'C': case '2': s = subst[1]; break;
+            case 'E': case 'n': s = subst[2]; break;
+            }
+        }
+        if (s) {
+            fputs(s, out);
+            p++;
+        } else
+            fputc(*p, out);
+    }
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : 주소 a의 명령어 하나를 C 문장으로 쓴다.
+* 매개 : 출력 파일, 적재 이미지, 주소, 해석한 명령어
+* 반환 : 다음 명령어로 이어지면 1, 항상 다른 곳으로 가면 0
+* 주의 : 번역된 코드에 쓰는 저장 명령어 뒤에서는 smc를 확인해 인터프리터로 넘어간다.
+* -----------------------------------------------------------------------------------
+*/
+static int xl_emit_insn(FILE* out, const sic_image* im, int a, const sic_insn* d)
+{
+    int next = a + d->len;
+    fprintf(out, "    /* %05X */ ", a);
+    if (!xl_supported(d)) {
+        fprintf(out, "{ pc = 0x%05X; goto dispatch; }\n", a);
+        return 0;
+    }
+    fprintf(out, "PROF(0x%05X); ", a);
+
+    if (d->format == 2) {
+        for (size_t k = 0; k < sizeof(xl_ops2) / sizeof(xl_ops2[0]); k++) {
+            if (xl_ops2[k].op != d->op)
+                continue;
+            int one_reg = d->op == 0xA4 || d->op == 0xA8 || d->op == 0xB4 || d->op == 0xB8;
+            char n[12];
+            snprintf(n, sizeof(n), "%d", d->r2 + 1);
+            const char* subst[] = { xl_reg_names[d->r1], one_reg ? "" : xl_reg_names[d->r2], n };
+            xl_expand(out, xl_ops2[k].stmt, subst);
+            fputc('\n', out);
+            return 1;
+        }
+    }
+
+    // 목표 주소 식: 정해진 주소는 상수, 아니면 B/X를 더하고 간접이면 한 번 더 읽는다
+    char base[64], ea[96], v[128], c[128];
+    if (d->b && d->x)
+        snprintf(base, sizeof(base), "((B + 0x%X + X) & ADDR_MASK)", d->addr);
+    else if (d->b)
+        snprintf(base, sizeof(base), "((B + 0x%X) & ADDR_MASK)", d->addr);
+    else if (d->x)
+        snprintf(base, sizeof(base), "((0x%05X + X) & ADDR_MASK)", d->addr);
+    else
+        snprintf(base, sizeof(base), "0x%05X", d->addr);
+    snprintf(ea, sizeof(ea), d->ni == 2 ? "(ld3(%s) & ADDR_MASK)" : "%s", base);
+    if (d->ni == 1) {
+        snprintf(v, sizeof(v), "%s", ea);
+        snprintf(c, sizeof(c), "(%s & 0xFF)", ea);
+    } else {
+        snprintf(v, sizeof(v), "ld3(%s)", ea);
+        snprintf(c, sizeof(c), "ld1(%s)", ea);
+    }
+
+    switch (d->op) {
+    case 0x3C:  // J
+        if (d->target == a)
+            fprintf(out, "return 0;\n");
+        else if (d->target >= 0) {
+            xl_goto(out, im, d->target);
+            fputc('\n', out);
+        } else
+            fprintf(out, "{ pc = %s; goto dispatch; }\n", ea);
+        return 0;
+    case 0x30: case 0x34: case 0x38:    // JEQ, JGT, JLT
+        // TD로 돌아가는 JEQ는 장치 대기 루프로 따로 센다 (인터프리터와 같은 규칙)
+        fprintf(out, "if (CC %s 0) { %s(0x%05X); ", d->op == 0x30 ? "==" : d->op == 0x34 ? ">" : "<",
+                d->op == 0x30 && xl_waits_on_device(im, d) ? "WAIT" : "TAKEN", a);
+        if (d->target >= 0)
+            xl_goto(out, im, d->target);
+        else
+            fprintf(out, "pc = %s; goto dispatch;", ea);
+        fprintf(out, " }\n");
+        return 1;
+    case 0x48:  // JSUB
+        fprintf(out, "L = 0x%05X; ", next);
+        if (d->target >= 0) {
+            fprintf(out, "CALL(0x%05X); ", d->target);
+            xl_goto(out, im, d->target);
+        } else
+            fprintf(out, "{ pc = %s; CALL(pc); goto dispatch; }", ea);
+        fputc('\n', out);
+        return 0;
+    case 0x4C:  // RSUB
+        fprintf(out, "RET(); { pc = L & ADDR_MASK; goto dispatch; }\n");
+        return 0;
+    }
+
+    for (size_t k = 0; k < sizeof(xl_ops) / sizeof(xl_ops[0]); k++) {
+        if (xl_ops[k].op != d->op)
+            continue;
+        const char* subst[] = { v, c, ea };
+        xl_expand(out, xl_ops[k].stmt, subst);
+        if (!strncmp(xl_ops[k].stmt, "st", 2))
+            fprintf(out, " if (smc) { pc = 0x%05X; goto dispatch; }", next);
+        fputc('\n', out);
+        return 1;
+    }
+    return 0;
+}
+
+/* xl_emit_ranges(): flags가 켜진 연속 구간을 { 주소, 길이, 바이트 } 표로 쓴다 */
+static void xl_emit_ranges(FILE* out, const char* table, const unsigned char* flags,
+                           const unsigned char* bytes)
+{
+    int runs = 0;
+    for (int a = 0; a < SIC_MEM_SIZE; a++) {
+        if (!flags[a] || (a > 0 && flags[a - 1]))
+            continue;
+        int end = a;
+        while (end < SIC_MEM_SIZE && flags[end])
+            end++;
+        if (bytes) {
+            fprintf(out, "static const unsigned char %s_%d[] = {", table, runs);
+            for (int k = a; k < end; k++)
+                fprintf(out, "%s0x%02X,", (k - a) % 16 ? " " : "\n    ", bytes[k]);
+            fprintf(out, "\n};\n");
+        }
+        runs++;
+    }
+
+    fprintf(out, "static const struct { int addr, len; const unsigned char* bytes; } %s[] = {\n", table);
+    runs = 0;
+    for (int a = 0; a < SIC_MEM_SIZE; a++) {
+        if (!flags[a] || (a > 0 && flags[a - 1]))
+            continue;
+        int end = a;
+        while (end < SIC_MEM_SIZE && flags[end])
+            end++;
+        if (bytes)
+            fprintf(out, "    { 0x%05X, %d, %s_%d },\n", a, end - a, table, runs);
+        else
+            fprintf(out, "    { 0x%05X, %d, NULL },\n", a, end - a);
+        runs++;
+    }
+    fprintf(out, "    { 0, 0, NULL }\n};\n\n");
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : 적재 이미지와 번역된 블록으로 C 프로그램 전체를 쓴다.
+*        sic_run()은 블록마다 라벨을 둔 함수 하나이고, 정해진 점프는 goto로 바로 잇는다.
+*        RSUB, 간접/인덱스 점프와 번역되지 않은 주소는 dispatch에서 블록을 찾고,
+*        블록이 없거나 번역된 코드가 바뀐 뒤(smc)에는 sic_step() 인터프리터로 실행한다.
+* 매개 : 출력 파일, 적재 이미지, 원본 오브젝트 파일 경로
+* 반환 : 없음
+* 주의 : -DSIC_INTERPRET로 컴파일하면 처음부터 인터프리터만으로 실행한다 (비교용).
+*        -DSIC_PROFILE로 컴파일하면 실행이 끝날 때 주소별 실행/분기/장치 대기 횟수와
+*        호출 스택별 실행 횟수를 sic.prof($SIC_PROF)에 쓴다 (--annotate 입력).
+* -----------------------------------------------------------------------------------
+*/
+static void xl_emit_program(FILE* out, const sic_image* im, const char* obj_path)
+{
+    fprintf(out, "/* my_assembler --translate %s 로 만든 파일이다. */\n", obj_path);
+    for (int k = 0; xl_prelude[k]; k++)
+        fprintf(out, "%s\n", xl_prelude[k]);
+    xl_emit_ranges(out, "image", im->loaded, im->mem);
+    xl_emit_ranges(out, "code_ranges", im->code, NULL);
+
+    fprintf(out, "static int sic_run(int pc)\n{\n    int r;\ndispatch:\n");
+    fprintf(out, "    if (pc == SIC_HALT)\n        return 0;\n");
+    fprintf(out, "    if (!smc)\n        switch (pc) {\n");
+    for (int a = 0; a < SIC_MEM_SIZE; a++)
+        if (im->leader[a])
+            fprintf(out, "        case 0x%05X: goto B_%05X;\n", a, a);
+    fprintf(out, "        }\n");
+    fprintf(out, "    r = sic_step(&pc);\n    if (r)\n        return r > 0 ? 0 : r;\n    goto dispatch;\n");
+
+    int expect = -1;
+    for (int a = 0; a < SIC_MEM_SIZE; a++) {
+        if (!im->insn[a])
+            continue;
+        if (expect >= 0 && expect != a)
+            fprintf(out, "    { pc = 0x%05X; goto dispatch; }\n", expect);
+        if (im->leader[a])
+            fprintf(out, "B_%05X:\n", a);
+        sic_insn d;
+        xl_decode(im, a, &d);
+        expect = xl_emit_insn(out, im, a, &d) ? a + d.len : -1;
+    }
+    if (expect >= 0)
+        fprintf(out, "    { pc = 0x%05X; goto dispatch; }\n", expect);
+    fprintf(out, "}\n\n");
+
+    fprintf(out,
+        "int main(void)\n"
+        "{\n"
+        "    for (int k = 0; image[k].len; k++)\n"
+        "        for (int i = 0; i < image[k].len; i++)\n"
+        "            mem[image[k].addr + i] = image[k].bytes[i];\n"
+        "    for (int k = 0; code_ranges[k].len; k++)\n"
+        "        for (int i = 0; i < code_ranges[k].len; i++)\n"
+        "            code_map[code_ranges[k].addr + i] = 1;\n"
+        "    L = SIC_HALT;\n"
+        "    if (getenv(\"SIC_DEV_LATENCY\"))\n"
+        "        dev_latency = atoi(getenv(\"SIC_DEV_LATENCY\"));\n"
+        "#ifdef SIC_INTERPRET\n"
+        "    smc = 1;\n"
+        "#endif\n"
+        "#ifdef SIC_PROFILE\n"
+        "    prof_stack[0].func = 0x%05X;\n"
+        "#endif\n"
+        "    int r = sic_run(0x%05X);\n"
+        "#ifdef SIC_PROFILE\n"
+        "    prof_write();\n"
+        "#endif\n"
+        "    for (int k = 0; k < 256; k++)\n"
+        "        if (devices[k])\n"
+        "            fclose(devices[k]);\n"
+        "    return r < 0 ? 1 : 0;\n"
+        "}\n", im->entry, im->entry);
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : 오브젝트 프로그램을 적재하고 기본 블록을 찾아 레지스터/메모리를 흉내 내는
+*        C 소스로 번역한다 (--translate). 결과는 시스템 컴파일러로 바로 빌드할 수 있다.
+* 매개 : 오브젝트 파일 경로(텍스트 또는 바이너리), 출력 경로("-"이면 stdout)
+* 반환 : 정상종료 = 0, 에러 < 0
+* 주의 : 부동소수점/시스템 명령어(1형식, SVC 등)는 번역하지 않고 실행 중에 오류로 끝난다.
+* -----------------------------------------------------------------------------------
+*/
+static int run_translate(const char* obj_path, const char* out_path)
+{
+    if (init_inst_file("inst_table.txt") < 0) {
+        fprintf(stderr, "init_my_assembler: 프로그램 초기화에 실패 했습니다.\n");
+        return -1;
+    }
+    build_dis_table();
+
+    object_code oc;
+    obj_init(&oc);
+    sic_image im;
+    im.mem = calloc(SIC_MEM_SIZE, 1);
+    im.loaded = calloc(SIC_MEM_SIZE, 1);
+    im.insn = calloc(SIC_MEM_SIZE, 1);
+    im.code = calloc(SIC_MEM_SIZE, 1);
+    im.leader = calloc(SIC_MEM_SIZE, 1);
+    im.entry = 0;
+
+    int result = -1;
+    if (!im.mem || !im.loaded || !im.insn || !im.code || !im.leader)
+        perror("translate");
+    else if (obj_read_file(obj_path, &oc, NULL) == 0 && xl_load(&oc, &im) == 0 &&
+             xl_discover(&im) == 0) {
+        FILE* out = open_output(out_path, "C source");
+        if (out) {
+            if (out != stdout)
+                setvbuf(out, NULL, _IOFBF, 1 << 20);
+            xl_emit_program(out, &im, obj_path);
+            close_stream(out);
+            result = 0;
+        }
+    }
+    obj_free(&oc);
+    xl_free(&im);
+    return result;
+}
+
+/* ------------------- 실행 프로파일 보고서 (--annotate, --flame) ------------------- */
+static void pm_free(prof_map* pm)
+{
+    for (int k = 0; k < pm->count; k++)
+        free(pm->lines[k].label);
+    free(pm->lines);
+    free(pm->secs);
+    free(pm->at);
+}
+
+/* pm_split(): 탭으로 나뉜 필드를 최대 n개 잘라 fields에 넣는다. 자른 개수를 반환 */
+static int pm_split(char* p, char** fields, int n)
+{
+    int count = 0;
+    while (count < n) {
+        fields[count++] = p;
+        char* tab = strchr(p, '\t');
+        if (!tab)
+            break;
+        *tab = '\0';
+        p = tab + 1;
+    }
+    return count;
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : --line-map 파일을 읽는다. 섹션은 번역기(--translate)와 같이 0번지부터 차례로
+*        이어 붙여 적재 주소를 정하고, 라인마다 적재 주소로 at[]에 색인한다.
+* 매개 : 맵 파일 경로, 채울 prof_map
+* 반환 : 정상종료 = 0, 에러 < 0
+* 주의 : 한 주소에 라인이 여럿이면(길이 0인 지시어 등) at[]은 그 주소의 첫 라인을 가리킨다.
+*        실패해도 그때까지 채운 pm은 호출자가 pm_free()로 해제해야 한다.
+* -----------------------------------------------------------------------------------
+*/
+static int pm_read_map(const char* path, prof_map* pm)
+{
+    FILE* fp = open_input(path);
+    if (!fp)
+        return -1;
+    pm->at = calloc(SIC_MEM_SIZE, sizeof(int));
+    if (!pm->at) {
+        perror("annotate");
+        close_stream(fp);
+        return -1;
+    }
+
+    char line[1024];
+    int line_no = 0, next = 0, result = 0;
+    while (result == 0 && fgets(line, sizeof(line), fp)) {
+        line_no++;
+        line[strcspn(line, "\r\n")] = '\0';
+        char* f[7];
+        int n = pm_split(line, f, 7);
+        if (line_no == 1) {
+            if (strcmp(line, "SICMAP 1"))
+                result = -1;
+        } else if (!strcmp(f[0], "S") && n == 3) {
+            if (dis_grow((void**)&pm->secs, &pm->sec_cap, pm->sec_count + 1, sizeof(prof_section)) < 0) {
+                result = -1;
+                break;
+            }
+            prof_section* sec = &pm->secs[pm->sec_count++];
+            copy_name(sec->name, f[1]);
+            sec->start = next;
+            sec->length = strtol(f[2], NULL, 16);
+            next += sec->length;
+        } else if (!strcmp(f[0], "L") && n == 7 && pm->sec_count > 0) {
+            int addr = pm->secs[pm->sec_count - 1].start + (int)strtol(f[1], NULL, 16);
+            if (addr < 0 || addr >= SIC_MEM_SIZE ||
+                dis_grow((void**)&pm->lines, &pm->cap, pm->count + 1, sizeof(prof_line)) < 0) {
+                result = -1;
+                break;
+            }
+            prof_line* pl = &pm->lines[pm->count];
+            memset(pl, 0, sizeof(*pl));
+            pl->addr = addr;
+            pl->len = atoi(f[2]);
+            pl->line = atoi(f[3]);
+            pl->section = pm->sec_count - 1;
+            size_t l1 = strlen(f[4]) + 1, l2 = strlen(f[5]) + 1, l3 = strlen(f[6]) + 1;
+            pl->label = malloc(l1 + l2 + l3);
+            if (!pl->label) {
+                result = -1;
+                break;
+            }
+            pl->op = pl->label + l1;
+            pl->operand = pl->op + l2;
+            memcpy(pl->label, f[4], l1);
+            memcpy(pl->op, f[5], l2);
+            memcpy(pl->operand, f[6], l3);
+            pm->count++;
+            if (!pm->at[addr])
+                pm->at[addr] = pm->count;
+        } else
+            result = -1;
+    }
+    if (result < 0)
+        fprintf(stderr, "annotate: %s %d번째 줄의 라인 맵 형식이 잘못되었습니다.\n", path, line_no);
+    close_stream(fp);
+    return result;
+}
+
+/* pm_frame_name(): 스택 프레임(서브루틴 시작 주소)의 이름. 라벨 > 섹션 이름 > sub_주소 */
+static const char* pm_frame_name(const prof_map* pm, int addr, char* buf, size_t size)
+{
+    if (addr >= 0 && addr < SIC_MEM_SIZE && pm->at[addr] && pm->lines[pm->at[addr] - 1].label[0])
+        return pm->lines[pm->at[addr] - 1].label;
+    for (int s = 0; s < pm->sec_count; s++)
+        if (pm->secs[s].start == addr && pm->secs[s].name[0])
+            return pm->secs[s].name;
+    snprintf(buf, size, "sub_%05X", addr);
+    return buf;
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : 번역된 프로그램이 쓴 프로파일(sic.prof)을 읽어 라인별 횟수를 채운다.
+*        "I 주소 실행 분기 대기"는 그 주소에서 시작하는 라인에 더하고, "C 횟수 프레임;..."은
+*        프레임 주소를 이름으로 바꿔 flame graph용 folded 형식("a;b;c 횟수")으로 쓴다.
+* 매개 : 프로파일 경로, 라인 맵, folded 출력(NULL이면 쓰지 않음),
+*        전체 실행 횟수와 맵에 없는 주소의 실행 횟수를 받을 곳
+* 반환 : 정상종료 = 0, 에러 < 0
+* 주의 : 라인 맵에 없는 주소의 실행 횟수는 unmapped에만 더한다.
+*        한 줄은 8192바이트까지 읽으므로 그보다 깊은 호출 스택 줄은 형식 오류로 보고된다.
+* -----------------------------------------------------------------------------------
+*/
+static int pm_read_profile(const char* path, prof_map* pm, FILE* flame,
+                           unsigned long long* total, unsigned long long* unmapped)
+{
+    FILE* fp = open_input(path);
+    if (!fp)
+        return -1;
+
+    char line[8192], name[16];
+    int line_no = 0, result = 0;
+    *total = *unmapped = 0;
+    while (result == 0 && fgets(line, sizeof(line), fp)) {
+        line_no++;
+        line[strcspn(line, "\r\n")] = '\0';
+        int addr;
+        unsigned long long exec, taken, wait;
+        if (line_no == 1) {
+            if (strcmp(line, "SICPROF 1"))
+                result = -1;
+        } else if (sscanf(line, "I %x %llu %llu %llu", &addr, &exec, &taken, &wait) == 4) {
+            *total += exec;
+            if (addr < 0 || addr >= SIC_MEM_SIZE || !pm->at[addr]) {
+                *unmapped += exec;
+                continue;
+            }
+            prof_line* pl = &pm->lines[pm->at[addr] - 1];
+            pl->exec += exec;
+            pl->taken += taken;
+            pl->wait += wait;
+        } else if (line[0] == 'C' && sscanf(line, "C %llu", &exec) == 1) {
+            char* frames = strchr(line + 2, ' ');
+            if (!frames) {
+                result = -1;
+                break;
+            }
+            if (!flame)
+                continue;
+            for (char* f = strtok(frames + 1, ";"); f; f = strtok(NULL, ";"))
+                fprintf(flame, "%s%s", f == frames + 1 ? "" : ";",
+                        pm_frame_name(pm, (int)strtol(f, NULL, 16), name, sizeof(name)));
+            fprintf(flame, " %llu\n", exec);
+        } else
+            result = -1;
+    }
+    if (result < 0)
+        fprintf(stderr, "annotate: %s %d번째 줄의 프로파일 형식이 잘못되었습니다.\n", path, line_no);
+    close_stream(fp);
+    return result;
+}
+
+/* pm_write_row(): 리스트 한 줄. 실행하지 않은 라인은 횟수 칸을 비운다 */
+static void pm_write_row(FILE* fp, const prof_line* pl, unsigned long long total)
+{
+    if (pl->exec)
+        fprintf(fp, "%12llu %6.2f%% ", pl->exec, total ? 100.0 * pl->exec / total : 0.0);
+    else
+        fprintf(fp, "%12s %7s ", "", "");
+    if (pl->taken)
+        fprintf(fp, "%10llu ", pl->taken);
+    else
+        fprintf(fp, "%10s ", "");
+    if (pl->wait)
+        fprintf(fp, "%10llu ", pl->wait);
+    else
+        fprintf(fp, "%10s ", "");
+    fprintf(fp, "%5d  %05X  %-8s %-8s %s\n", pl->line, pl->addr, pl->label, pl->op, pl->operand);
+}
+
+static const prof_line* pm_sort_lines;
+
+/* 실행 횟수 내림차순, 같으면 라인 번호 순 */
+static int pm_compare_hot(const void* a, const void* b)
+{
+    const prof_line* x = &pm_sort_lines[*(const int*)a];
+    const prof_line* y = &pm_sort_lines[*(const int*)b];
+    if (x->exec != y->exec)
+        return x->exec < y->exec ? 1 : -1;
+    return x->line - y->line;
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : 라인 맵 순서대로 섹션별 소스 라인에 실행 횟수, 비율, 분기한 횟수,
+*        장치 대기(TD로 돌아간 JEQ) 횟수를 붙여 쓰고, 끝에 가장 많이 실행된 라인을 모은다.
+* 매개 : 출력 파일, 횟수를 채운 라인 맵, 전체 실행 횟수, 맵에 없는 주소의 실행 횟수
+* 반환 : 없음
+* 주의 : HOT LINES는 상위 10개 라인만 쓰고, 정렬할 메모리를 얻지 못하면 생략한다.
+*        정렬 비교 함수가 전역 pm_sort_lines를 쓰므로 스레드 안전하지 않다.
+* -----------------------------------------------------------------------------------
+*/
+static void pm_write_listing(FILE* fp, const prof_map* pm, unsigned long long total,
+                             unsigned long long unmapped)
+{
+    fprintf(fp, "SIC/XE EXECUTION PROFILE  (instructions %llu, unmapped %llu)\n\n", total, unmapped);
+    fprintf(fp, "%12s %7s %10s %10s %5s  %-5s  %s\n", "EXEC", "PCT", "TAKEN", "WAIT", "LINE", "ADDR", "SOURCE");
+    int section = -1;
+    for (int k = 0; k < pm->count; k++) {
+        const prof_line* pl = &pm->lines[k];
+        if (pl->section != section) {
+            section = pl->section;
+            fprintf(fp, "SECTION %s (%05X - %05X)\n", pm->secs[section].name, pm->secs[section].start,
+                    pm->secs[section].start + pm->secs[section].length);
+        }
+        pm_write_row(fp, pl, total);
+    }
+
+    int* order = malloc(sizeof(int) * (pm->count + 1));
+    if (!order)
+        return;
+    int hot = 0;
+    for (int k = 0; k < pm->count; k++)
+        if (pm->lines[k].exec)
+            order[hot++] = k;
+    pm_sort_lines = pm->lines;
+    qsort(order, hot, sizeof(int), pm_compare_hot);
+    fprintf(fp, "\nHOT LINES\n");
+    for (int k = 0; k < hot && k < 10; k++)
+        pm_write_row(fp, &pm->lines[order[k]], total);
+    free(order);
+}
+
+/* ----------------------------------------------------------------------------------
+* 설명 : --line-map 맵과 -DSIC_PROFILE로 빌드한 번역 프로그램의 프로파일로
+*        소스 라인별 프로파일 리스트와 flame graph용 folded 스택 파일을 만든다 (--annotate).
+* 매개 : 라인 맵 경로, 프로파일 경로, 리스트 출력 경로("-"이면 stdout), folded 출력 경로(NULL 가능)
+* 반환 : 정상종료 = 0, 에러 < 0
+* 주의 : 맵과 프로파일은 같은 오브젝트 프로그램(같은 섹션 구성)에서 나온 것이어야 한다.
+* -----------------------------------------------------------------------------------
+*/
+static int run_annotate(const char* map_path, const char* prof_path, const char* out_path,
+                        const char* flame_path)
+{
+    prof_map pm;
+    memset(&pm, 0, sizeof(pm));
+    FILE* flame = NULL;
+    int result = pm_read_map(map_path, &pm);
+    if (result == 0 && flame_path && !(flame = open_output(flame_path, "flame graph")))
+        result = -1;
+
+    unsigned long long total = 0, unmapped = 0;
+    if (result == 0)
+        result = pm_read_profile(prof_path, &pm, flame, &total, &unmapped);
+    if (flame)
+        close_stream(flame);
+    if (result == 0) {
+        FILE* out = open_output(out_path, "profile listing");
+        if (!out)
+            result = -1;
+        else {
+            pm_write_listing(out, &pm, total, unmapped);
+            close_stream(out);
+        }
+    }
+    pm_free(&pm);
+    return result;
+}
@@ -1,12 +1,17 @@
 #ifndef MY_ASSEMBLER_20231241_H
 #define MY_ASSEMBLER_20231241_H
 
+#include <stdio.h>
+#include <stdint.h>
+
 /*
  * my_assembler 함수를 위한 변수 선언 및 매크로를 담고 있는 헤더 파일이다.
  *
  */
 #define MAX_INST 256
-#define MAX_LINES 5000
+#ifndef MAX_LINES
+#define MAX_LINES 5000  // 벤치마크 등 큰 입력에서는 -DMAX_LINES=... 로 늘려서 빌드
+#endif
 #define MAX_OPERAND 3
 
  /*
@@ -43,11 +48,77 @@ typedef struct _token
     char nixbpe;
     int addr;   // 명령어의 주소 정보를 저장하기 위해 추가하였다.
     int section;    // 명령어의 섹션 정보를 저장하기 위해 추가하였다.
+    char* obj;      // 패스2에서 생성한 최종 오브젝트 코드 (전체 리스트 출력용)
+    int lit_start, lit_end;     // LTORG/CSECT/END에 배치된 리터럴 범위 [lit_start, lit_end)
+    int target;     // 패스2가 계산한 3/4형식 목표 주소 (--size-profile 용)
+    int base;       // 이 라인에서 유효한 BASE 주소 (패스2 전에 정해진다, -1이면 BASE 상대 주소를 쓰지 않는다)
+    int block;      // 라인이 속한 프로그램 블록 (섹션 안에서의 번호, 0 = 기본 블록)
 } token;
 
 extern token* token_table[MAX_LINES];
 extern int token_line;
 
+/*
+ * MACRO/MEND 로 정의한 매크로이다. 본문의 각 필드(라벨, operator, operand)는
+ * 문자열 조각, 매개변수 칸, $ 고유 번호 칸으로 미리 나눠 두어 확장할 때 다시 토큰 분리하지 않는다.
+ */
+#define MAX_MACROS 256
+#define MAX_MACRO_PARAMS 16
+#define MAX_MACRO_DEPTH 16
+#define MACRO_HASH_SIZE 512     // 2의 거듭제곱, MAX_MACROS의 두 배 이상
+
+#define MACRO_PART_TEXT 0
+#define MACRO_PART_PARAM 1
+#define MACRO_PART_UNIQUE 2
+
+typedef struct _macro_part {
+    int kind;
+    int param;      // MACRO_PART_PARAM일 때 매개변수 번호
+    int len;
+    char* text;     // MACRO_PART_TEXT일 때 문자열
+} macro_part;
+
+typedef struct _macro_field {
+    macro_part* parts;
+    int count;
+} macro_field;
+
+typedef struct _macro_line {
+    macro_field label;
+    macro_field operator;
+    macro_field operand;
+} macro_line;
+
+typedef struct _macro_def {
+    char name[10];
+    char params[MAX_MACRO_PARAMS][16];      // '&' 포함
+    char* defaults[MAX_MACRO_PARAMS];       // 키워드 매개변수 기본값 (NULL이면 없음)
+    int param_count;
+    macro_line* lines;
+    int line_count;
+    int line_cap;
+} macro_def;
+
+extern macro_def macro_defs[MAX_MACROS];
+extern int macro_count;
+
+/*
+ * INCLUDE 'file' 로 읽은 파일의 토큰 캐시 항목이다.
+ * 경로와 mtime/크기가 같으면 다시 읽지 않고 tokens의 사본을 토큰 테이블에 끼워 넣는다.
+ */
+#define MAX_INCLUDE_DEPTH 8
+
+typedef struct _include_module {
+    char* path;
+    long mtime;
+    long size;
+    token** tokens;
+    int count;
+    int cap;
+    long hits;      // 캐시 적중 횟수
+    struct _include_module* next;
+} include_module;
+
 /*
  * 심볼을 관리하는 구조체이다.
  * 심볼 테이블은 심볼 이름, 심볼의 위치로 구성된다.
@@ -58,6 +129,7 @@ typedef struct _symbol
     char symbol[10];
     int addr;
     int section;    // 심볼이 속한 섹션 번호를 저장하기 위해 추가하였다.
+    int block;      // 심볼이 속한 프로그램 블록 (USE)
 } symbol;
 
 /*
@@ -72,6 +144,77 @@ typedef struct _literal {
 
 extern symbol sym_table[MAX_LINES];
 extern symbol literal_table[MAX_LINES];
+#define SYM_SLOTS (MAX_LINES * 2 + 1)  // 심볼 이름 해시 칸 수 (항상 빈 칸이 남도록 테이블의 두 배)
+
+/*
+ * --symindex 로 출력하는 바이너리 심볼/리터럴 색인이다. 필드는 모두 4바이트 정렬이므로
+ * 파일을 mmap해서 그대로 캐스팅해 읽을 수 있다.
+ *   [symx_header][symx_entry x entry_count][uint32 해시 슬롯 x hash_size][문자열 풀]
+ * 항목은 (이름, 섹션) 순으로 정렬되어 있다. 해시는 이름의 FNV-1a 값 & (hash_size - 1)에서
+ * 시작하는 선형 탐사이고, 슬롯 값은 항목 인덱스 + 1 (0: 빈 칸)이다.
+ * 같은 이름이 여러 섹션에 있으면 모두 같은 탐사열에 섹션 순서대로 놓인다.
+ */
+#define SYMX_MAGIC 0x584D5953u      // "SYMX"
+#define SYMX_VERSION 1
+#define SYMX_SYMBOL 1
+#define SYMX_LITERAL 2
+
+typedef struct _symx_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t file_size;
+    uint32_t entry_count;
+    uint32_t entry_offset;
+    uint32_t hash_offset;
+    uint32_t hash_size;         // 2의 거듭제곱
+    uint32_t string_offset;
+    uint32_t string_size;
+} symx_header;
+
+typedef struct _symx_entry {
+    uint32_t name;      // 문자열 풀 오프셋 (NUL 종료)
+    int32_t value;      // 주소 (배치되지 않은 리터럴은 -1)
+    uint16_t section;   // 섹션 번호 (리터럴이 아직 배치되지 않았으면 0)
+    uint16_t kind;      // SYMX_SYMBOL / SYMX_LITERAL
+} symx_entry;
+
+/*
+ * EQU 식의 항 하나와 EQU 정의 하나(의존 그래프 노드)를 표현하는 구조체이다.
+ * 식은 pass1에서 한 번만 항 단위로 분해되고, 모든 주소가 확정된 뒤
+ * 위상 정렬 순서로 한 번만 계산된다.
+ */
+#define MAX_EQU_TERMS 8
+
+typedef struct _equ_term {
+    int sign;       // +1 또는 -1
+    int sym;        // 참조하는 심볼 인덱스 (-1: 상수 혹은 '*')
+    int value;      // 상수 혹은 '*'의 값
+    int block;      // '*' 항이면 그 라인의 프로그램 블록, 아니면 -1
+    char name[10];  // 참조하는 심볼 이름
+} equ_term;
+
+typedef struct _equ_node {
+    int sym;        // 정의되는 심볼의 sym_table 인덱스
+    char expr[32];  // 오류 보고용 원래 식
+    int term_count;
+    int resolved;   // 값 계산 완료 여부 (각 식은 한 번만 계산)
+    equ_term terms[MAX_EQU_TERMS];
+} equ_node;
+
+extern equ_node equ_nodes[MAX_LINES];
+extern int equ_count;
+
+/*
+ * USE 지시어로 나뉘는 프로그램 블록이다. 블록마다 locctr를 따로 두고,
+ * 패스1이 끝나면 섹션 안에서 처음 나온 순서대로 블록을 이어 붙여 주소를 확정한다.
+ */
+#define MAX_BLOCKS 8
+
+typedef struct _program_block {
+    char name[10];  // 블록 이름 ("" = 기본 블록)
+    int length;     // 블록의 locctr (패스1이 끝나면 블록 끝 주소)
+    int start;      // 배치 후 블록 주소에 더할 값
+} program_block;
 
 
 /**
@@ -83,16 +226,541 @@ extern symbol literal_table[MAX_LINES];
  */
 
 // Object Code 전체 정보를 담기 위하 구조체
+// 텍스트(H/D/R/T/M/E)와 바이너리 오브젝트 형식은 모두 이 구조체를 거쳐 읽고 쓴다.
+// T 레코드는 주소가 이어지는 한 하나의 세그먼트로 합쳐지고, 바이트는 text에 연속으로 모인다.
+typedef struct _obj_segment {
+    int addr;       // 섹션 상대 주소
+    int length;
+    int offset;     // object_code.text 안의 시작 위치
+} obj_segment;
+
+typedef struct _obj_mod {
+    int addr;
+    int halfbytes;
+    char sign;      // '+' 또는 '-'
+    char name[10];
+} obj_mod;
+
+typedef struct _obj_symbol {
+    char name[10];
+    int addr;       // R 레코드 심볼은 0
+} obj_symbol;
+
+typedef struct _obj_section {
+    char name[10];
+    int start;
+    int length;
+    int entry;      // E 레코드의 실행 시작 주소 (없으면 -1)
+    int seg_first, seg_count;   // object_code.segs 안의 범위 (섹션 순서대로 이어진다)
+    int mod_first, mod_count;
+    int def_first, def_count;
+    int ref_first, ref_count;
+} obj_section;
+
 typedef struct _object_code {
-    /* add fields */
+    obj_section* sections;
+    int section_count, section_cap;
+    obj_segment* segs;
+    int seg_count, seg_cap;
+    obj_mod* mods;
+    int mod_count, mod_cap;
+    obj_symbol* defs;
+    int def_count, def_cap;
+    obj_symbol* refs;
+    int ref_count, ref_cap;
+    unsigned char* text;
+    int text_len, text_cap;
 } object_code;
 
+/*
+ * 바이너리 오브젝트 파일(--obj-format binary) 레이아웃이다.
+ * 모든 필드는 4바이트 정렬된 리틀 엔디안 uint32이므로 파일을 mmap해서 그대로 캐스팅해 읽을 수 있다.
+ *   [objb_header][objb_section x section_count][objb_segment ...][objb_mod ...]
+ *   [objb_symbol (D) ...][objb_symbol (R) ...][text 바이트][문자열 풀]
+ * 이름은 문자열 풀 안의 오프셋(NUL 종료)이고, 각 테이블은 섹션 순서대로 이어진다.
+ */
+#define OBJB_MAGIC 0x424F5853u      // "SXOB"
+#define OBJB_VERSION 1
+#define OBJB_NO_ENTRY 0xFFFFFFFFu
+
+typedef struct _objb_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t file_size;
+    uint32_t section_count;
+    uint32_t seg_offset, seg_count;     // 파일 앞에서부터의 오프셋과 항목 수
+    uint32_t mod_offset, mod_count;
+    uint32_t def_offset, def_count;
+    uint32_t ref_offset, ref_count;
+    uint32_t text_offset, text_size;
+    uint32_t string_offset, string_size;
+} objb_header;
+
+typedef struct _objb_section {
+    uint32_t name;      // 문자열 풀 오프셋
+    uint32_t start;
+    uint32_t length;
+    uint32_t entry;     // OBJB_NO_ENTRY: E 레코드에 주소 없음
+    uint32_t seg_first, seg_count;
+    uint32_t mod_first, mod_count;
+    uint32_t def_first, def_count;
+    uint32_t ref_first, ref_count;
+} objb_section;
+
+typedef struct _objb_segment {
+    uint32_t addr;
+    uint32_t length;
+    uint32_t offset;    // text 영역 안의 시작 위치
+} objb_segment;
+
+typedef struct _objb_mod {
+    uint32_t addr;
+    uint32_t halfbytes_sign;    // 하위 8비트: half byte 수, 8번 비트: 1이면 '-'
+    uint32_t name;
+} objb_mod;
+
+typedef struct _objb_symbol {
+    uint32_t name;
+    uint32_t addr;
+} objb_symbol;
+
+/*
+ * 오브젝트 모듈 아카이브(--archive, --ar-create) 레이아웃이다. 모듈 하나는 control section
+ * 하나의 H ~ E 레코드 텍스트이고, 색인은 섹션 이름과 D 레코드 심볼에서 모듈로 가는 표이다.
+ * 필드는 모두 4바이트 정렬이므로 파일을 mmap해서 그대로 캐스팅해 읽을 수 있다.
+ *   [arx_header][arx_module x module_count][arx_symbol x symbol_count]
+ *   [uint32 해시 슬롯 x hash_size][문자열 풀][모듈 텍스트 (4바이트 정렬) ...]
+ * 심볼은 (이름, 모듈) 순으로 정렬되어 있고, 해시는 symx와 같이 이름의 FNV-1a 값에서
+ * 시작하는 선형 탐사이다. 슬롯 값은 심볼 인덱스 + 1 (0: 빈 칸)이다.
+ */
+#define ARX_MAGIC 0x52415853u       // "SXAR"
+#define ARX_VERSION 1
+
+typedef struct _arx_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t file_size;
+    uint32_t module_count;
+    uint32_t module_offset;
+    uint32_t symbol_count;
+    uint32_t symbol_offset;
+    uint32_t hash_offset;
+    uint32_t hash_size;         // 2의 거듭제곱
+    uint32_t string_offset;
+    uint32_t string_size;
+    uint32_t text_offset;
+    uint32_t text_size;
+} arx_header;
+
+typedef struct _arx_module {
+    uint32_t name;      // 문자열 풀 오프셋
+    uint32_t offset;    // 모듈 텍스트 영역 안의 시작 위치
+    uint32_t length;
+} arx_module;
+
+typedef struct _arx_symbol {
+    uint32_t name;
+    uint32_t module;    // 내보내는 모듈 번호
+    uint32_t addr;      // 모듈 상대 주소 (섹션 이름은 H 레코드의 시작 주소)
+} arx_symbol;
+
+// arx_open()으로 mmap한 아카이브
+typedef struct _sx_archive {
+    unsigned char* image;
+    size_t size;
+} sx_archive;
+
+/*
+ * --async-output에서 백그라운드 writer 스레드가 처리하는 출력 작업이다.
+ * 작업은 제출한 순서대로 하나씩 처리되므로 같은 스트림에 쓰는 순서는 동기 모드와 같다.
+ */
+typedef struct _writer_job {
+    struct _writer_job* next;
+    void (*make)(char* file_name);  // NULL이 아니면 make(path)를 호출한다
+    char* path;
+    FILE* fp;           // buf를 쓰거나 닫을 스트림
+    char* buf;          // 쓸 내용 (처리 후 해제한다)
+    size_t len;
+    int echo;           // buf를 stdout에도 출력
+    int close;          // 앞선 작업이 끝난 뒤 fp를 닫는다
+} writer_job;
+
+// 아카이브를 만들 때 메모리에 모아두는 모듈
+typedef struct _ar_member {
+    char name[8];
+    char* text;     // H ~ E 레코드 텍스트 (개행으로 끝난다)
+    int length;
+} ar_member;
+
+typedef struct _ar_builder {
+    ar_member* members;
+    int count, cap;
+} ar_builder;
+
+
+/*
+ * pass2에서 섹션 하나의 T/M 레코드를 모아 출력하기 위한 구조체이다.
+ * 토큰 테이블 기반 pass2와 스트리밍 pass2가 함께 사용한다.
+ */
+#define MAX_TEXT_RECORD_LENGTH 30   // Text record 기본 최대 바이트 수
+#define MAX_TEXT_RECORD_LIMIT 255   // --text-record-size 상한 (길이 필드가 16진 2자리)
+#define AUTO_LTORG_MARGIN 1024      // --auto-ltorg: 리터럴 풀 끝이 PC relative 한계까지 이만큼 남으면 풀을 넣는다
+#define AUTO_BASE_MARGIN 64         // --auto-base: 끼워 넣은 LDB가 주소를 미는 만큼 LDB #심볼의 PC relative 한계에 남겨 두는 여유
+#define MAX_MOD_RECORDS 100
+
+/*
+ * 3/4형식 명령어를 섹션 단위로 한꺼번에 인코딩하기 위한 SoA(배열 묶음)이다.
+ * format34_resolve()가 심볼/리터럴을 해석해 입력 배열을 채우면, encode_format34()는
+ * 분기 없는 정수 연산만으로 word/nixbpe를 계산한다.
+ */
+#define FMT34_E 0x01        // e 비트 (4형식)
+#define FMT34_X 0x08        // x 비트 (,X)
+#define FMT34_DIRECT 0x10   // @상수: disp_in을 변위로 그대로 쓴다
+#define FMT34_WIDE 0x20     // 4바이트로 배치 (3형식이 아닌 경우)
+
+typedef struct _fmt34_batch {
+    int count, cap;
+    int* opcode;        // n/i 비트가 들어간 오피코드
+    int* mode;          // FMT34_* 조합
+    int* target;        // 목표 주소
+    int* addr;          // 명령어 주소
+    int* base;          // 그 위치의 BASE (-1: 없음)
+    int* disp_in;       // FMT34_DIRECT일 때의 변위
+    uint32_t* word;     // 결과: 인코딩된 명령어
+    int* nixbpe;        // 결과: 전체 리스트용 nixbpe
+    int* token;         // 토큰 인덱스
+} fmt34_batch;
+
+/*
+ * 오브젝트 프로그램 -> C 번역기(--translate)가 쓰는 적재 이미지이다.
+ * 섹션들을 첫 섹션의 시작 주소부터 이어서 적재하고 M 레코드를 적용한 뒤,
+ * E 레코드의 진입점에서 제어 흐름을 따라가며 명령어와 기본 블록 시작을 표시한다.
+ */
+#define SIC_MEM_SIZE 0x100000       // 20비트 주소 공간
+#define SIC_HALT 0xFFFFF            // L의 초기값. 이 주소로 돌아오면 프로그램이 끝난 것으로 본다
+
+typedef struct _sic_image {
+    unsigned char* mem;     // 적재된 메모리
+    unsigned char* loaded;  // 1: 오브젝트 코드가 적재된 바이트
+    unsigned char* insn;    // 번역할 명령어의 시작이면 그 길이, 아니면 0
+    unsigned char* code;    // 1: 번역한 명령어에 속한 바이트 (실행 중 여기에 쓰면 인터프리터로 넘어간다)
+    unsigned char* leader;  // 1: 기본 블록의 시작
+    int entry;
+} sic_image;
+
+typedef struct _sic_insn {
+    int op;         // 1/2형식은 첫 바이트, 3/4형식은 하위 2비트(ni)를 뺀 opcode
+    int format;     // 1, 2, 3, 4 (SIC 형식은 3)
+    int len;
+    int ni;         // SIC 형식은 단순 주소 지정(3)으로 본다
+    int x, b;
+    int addr;       // b가 아니면 목표 주소(인덱스 제외), b이면 변위
+    int target;     // 실행 전에 정해지는 점프 목표 (x/b/간접이면 -1)
+    int r1, r2;     // 2형식 레지스터 번호
+} sic_insn;
+
+/*
+ * 실행 프로파일 보고서(--annotate)가 읽는 라인 맵과 프로파일이다. 섹션은 번역기와 같이
+ * 차례로 이어 붙여 적재 주소를 정하고, at[적재 주소]로 그 주소에서 시작하는 라인을 찾는다.
+ */
+typedef struct _prof_section {
+    char name[8];
+    int start;      // 적재 주소
+    int length;
+} prof_section;
+
+typedef struct _prof_line {
+    int addr;       // 적재 주소
+    int len;
+    int line;       // 소스 라인 번호 (--full-listing과 같은 번호)
+    int section;    // prof_map.secs 안의 번호
+    char* label;    // label/op/operand는 한 번에 할당한 버퍼를 나눠 가리킨다 (label이 소유)
+    char* op;
+    char* operand;
+    unsigned long long exec, taken, wait;
+} prof_line;
+
+typedef struct _prof_map {
+    prof_section* secs;
+    int sec_count, sec_cap;
+    prof_line* lines;
+    int count, cap;
+    int* at;        // 적재 주소 -> lines 번호 + 1 (0이면 없음)
+} prof_map;
+
+typedef struct _section_writer {
+    FILE* fp;
+    int tRecStart;
+    int tRecLen;
+    char tRecord[MAX_TEXT_RECORD_LIMIT * 2 + 1];
+    int modCount;
+    char modRecords[MAX_MOD_RECORDS][32];
+    object_code* oc;    // NULL이 아니면 레코드를 출력하지 않고 여기에 모은다
+    int literal_bytes;  // 이 섹션에서 출력한 리터럴 바이트 수
+} section_writer;
+
+/*
+ * --size-profile 에서 섹션 하나의 코드 크기/재배치 통계이다.
+ * pass2가 인코딩한 결과(오브젝트 코드 길이, nixbpe, 목표 주소)와 모아둔 M 레코드를
+ * 그대로 세므로 따로 분석 패스를 돌지 않는다.
+ */
+#define PROF_PC 0           // 목표 주소 계산: PC relative
+#define PROF_BASE 1         //                BASE relative
+#define PROF_ABSOLUTE 2     //                b = p = 0 인 3형식
+#define PROF_EXTENDED 3     //                4형식
+#define PROF_SIMPLE 4       // 피연산자: n = i = 1
+#define PROF_IMMEDIATE 5    //           #
+#define PROF_INDIRECT 6     //           @
+#define PROF_INDEXED 7      //           ,X
+#define PROF_MODES 8
+
+typedef struct _prof_mod {
+    char name[10];
+    int count;
+    int words;      // 그중 6 half-byte(WORD) 수정 수
+} prof_mod;
+
+typedef struct _prof_shrink {
+    int line;       // 토큰 번호 (1부터)
+    int addr;
+    char reason;    // 'P': PC relative, 'B': BASE relative, 'I': 12비트 즉시값, 'A': 12비트 절대 주소
+    int value;      // disp 혹은 값
+} prof_shrink;
+
+typedef struct _size_profile {
+    char name[10];
+    int code_bytes, data_bytes, literal_bytes;
+    int formats[5];     // [1] ~ [4]
+    int modes[PROF_MODES];
+    int opcodes[MAX_INST];  // inst_table 인덱스별 명령어 수
+    prof_mod* mods;
+    int mod_count, mod_cap;
+    prof_shrink* shrinks;   // 3형식으로 줄일 수 있었던 4형식 명령어
+    int shrink_count, shrink_cap;
+} size_profile;
+
+/*
+ * 스트리밍 모드(--stream)에서 pass1이 라인마다 임시 파일에 기록하는 중간 레코드이다.
+ * 고정 길이 헤더 뒤에 label, operator(명령어가 아닐 때만), operand 문자열이
+ * 길이만큼 이어진다. 주석 라인은 주석 문자열만 operand 자리에 기록한다.
+ */
+#define IMED_COMMENT 1
+#define IMED_LINE 2
+#define IMED_KIND_MASK 0x0F
+#define IMED_EXTENDED 0x80   // '+' (format 4) 명령어
+
+typedef struct _imed_record {
+    unsigned char kind;
+    unsigned char label_len;
+    unsigned char operator_len;
+    unsigned char operand_len;
+    short op_id;                // inst_table 인덱스 (-1: 지시어, operator 문자열이 뒤따름)
+    unsigned short section;
+    int addr;
+} imed_record;
+
+/*
+ * 단일 패스 모드(--one-pass)에서 사용하는 구조체들이다.
+ * 섹션마다 인코딩된 라인(op_item)을 순서대로 모아 두고, 아직 정의되지 않은 심볼을
+ * 참조하는 명령어는 심볼별 fixup 체인에 등록해 두었다가 라벨이 정의되면 고친다.
+ */
+#define OPI_TEXT 1      // 오브젝트 코드가 있는 라인
+#define OPI_LTORG 2     // LTORG 위치 (리터럴 풀 출력)
+
+#define FIX_SAME 1      // 직접 주소: 같은 섹션 심볼 대기
+#define FIX_ANY 2       // #/@ 혹은 섹션이 끝난 직접 주소: 첫 번째 심볼 대기
+#define FIX_LITERAL 3   // 리터럴 풀 배치 대기
+#define FIX_BASE 4      // BASE 상대 주소: END에서 BASE 확정 후 처리
+#ifndef FIX_CHAIN_SIZE
+#define FIX_CHAIN_SIZE 4096    // 큰 입력에서는 -DFIX_CHAIN_SIZE=... 로 늘려서 빌드
+#endif
+
+typedef struct _op_item {
+    int kind;
+    int addr;
+    char* obj;              // 인코딩된 오브젝트 코드 (16진 문자열)
+    char* mod_operator;     // M 레코드가 필요한 라인의 operator/operand (없으면 NULL)
+    char* mod_operand;
+} op_item;
+
+typedef struct _op_section {
+    char name[7];
+    int ended;      // CSECT/END로 섹션이 끝났는지
+    int is_last;    // END로 끝난 섹션인지
+    int pending;    // 아직 해결되지 않은 fixup 수
+    int same_fixups;    // 같은 섹션 심볼을 기다리는 fixup 목록 (fixups 인덱스, -1: 끝)
+    op_item* items;
+    int item_count;
+    int item_cap;
+} op_section;
+
+typedef struct _fixup {
+    int section;
+    int item;           // op_sections[section].items 인덱스
+    int addr;
+    int finalOpcode;    // n, i 비트가 적용된 opcode
+    int x;
+    int wide;           // 4형식: 변위 대신 같은 섹션 라벨의 주소를 20비트 필드에 넣는다
+    int rule;
+    int next;           // 같은 체인의 다음 fixup (-1: 끝)
+    int sec_next;       // 같은 섹션 FIX_SAME 목록의 다음 fixup (-1: 끝)
+    char name[20];      // 기다리는 심볼 혹은 리터럴 이름
+    char base[20];      // 이 명령어 위치에서 유효한 BASE 피연산자 ("" = BASE 없음)
+    int line;           // 진단 메시지용 소스 라인 번호와 명령어
+    char op[10];
+    char operand[24];
+} fixup;
+
+typedef struct _fix_chain {
+    char name[20];
+    int head;
+    int stamp;      // op_end_section에서 이미 처리한 체인인지 표시
+} fix_chain;
+
+/*
+ * 데몬 모드(--daemon)와 클라이언트(--client) 사이의 요청/응답 헤더이다.
+ * 요청: 헤더 뒤에 source_len 바이트의 소스가 이어진다.
+ * 응답: 헤더 뒤에 오브젝트 코드, 심볼 테이블, 리터럴 테이블, 리스트, 진단 메시지가
+ *       len[] 길이만큼 차례로 이어진다.
+ */
+#define DAEMON_MAGIC 0x31415853u    // "SXA1"
+#define DAEMON_MAX_SOURCE (64u * 1024 * 1024)
+#define DAEMON_OPT_LISTING 0x1      // opcode 리스트도 함께 요청
+
+#define DAEMON_OUT_OBJECT 0
+#define DAEMON_OUT_SYMTAB 1
+#define DAEMON_OUT_LITTAB 2
+#define DAEMON_OUT_LISTING 3
+#define DAEMON_OUT_DIAG 4
+#define DAEMON_OUTPUTS 5
+
+typedef struct _daemon_request {
+    unsigned int magic;
+    unsigned int flags;
+    unsigned int source_len;
+} daemon_request;
+
+typedef struct _daemon_response {
+    unsigned int magic;
+    int status;
+    unsigned int len[DAEMON_OUTPUTS];
+} daemon_response;
+
+/*
+ * --stats/--trace 용 내부 카운터이다. -DASM_STATS 로 빌드했을 때만 수집되며,
+ * 그렇지 않으면 STAT_* 매크로는 아무 코드도 만들지 않는다.
+ * stat_probe는 선형 탐색 한 번(lookup)과 그동안 비교한 항목 수(probe)를 센다.
+ */
+#define STAT_RECORD_KINDS "HDRTME"
+
+typedef struct _stat_probe {
+    long lookups;
+    long probes;
+    long max_probe;     // 한 번의 탐색에서 가장 많이 비교한 항목 수
+    long cur;
+} stat_probe;
+
+typedef struct _asm_stats {
+    stat_probe symbol;
+    stat_probe opcode;
+    stat_probe literal;
+    long gen_obj_calls;         // generate_object_code 전체 호출 수
+    long records[6];            // STAT_RECORD_KINDS 순서
+    long record_bytes[6];
+    long allocs;
+    long alloc_bytes;
+} asm_stats;
+
+#ifdef ASM_STATS
+extern asm_stats stats;
+int stat_record(char kind, int is_new, int written);
+
+#define STAT_INC(field) (stats.field++)
+#define STAT_LOOKUP(table) (stats.table.lookups++, stats.table.cur = 0)
+#define STAT_PROBE(table) \
+    (stats.table.probes++, \
+     ++stats.table.cur > stats.table.max_probe ? (void)(stats.table.max_probe = stats.table.cur) : (void)0)
+#define STAT_RECORD(kind, written) stat_record(kind, 1, (written))
+#define STAT_BYTES(kind, written) stat_record(kind, 0, (written))
+#else
+#define STAT_INC(field) ((void)0)
+#define STAT_LOOKUP(table) ((void)0)
+#define STAT_PROBE(table) ((void)0)
+#define STAT_RECORD(kind, written) (written)
+#define STAT_BYTES(kind, written) (written)
+#endif
+
+/*
+ * --bench-json 옵션으로 기록하는 단계별 측정 결과이다.
+ */
+#define MAX_PHASES 16
+
+typedef struct _phase_record {
+    const char* name;
+    double start_ms;    // 단조 시계 기준 시작 시각
+    double wall_ms;
+    long max_rss_kb;    // 단계가 끝난 시점까지의 프로세스 최대 RSS (앞 단계를 포함한 누적값)
+    long rss_growth_kb; // 이 단계 동안 최대 RSS가 늘어난 양
+} phase_record;
+
+/*
+ * --disasm 에서 섹션 하나를 모아두는 구조체이다.
+ * T 레코드 바이트는 bytes에 이어 붙이고, 레코드마다 (주소, 길이, 오프셋)을 기록한다.
+ * M 레코드는 주소순으로 정렬해 명령어마다 이진 탐색으로 찾는다.
+ */
+typedef struct _dis_text {
+    int addr;
+    int len;
+    int offset;     // bytes 안의 시작 위치
+} dis_text;
+
+typedef struct _dis_mod {
+    int addr;
+    int halfbytes;
+    char sign;
+    char name[8];
+} dis_mod;
+
+typedef struct _dis_def {
+    char name[8];
+    int addr;
+} dis_def;
+
+typedef struct _dis_section {
+    char name[8];
+    int start;
+    int length;
+    unsigned char* bytes;
+    int byte_count, byte_cap;
+    dis_text* texts;
+    int text_count, text_cap;
+    dis_mod* mods;
+    int mod_count, mod_cap;
+    dis_def* defs;
+    int def_count, def_cap;
+    char* refs;         // R 레코드의 이름들 ("A,B,...")
+    int ref_len, ref_cap;
+} dis_section;
 
 extern int locctr;
 //--------------
 
 extern char* input_file;
 extern char* output_file;
+extern char* symtab_file;
+extern char* littab_file;
+extern char* listing_file;
+extern char* full_listing_file;
+extern char* line_map_file;
+extern char* symindex_file;
+extern char* size_profile_file;
+extern char* archive_file;
+extern int async_output;
+extern int text_record_max;
+extern int auto_base;
+extern int auto_ltorg;
+extern int gc_sections;
+extern int echo_object;
 
 /* 함수 프로토타입 */
 int init_my_assembler(void);
@@ -108,6 +776,14 @@ static int assem_pass2(void);
 void make_opcode_output(char* file_name);
 void make_symtab_output(char* file_name);
 void make_literaltab_output(char* file_name);
+void make_symindex_output(char* file_name);
+void make_size_profile_output(char* file_name);
+void make_line_map_output(char* file_name);
 void make_objectcode_output(char* file_name);
+int arx_open(const char* path, sx_archive* ar);
+void arx_close(sx_archive* ar);
+int arx_find(const sx_archive* ar, const char* name, int* addr);
+const char* arx_module_text(const sx_archive* ar, int module, int* length);
+const char* arx_module_name(const sx_archive* ar, int module);
 
 #endif
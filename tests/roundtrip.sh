@@ -0,0 +1,212 @@
+#!/bin/sh
+# 역어셈블 왕복 테스트
+#   소스를 어셈블한 오브젝트 프로그램(generate_object_code 출력)을 --disasm으로 풀고,
+#   그 결과를 다시 어셈블 가능한 소스로 바꿔 어셈블한 뒤 처음 오브젝트 프로그램과 비교한다.
+#
+# 사용법 : tests/roundtrip.sh [소스 파일 ...]
+#   인자가 없으면 input-1.txt와 gen_sicxe로 만든 합성 소스 몇 개를 사용한다.
+#   WORK 환경 변수로 작업 디렉터리를 바꿀 수 있다.
+#
+# 역어셈블 결과 -> 소스 변환 규칙
+#   - 각 섹션의 첫 줄은 START/CSECT, EXTDEF/EXTREF는 이름만 남긴다.
+#   - PC relative 명령어의 목표 주소(16진)는 그 주소에 붙인 라벨 L<주소>로 바꾼다.
+#   - D 레코드 이름은 그 주소에 "이름 EQU *"로 정의하고, 비어 있는 주소 구간은 RESB로 채운다.
+#   - WORD의 M 레코드는 식(BUFEND-BUFFER 등)으로 되돌린다. WORD 상수는 어셈블러와 같이 16진으로 둔다.
+#   - 섹션 이름으로 재배치되는 4형식 명령어의 주소는 라벨 L<주소>로 바꾼다. 명령어 중간을
+#     가리키면 그 라벨을 섹션 끝 기준 "EQU *-거리"로 정의한다.
+#   - 어셈블러가 1형식 명령어를 인코딩하지 않으므로 1바이트 명령어는 BYTE로 쓴다.
+#   - BASE relative나 절대 주소처럼 라벨로 되돌릴 수 없는 명령어(리터럴 등 데이터를 명령어로
+#     해석한 줄 포함)는 같은 바이트의 BYTE X'..'로 쓴다.
+set -e
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+WORK=${WORK:-"$ROOT/tests/work"}
+
+mkdir -p "$WORK"
+cc -O2 -o "$WORK/asm" "$ROOT/my_assembler_20231241.c" -lpthread -lm
+cc -O2 -o "$WORK/gen_sicxe" "$ROOT/bench/gen_sicxe.c"
+cp "$ROOT/inst_table.txt" "$WORK/"
+cd "$WORK"
+
+if [ $# -eq 0 ]; then
+    cp "$ROOT/input-1.txt" input-1.txt
+    set -- input-1.txt
+    for seed in 1 2 3; do
+        ./gen_sicxe --lines 1500 --csects 3 --literal-density 0.1 --format4 0.1 --seed "$seed" > "gen$seed.asm"
+        set -- "$@" "gen$seed.asm"
+    done
+fi
+
+dis2src() {
+    awk '
+    function hex(s,    v, k, c) {
+        v = 0
+        for (k = 1; k <= length(s); k++) {
+            c = index("0123456789ABCDEF", substr(s, k, 1))
+            if (c == 0) return -1
+            v = v * 16 + c - 1
+        }
+        return v
+    }
+    function label_at(a) { return (a in name_at) ? name_at[a] : sprintf("L%06X", a) }
+    # 목표 주소를 라벨로 바꿀 수 있으면 바꾼 피연산자, 아니면 ""
+    function relabel(op,    pre, post, t) {
+        pre = ""; post = ""
+        if (op ~ /^[#@]/) { pre = substr(op, 1, 1); op = substr(op, 2) }
+        if (op ~ /,X$/) { post = ",X"; op = substr(op, 1, length(op) - 2) }
+        if (op !~ /^[0-9A-F]+$/) return ""
+        t = hex(op)
+        if (!(t in is_start) && !(t in in_gap) && t != sec_len) return ""
+        want[t] = 1
+        return pre label_at(t) post
+    }
+    # 명령어 중간(데이터를 명령어로 해석한 줄)을 가리키는 주소는 섹션 끝 기준 EQU로 라벨을 만든다
+    function mid_label(op,    pre, post, t) {
+        pre = ""; post = ""
+        if (op ~ /^[#@]/) { pre = substr(op, 1, 1); op = substr(op, 2) }
+        if (op ~ /,X$/) { post = ",X"; op = substr(op, 1, length(op) - 2) }
+        if (op !~ /^[0-9A-F]+$/) return ""
+        t = hex(op)
+        if (t > sec_len) return ""
+        mid_at[t] = 1
+        return pre sprintf("L%06X", t) post
+    }
+    function byte_line(k) { return "BYTE\tX\047" obj[k] "\047" }
+    # 줄마다 붙이는 라벨. 라벨이 없는 RESB/BYTE/WORD 줄은 첫 토큰이 라벨로 읽히므로 항상 붙인다
+    function new_label(a) { return sprintf("L%06X", a) }
+    # 한 섹션을 소스로 바꿔 출력한다
+    function flush(    k, a, e, g, line, body) {
+        for (k = 1; k <= n; k++) {
+            is_start[addr[k]] = 1
+            e = (k < n) ? addr[k + 1] : sec_len
+            for (a = addr[k] + len[k]; a < e; a++) in_gap[a] = 1
+        }
+        if (n == 0) for (a = 0; a < sec_len; a++) in_gap[a] = 1
+        for (k = 1; k <= n; k++) {
+            body = ""
+            if (mn[k] == "BYTE")
+                body = "BYTE\t" op[k]
+            else if (mn[k] == "WORD")
+                body = "WORD\t" (mods[k] != "" ? mods[k] : op[k])
+            else if (len[k] == 2) {
+                # 레지스터 하나만 쓰는 명령어는 r2가 0일 때만 같은 바이트로 돌아온다
+                if (op[k] ~ /^[AXLBSTF],[AXLBSTF]$/ ||
+                    (op[k] ~ /^[AXLBSTF]$/ && obj[k] ~ /0$/))
+                    body = mn[k] "\t" op[k]
+            } else if (bits[k] == "" || (substr(bits[k], 3, 1) == "1" && substr(bits[k], 1, 2) != "11"))
+                body = ""   # SIC 형식, 혹은 단순 주소가 아닌데 x가 켜진 줄(데이터)
+            else if (mn[k] == "RSUB")
+                body = (op[k] == "" && bits[k] == "110000") ? "RSUB" : ""
+            else if (op[k] ~ /^#[0-9A-F]+$/ && mods[k] == "" && substr(bits[k], 4, 2) == "00" &&
+                     mn[k] != "TD" && mn[k] != "WD")
+                body = mn[k] "\t#" hex(substr(op[k], 2))
+            else if (len[k] == 4) {
+                line = op[k]
+                sub(/^[#@]/, "", line); sub(/,X$/, "", line)
+                if (mods[k] != "" && line == mods[k])
+                    body = mn[k] "\t" op[k]
+                else if (mods[k] == name) {
+                    # 같은 섹션 라벨을 가리키는 4형식은 섹션 이름 M 레코드가 붙는다
+                    line = relabel(op[k])
+                    if (line == "") line = mid_label(op[k])
+                    body = (line == "") ? "" : mn[k] "\t" line
+                }
+            } else if (substr(bits[k], 4, 2) == "01") {
+                line = relabel(op[k])
+                if (line == "") {
+                    # --disasm은 D 레코드 이름과 같은 주소만 이름으로 쓴다
+                    line = op[k]
+                    sub(/^[#@]/, "", line); sub(/,X$/, "", line)
+                    line = (line in is_def) ? op[k] : ""
+                }
+                body = (line == "") ? "" : mn[k] "\t" line
+            } else if (substr(bits[k], 4, 2) == "00" && op[k] == "")
+                body = mn[k]
+            src[k] = (body == "") ? byte_line(k) : body
+        }
+        for (a in def_at) want[a] = 1
+        print name "\t" (first ? "START\t0" : "CSECT")
+        if (defs != "") print "\tEXTDEF\t" defs
+        if (refs != "") print "\tEXTREF\t" refs
+        k = 1; a = 0
+        while (a < sec_len || k <= n) {
+            if (a in def_at) print def_at[a]
+            if (k <= n && addr[k] == a) {
+                print new_label(a) "\t" src[k]
+                a += len[k]; k++
+            } else {
+                e = (k <= n) ? addr[k] : sec_len
+                for (g = a + 1; g < e && !(g in want); g++) ;
+                print new_label(a) "\tRESB\t" (g - a)
+                a = g
+            }
+        }
+        if (sec_len in def_at) print def_at[sec_len]
+        if ((sec_len in want) && !(sec_len in name_at)) print new_label(sec_len) "\tEQU\t*"
+        for (a in mid_at) print new_label(a) "\tEQU\t*-" sprintf("0%X", sec_len - a)
+        first = 0
+    }
+    BEGIN { first = 1 }
+    $2 == "START" {
+        name = $1; sec_len = hex($5); n = 0; defs = ""; refs = ""
+        split("", is_start); split("", in_gap); split("", want); split("", def_at); split("", name_at)
+        split("", is_def)
+        split("", src); split("", mods); split("", mid_at)
+        next
+    }
+    $1 == "EXTDEF" {
+        m = split($2, list, ",")
+        for (k = 1; k <= m; k++) {
+            split(list[k], kv, "=")
+            defs = defs (defs == "" ? "" : ",") kv[1]
+            is_def[kv[1]] = 1
+            a = hex(kv[2])
+            line = kv[1] "\tEQU\t*"
+            if (a in def_at) line = def_at[a] "\n" line
+            def_at[a] = line
+            if (!(a in name_at)) name_at[a] = kv[1]
+        }
+        next
+    }
+    $1 == "EXTREF" { refs = $2; next }
+    $1 == "END" { flush(); next }
+    $1 ~ /^[0-9A-F][0-9A-F][0-9A-F][0-9A-F][0-9A-F][0-9A-F]$/ {
+        n++
+        addr[n] = hex($1); obj[n] = $2; len[n] = length($2) / 2; mn[n] = $3
+        op[n] = ""; bits[n] = ""; mods[n] = ""
+        f = 4
+        if (f <= NF && $f !~ /^nixbpe=/ && $f != "[M") { op[n] = $f; f++ }
+        if (f <= NF && $f ~ /^nixbpe=/) { bits[n] = substr($f, 8); f++ }
+        for (; f + 2 <= NF; f += 3) {
+            sym = $(f + 2); sub(/\]$/, "", sym)
+            if (sym ~ /^\+/ && mods[n] == "") sym = substr(sym, 2)
+            mods[n] = mods[n] sym
+        }
+        next
+    }
+    END { print "\tEND" }
+    '
+}
+
+status=0
+for src in "$@"; do
+    base=$(basename "$src" | sed 's/\.[^.]*$//')
+    ./asm -i "$src" -o "$base.obj" --symtab "$base.sym" --littab "$base.lit" --listing "$base.lst" >/dev/null
+    ./asm --disasm "$base.obj" -o "$base.dis"
+    dis2src < "$base.dis" > "$base.rt.asm"
+    ./asm -i "$base.rt.asm" -o "$base.rt.obj" --symtab "$base.rt.sym" --littab "$base.rt.lit" \
+        --listing "$base.rt.lst" >/dev/null
+    # 데이터를 명령어로 해석한 구간은 T 레코드 경계가 달라질 수 있으므로,
+    # 두 오브젝트 프로그램을 --convert로 바이너리를 거쳐 같은 모양으로 맞춘 뒤 비교한다
+    for obj in "$base.obj" "$base.rt.obj"; do
+        ./asm --convert "$obj" -o "$obj.bin" && ./asm --convert "$obj.bin" -o "$obj.canon"
+    done
+    if cmp -s "$base.obj.canon" "$base.rt.obj.canon"; then
+        echo "ok   $src"
+    else
+        echo "FAIL $src (diff $base.obj.canon $base.rt.obj.canon)"
+        diff "$base.obj.canon" "$base.rt.obj.canon" | head -10
+        status=1
+    fi
+done
+exit $status